@@ -1,15 +1,15 @@
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include <SDL/SDL.h>
 
 #include <upng.h>
 
-#ifndef MIN
-  #define MIN(a, b) (((a) < (b)) ? (a) : (b))
-#endif
-
 // Non-public but extremely useful stretch
 // Both buffers must be same color depth
 extern int SDL_SoftStretch(SDL_Surface *src, SDL_Rect *srcrect,
@@ -22,10 +22,17 @@ extern int SDL_SoftStretch(SDL_Surface *src, SDL_Rect *srcrect,
 
 SDL_Surface *sdl_surface; // 32-bit sdl window surface
 SDL_Surface *cpy_surface; // 32-bit surface for converting/scaling
-SDL_Surface *img_surface; // 8-bit surface
 
-// RGBA framebuffer 32-bit
-uint32_t screenbuffer[FRAMEBUFFER_WIDTH * FRAMEBUFFER_HEIGHT];
+// The compositor's canvas, and so every frame ring slot, holds R, G, B, A bytes
+#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+  #define SCREEN_RMASK 0xFF000000
+  #define SCREEN_GMASK 0x00FF0000
+  #define SCREEN_BMASK 0x0000FF00
+#else
+  #define SCREEN_RMASK 0x000000FF
+  #define SCREEN_GMASK 0x0000FF00
+  #define SCREEN_BMASK 0x00FF0000
+#endif
 
 void sdl_setup(void) {
   SDL_Init(SDL_INIT_VIDEO);// | SDL_INIT_EVENTTHREAD);
@@ -54,24 +61,50 @@ void sdl_setup(void) {
     FRAMEBUFFER_WIDTH, FRAMEBUFFER_HEIGHT, 
     sdl_bpp, //depth
     0, 0, 0, 0); 
+}
 
-  img_surface = SDL_CreateRGBSurfaceFrom( screenbuffer,
-    FRAMEBUFFER_WIDTH, FRAMEBUFFER_HEIGHT, 
-    32, //depth
-    FRAMEBUFFER_WIDTH * 4, //row_stride in bytes
-    0, 0, 0, 0); 
+// Requests from the keyboard, handled by the main loop
+static bool paused = false;
+static int64_t seek_request = -1; // frame to show next, -1 for none
+static uint32_t seek_digits = 0;  // frame number typed so far
+static bool seek_typing = false;
+
+static void handle_key(SDLKey key, uint32_t current_frame) {
+  if (key >= SDLK_0 && key <= SDLK_9) {
+    // digits followed by return jump to that frame
+    seek_digits = seek_digits * 10 + (key - SDLK_0);
+    seek_typing = true;
+    return;
+  }
 
-  if (!img_surface) {
-    printf("SDL_CreateRGBSurface failed: %s\n", SDL_GetError());
-    exit(EXIT_FAILURE);
+  switch (key) {
+  case SDLK_RETURN:
+    if (seek_typing) {
+      seek_request = seek_digits;
+      paused = true;
+    }
+    break;
+  case SDLK_SPACE:
+    paused = !paused;
+    break;
+  case SDLK_LEFT:
+    if (current_frame > 0) {
+      seek_request = current_frame - 1;
+    }
+    paused = true;
+    break;
+  case SDLK_RIGHT:
+    seek_request = current_frame + 1;
+    paused = true;
+    break;
+  default:
+    break;
   }
+  seek_digits = 0;
+  seek_typing = false;
 }
 
-void sdl_draw(void) {
-  SDL_BlitSurface(img_surface, NULL, cpy_surface, NULL);
-  SDL_SoftStretch(cpy_surface, 0, sdl_surface, 0);
-  SDL_Flip(sdl_surface);
-
+void sdl_poll_events(uint32_t current_frame) {
   SDL_Event event;
   while(SDL_PollEvent(&event)) {
     switch (event.type) {
@@ -85,13 +118,8 @@ void sdl_draw(void) {
         SDL_Quit();
         exit(EXIT_SUCCESS);
       }
-      case SDLK_LEFT: {
-        break;
-      }
-      case SDLK_RIGHT: {
-        break;
-      }
       default:
+        handle_key(event.key.keysym.sym, current_frame);
         break;
       }
       break;
@@ -102,6 +130,18 @@ void sdl_draw(void) {
   }
 }
 
+// Converts a frame into cpy_surface; the frame may be reused as soon as this returns
+void sdl_convert(SDL_Surface *frame) {
+  SDL_BlitSurface(frame, NULL, cpy_surface, NULL);
+}
+
+// Scales the frame sdl_convert put in cpy_surface to the window and shows it
+void sdl_draw(uint32_t current_frame) {
+  SDL_SoftStretch(cpy_surface, 0, sdl_surface, 0);
+  SDL_Flip(sdl_surface);
+  sdl_poll_events(current_frame);
+}
+
 static void color_demo(uint8_t *buffer) {
   static uint8_t color = 0xc0;
   color = 0x3 | ((color >> 2) + 1) << 2;
@@ -124,6 +164,343 @@ static size_t file_to_buffer(char *filename, char **output_buffer) {
   return bytes_read;
 }
 
+// Memory the keyframe snapshots may use; the keyframe interval follows from it
+#define KEYFRAME_BUDGET_BYTES (4 * 1024 * 1024)
+
+// The compositor after compositing a frame, so seeking can restart from there
+typedef struct keyframe {
+  bool valid;
+  void *snapshot;
+} keyframe;
+
+static upng_t *upng;
+static uint32_t width;
+static uint32_t height;
+
+// The decode thread composites into the compositor's canvas, the screen only gets 
+// finished frames
+static apng_compositor *compositor;
+static uint32_t current_frame; // frame on the canvas
+
+static keyframe *keyframes;
+static uint32_t keyframe_interval; // every keyframe_interval-th frame is kept
+static uint32_t num_keyframes;
+
+// A second decoder and compositor run through the animation once on the decode 
+// thread, whenever it has nothing else to do, and store every keyframe; NULL once
+// they reached the end
+static upng_t *keyframe_upng;
+static apng_compositor *keyframe_compositor;
+
+// Picks the keyframe interval so that all keyframes fit in the budget; a
+// seek then decodes fewer than keyframe_interval frames
+static void keyframes_setup(uint32_t frame_count) {
+  size_t keyframe_bytes = apng_compositor_snapshot_size(compositor);
+  uint32_t max_keyframes = KEYFRAME_BUDGET_BYTES / keyframe_bytes;
+  if (max_keyframes == 0) {
+    max_keyframes = 1;
+  }
+
+  keyframe_interval = (frame_count + max_keyframes - 1) / max_keyframes;
+  if (keyframe_interval == 0) {
+    keyframe_interval = 1;
+  }
+  num_keyframes = (frame_count + keyframe_interval - 1) / keyframe_interval;
+  keyframes = (keyframe*)calloc(num_keyframes, sizeof(keyframe));
+  printf("%u frames, keyframe every %u\n", frame_count, keyframe_interval);
+}
+
+static void keyframe_store(keyframe *key, const apng_compositor *from) {
+  if (key->snapshot == NULL) {
+    key->snapshot = malloc(apng_compositor_snapshot_size(from));
+  }
+  apng_compositor_save(from, key->snapshot);
+  key->valid = true;
+}
+
+// Starts filling the keyframe table from a decoder of its own; without one seeks
+// start from whatever keyframes playback stored
+static void keyframes_fill_start(char *png_buffer, size_t png_buffer_size) {
+  keyframe_upng = upng_new_from_bytes((uint8_t*)png_buffer, png_buffer_size);
+  if (keyframe_upng != NULL && upng_load(keyframe_upng) == UPNG_EOK) {
+    keyframe_compositor = apng_compositor_new(keyframe_upng);
+  }
+  if (keyframe_compositor == NULL && keyframe_upng != NULL) {
+    upng_free(keyframe_upng);
+    keyframe_upng = NULL;
+  }
+}
+
+// Composites one more frame of the keyframe decoder and stores it if it is a
+// keyframe; false once the table is complete
+static bool keyframes_fill_step(void) {
+  if (keyframe_compositor == NULL) {
+    return false;
+  }
+
+  if (apng_compositor_decode_frame(keyframe_compositor, keyframe_upng) == UPNG_EOK) {
+    uint32_t frame = apng_compositor_get_frame(keyframe_compositor);
+    if (frame % keyframe_interval == 0 && !keyframes[frame / keyframe_interval].valid) {
+      keyframe_store(&keyframes[frame / keyframe_interval], keyframe_compositor);
+    }
+    if (frame + 1 < upng_get_frame_count(keyframe_upng)) {
+      return true;
+    }
+  }
+
+  // the last frame, or one that does not decode: seeks go no further than that
+  apng_compositor_free(keyframe_compositor);
+  upng_free(keyframe_upng);
+  keyframe_compositor = NULL;
+  keyframe_upng = NULL;
+  printf("keyframes complete\n");
+  return false;
+}
+
+static void keyframe_restore(const keyframe *key) {
+  apng_compositor_restore(compositor, key->snapshot);
+}
+
+// Decodes the next frame and composites it onto the canvas. The previous frame is
+// disposed of first, the new one is blended band by band while it is decoded
+static bool composite_next_frame(void) {
+  if (apng_compositor_decode_frame(compositor, upng) != UPNG_EOK) {
+    return false;
+  }
+
+  uint32_t frame = apng_compositor_get_frame(compositor);
+  current_frame = frame;
+  if (frame % keyframe_interval == 0 && !keyframes[frame / keyframe_interval].valid) {
+    keyframe_store(&keyframes[frame / keyframe_interval], compositor);
+  }
+  return true;
+}
+
+// Puts frame target on the canvas, starting from the closest keyframe at or
+// before it, or from the canvas itself when that is closer. A keyframe the table 
+// does not have yet is filled in first, so at most keyframe_interval - 1 frames
+// are composited after it
+static void seek_to_frame(uint32_t target) {
+  uint32_t frame_count = upng_get_frame_count(upng);
+  if (target >= frame_count) {
+    target = frame_count - 1;
+  }
+
+  uint32_t key = target / keyframe_interval;
+  while (!keyframes[key].valid && keyframes_fill_step()) {
+  }
+  while (key > 0 && !keyframes[key].valid) {
+    key--;
+  }
+  if (!keyframes[key].valid) {
+    return; // the initial image never decoded
+  }
+
+  uint32_t key_frame = key * keyframe_interval;
+  if (current_frame > target || current_frame < key_frame) {
+    keyframe_restore(&keyframes[key]);
+    current_frame = key_frame;
+  }
+
+  upng_seek_frame(upng, current_frame + 1);
+  while (current_frame < target) {
+    if (!composite_next_frame()) {
+      break;
+    }
+  }
+  printf("frame %u\n", current_frame);
+}
+
+// Number of composited frames the decode thread may work ahead
+#ifndef FRAME_RING_DEPTH
+  #define FRAME_RING_DEPTH 4
+#endif
+
+typedef struct frame_slot {
+  uint32_t *canvas;
+  SDL_Surface *surface; // over canvas, so a frame is blitted straight from its slot
+  uint32_t frame;
+  uint32_t generation; // seek the frame was composited for
+  uint64_t delay_ns;   // how long the frame stays on screen
+} frame_slot;
+
+// Lock-free ring between exactly one producer (the decode thread) and one
+// consumer (the display loop). head and tail only ever grow; each side
+// writes its own index and reads the other's
+typedef struct frame_ring {
+  frame_slot *slots;
+  uint32_t depth;
+  uint32_t head; // next slot the producer fills
+  uint32_t tail; // next slot the consumer takes
+} frame_ring;
+
+static void frame_ring_init(frame_ring *ring, uint32_t depth, uint32_t width, uint32_t height) {
+  ring->slots = (frame_slot*)calloc(depth, sizeof(frame_slot));
+  for (uint32_t i = 0; i < depth; i++) {
+    frame_slot *slot = &ring->slots[i];
+    slot->canvas = (uint32_t*)malloc(width * height * 4);
+    slot->surface = SDL_CreateRGBSurfaceFrom(slot->canvas,
+      width, height,
+      32, //depth
+      width * 4, //row_stride in bytes
+      SCREEN_RMASK, SCREEN_GMASK, SCREEN_BMASK, 0);
+
+    if (!slot->surface) {
+      printf("SDL_CreateRGBSurface failed: %s\n", SDL_GetError());
+      exit(EXIT_FAILURE);
+    }
+  }
+  ring->depth = depth;
+  ring->head = 0;
+  ring->tail = 0;
+}
+
+// Producer: the slot to fill next, NULL while the ring is full
+static frame_slot *frame_ring_acquire(frame_ring *ring) {
+  uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+  if (ring->head - tail == ring->depth) {
+    return NULL;
+  }
+  return &ring->slots[ring->head % ring->depth];
+}
+
+static void frame_ring_publish(frame_ring *ring) {
+  __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+// Consumer: the oldest filled slot, NULL while the ring is empty
+static frame_slot *frame_ring_peek(frame_ring *ring) {
+  uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  if (head == ring->tail) {
+    return NULL;
+  }
+  return &ring->slots[ring->tail % ring->depth];
+}
+
+// Consumer: number of filled slots
+static uint32_t frame_ring_count(frame_ring *ring) {
+  return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - ring->tail;
+}
+
+static void frame_ring_release(frame_ring *ring) {
+  __atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+}
+
+static frame_ring ring;
+
+// Seeks go from the display loop to the decode thread: seek_target is
+// written before seek_generation is bumped
+static uint32_t seek_target;
+static uint32_t seek_generation;
+
+static uint64_t frame_delay_ns(uint32_t frame) {
+  apng_fctl fctl;
+  if (!upng_get_frame_fctl(upng, frame, &fctl)) {
+    return 0;
+  }
+  // a denominator of 0 means hundredths of a second
+  uint32_t delay_den = fctl.delay_den != 0 ? fctl.delay_den : 100;
+  return (uint64_t)fctl.delay_num * 1000000000ull / delay_den;
+}
+
+// Decodes and composites ahead of the display, as far as the ring allows, and 
+// fills the keyframe table while it waits
+static int decode_thread(void *unused) {
+  uint32_t generation = 0;
+  bool pending = false; // canvas holds a frame not yet in the ring
+
+  (void)unused;
+  while (1) {
+    uint32_t request = __atomic_load_n(&seek_generation, __ATOMIC_ACQUIRE);
+    if (request != generation) {
+      generation = request;
+      seek_to_frame(__atomic_load_n(&seek_target, __ATOMIC_RELAXED));
+      pending = true;
+    }
+
+    if (!pending) {
+      if (current_frame + 1 >= upng_get_frame_count(upng) || !composite_next_frame()) {
+        if (!keyframes_fill_step()) {
+          SDL_Delay(10); // end of the animation, wait for a seek
+        }
+        continue;
+      }
+
+      apng_fctl fctl;
+      upng_get_apng_fctl(upng, &fctl);
+      printf("fctl seq:%d dispose:%s blend:%s\n", 
+          fctl.sequence_number,
+          (fctl.dispose_op == APNG_DISPOSE_OP_PREVIOUS) ? "PREVIOUS" : 
+          ((fctl.dispose_op == APNG_DISPOSE_OP_BACKGROUND) ? "BACKGROUND" : "NONE"),
+          (fctl.blend_op == APNG_BLEND_OP_SOURCE) ? "SOURCE" : "OVER");
+      pending = true;
+    }
+
+    frame_slot *slot = frame_ring_acquire(&ring);
+    if (slot == NULL) {
+      if (!keyframes_fill_step()) {
+        SDL_Delay(1);
+      }
+      continue;
+    }
+
+    memcpy(slot->canvas, apng_compositor_get_canvas(compositor), width * height * 4);
+    slot->frame = current_frame;
+    slot->generation = generation;
+    slot->delay_ns = frame_delay_ns(current_frame);
+    frame_ring_publish(&ring);
+    pending = false;
+  }
+  return 0;
+}
+
+static uint64_t clock_now_ns(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+static void sleep_until_ns(uint64_t deadline) {
+  struct timespec until;
+  until.tv_sec = deadline / 1000000000ull;
+  until.tv_nsec = deadline % 1000000000ull;
+  // clock_nanosleep returns the error instead of setting errno; only a signal
+  // is worth sleeping again for
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) == EINTR) {
+  }
+}
+
+// Longest the display sleeps before looking at the keyboard again
+#define EVENT_POLL_NS 10000000ull
+// Behind by more than this, playback restarts its timeline instead of
+// dropping frames to catch up
+#define RESYNC_LATENESS_NS 500000000ull
+// Lateness that counts as a late frame in the statistics
+#define LATE_THRESHOLD_NS 2000000ull
+// Presented frames between statistics reports
+#define STATS_INTERVAL 100
+
+// How far presentation trails the deadlines of the fcTL delays
+typedef struct playback_stats {
+  uint32_t presented;
+  uint32_t dropped;  // composited but never shown, their successor was already due
+  uint32_t late;     // shown more than LATE_THRESHOLD_NS after their deadline
+  uint32_t resyncs;
+  uint64_t lateness_sum_ns;
+  uint64_t lateness_max_ns;
+} playback_stats;
+
+static void playback_stats_report(playback_stats *stats) {
+  if (stats->presented == 0) {
+    return;
+  }
+  printf("presented %u dropped %u late %u resyncs %u, lateness mean %.2fms max %.2fms\n",
+      stats->presented, stats->dropped, stats->late, stats->resyncs,
+      stats->lateness_sum_ns / 1e6 / stats->presented, stats->lateness_max_ns / 1e6);
+  fflush(stdout);
+  memset(stats, 0, sizeof(*stats));
+}
+
 int main(int argc, char* argv[]){
   sdl_setup();
  
@@ -131,128 +508,121 @@ int main(int argc, char* argv[]){
   size_t png_buffer_size = 0;
   png_buffer_size = file_to_buffer("images/sequence.png", &png_buffer);
 
-  upng_t* upng = upng_new_from_bytes(png_buffer, png_buffer_size);
+  upng = upng_new_from_bytes(png_buffer, png_buffer_size);
+
+  // the frames after the one being composited are decoded on every core; a build
+  // of upng without threads keeps decoding them on the decode thread
+  upng_set_decode_threads(upng, sysconf(_SC_NPROCESSORS_ONLN));
+  // without threads for whole frames (a single core), inflate and unfilter of
+  // a frame still overlap its compositing
+  upng_set_decode_pipeline(upng, true);
   
   upng_load(upng);
 
-  uint32_t width = upng_get_width(upng);
-  uint32_t height = upng_get_height(upng);
-
-  //rgb palette
-  rgb *palette = NULL;
-  int palette_entries = upng_get_palette(upng, &palette);
-
-  uint8_t *alpha_palette = NULL;
-  int alpha_palette_entries = upng_get_alpha_palette(upng, &alpha_palette);
-
-  typedef union rgba32 {
-    uint32_t rgba;
-    struct {
-      unsigned char b;
-      unsigned char g;
-      unsigned char r;
-      unsigned char a;
-    };
-  } rgba32;
-
-  rgba32 *rgba_palette = (rgba32*)malloc(palette_entries * sizeof(rgba32));
-  for (int i = 0; i < palette_entries; i++) {
-    rgba_palette[i].r = palette[i].r;
-    rgba_palette[i].g = palette[i].g;
-    rgba_palette[i].b = palette[i].b;
-    rgba_palette[i].a = (i < alpha_palette_entries) ? alpha_palette[i] : 0xFF;
-  }
-
-  upng_decode_image(upng); //decode the initial image
+  width = upng_get_width(upng);
+  height = upng_get_height(upng);
 
-  const char* raw_buffer = upng_get_buffer(upng);
-  for (int i = 0; i < width * height; i++) {
-    uint8_t palette_index = ((uint8_t*)raw_buffer)[i];
-    // Looks like ARGB on this
-    screenbuffer[i] = rgba_palette[palette_index].rgba;
+  // the canvas and dispose areas are allocated once, here
+  compositor = apng_compositor_new(upng);
+  if (compositor == NULL) {
+    printf("apng_compositor_new failed\n");
+    exit(EXIT_FAILURE);
   }
-  sdl_draw();
-
-  apng_dispose_ops last_dispose_op = APNG_DISPOSE_OP_BACKGROUND;
-  uint32_t *buffer_previous = NULL;
-  uint32_t previous_xoffset = 0;
-  uint32_t previous_yoffset = 0;
-  uint32_t previous_width = 0;
-  uint32_t previous_height = 0;
 
+  keyframes_setup(upng_get_frame_count(upng));
+  keyframes_fill_start(png_buffer, png_buffer_size);
+  frame_ring_init(&ring, FRAME_RING_DEPTH, width, height);
+
+  // the decode thread owns upng from here on
+  composite_next_frame(); //decode the initial image
+  seek_target = 0;
+  seek_generation = 1;
+  SDL_CreateThread(decode_thread, NULL);
+
+  uint32_t generation = 1;
+  uint32_t shown_frame = 0;
+  uint32_t last_frame = upng_get_frame_count(upng) - 1;
+  uint64_t deadline = 0; // when the oldest slot is due, on the monotonic clock
+  bool show_next = true; // present the next frame right away, starting a new timeline
+  bool was_paused = false;
+  playback_stats stats;
+  memset(&stats, 0, sizeof(stats));
 
   while (1) {
-    upng_error error = upng_decode_image(upng); //decode the next image
-    if (error != UPNG_EOK) {
-      SDL_Delay(100);
-      sdl_draw();
+    if (seek_request >= 0) {
+      __atomic_store_n(&seek_target, (uint32_t)seek_request, __ATOMIC_RELAXED);
+      generation++;
+      __atomic_store_n(&seek_generation, generation, __ATOMIC_RELEASE);
+      seek_request = -1;
+      show_next = true;
+    }
+    if (was_paused && !paused) {
+      show_next = true;
+    }
+    was_paused = paused;
+
+    frame_slot *slot = frame_ring_peek(&ring);
+    if (slot != NULL && slot->generation != generation) {
+      frame_ring_release(&ring); // composited before the last seek
       continue;
     }
 
-    apng_fctl fctl;
-    upng_get_apng_fctl(upng, &fctl);
-    raw_buffer = upng_get_buffer(upng);
-    SDL_Delay((fctl.delay_num * 1000) / fctl.delay_den);
-
-    printf("fctl seq:%d dispose:%s blend:%s\n", 
-        fctl.sequence_number,
-        (fctl.dispose_op == APNG_DISPOSE_OP_PREVIOUS) ? "PREVIOUS" : 
-        ((fctl.dispose_op == APNG_DISPOSE_OP_BACKGROUND) ? "BACKGROUND" : "NONE"),
-        (fctl.blend_op == APNG_BLEND_OP_SOURCE) ? "SOURCE" : "OVER");
-
-    if (last_dispose_op == APNG_DISPOSE_OP_PREVIOUS) {
-      //copy row by row
-      for (int y = 0; y < previous_height; y++) {
-        memcpy(&screenbuffer[(previous_yoffset + y) * width + previous_xoffset], 
-            &buffer_previous[y * previous_width], 
-            previous_width * sizeof(rgba32));
-      }
-    } else if (last_dispose_op == APNG_DISPOSE_OP_BACKGROUND) {
-      for (int y = 0; y < previous_height; y++) {
-        memset(&screenbuffer[(previous_yoffset + y) * width + previous_xoffset], 
-            0, previous_width * sizeof(rgba32));
+    uint64_t now = clock_now_ns();
+    if (slot == NULL || (!show_next && (paused || now < deadline))) {
+      // nothing due: sleep up to the deadline, or a little while the decoder catches up
+      uint64_t wake = now + EVENT_POLL_NS;
+      if (slot == NULL) {
+        wake = now + EVENT_POLL_NS / 10;
+      } else if (!paused && deadline < wake) {
+        wake = deadline;
       }
+      sleep_until_ns(wake);
+      sdl_poll_events(shown_frame);
+      continue;
     }
 
-    previous_xoffset = fctl.x_offset;
-    previous_yoffset = fctl.y_offset;
-    previous_width = fctl.width;
-    previous_height = fctl.height;
-
-    if (fctl.dispose_op == APNG_DISPOSE_OP_PREVIOUS) {
-      if (buffer_previous) {
-        free(buffer_previous);
-        buffer_previous = NULL;
+    if (show_next) {
+      deadline = now;
+      show_next = false;
+    } else {
+      // a late frame whose successor is also due already is dropped, the decode
+      // thread composited it so nothing after it changes
+      uint64_t next_deadline = deadline + slot->delay_ns;
+      if (now >= next_deadline && frame_ring_count(&ring) > 1) {
+        stats.dropped++;
+        deadline = next_deadline;
+        frame_ring_release(&ring);
+        continue;
       }
-      buffer_previous = malloc(previous_width * previous_height * sizeof(rgba32));
-      //copy row by row
-      for (int y = 0; y < previous_height; y++) {
-        memcpy(&buffer_previous[y * previous_width], 
-            &screenbuffer[(previous_yoffset + y) * width + previous_xoffset], 
-            previous_width * sizeof(rgba32));
-      }
-    } 
-    
-    for (int y = 0; y < fctl.height; y++) {
-      for (int x = 0; x < fctl.width; x++) {
-        uint8_t palette_index = ((uint8_t*)raw_buffer)[y * fctl.width + x];
-
-        if (fctl.blend_op == APNG_BLEND_OP_OVER) {
-          rgba32 src = rgba_palette[palette_index];
-          rgba32 *dst = (rgba32*)&screenbuffer[(fctl.y_offset + y) * width + (fctl.x_offset + x)];
-          dst->r = MIN(0xFF, (src.r * (src.a / 255) + (dst->r * ((255 - src.a) / 255))));
-          dst->g = MIN(0xFF, (src.g * (src.a / 255) + (dst->g * ((255 - src.a) / 255))));
-          dst->b = MIN(0xFF, (src.b * (src.a / 255) + (dst->b * ((255 - src.a) / 255))));
-        } else {
-          screenbuffer[(fctl.y_offset + y) * width + (fctl.x_offset + x)] = rgba_palette[palette_index].rgba;
-        }
+
+      if (now - deadline > RESYNC_LATENESS_NS) {
+        stats.resyncs++;
+        deadline = now;
       }
     }
 
-    last_dispose_op = fctl.dispose_op;
+    uint64_t lateness = now - deadline;
+    stats.presented++;
+    stats.lateness_sum_ns += lateness;
+    if (lateness > stats.lateness_max_ns) {
+      stats.lateness_max_ns = lateness;
+    }
+    if (lateness > LATE_THRESHOLD_NS) {
+      stats.late++;
+    }
+
+    // the decode thread may refill the slot once it is released
+    sdl_convert(slot->surface);
+    shown_frame = slot->frame;
+    deadline += slot->delay_ns;
+    frame_ring_release(&ring);
 
-    //color_demo(screenbuffer);
-    sdl_draw();
+    //color_demo((uint8_t *)cpy_surface->pixels);
+    sdl_draw(shown_frame);
+
+    if (stats.presented == STATS_INTERVAL || shown_frame == last_frame) {
+      playback_stats_report(&stats);
+    }
   }
 
   return 0;
@@ -0,0 +1,71 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <upng.h>
+
+// Decodes every PNG given on the command line and reports the throughput
+// usage: png_batch [-j threads] [-q] file.png...
+
+typedef struct batch_report {
+  char **paths;
+  int quiet;
+} batch_report;
+
+static void decoded(void *user, uint32_t index, upng_t *upng, upng_error error) {
+  batch_report *report = (batch_report*)user;
+  if (error != UPNG_EOK) {
+    // decoder threads print concurrently, one line each
+    printf("%s: error %d line %u\n", report->paths[index], error, 
+        upng != NULL ? upng_get_error_line(upng) : 0);
+  } else if (!report->quiet) {
+    printf("%s: %ux%u format %d, %u frames\n", report->paths[index], 
+        upng_get_width(upng), upng_get_height(upng), upng_get_format(upng), 
+        upng_get_frame_count(upng));
+  }
+}
+
+int main(int argc, char* argv[]){
+  uint32_t threads = 0; // one per core
+  batch_report report = { NULL, 0 };
+  int first = 1;
+
+  for (; first < argc && argv[first][0] == '-'; first++) {
+    if (strcmp(argv[first], "-j") == 0 && first + 1 < argc) {
+      threads = atoi(argv[++first]);
+    } else if (strcmp(argv[first], "-q") == 0) {
+      report.quiet = 1;
+    } else {
+      break;
+    }
+  }
+  if (first >= argc) {
+    printf("usage: %s [-j threads] [-q] file.png...\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  uint32_t count = argc - first;
+  upng_batch_input *inputs = (upng_batch_input*)calloc(count, sizeof(upng_batch_input));
+  for (uint32_t i = 0; i < count; i++) {
+    inputs[i].path = argv[first + i];
+  }
+  report.paths = argv + first;
+
+  upng_batch_stats stats;
+  if (upng_decode_batch(inputs, count, threads, decoded, &report, &stats) != UPNG_EOK) {
+    printf("batch failed\n");
+    return EXIT_FAILURE;
+  }
+
+  printf("%u images, %u failed, %u threads, %u steals in %.3fs\n", 
+      stats.images, stats.failed, stats.threads, stats.steals, stats.seconds);
+  if (stats.seconds > 0) {
+    printf("%.0f images/s, %.1f MB/s in, %.1f MB/s out\n", 
+        (stats.images + stats.failed) / stats.seconds, 
+        stats.input_bytes / 1e6 / stats.seconds, stats.output_bytes / 1e6 / stats.seconds);
+  }
+
+  free(inputs);
+  return stats.failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -20,9 +20,12 @@ SDL_Surface *sdl_surface; // 32-bit sdl window surface
 SDL_Surface *cpy_surface; // 32-bit surface for converting/scaling
 SDL_Surface *img_surface; // 8-bit surface
 
-// RGBA framebuffer 32-bit
+// ARGB framebuffer 32-bit, for when cpy_surface has a layout upng can not write
 uint32_t screenbuffer[FRAMEBUFFER_WIDTH * FRAMEBUFFER_HEIGHT];
 
+// the image is decoded straight into cpy_surface, no blit from img_surface
+bool decode_to_surface = false;
+
 void sdl_setup(void) {
   SDL_Init(SDL_INIT_VIDEO);// | SDL_INIT_EVENTTHREAD);
 
@@ -79,8 +82,35 @@ void sdl_setup(void) {
   */
 }
 
+// the upng pixel format with cpy_surface's layout, false if there is none
+static bool surface_pixel_format(const SDL_Surface *surface, upng_pixel_format *format) {
+  const SDL_PixelFormat *fmt = surface->format;
+
+  if (fmt->BitsPerPixel == 32 && fmt->Rmask == 0x00FF0000 && fmt->Gmask == 0x0000FF00 
+      && fmt->Bmask == 0x000000FF) {
+    *format = UPNG_PIXEL_ARGB8888;
+  } else if (fmt->BitsPerPixel == 32 && fmt->Rmask == 0x000000FF && fmt->Gmask == 0x0000FF00 
+      && fmt->Bmask == 0x00FF0000) {
+    *format = UPNG_PIXEL_ABGR8888;
+  } else if (fmt->BitsPerPixel == 16 && fmt->Rmask == 0xF800 && fmt->Gmask == 0x07E0 
+      && fmt->Bmask == 0x001F) {
+    *format = UPNG_PIXEL_RGB565;
+#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+  } else if (fmt->BitsPerPixel == 24 && fmt->Rmask == 0xFF0000 && fmt->Bmask == 0x0000FF) {
+#else
+  } else if (fmt->BitsPerPixel == 24 && fmt->Rmask == 0x0000FF && fmt->Bmask == 0xFF0000) {
+#endif
+    *format = UPNG_PIXEL_RGB888;
+  } else {
+    return false;
+  }
+  return true;
+}
+
 void sdl_draw(void) {
-  SDL_BlitSurface(img_surface, NULL, cpy_surface, NULL);
+  if (!decode_to_surface) {
+    SDL_BlitSurface(img_surface, NULL, cpy_surface, NULL);
+  }
   SDL_SoftStretch(cpy_surface, 0, sdl_surface, 0);
   SDL_Flip(sdl_surface);
 }
@@ -149,41 +179,26 @@ int main(int argc, char* argv[]){
 
   upng_load(upng);
 
-  uint32_t width = upng_get_width(upng);
-  uint32_t height = upng_get_height(upng);
-
-  //rgb palette
-  rgb *palette = NULL;
-  int palette_entries = upng_get_palette(upng, &palette);
-
-  uint8_t *alpha_palette = NULL;
-  int alpha_palette_entries = upng_get_alpha_palette(upng, &alpha_palette);
-
-  typedef union rgba32 {
-    uint32_t rgba;
-    struct {
-      unsigned char b;
-      unsigned char g;
-      unsigned char r;
-      unsigned char a;
-    };
-  } rgba32;
-
-  rgba32 *rgba_palette = (rgba32*)malloc(palette_entries * sizeof(rgba32));
-  for (int i = 0; i < palette_entries; i++) {
-    rgba_palette[i].r = palette[i].r;
-    rgba_palette[i].g = palette[i].g;
-    rgba_palette[i].b = palette[i].b;
-    rgba_palette[i].a = (i < alpha_palette_entries) ? alpha_palette[i] : 0xFF;
+  //upng converts every scanline as it is decoded, straight into the surface SDL
+  //stretches from when it can, else into screenbuffer for SDL to convert
+  upng_pixel_format format;
+  decode_to_surface = surface_pixel_format(cpy_surface, &format);
+  if (decode_to_surface) {
+    SDL_LockSurface(cpy_surface);
+    upng_set_output_pixels(upng, cpy_surface->pixels, cpy_surface->pitch, 
+      cpy_surface->pitch * FRAMEBUFFER_HEIGHT, format, false);
+  } else {
+    upng_set_output_pixels(upng, screenbuffer, FRAMEBUFFER_WIDTH * 4, 
+      sizeof(screenbuffer), UPNG_PIXEL_ARGB8888, false);
   }
 
-  upng_decode_image(upng); //decode the initial image
-
-  const char* raw_buffer = upng_get_buffer(upng);
-  for (int i = 0; i < width * height; i++) {
-    uint8_t palette_index = ((uint8_t*)raw_buffer)[i];
-    // Looks like ARGB on this
-    screenbuffer[i] = rgba_palette[palette_index].rgba;
+  upng_error error = upng_decode_image(upng); //decode the initial image
+  if (decode_to_surface) {
+    SDL_UnlockSurface(cpy_surface);
+  }
+  if (error != UPNG_EOK) {
+    printf("upng_decode_image failed: %d\n", error);
+    exit(EXIT_FAILURE);
   }
   sdl_draw();
 
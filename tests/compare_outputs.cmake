@@ -0,0 +1,20 @@
+# runs FIRST and SECOND on the .png files in DATA and its subdirectories and fails unless both succeed and
+# print the same; their output is kept in OUTPUT_DIR for a look at the difference
+# usage: cmake -DFIRST=program -DSECOND=program -DDATA=dir -DOUTPUT_DIR=dir -P compare_outputs.cmake
+
+file(GLOB_RECURSE samples ${DATA}/*.png)
+
+foreach(program FIRST SECOND)
+  get_filename_component(name ${${program}} NAME_WE)
+  execute_process(COMMAND ${${program}} ${samples}
+    OUTPUT_VARIABLE ${program}_output
+    RESULT_VARIABLE result)
+  file(WRITE ${OUTPUT_DIR}/${name}.txt "${${program}_output}")
+  if(NOT result EQUAL 0)
+    message(FATAL_ERROR "${name} failed: ${result}")
+  endif()
+endforeach()
+
+if(NOT FIRST_output STREQUAL SECOND_output)
+  message(FATAL_ERROR "the outputs differ, see ${OUTPUT_DIR}")
+endif()
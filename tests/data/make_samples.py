@@ -0,0 +1,515 @@
+#!/usr/bin/env python3
+# Writes the PNG and APNG samples the upng tests and benchmarks run on into the
+# directory of this script. The output is checked in; rerun this only to change
+# the set. Python's zlib produces every kind of deflate block (stored, fixed and
+# dynamic Huffman), image data is split over chunks of various sizes and every
+# filter type is used. The streams in deflate/ are written bit by bit instead, to
+# hold codes and blocks zlib never writes, and streams broken in one place only.
+
+import os
+import random
+import struct
+import zlib
+
+OUT = os.path.dirname(os.path.abspath(__file__))
+CHANNELS = {0: 1, 2: 3, 3: 1, 4: 2, 6: 4}
+
+
+def chunk(kind, data):
+    body = kind + data
+    return struct.pack('>I', len(data)) + body + struct.pack('>I', zlib.crc32(body) & 0xffffffff)
+
+
+def ihdr(width, height, depth, color_type):
+    return chunk(b'IHDR', struct.pack('>IIBBBBB', width, height, depth, color_type, 0, 0, 0))
+
+
+def paeth(a, b, c):
+    p = a + b - c
+    pa, pb, pc = abs(p - a), abs(p - b), abs(p - c)
+    if pa <= pb and pa <= pc:
+        return a
+    return b if pb <= pc else c
+
+
+def filter_rows(rows, bytewidth, filters):
+    """prefixes every row with a filter type from filters (None for random ones)"""
+    out = bytearray()
+    prev = bytes(len(rows[0])) if rows else b''
+    for y, row in enumerate(rows):
+        kind = random.randrange(5) if filters is None else filters[y % len(filters)]
+        out.append(kind)
+        for i, x in enumerate(row):
+            a = row[i - bytewidth] if i >= bytewidth else 0
+            b = prev[i]
+            c = prev[i - bytewidth] if i >= bytewidth else 0
+            predictor = (0, a, b, (a + b) >> 1, paeth(a, b, c))[kind]
+            out.append((x - predictor) & 255)
+        prev = row
+    return bytes(out)
+
+
+def make_rows(width, height, bits, kind):
+    """rows of width pixels of bits each: random, flat, smooth or noisy content"""
+    row_bytes = (width * bits + 7) // 8
+    rows = []
+    for y in range(height):
+        if kind == 'random':
+            row = bytes(random.randrange(256) for _ in range(row_bytes))
+        elif kind == 'flat':
+            row = bytes([0x5a] * row_bytes)
+        elif kind == 'repeat':
+            period = bytes(random.randrange(256) for _ in range(random.randrange(1, 24)))
+            row = (period * (row_bytes // len(period) + 1))[:row_bytes]
+        else:
+            noise = 3 if kind == 'noisy' else 0
+            row = bytes(((x * 3 + y * 5) // 7 + random.randrange(noise + 1)) & 255
+                        for x in range(row_bytes))
+        # the padding bits of the last byte are zero
+        if (width * bits) % 8:
+            row = row[:-1] + bytes([row[-1] & (0xff << (8 - (width * bits) % 8)) & 0xff])
+        rows.append(row)
+    return rows
+
+
+def compress(data, level=6, strategy=zlib.Z_DEFAULT_STRATEGY, mem_level=9):
+    stream = zlib.compressobj(level, zlib.DEFLATED, 15, mem_level, strategy)
+    return stream.compress(data) + stream.flush()
+
+
+def split(data, size):
+    if size <= 0:
+        return [data]
+    return [data[i:i + size] for i in range(0, len(data), size)]
+
+
+def palette(entries, alpha_entries, binary_alpha=False):
+    colours = bytes(random.randrange(256) for _ in range(entries * 3))
+    out = chunk(b'PLTE', colours)
+    if alpha_entries:
+        alpha = bytes(random.choice((0, 255)) if binary_alpha else random.randrange(256)
+                      for _ in range(alpha_entries))
+        out += chunk(b'tRNS', alpha)
+    return out
+
+
+def write(name, data):
+    with open(os.path.join(OUT, name + '.png'), 'wb') as f:
+        f.write(data)
+
+
+def still(name, width, height, depth, color_type, kind, level=6,
+          strategy=zlib.Z_DEFAULT_STRATEGY, chunk_size=0, extra=b'', mem_level=9):
+    bits = depth * CHANNELS[color_type]
+    rows = make_rows(width, height, bits, kind)
+    data = compress(filter_rows(rows, max(1, bits // 8), None), level, strategy, mem_level)
+    png = b'\x89PNG\r\n\x1a\n' + ihdr(width, height, depth, color_type) + extra
+    for part in split(data, chunk_size):
+        png += chunk(b'IDAT', part)
+    write(name, png + chunk(b'IEND', b''))
+
+
+def rgba_rows(width, height, alphas):
+    """8-bit RGBA with alpha values taken from alphas"""
+    rows = []
+    for y in range(height):
+        row = bytearray()
+        for x in range(width):
+            row += bytes(random.randrange(256) for _ in range(3))
+            row.append(random.choice(alphas))
+        rows.append(bytes(row))
+    return rows
+
+
+def animation(name, width, height, depth, color_type, frames, extra=b'',
+              hidden_default=False, num_frames=None, rows_of=None):
+    """frames: (width, height, x, y, dispose_op, blend_op). With hidden_default the
+    IDAT image has no fcTL and is not part of the animation"""
+    bits = depth * CHANNELS[color_type]
+    bytewidth = max(1, bits // 8)
+    if rows_of is None:
+        rows_of = lambda w, h: make_rows(w, h, bits, random.choice(('random', 'smooth', 'noisy')))
+    count = len(frames) if num_frames is None else num_frames
+    png = b'\x89PNG\r\n\x1a\n' + ihdr(width, height, depth, color_type) + extra
+    png += chunk(b'acTL', struct.pack('>II', count, 0))
+    sequence = 0
+    if hidden_default:
+        data = compress(filter_rows(rows_of(width, height), bytewidth, None))
+        png += chunk(b'IDAT', data)
+    for index, (w, h, x, y, dispose_op, blend_op) in enumerate(frames):
+        png += chunk(b'fcTL', struct.pack('>IIIIIHHBB', sequence, w, h, x, y, 1, 10,
+                                          dispose_op, blend_op))
+        sequence += 1
+        data = compress(filter_rows(rows_of(w, h), bytewidth, None),
+                        random.choice((1, 6, 9)),
+                        random.choice((zlib.Z_DEFAULT_STRATEGY, zlib.Z_FIXED, zlib.Z_RLE)))
+        for part in split(data, random.choice((0, 64, 700))):
+            if index == 0 and not hidden_default:
+                png += chunk(b'IDAT', part)
+            else:
+                png += chunk(b'fdAT', struct.pack('>I', sequence) + part)
+                sequence += 1
+    write(name, png + chunk(b'IEND', b''))
+
+
+def every_op(width, height, count):
+    """frames going through every dispose_op and blend_op pair, the first one
+    APNG_DISPOSE_OP_PREVIOUS, at random places after the full size first frame"""
+    frames = [(width, height, 0, 0, 2, 0)]
+    for i in range(1, count):
+        w = random.randrange(1, width + 1)
+        h = random.randrange(1, height + 1)
+        frames.append((w, h, random.randrange(width - w + 1), random.randrange(height - h + 1),
+                       i % 3, (i // 3) % 2))
+    return frames
+
+
+class BitWriter:
+    """deflate's bit order: values from their lsb, Huffman codes from their msb"""
+
+    def __init__(self):
+        self.data = bytearray()
+        self.acc = 0
+        self.count = 0
+
+    def bits(self, value, count):
+        self.acc |= value << self.count
+        self.count += count
+        while self.count >= 8:
+            self.data.append(self.acc & 255)
+            self.acc >>= 8
+            self.count -= 8
+
+    def code(self, code, length):
+        self.bits(int(format(code, '0%db' % length)[::-1], 2), length)
+
+    def align(self):
+        if self.count:
+            self.bits(0, 8 - self.count)
+
+
+def canonical(lengths):
+    """the codes of a canonical Huffman code with these code lengths"""
+    counts = [0] * 16
+    for length in lengths:
+        counts[length] += 1
+    counts[0] = 0
+    next_code, code = [0] * 16, 0
+    for bits in range(1, 16):
+        code = (code + counts[bits - 1]) << 1
+        next_code[bits] = code
+    codes = []
+    for length in lengths:
+        codes.append(next_code[length])
+        next_code[length] += 1
+    return codes
+
+
+LENGTH_BASE = [3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59,
+               67, 83, 99, 115, 131, 163, 195, 227, 258]
+LENGTH_EXTRA = [0] * 8 + [i // 4 for i in range(4, 24)] + [0]
+DISTANCE_BASE = [1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513,
+                 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577]
+DISTANCE_EXTRA = [0] * 4 + [i // 2 - 1 for i in range(4, 30)]
+FIXED_LITLEN = [8] * 144 + [9] * 112 + [7] * 24 + [8] * 8
+FIXED_DISTANCE = [5] * 32
+# a complete code length code: 13 codes of 4 bits and 6 of 5
+CODE_LENGTH_LENGTHS = [4] * 13 + [5] * 6
+CODE_LENGTH_ORDER = [16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15]
+
+
+def symbol_of(value, bases):
+    return max(i for i, base in enumerate(bases) if base <= value)
+
+
+def huffman_block(w, out, tokens, litlen, distance, end=256):
+    """writes tokens and the end symbol with the codes of these code lengths, and what
+    they decode to to out: ('lit', byte), ('match', length, distance), ('symbol', litlen
+    symbol) and ('distance_code', length, code) for a match with a distance code of its
+    own. Matches before the start of out copy zeros"""
+    litlen_codes, distance_codes = canonical(litlen), canonical(distance)
+    for token in tokens + [('symbol', end)]:
+        if token[0] == 'lit':
+            w.code(litlen_codes[token[1]], litlen[token[1]])
+            out.append(token[1])
+        elif token[0] == 'symbol':
+            w.code(litlen_codes[token[1]], litlen[token[1]])
+        else:
+            length = token[1]
+            symbol = symbol_of(length, LENGTH_BASE)
+            w.code(litlen_codes[257 + symbol], litlen[257 + symbol])
+            w.bits(length - LENGTH_BASE[symbol], LENGTH_EXTRA[symbol])
+            if token[0] == 'distance_code':
+                w.code(distance_codes[token[2]], distance[token[2]])
+                out.extend(bytes(length))
+                continue
+            symbol = symbol_of(token[2], DISTANCE_BASE)
+            w.code(distance_codes[symbol], distance[symbol])
+            w.bits(token[2] - DISTANCE_BASE[symbol], DISTANCE_EXTRA[symbol])
+            for _ in range(length):
+                out.append(out[-token[2]] if token[2] <= len(out) else 0)
+
+
+def block_header(w, final, kind):
+    w.bits(final, 1)
+    w.bits(kind, 2)
+
+
+def fixed_block(w, out, tokens, final=True, end=256):
+    block_header(w, final, 1)
+    huffman_block(w, out, tokens, FIXED_LITLEN, FIXED_DISTANCE, end)
+
+
+def dynamic_block(w, out, tokens, litlen, distance, final=True, sequence=None,
+                  code_length_lengths=CODE_LENGTH_LENGTHS):
+    """sequence: the code length symbols, as (symbol, extra bits) pairs, if not just
+    litlen and distance one by one"""
+    block_header(w, final, 2)
+    w.bits(len(litlen) - 257, 5)
+    w.bits(len(distance) - 1, 5)
+    w.bits(19 - 4, 4)
+    for symbol in CODE_LENGTH_ORDER:
+        w.bits(code_length_lengths[symbol], 3)
+    codes = canonical(code_length_lengths)
+    if sequence is None:
+        sequence = [(length, None) for length in litlen + distance]
+    for symbol, extra in sequence:
+        w.code(codes[symbol], code_length_lengths[symbol])
+        if symbol >= 16:
+            w.bits(extra, (2, 3, 7)[symbol - 16])
+    huffman_block(w, out, tokens, litlen + [0] * (288 - len(litlen)),
+                  distance + [0] * (32 - len(distance)))
+
+
+def stored_block(w, out, data, final=True, nlen=None):
+    block_header(w, final, 0)
+    w.align()
+    w.bits(len(data), 16)
+    w.bits(len(data) ^ 0xffff if nlen is None else nlen, 16)
+    w.data += data
+    out.extend(data)
+
+
+def fill(tokens, out_size, size):
+    """appends matches of distance 1 to tokens that bring the output from out_size to size"""
+    while size - out_size > 0:
+        length = min(258, size - out_size)
+        if 0 < size - out_size - length < 3:
+            length -= 3
+        tokens.append(('match', length, 1))
+        out_size += length
+
+
+def deflate_sample(name, w, out):
+    """a grey row of len(out) - 1 pixels, out led by filter type 0, in the zlib stream of
+    the blocks in w"""
+    w.align()
+    data = b'\x78\x01' + bytes(w.data) + struct.pack('>I', zlib.adler32(bytes(out)))
+    png = b'\x89PNG\r\n\x1a\n' + ihdr(len(out) - 1, 1, 8, 0) + chunk(b'IDAT', data)
+    with open(os.path.join(OUT, 'deflate', name + '.png'), 'wb') as f:
+        f.write(png + chunk(b'IEND', b''))
+
+
+def tokens_size(tokens):
+    return sum(1 if t[0] == 'lit' else 0 if t[0] == 'symbol' else t[1] for t in tokens)
+
+
+def fixed_sample(name, tokens, at_end=False, end=None, width=600):
+    """tokens in a fixed block of a row of width pixels, the rest of it a run. At the
+    start of such a row a token goes through the fast loop of a decoder, at its end
+    through the careful one. With end the block after the tokens ends in that symbol,
+    and a second block holds the rest"""
+    w, out = BitWriter(), bytearray()
+    head, tail = [('lit', 0), ('lit', 0x5a)], [('lit', 7)] * 8
+    if at_end:
+        fill(head, 2, width + 1 - tokens_size(tokens + tail))
+    else:
+        fill(tail, tokens_size(head + tokens + tail), width + 1)
+    if end is None:
+        fixed_block(w, out, head + tokens + tail)
+    else:
+        fixed_block(w, out, head + tokens, final=False, end=end)
+        fixed_block(w, out, tail)
+    deflate_sample(name, w, out)
+
+
+def deflate_streams():
+    os.makedirs(os.path.join(OUT, 'deflate'), exist_ok=True)
+    literals = lambda count, values: [('lit', random.randrange(values)) for _ in range(count)]
+
+    # decoded: overlapping matches of every period up to 24, at the start of the
+    # output and at its end
+    tokens = []
+    for period in range(1, 25):
+        tokens += literals(period, 256) + [('match', 3 * period + 5, period)]
+    w, out = BitWriter(), bytearray()
+    fixed_block(w, out, [('lit', 1)] + tokens + literals(40, 256) + tokens)
+    deflate_sample('periods', w, out)
+
+    # decoded: literal/length and distance codes of every length from 1 to 15, so that
+    # both root tables have subtables
+    litlen = [0] * 259
+    for length, symbol in enumerate([257] + list(range(13)) + [258, 256]):
+        litlen[symbol] = min(length + 1, 15)
+    distance = [min(length + 1, 15) for length in range(16)]
+    tokens = [('lit', 0)] + literals(400, 13)
+    for code in range(16):
+        tokens += [('match', 3, DISTANCE_BASE[code]), ('match', 4, DISTANCE_BASE[code] + 1)]
+    tokens += literals(20, 13)
+    w, out = BitWriter(), bytearray()
+    dynamic_block(w, out, tokens, litlen, distance)
+    deflate_sample('long_codes', w, out)
+
+    # decoded: a single distance code of one bit, and no distance codes at all
+    litlen = [0] * 258
+    litlen[0] = litlen[0x5a] = litlen[256] = litlen[257] = 2
+    w, out = BitWriter(), bytearray()
+    dynamic_block(w, out, [('lit', 0), ('lit', 0x5a), ('match', 3, 1)], litlen, [1], final=False)
+    litlen = [0] * 257
+    litlen[0x5a] = litlen[256] = 1
+    dynamic_block(w, out, [('lit', 0x5a)] * 5, litlen, [0])
+    deflate_sample('lone_codes', w, out)
+
+    # decoded: stored blocks, the empty one among them, between Huffman blocks
+    w, out = BitWriter(), bytearray()
+    fixed_block(w, out, [('lit', 0), ('lit', 1)], final=False)
+    stored_block(w, out, bytes(random.randrange(256) for _ in range(300)), final=False)
+    stored_block(w, out, b'', final=False)
+    fixed_block(w, out, [('match', 100, 299)], final=False)
+    stored_block(w, out, b'\x05\x06\x07')
+    deflate_sample('stored_blocks', w, out)
+
+    # not decoded: a distance past the start of the output, distance codes 30 and 31
+    # and literal/length symbols 286 and 287 where a block would end, at the start and
+    # at the end
+    fixed_sample('far_distance_start', [('match', 3, 3)])
+    fixed_sample('far_distance_end', [('match', 3, 594)], at_end=True)
+    fixed_sample('distance_30_start', [('distance_code', 3, 30)])
+    fixed_sample('distance_31_end', [('distance_code', 3, 31)], at_end=True)
+    fixed_sample('litlen_286_start', [], end=286)
+    fixed_sample('litlen_287_end', [], at_end=True, end=287)
+
+    # not decoded: incomplete literal/length and distance codes with codes of two and
+    # more bits, whose missing codes the stream does not use, and a code one code too many
+    litlen = [0] * 258
+    litlen[0] = litlen[0x5a] = litlen[256] = 2
+    w, out = BitWriter(), bytearray()
+    dynamic_block(w, out, [('lit', 0), ('lit', 0x5a)], litlen, [0])
+    deflate_sample('incomplete_litlen', w, out)
+    litlen = [0] * 259
+    for length, symbol in enumerate([257] + list(range(13)) + [256]):
+        litlen[symbol] = length + 1
+    w, out = BitWriter(), bytearray()
+    dynamic_block(w, out, [('lit', 0), ('lit', 1), ('match', 3, 1)], litlen, [1])
+    deflate_sample('incomplete_long_litlen', w, out)
+    litlen = [0] * 258
+    litlen[0] = litlen[256] = litlen[257] = 2
+    litlen[1] = 3
+    litlen[2] = 3
+    w, out = BitWriter(), bytearray()
+    dynamic_block(w, out, [('lit', 0), ('lit', 1), ('match', 3, 1), ('match', 3, 2)], litlen,
+                  [2, 2, 2])
+    deflate_sample('incomplete_distance', w, out)
+    litlen = [0] * 257
+    litlen[0] = litlen[0x5a] = 1
+    litlen[256] = 2
+    w, out = BitWriter(), bytearray()
+    dynamic_block(w, out, [('lit', 0), ('lit', 0x5a)], litlen, [0])
+    deflate_sample('oversubscribed_litlen', w, out)
+    litlen[0x5a] = 2
+    w, out = BitWriter(), bytearray()
+    dynamic_block(w, out, [('lit', 0), ('lit', 0x5a)], litlen, [0],
+                  code_length_lengths=[4] * 12 + [5] * 6 + [0])
+    deflate_sample('incomplete_code_lengths', w, out)
+
+    # not decoded: a repeat of the previous code length before the first one, and a run
+    # of zeros past the last code length
+    litlen = [0] * 257
+    litlen[3] = litlen[256] = 1
+    w, out = BitWriter(), bytearray()
+    dynamic_block(w, out, [('lit', 3), ('lit', 3)], litlen, [0],
+                  sequence=[(16, 0), (1, None), (18, 127), (18, 103), (1, None), (0, None)])
+    deflate_sample('repeat_first', w, out)
+    litlen = [0] * 257
+    litlen[0] = litlen[256] = 1
+    w, out = BitWriter(), bytearray()
+    dynamic_block(w, out, [('lit', 0), ('lit', 0)], litlen, [0],
+                  sequence=[(1, None), (18, 127), (18, 106), (1, None), (17, 0)])
+    deflate_sample('repeat_past_end', w, out)
+
+    # not decoded: a stored block whose length and its complement disagree, and a block
+    # of the reserved type 3
+    w, out = BitWriter(), bytearray()
+    stored_block(w, out, b'\x00\x01\x02', nlen=0xfffd)
+    deflate_sample('stored_nlen', w, out)
+    w, out = BitWriter(), bytearray()
+    fixed_block(w, out, [('lit', 0), ('lit', 1)], final=False)
+    block_header(w, 1, 3)
+    w.bits(0, 32)
+    deflate_sample('block_type_3', w, out)
+
+
+def main():
+    random.seed(20100808)
+
+    # every colour type and bit depth upng decodes
+    still('grey1', 33, 17, 1, 0, 'random')
+    still('grey2', 7, 3, 2, 0, 'repeat', level=0)
+    still('grey4', 61, 45, 4, 0, 'noisy', strategy=zlib.Z_FIXED)
+    still('grey8', 61, 45, 8, 0, 'smooth', level=9, chunk_size=100)
+    still('grey8_key', 33, 17, 8, 0, 'random', extra=chunk(b'tRNS', b'\x00\x5a'))
+    still('grey2_key', 33, 17, 2, 0, 'random', extra=chunk(b'tRNS', b'\x00\x02'))
+    still('rgb8', 61, 45, 8, 2, 'noisy', strategy=zlib.Z_HUFFMAN_ONLY)
+    still('rgb8_key', 33, 17, 8, 2, 'repeat', extra=chunk(b'tRNS', b'\x00\x5a\x00\x5a\x00\x5a'))
+    still('rgb16', 33, 17, 16, 2, 'smooth', strategy=zlib.Z_RLE)
+    still('rgb16_key', 7, 3, 16, 2, 'flat', extra=chunk(b'tRNS', b'\x5a\x5a\x5a\x5a\x5a\x5a'))
+    still('index1', 61, 45, 1, 3, 'random', extra=palette(2, 1))
+    still('index2', 33, 17, 2, 3, 'repeat', extra=palette(4, 4, True))
+    still('index4', 61, 45, 4, 3, 'noisy', chunk_size=1, level=1, extra=palette(16, 9))
+    still('index8', 61, 45, 8, 3, 'random', extra=palette(256, 100))
+    still('index8_short_palette', 33, 17, 8, 3, 'random', extra=palette(200, 0))
+    still('grey_alpha8', 61, 45, 8, 4, 'noisy')
+    still('rgba8', 61, 45, 8, 6, 'random', chunk_size=7)
+    still('rgba16', 33, 17, 16, 6, 'noisy', level=1)
+    still('one_pixel', 1, 1, 8, 6, 'random')
+    still('flat_stored', 61, 45, 8, 2, 'flat', level=0)
+    still('flat_rle', 200, 150, 8, 6, 'flat', strategy=zlib.Z_RLE)
+    # no upng_format for 16-bit grey, loading it fails with UPNG_EUNFORMAT
+    still('grey16_unsupported', 7, 3, 16, 0, 'random')
+
+    # larger images for upng_bench
+    still('bench_rgba8', 256, 192, 8, 6, 'noisy')
+    still('bench_index8', 256, 192, 8, 3, 'smooth', extra=palette(256, 0))
+
+    # animations for the compositor: every dispose_op and blend_op pair
+    alphas = (0, 0, 255, 255, 128, 40, 200)
+    animation('anim_rgba8', 64, 48, 8, 6, every_op(64, 48, 13),
+              rows_of=lambda w, h: rgba_rows(w, h, alphas))
+    animation('anim_rgba16', 40, 30, 16, 6, every_op(40, 30, 7))
+    animation('anim_grey_alpha8', 40, 30, 8, 4, every_op(40, 30, 7))
+    animation('anim_rgb8', 40, 30, 8, 2, every_op(40, 30, 7))
+    animation('anim_rgb8_key', 40, 30, 8, 2, every_op(40, 30, 7),
+              extra=chunk(b'tRNS', b'\x00\x07\x00\x07\x00\x07'),
+              rows_of=lambda w, h: [bytes(random.choice((7, 7, 9)) for _ in range(w * 3))
+                                    for _ in range(h)])
+    animation('anim_index8_binary', 40, 30, 8, 3, every_op(40, 30, 7),
+              extra=palette(64, 64, True),
+              rows_of=lambda w, h: [bytes(random.randrange(64) for _ in range(w))
+                                    for _ in range(h)])
+    animation('anim_index4', 40, 30, 4, 3, every_op(40, 30, 7), extra=palette(16, 16))
+    animation('anim_grey8', 40, 30, 8, 0, every_op(40, 30, 7))
+    # the default image is not part of the animation
+    animation('anim_hidden_default', 48, 32, 8, 6, every_op(48, 32, 7), hidden_default=True,
+              rows_of=lambda w, h: rgba_rows(w, h, alphas))
+    # acTL announces fewer frames than the file has
+    animation('anim_more_frames', 32, 32, 8, 6, every_op(32, 32, 11), num_frames=2)
+
+    # a small memLevel ends a dynamic block every 128 symbols, so that a stream cut into
+    # parts has block starts in each; see upng_test_small_parts
+    still('parts_rgba8', 96, 64, 8, 6, 'noisy', mem_level=1, chunk_size=1000)
+
+    deflate_streams()
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,55 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <upng_internal.h>
+
+// Writes upng/upng_fixed_tables.h from the table builder, to stdout; regenerate it with
+//   make_fixed_tables > upng/upng_fixed_tables.h
+// after changing the table entry layout. With a file, it checks that the file holds
+// exactly what the builder makes instead, which the fixed_tables test runs on the
+// header in the tree
+// usage: make_fixed_tables [upng_fixed_tables.h]
+
+static int check(const char* path) {
+  FILE* generated = tmpfile();
+  FILE* header = fopen(path, "rb");
+  if (generated == NULL || header == NULL) {
+    printf("%s: can not be read\n", path);
+    return EXIT_FAILURE;
+  }
+
+  upng_make_fixed_tables(generated);
+  rewind(generated);
+
+  long line = 1;
+  int a, b;
+  do {
+    a = fgetc(generated);
+    b = fgetc(header);
+    if (a != b) {
+      printf("%s:%ld: differs from what upng_make_fixed_tables writes, regenerate it\n",
+          path, line);
+      fclose(header);
+      fclose(generated);
+      return EXIT_FAILURE;
+    }
+    line += a == '\n';
+  } while (a != EOF);
+
+  fclose(header);
+  fclose(generated);
+  return EXIT_SUCCESS;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc == 2) {
+    return check(argv[1]);
+  }
+  if (argc > 2) {
+    printf("usage: %s [upng_fixed_tables.h]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  upng_make_fixed_tables(stdout);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,95 @@
+#include <stdlib.h>
+
+#include "test_util.h"
+#include "upng_tests.h"
+
+// All of the decoder's memory is allocated by upng_load: decoding every frame,
+// decoding them again after a seek and converting them to caller pixels must leave
+// upng_get_allocation_count where upng_load left it. That is checked for each way
+// of decoding, with an allocator hook that counts what really got allocated
+
+typedef enum decode_mode {
+  DECODE_SEQUENTIAL,
+  DECODE_POOL,
+  DECODE_PIPELINE,
+  NUM_DECODE_MODES
+} decode_mode;
+
+static const char* const mode_names[NUM_DECODE_MODES] = { "sequential", "pool", "pipeline" };
+
+typedef struct counted_memory {
+  uint32_t allocations;
+  uint32_t live;
+} counted_memory;
+
+// the decode pool allocates for its workers on the calling thread, but count
+// atomically all the same
+static void* counted_alloc(void* user, size_t size) {
+  counted_memory* memory = (counted_memory*)user;
+  void* ptr = malloc(size);
+  if (ptr != NULL) {
+    __atomic_add_fetch(&memory->allocations, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&memory->live, 1, __ATOMIC_RELAXED);
+  }
+  return ptr;
+}
+
+static void counted_free(void* user, void* ptr) {
+  counted_memory* memory = (counted_memory*)user;
+  __atomic_sub_fetch(&memory->live, 1, __ATOMIC_RELAXED);
+  free(ptr);
+}
+
+static void test_mode(const char* name, uint8_t* png, uint32_t size, decode_mode mode) {
+  counted_memory memory = { 0, 0 };
+  upng_allocator allocator = { counted_alloc, counted_free, &memory };
+  upng_t* upng = upng_new_from_bytes(png, size);
+  upng_error error = UPNG_EOK;
+
+  TEST_CHECK(upng_set_allocator(upng, &allocator) == UPNG_EOK, "%s: allocator refused", name);
+  if (mode == DECODE_POOL) {
+    error = upng_set_decode_threads(upng, 3);
+  } else if (mode == DECODE_PIPELINE) {
+    error = upng_set_decode_pipeline(upng, true);
+  }
+  // a build without UPNG_THREADS has only the sequential decoder
+  if (error == UPNG_EUNSUPPORTED || upng_load(upng) != UPNG_EOK) {
+    upng_free(upng);
+    return;
+  }
+
+  uint32_t loaded = upng_get_allocation_count(upng);
+  TEST_CHECK(loaded == memory.allocations, "%s %s: upng_load counted %u allocations, made %u",
+      name, mode_names[mode], loaded, memory.allocations);
+
+  uint32_t frames = 0;
+  error = test_decode_all(upng, &frames);
+  TEST_CHECK(error == UPNG_EDONE && frames == upng_get_frame_count(upng),
+      "%s %s: decoded %u of %u frames, error %d", name, mode_names[mode], frames,
+      upng_get_frame_count(upng), error);
+  TEST_CHECK(upng_get_allocation_count(upng) == loaded && memory.allocations == loaded,
+      "%s %s: decoding the frames allocated", name, mode_names[mode]);
+
+  // the same frames again, now also converted to caller pixels
+  uint32_t pitch = upng_get_width(upng) * 4;
+  uint32_t pixels_size = pitch * upng_get_height(upng);
+  void* pixels = malloc(pixels_size);
+  upng_set_output_pixels(upng, pixels, pitch, pixels_size, UPNG_PIXEL_ARGB8888, false);
+  TEST_CHECK(upng_seek_frame(upng, 0) == UPNG_EOK, "%s %s: seek failed", name, mode_names[mode]);
+  error = test_decode_all(upng, &frames);
+  TEST_CHECK(error == UPNG_EDONE && frames == upng_get_frame_count(upng),
+      "%s %s: decoded %u frames after a seek, error %d", name, mode_names[mode], frames, error);
+  TEST_CHECK(upng_get_allocation_count(upng) == loaded && memory.allocations == loaded,
+      "%s %s: decoding after a seek allocated", name, mode_names[mode]);
+
+  upng_free(upng);
+  free(pixels);
+  TEST_CHECK(memory.live == 0, "%s %s: %u allocations not freed", name, mode_names[mode],
+      memory.live);
+}
+
+void test_allocations(const char* path, uint8_t* png, uint32_t size) {
+  for (int mode = 0; mode < NUM_DECODE_MODES; mode++) {
+    test_mode(test_name(path), png, size, (decode_mode)mode);
+  }
+}
@@ -0,0 +1,102 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <upng_internal.h>
+
+#include "test_util.h"
+#include "upng_tests.h"
+
+// Every APNG_BLEND_OP_OVER kernel the CPU can run has to leave the same canvas as the
+// plain C blend, for every row width from 0 to past the widest vector loop and its
+// tail. Random sources are blended over random canvases, with alpha drawn from mixes
+// that make whole vector groups transparent, opaque or both now and then, so every
+// shortcut of the kernels is taken; nothing may be written past the row
+
+#define MAX_WIDTH 70
+// bytes after the row that have to stay untouched
+#define GUARD_BYTES 64
+#define GUARD 0xA5
+
+// how the alpha of a row is drawn
+typedef enum alpha_mix {
+  MIX_ANY,        // any value
+  MIX_OPAQUE,     // mostly 255
+  MIX_CLEAR,      // mostly 0
+  MIX_BINARY,     // 0 or 255
+  NUM_MIXES
+} alpha_mix;
+
+static const char* const mix_names[] = { "any", "opaque", "clear", "0 or 255" };
+
+static uint32_t random_state = 20100808;
+
+static uint8_t random_byte(void) {
+  random_state = random_state * 1103515245 + 12345;
+  return (uint8_t)(random_state >> 16);
+}
+
+static uint8_t random_alpha(alpha_mix mix) {
+  uint8_t roll = random_byte();
+  switch (mix) {
+  case MIX_OPAQUE:
+    return roll < 240 ? 0xFF : random_byte();
+  case MIX_CLEAR:
+    return roll < 240 ? 0 : random_byte();
+  case MIX_BINARY:
+    return roll & 1 ? 0xFF : 0;
+  default:
+    return roll;
+  }
+}
+
+static void random_row(uint8_t* row, uint32_t width, alpha_mix mix) {
+  for (uint32_t x = 0; x < width; x++) {
+    for (int c = 0; c < 3; c++) {
+      row[x * 4 + c] = random_byte();
+    }
+    row[x * 4 + 3] = random_alpha(mix);
+  }
+}
+
+static void check_kernel(const char* name, upng_blend_fn kernel) {
+  size_t row_size = (size_t)MAX_WIDTH * 4 + GUARD_BYTES;
+  uint8_t* canvas = (uint8_t*)malloc(row_size);
+  uint8_t* expected = (uint8_t*)malloc(row_size);
+  uint8_t* blended = (uint8_t*)malloc(row_size);
+
+  bool same = true;
+  for (uint32_t width = 0; same && width <= MAX_WIDTH; width++) {
+    for (int source_mix = 0; same && source_mix < NUM_MIXES; source_mix++) {
+      for (int canvas_mix = 0; same && canvas_mix < NUM_MIXES; canvas_mix++) {
+        // the source has no room after it, so that a sanitizer sees reads past it
+        uint8_t* src = (uint8_t*)malloc(width > 0 ? (size_t)width * 4 : 1);
+        random_row(src, width, (alpha_mix)source_mix);
+        memset(canvas, GUARD, row_size);
+        random_row(canvas, width, (alpha_mix)canvas_mix);
+
+        memcpy(expected, canvas, row_size);
+        memcpy(blended, canvas, row_size);
+        upng_blend_over_reference(expected, src, width);
+        kernel(blended, src, width);
+        same = TEST_CHECK(memcmp(expected, blended, row_size) == 0,
+            "%s blend of %u pixels, %s source over %s canvas, differs from the scalar blend",
+            name, width, mix_names[source_mix], mix_names[canvas_mix]);
+        free(src);
+      }
+    }
+  }
+
+  free(blended);
+  free(expected);
+  free(canvas);
+}
+
+void test_blend(void) {
+  upng_blend_fn kernels[UPNG_MAX_BLEND_KERNELS];
+  const char* names[UPNG_MAX_BLEND_KERNELS];
+  uint32_t count = upng_list_blend_kernels(kernels, names);
+
+  for (uint32_t k = 0; k < count; k++) {
+    check_kernel(names[k], kernels[k]);
+  }
+}
@@ -0,0 +1,218 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <upng_internal.h>
+
+#include "test_util.h"
+#include "upng_tests.h"
+
+// upng_crc32 and upng_adler32 give what bit by bit reference versions of them give, in
+// one call or continued over pieces, and the CRC of every chunk of the file is the one
+// stored after it. Then each verify level is checked to fail with UPNG_ECHECKSUM for
+// exactly the checksums it covers: a bad CRC of the image data chunks of every frame,
+// of IHDR and of an ancillary chunk, and a bad Adler-32 at the end of every frame's
+// stream. Where a level does not look, the frame decodes as if nothing were wrong
+
+static const upng_verify verify_levels[] = {
+  UPNG_VERIFY_NONE, UPNG_VERIFY_CRITICAL, UPNG_VERIFY_ALL
+};
+#define NUM_VERIFY_LEVELS (sizeof(verify_levels) / sizeof(verify_levels[0]))
+
+// the chunk insert_chunk adds, ancillary and unknown to upng
+static const uint8_t ancillary_type[4] = { 't', 'E', 'X', 't' };
+
+static uint32_t reference_crc32(uint32_t crc, const uint8_t* data, size_t size) {
+  crc = ~crc;
+  for (size_t i = 0; i < size; i++) {
+    crc ^= data[i];
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+    }
+  }
+  return ~crc;
+}
+
+static uint32_t reference_adler32(uint32_t adler, const uint8_t* data, size_t size) {
+  uint32_t a = adler & 0xFFFF, b = adler >> 16;
+  for (size_t i = 0; i < size; i++) {
+    a = (a + data[i]) % 65521;
+    b = (b + a) % 65521;
+  }
+  return b << 16 | a;
+}
+
+static uint32_t read_be32(const uint8_t* p) {
+  return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static void write_be32(uint8_t* p, uint32_t value) {
+  p[0] = (uint8_t)(value >> 24);
+  p[1] = (uint8_t)(value >> 16);
+  p[2] = (uint8_t)(value >> 8);
+  p[3] = (uint8_t)value;
+}
+
+static bool is_image_data(const uint8_t* chunk) {
+  return memcmp(chunk + 4, "IDAT", 4) == 0 || memcmp(chunk + 4, "fdAT", 4) == 0;
+}
+
+// stores the right CRC after the chunk at offset
+static void fix_crc(uint8_t* png, uint32_t offset) {
+  uint32_t length = read_be32(png + offset);
+  write_be32(png + offset + 8 + length, upng_crc32(0, png + offset + 4, length + 4));
+}
+
+static void check_functions(const char* name, const uint8_t* png, uint32_t size) {
+  // every length up to a few blocks of the vector loops, at every alignment
+  for (uint32_t length = 0; length <= 300 && length < size; length++) {
+    uint32_t start = (length * 7) % (size - length);
+    TEST_CHECK(upng_crc32(0, png + start, length) == reference_crc32(0, png + start, length),
+        "%s: upng_crc32 of %u bytes", name, length);
+    TEST_CHECK(upng_adler32(1, png + start, length) == reference_adler32(1, png + start, length),
+        "%s: upng_adler32 of %u bytes", name, length);
+  }
+
+  // the whole file, in one call and in two pieces; long enough for Adler-32 sums that
+  // have to be reduced on the way
+  uint32_t crc = reference_crc32(0, png, size), adler = reference_adler32(1, png, size);
+  TEST_CHECK(upng_crc32(0, png, size) == crc, "%s: upng_crc32 of the file", name);
+  TEST_CHECK(upng_adler32(1, png, size) == adler, "%s: upng_adler32 of the file", name);
+  for (uint32_t split = 1; split < size; split = split * 3 + 1) {
+    TEST_CHECK(upng_crc32(upng_crc32(0, png, split), png + split, size - split) == crc,
+        "%s: upng_crc32 continued after %u bytes", name, split);
+    TEST_CHECK(upng_adler32(upng_adler32(1, png, split), png + split, size - split) == adler,
+        "%s: upng_adler32 continued after %u bytes", name, split);
+  }
+
+  // the CRC stored with every chunk
+  for (uint32_t pos = 8; pos + 12 <= size; ) {
+    uint32_t length = read_be32(png + pos);
+    if (length > size - pos - 12) {
+      break;
+    }
+    TEST_CHECK(upng_crc32(0, png + pos + 4, length + 4) == read_be32(png + pos + 8 + length),
+        "%s: CRC of the chunk at %u", name, pos);
+    pos += length + 12;
+  }
+}
+
+// decodes frame of a copy of png at each verify level and checks that the levels
+// covering the damage fail with UPNG_ECHECKSUM, in upng_load or when decoding, and the
+// others give the frame of the intact file; caught_by is the first level that covers it
+static void check_levels(const char* name, const char* damage, const uint8_t* png,
+    uint32_t size, uint32_t frame, upng_verify caught_by, uint64_t intact_hash) {
+  for (size_t v = 0; v < NUM_VERIFY_LEVELS; v++) {
+    upng_t* upng = upng_new_from_bytes((uint8_t*)png, size);
+    upng_set_verify(upng, verify_levels[v]);
+
+    upng_error error = upng_load(upng);
+    if (error == UPNG_EOK) {
+      error = upng_seek_frame(upng, frame);
+    }
+    if (error == UPNG_EOK) {
+      error = upng_decode_image(upng);
+    }
+
+    if (verify_levels[v] >= caught_by) {
+      TEST_CHECK(error == UPNG_ECHECKSUM, "%s frame %u, %s at verify level %d: error %d",
+          name, frame, damage, verify_levels[v], error);
+    } else {
+      TEST_CHECK(error == UPNG_EOK && test_hash(upng_get_buffer(upng), upng_get_size(upng)) ==
+          intact_hash, "%s frame %u, %s at verify level %d: error %d or other pixels", name,
+          frame, damage, verify_levels[v], error);
+    }
+    upng_free(upng);
+  }
+}
+
+// the frame of each run of image data chunks, and the hash of the intact frame
+static bool intact_frame(const uint8_t* png, uint32_t size, uint32_t frame, uint64_t* hash) {
+  upng_t* upng = upng_new_from_bytes((uint8_t*)png, size);
+  bool ok = upng_load(upng) == UPNG_EOK && upng_seek_frame(upng, frame) == UPNG_EOK &&
+      upng_decode_image(upng) == UPNG_EOK;
+  if (ok) {
+    *hash = test_hash(upng_get_buffer(upng), upng_get_size(upng));
+  }
+  upng_free(upng);
+  return ok;
+}
+
+static void check_frames(const char* name, const uint8_t* png, uint32_t size, uint8_t* copy) {
+  uint32_t frame = 0, run_start = 0, last_data = 0;
+
+  for (uint32_t pos = 8; pos + 12 <= size; ) {
+    uint32_t length = read_be32(png + pos);
+    if (length > size - pos - 12) {
+      break;
+    }
+    uint32_t next = pos + length + 12;
+    bool data = is_image_data(png + pos);
+
+    if (data && run_start == 0) {
+      run_start = pos;
+    }
+    // the stream data of fdAT starts after the sequence number
+    if (data && length > (png[pos + 4] == 'f' ? 4u : 0u)) {
+      last_data = pos;
+    }
+
+    // at the end of a run of image data chunks
+    if (run_start != 0 && (next + 12 > size || !is_image_data(png + next) ||
+        memcmp(png + next + 4, png + run_start + 4, 4) != 0)) {
+      uint64_t hash;
+      if (last_data != 0 && intact_frame(png, size, frame, &hash)) {
+        // a bad CRC of the first chunk of the run
+        memcpy(copy, png, size);
+        copy[run_start + 8 + read_be32(png + run_start)] ^= 1;
+        check_levels(name, "chunk CRC", copy, size, frame, UPNG_VERIFY_CRITICAL, hash);
+
+        // the last byte of the stream is the low byte of the Adler-32
+        memcpy(copy, png, size);
+        copy[last_data + 8 + read_be32(png + last_data) - 1] ^= 1;
+        fix_crc(copy, last_data);
+        check_levels(name, "Adler-32", copy, size, frame, UPNG_VERIFY_CRITICAL, hash);
+      }
+      frame++;
+      run_start = 0;
+      last_data = 0;
+    }
+    pos = next;
+  }
+}
+
+// a copy of png with an ancillary chunk and a wrong CRC right after IHDR
+static uint32_t insert_chunk(const uint8_t* png, uint32_t size, uint8_t* copy) {
+  static const uint8_t text[] = "Comment\0checked";
+  uint32_t length = sizeof(text) - 1;
+
+  memcpy(copy, png, 33);
+  write_be32(copy + 33, length);
+  memcpy(copy + 37, ancillary_type, 4);
+  memcpy(copy + 41, text, length);
+  write_be32(copy + 41 + length, upng_crc32(0, copy + 37, length + 4) ^ 1);
+  memcpy(copy + 45 + length, png + 33, size - 33);
+  return size + length + 12;
+}
+
+void test_checksums(const char* path, uint8_t* png, uint32_t size) {
+  const char* name = test_name(path);
+  uint64_t hash;
+
+  check_functions(name, png, size);
+
+  // the checks below damage images that decode when intact
+  if (size < 45 || !intact_frame(png, size, 0, &hash)) {
+    return;
+  }
+
+  uint8_t* copy = (uint8_t*)malloc(size + 64);
+  check_frames(name, png, size, copy);
+
+  memcpy(copy, png, size);
+  copy[29] ^= 1;
+  check_levels(name, "IHDR CRC", copy, size, 0, UPNG_VERIFY_CRITICAL, hash);
+
+  uint32_t inserted = insert_chunk(png, size, copy);
+  check_levels(name, "ancillary chunk CRC", copy, inserted, 0, UPNG_VERIFY_ALL, hash);
+  free(copy);
+}
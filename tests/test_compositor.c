@@ -0,0 +1,218 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test_util.h"
+#include "upng_tests.h"
+
+// Every frame apng_compositor_decode_frame puts on the canvas is compared with a
+// plain floating point compositor that follows the APNG spec, working from frames a
+// second upng_t decodes. The samples cover every dispose_op and blend_op pair,
+// APNG_DISPOSE_OP_PREVIOUS on the first frame and a default image that is not part
+// of the animation. Compositing must not allocate, and a snapshot saved halfway has
+// to give the same canvases again after a restore and a seek
+
+// the canvas may be off by one from the reference, which rounds only once per blend
+#define MAX_DIFFERENCE 1
+
+static uint16_t reference_key(const uint8_t* alpha, int32_t count, int32_t index) {
+  return index * 2 + 1 < count ? (uint16_t)(alpha[index * 2] << 8 | alpha[index * 2 + 1]) : 0;
+}
+
+// R, G, B and A of pixel x of row y of a frame in upng's buffer
+static void reference_pixel(const upng_t* upng, uint32_t width, uint32_t x, uint32_t y,
+    double out[4]) {
+  upng_format format = upng_get_format(upng);
+  uint32_t depth = upng_get_bitdepth(upng);
+  const uint8_t* row = upng_get_buffer(upng) + y * ((width * upng_get_bpp(upng) + 7) / 8);
+  rgb* palette;
+  uint8_t* alpha;
+  int32_t palette_size = upng_get_palette(upng, &palette);
+  int32_t alpha_size = upng_get_alpha_palette(upng, &alpha);
+
+  if (format <= UPNG_INDEXED8 || (format >= UPNG_LUMINANCE1 && format <= UPNG_LUMINANCE8)) {
+    uint32_t bit = x * depth;
+    uint32_t value = (row[bit / 8] >> (8 - depth - bit % 8)) & ((1u << depth) - 1);
+    if (format <= UPNG_INDEXED8) {
+      bool known = value < (uint32_t)palette_size;
+      out[0] = known ? palette[value].r : 0;
+      out[1] = known ? palette[value].g : 0;
+      out[2] = known ? palette[value].b : 0;
+      out[3] = value < (uint32_t)alpha_size ? alpha[value] : (known ? 255 : 0);
+    } else {
+      out[0] = out[1] = out[2] = round(value * 255.0 / ((1u << depth) - 1));
+      out[3] = alpha_size >= 2 && value == reference_key(alpha, alpha_size, 0) ? 0 : 255;
+    }
+    return;
+  }
+
+  // 8 and 16 bit samples, of which the canvas keeps the high byte
+  uint32_t components = upng_get_components(upng), bytes = depth / 8;
+  const uint8_t* pixel = row + x * components * bytes;
+  uint16_t sample[4];
+  for (uint32_t i = 0; i < components; i++) {
+    sample[i] = bytes == 2 ? (uint16_t)(pixel[i * 2] << 8 | pixel[i * 2 + 1]) : pixel[i];
+  }
+  double high[4];
+  for (uint32_t i = 0; i < components; i++) {
+    high[i] = pixel[i * bytes];
+  }
+
+  if (components == 1 || components == 2) {
+    out[0] = out[1] = out[2] = high[0];
+    out[3] = components == 2 ? high[1] :
+        alpha_size >= 2 && sample[0] == reference_key(alpha, alpha_size, 0) ? 0 : 255;
+  } else {
+    memcpy(out, high, sizeof(double) * 3);
+    out[3] = components == 4 ? high[3] :
+        alpha_size >= 6 && sample[0] == reference_key(alpha, alpha_size, 0) &&
+        sample[1] == reference_key(alpha, alpha_size, 1) &&
+        sample[2] == reference_key(alpha, alpha_size, 2) ? 0 : 255;
+  }
+}
+
+// the area of region on canvas gets the pixels of from, or transparent black without it
+static void reference_fill(double* canvas, uint32_t width, const apng_fctl* region,
+    const double* from) {
+  for (uint32_t y = region->y_offset; y < region->y_offset + region->height; y++) {
+    size_t start = ((size_t)y * width + region->x_offset) * 4, count = (size_t)region->width * 4;
+    if (from != NULL) {
+      memcpy(canvas + start, from + start, count * sizeof(double));
+    } else {
+      memset(canvas + start, 0, count * sizeof(double));
+    }
+  }
+}
+
+static void reference_blend(double* canvas, uint32_t width, const upng_t* decoded,
+    const apng_fctl* fctl) {
+  for (uint32_t y = 0; y < fctl->height; y++) {
+    for (uint32_t x = 0; x < fctl->width; x++) {
+      double source[4];
+      double* target = canvas + ((size_t)(fctl->y_offset + y) * width + fctl->x_offset + x) * 4;
+      reference_pixel(decoded, fctl->width, x, y, source);
+
+      if (fctl->blend_op == APNG_BLEND_OP_SOURCE) {
+        memcpy(target, source, sizeof(source));
+        continue;
+      }
+      double source_alpha = source[3] / 255, target_alpha = target[3] / 255;
+      double alpha = source_alpha + target_alpha * (1 - source_alpha);
+      if (alpha > 0) {
+        for (int i = 0; i < 3; i++) {
+          target[i] = round((source[i] * source_alpha + target[i] * target_alpha * (1 - source_alpha)) / alpha);
+        }
+      }
+      target[3] = round(alpha * 255);
+    }
+  }
+}
+
+void test_compositor(const char* path, uint8_t* png, uint32_t size) {
+  const char* name = test_name(path);
+  upng_t* upng = upng_new_from_bytes(png, size);
+  upng_t* reference = upng_new_from_bytes(png, size);
+  apng_compositor* compositor = NULL;
+
+  if (upng_load(upng) != UPNG_EOK || upng_load(reference) != UPNG_EOK ||
+      (compositor = apng_compositor_new(upng)) == NULL) {
+    // images that do not load are for other tests, the one format the compositor
+    // can not convert has no compositor
+    TEST_CHECK(compositor != NULL || upng_get_error(upng) != UPNG_EOK ||
+        upng_get_format(upng) == UPNG_BADFORMAT, "%s: no compositor", name);
+    upng_free(upng);
+    upng_free(reference);
+    return;
+  }
+
+  uint32_t width = upng_get_width(upng), height = upng_get_height(upng);
+  uint32_t frame_count = upng_get_frame_count(upng);
+  size_t canvas_size = (size_t)width * height * 4;
+  double* expected = (double*)calloc(canvas_size, sizeof(double));
+  double* previous = (double*)malloc(canvas_size * sizeof(double));
+  uint8_t* canvases = (uint8_t*)malloc(canvas_size * frame_count);
+  void* snapshot = malloc(apng_compositor_snapshot_size(compositor));
+  uint32_t snapshot_frame = frame_count / 2, decoded = 0;
+  uint32_t allocations = upng_get_allocation_count(upng);
+  apng_fctl dispose = { 0 }, unused;
+
+  TEST_CHECK(apng_compositor_get_frame(compositor) == UINT32_MAX,
+      "%s: a frame on the canvas before the first", name);
+
+  for (uint32_t frame = 0; frame < frame_count; frame++) {
+    upng_error error = apng_compositor_decode_frame(compositor, upng);
+    upng_error reference_error = upng_decode_image(reference);
+    if (!TEST_CHECK(error == reference_error, "%s frame %u: error %d, decoding alone gives %d",
+        name, frame, error, reference_error) || error != UPNG_EOK) {
+      break;
+    }
+    TEST_CHECK(upng_get_allocation_count(upng) == allocations, "%s frame %u: compositing allocated",
+        name, frame);
+
+    // the animation starts at frame 1 when the default image is not part of it
+    apng_fctl fctl = { 0, width, height, 0, 0, 0, 0, APNG_DISPOSE_OP_NONE, APNG_BLEND_OP_SOURCE };
+    bool first = frame == 0 || (frame == 1 && !upng_get_frame_fctl(reference, 0, &unused));
+    upng_get_frame_fctl(reference, frame, &fctl);
+    if (first) {
+      memset(expected, 0, canvas_size * sizeof(double));
+    } else if (dispose.dispose_op == APNG_DISPOSE_OP_BACKGROUND) {
+      reference_fill(expected, width, &dispose, NULL);
+    } else if (dispose.dispose_op == APNG_DISPOSE_OP_PREVIOUS) {
+      reference_fill(expected, width, &dispose, previous);
+    }
+    dispose = fctl;
+    if (first && dispose.dispose_op == APNG_DISPOSE_OP_PREVIOUS) {
+      dispose.dispose_op = APNG_DISPOSE_OP_BACKGROUND;
+    }
+    memcpy(previous, expected, canvas_size * sizeof(double));
+    reference_blend(expected, width, reference, &fctl);
+
+    const uint8_t* canvas = apng_compositor_get_canvas(compositor);
+    int difference = 0;
+    for (size_t i = 0; i < canvas_size; i++) {
+      int d = abs((int)canvas[i] - (int)lround(expected[i]));
+      difference = d > difference ? d : difference;
+      // go on from the canvas, so that rounding differences do not add up
+      expected[i] = canvas[i];
+    }
+    TEST_CHECK(difference <= MAX_DIFFERENCE, "%s frame %u: canvas off by %d", name, frame,
+        difference);
+    TEST_CHECK(apng_compositor_get_frame(compositor) == frame, "%s frame %u: canvas has frame %u",
+        name, frame, apng_compositor_get_frame(compositor));
+
+    memcpy(canvases + canvas_size * frame, canvas, canvas_size);
+    if (frame == snapshot_frame) {
+      apng_compositor_save(compositor, snapshot);
+    }
+    decoded++;
+  }
+
+  // back to the snapshot, then on to the last frame again
+  if (decoded == frame_count && snapshot_frame + 1 < frame_count) {
+    apng_compositor_restore(compositor, snapshot);
+    TEST_CHECK(upng_seek_frame(upng, snapshot_frame + 1) == UPNG_EOK, "%s: seek failed", name);
+    TEST_CHECK(apng_compositor_get_frame(compositor) == snapshot_frame &&
+        memcmp(apng_compositor_get_canvas(compositor), canvases + canvas_size * snapshot_frame,
+        canvas_size) == 0, "%s: restoring frame %u differs", name, snapshot_frame);
+
+    for (uint32_t frame = snapshot_frame + 1; frame < frame_count; frame++) {
+      upng_error error = apng_compositor_decode_frame(compositor, upng);
+      if (!TEST_CHECK(error == UPNG_EOK && memcmp(apng_compositor_get_canvas(compositor),
+          canvases + canvas_size * frame, canvas_size) == 0,
+          "%s frame %u: differs after restoring frame %u, error %d", name, frame,
+          snapshot_frame, error)) {
+        break;
+      }
+    }
+    TEST_CHECK(upng_get_allocation_count(upng) == allocations,
+        "%s: compositing after a restore allocated", name);
+  }
+
+  free(snapshot);
+  free(canvases);
+  free(previous);
+  free(expected);
+  apng_compositor_free(compositor);
+  upng_free(reference);
+  upng_free(upng);
+}
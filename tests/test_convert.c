@@ -0,0 +1,105 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <upng_internal.h>
+
+#include "test_util.h"
+#include "upng_tests.h"
+
+// The conversion kernel upng_pixel_converter_init picks for this CPU has to write
+// the same pixels as upng_convert_row_reference, for every row width from 0 to past
+// the widest vector loop and its tail, every output format and premultiplied or not.
+// Rows are random samples in the image's format, converted with its palette and
+// colour key, which is planted every few pixels; nothing may be written past the row
+
+#define MAX_WIDTH 200
+#define KEY_EVERY 3
+// bytes after the row that have to stay untouched
+#define GUARD_BYTES 64
+#define GUARD 0xA5
+
+static const char* const target_names[] = {
+  "ARGB8888", "ABGR8888", "RGB565", "RGB888", "RGBA8888", "INDEX8"
+};
+
+static uint32_t random_state = 20100808;
+
+static uint8_t random_byte(void) {
+  random_state = random_state * 1103515245 + 12345;
+  return (uint8_t)(random_state >> 16);
+}
+
+// makes pixel x of a row of depth bits per sample the colour key of converter
+static void plant_key(const upng_pixel_converter* converter, uint32_t depth, uint8_t* src,
+    uint32_t x) {
+  const uint16_t* key = converter->key;
+
+  if (converter->format == UPNG_RGB8) {
+    for (int i = 0; i < 3; i++) {
+      src[x * 3 + i] = (uint8_t)key[i];
+    }
+  } else if (converter->format == UPNG_RGB16) {
+    for (int i = 0; i < 3; i++) {
+      src[x * 6 + i * 2] = (uint8_t)(key[i] >> 8);
+      src[x * 6 + i * 2 + 1] = (uint8_t)key[i];
+    }
+  } else if (depth <= 8) {
+    // grey, most significant sample first in a byte
+    uint32_t bit = x * depth, shift = 8 - depth - bit % 8;
+    uint8_t mask = (uint8_t)(((1u << depth) - 1) << shift);
+    src[bit / 8] = (uint8_t)((src[bit / 8] & ~mask) | ((key[0] << shift) & mask));
+  }
+}
+
+static void test_target(const char* name, const upng_t* upng, upng_pixel_format target,
+    bool premultiplied) {
+  upng_pixel_converter converter;
+  if (!upng_pixel_converter_init(&converter, upng, target, premultiplied)) {
+    // INDEX8 is only for palette and grey images
+    TEST_CHECK(target == UPNG_PIXEL_INDEX8, "%s: no conversion to %s", name, target_names[target]);
+    return;
+  }
+
+  uint32_t bpp = upng_get_bpp(upng), pixel_bytes = upng_pixel_format_bytes(target);
+  size_t dst_size = (size_t)MAX_WIDTH * pixel_bytes + GUARD_BYTES;
+  uint8_t* src = (uint8_t*)malloc(((size_t)MAX_WIDTH * bpp + 7) / 8);
+  uint8_t* expected = (uint8_t*)malloc(dst_size);
+  uint8_t* converted = (uint8_t*)malloc(dst_size);
+
+  for (uint32_t width = 0; width < MAX_WIDTH; width++) {
+    size_t src_size = ((size_t)width * bpp + 7) / 8;
+    for (size_t i = 0; i < src_size; i++) {
+      src[i] = random_byte();
+    }
+    for (uint32_t x = width % KEY_EVERY; converter.has_key && x < width; x += KEY_EVERY) {
+      plant_key(&converter, upng_get_bitdepth(upng), src, x);
+    }
+
+    memset(expected, GUARD, dst_size);
+    memset(converted, GUARD, dst_size);
+    upng_convert_row_reference(&converter, expected, src, width);
+    upng_convert_row(&converter, converted, src, width);
+    if (!TEST_CHECK(memcmp(expected, converted, dst_size) == 0,
+        "%s: %u pixels to %s%s differ from the reference", name, width, target_names[target],
+        premultiplied ? " premultiplied" : "")) {
+      break;
+    }
+  }
+
+  free(converted);
+  free(expected);
+  free(src);
+}
+
+void test_convert(const char* path, uint8_t* png, uint32_t size) {
+  upng_t* upng = upng_new_from_bytes(png, size);
+
+  // only the format and palette upng_load read are needed
+  if (upng_load(upng) == UPNG_EOK) {
+    for (int target = UPNG_PIXEL_ARGB8888; target <= UPNG_PIXEL_INDEX8; target++) {
+      test_target(test_name(path), upng, (upng_pixel_format)target, false);
+      test_target(test_name(path), upng, (upng_pixel_format)target, true);
+    }
+  }
+  upng_free(upng);
+}
@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test_util.h"
+#include "upng_tests.h"
+
+// Inflating a frame's stream in parts on 2, 4 and 8 threads has to give every frame and
+// error that inflating it on one does, for each image and its damaged copies, without
+// verifying checksums and verifying all of them. A part taken over by the thread that
+// called the decode has to bring the chunk CRCs it went past along, so copies with the
+// CRC of one image data chunk wrong are decoded as well. Streams are only cut into
+// parts of UPNG_INFLATE_PART_MIN_BYTES, so upng_test_small_parts is built with a part
+// size the samples reach; in upng_test this just compares one thread with itself
+
+static const uint32_t thread_counts[] = { 2, 4, 8 };
+#define NUM_THREAD_COUNTS (sizeof(thread_counts) / sizeof(thread_counts[0]))
+
+// image data chunks of a file that get a wrong CRC, spread over the file
+#define MAX_CRC_COPIES 64
+
+// what decoding every frame gave: the errors of the calls and hashes of the frames
+typedef struct frames_result {
+  upng_error* errors;
+  uint64_t* hashes;
+  uint32_t count;
+  uint32_t capacity;
+} frames_result;
+
+static void add_frame(frames_result* result, upng_error error, uint64_t hash) {
+  if (result->count == result->capacity) {
+    result->capacity = result->capacity * 2 + 16;
+    result->errors = (upng_error*)realloc(result->errors, result->capacity * sizeof(upng_error));
+    result->hashes = (uint64_t*)realloc(result->hashes, result->capacity * sizeof(uint64_t));
+  }
+  result->errors[result->count] = error;
+  result->hashes[result->count++] = hash;
+}
+
+// decodes the frames of png until one fails, false when the build can not inflate on
+// that many threads
+static bool decode_frames(uint8_t* png, uint32_t size, uint32_t threads, upng_verify verify,
+    frames_result* result) {
+  upng_t* upng = upng_new_from_bytes(png, size);
+
+  result->count = 0;
+  if (upng_set_inflate_threads(upng, threads) == UPNG_EUNSUPPORTED) {
+    upng_free(upng);
+    return false;
+  }
+  upng_set_verify(upng, verify);
+
+  upng_error error = upng_load(upng);
+  add_frame(result, error, 0);
+  while (error == UPNG_EOK) {
+    error = upng_decode_image(upng);
+    add_frame(result, error, error == UPNG_EOK ?
+        test_hash(upng_get_buffer(upng), upng_get_size(upng)) : 0);
+  }
+  upng_free(upng);
+  return true;
+}
+
+static void test_copy(const char* name, const char* damage, uint8_t* png, uint32_t size,
+    frames_result* expected, frames_result* result) {
+  for (int v = 0; v < 2; v++) {
+    upng_verify verify = v == 0 ? UPNG_VERIFY_NONE : UPNG_VERIFY_ALL;
+    decode_frames(png, size, 1, verify, expected);
+
+    for (size_t t = 0; t < NUM_THREAD_COUNTS; t++) {
+      if (!decode_frames(png, size, thread_counts[t], verify, result) ||
+          !TEST_CHECK(result->count == expected->count,
+          "%s%s on %u threads, verify level %d: %u calls, on one thread %u", name, damage,
+          thread_counts[t], verify, result->count, expected->count)) {
+        continue;
+      }
+      // the first call is upng_load
+      for (uint32_t i = 0; i < result->count; i++) {
+        if (!TEST_CHECK(result->errors[i] == expected->errors[i] &&
+            result->hashes[i] == expected->hashes[i],
+            "%s%s on %u threads, verify level %d: call %u gives error %d, on one thread %d%s",
+            name, damage, thread_counts[t], verify, i, result->errors[i], expected->errors[i],
+            result->hashes[i] != expected->hashes[i] ? " and other pixels" : "")) {
+          break;
+        }
+      }
+    }
+  }
+}
+
+static uint32_t read_be32(const uint8_t* p) {
+  return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static bool is_image_data(const uint8_t* chunk) {
+  return memcmp(chunk + 4, "IDAT", 4) == 0 || memcmp(chunk + 4, "fdAT", 4) == 0;
+}
+
+// copies of png with the CRC of one image data chunk flipped
+static void test_chunk_crcs(const char* name, uint8_t* png, uint32_t size,
+    frames_result* expected, frames_result* result) {
+  uint32_t chunks = 0;
+  for (uint32_t pos = 8; pos + 12 <= size && read_be32(png + pos) <= size - pos - 12;
+      pos += read_be32(png + pos) + 12) {
+    chunks += is_image_data(png + pos);
+  }
+
+  uint32_t every = chunks / MAX_CRC_COPIES + 1, index = 0;
+  uint8_t* copy = (uint8_t*)malloc(size);
+  for (uint32_t pos = 8; pos + 12 <= size && read_be32(png + pos) <= size - pos - 12;
+      pos += read_be32(png + pos) + 12) {
+    if (is_image_data(png + pos) && index++ % every == 0) {
+      memcpy(copy, png, size);
+      copy[pos + 8 + read_be32(png + pos) + 3] ^= 1;
+      char damage[48];
+      snprintf(damage, sizeof(damage), " with the CRC of the chunk at %u wrong", pos);
+      test_copy(name, damage, copy, size, expected, result);
+    }
+  }
+  free(copy);
+}
+
+void test_inflate_parts(const char* path, uint8_t* png, uint32_t size) {
+  const char* name = test_name(path);
+  frames_result expected = { 0 }, result = { 0 };
+
+  test_copy(name, "", png, size, &expected, &result);
+  test_chunk_crcs(name, png, size, &expected, &result);
+
+  // each damaged copy gets a buffer of its exact size, so that reads past it are seen
+  for (uint32_t copy = 0; copy < TEST_DAMAGED_COPIES; copy++) {
+    uint8_t* damaged = (uint8_t*)malloc(size);
+    uint32_t damaged_size = test_damage(png, size, copy, damaged);
+    uint8_t* exact = (uint8_t*)malloc(damaged_size > 0 ? damaged_size : 1);
+    memcpy(exact, damaged, damaged_size);
+    char damage[32];
+    snprintf(damage, sizeof(damage), " damaged copy %u", copy);
+    test_copy(name, damage, exact, damaged_size, &expected, &result);
+    free(exact);
+    free(damaged);
+  }
+
+  free(result.hashes);
+  free(result.errors);
+  free(expected.hashes);
+  free(expected.errors);
+}
@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test_util.h"
+#include "upng_tests.h"
+
+// Decoding on a pool of threads and in a pipeline of two has to hand out the same
+// frames and errors as the sequential decoder, in the same order. Each image and its damaged copies are taken
+// through the same script in every mode: the first frame, a seek to the middle of the
+// animation while the pool is decoding ahead, the frames from there to the end, two
+// frames after a seek back to the start, a seek back by one and the rest from there.
+// Every call's error and the hash of every frame it returns are compared with what the
+// sequential decoder gives, without verifying checksums and verifying all of them.
+// In every mode the rows callback has to hand out bands that follow each other from
+// the top of each frame that decodes to its bottom, with the rows as they end up
+
+typedef enum decode_mode {
+  DECODE_SEQUENTIAL,
+  DECODE_POOL_2,
+  DECODE_POOL_4,
+  DECODE_PIPELINE,
+  NUM_DECODE_MODES
+} decode_mode;
+
+static const char* const mode_names[NUM_DECODE_MODES] = {
+  "sequential", "pool of 2", "pool of 4", "pipeline"
+};
+
+// the frame put together from the bands of the rows callback
+typedef struct band_frame {
+  uint8_t* rows;
+  size_t capacity;
+  uint32_t row_bytes;
+  uint32_t height;
+  uint32_t next_row;  // where the next band has to start
+  bool contiguous;    // every band so far started there and was in the frame
+} band_frame;
+
+// what one step of the script gave
+typedef struct step_result {
+  upng_error error;
+  uint32_t frame;     // upng_get_frame_position before the step
+  bool decoded;       // a decode step that succeeded
+  uint64_t hash;      // of the frame it decoded
+  bool bands_cover;   // the bands of the rows callback covered the frame, in order
+  uint64_t bands_hash;  // of the frame the bands put together
+} step_result;
+
+typedef struct script_result {
+  step_result* steps;
+  uint32_t count;
+  uint32_t capacity;
+  band_frame bands;
+} script_result;
+
+static void rows_callback(void* user, const upng_t* upng, uint32_t first_row,
+    uint32_t num_rows) {
+  band_frame* bands = (band_frame*)user;
+  if (first_row != bands->next_row || num_rows == 0 || num_rows > bands->height - first_row) {
+    bands->contiguous = false;
+    return;
+  }
+  size_t offset = (size_t)first_row * bands->row_bytes, length = (size_t)num_rows * bands->row_bytes;
+  memcpy(bands->rows + offset, upng_get_buffer(upng) + offset, length);
+  bands->next_row = first_row + num_rows;
+}
+
+// readies bands for the frame upng decodes next
+static void start_bands(band_frame* bands, const upng_t* upng) {
+  apng_fctl fctl;
+  uint32_t width = upng_get_width(upng), height = upng_get_height(upng);
+  if (upng_get_frame_fctl(upng, upng_get_frame_position(upng), &fctl)) {
+    width = fctl.width;
+    height = fctl.height;
+  }
+  bands->row_bytes = (width * upng_get_bpp(upng) + 7) / 8;
+  bands->height = height;
+  bands->next_row = 0;
+  bands->contiguous = true;
+  if ((size_t)bands->row_bytes * height > bands->capacity) {
+    bands->capacity = (size_t)bands->row_bytes * height;
+    bands->rows = (uint8_t*)realloc(bands->rows, bands->capacity);
+  }
+}
+
+static void add_step(script_result* result, upng_error error, uint32_t frame, uint64_t hash) {
+  if (result->count == result->capacity) {
+    result->capacity = result->capacity * 2 + 16;
+    result->steps = (step_result*)realloc(result->steps, result->capacity * sizeof(step_result));
+  }
+  step_result* step = &result->steps[result->count++];
+  step->error = error;
+  step->frame = frame;
+  step->decoded = false;
+  step->hash = hash;
+  step->bands_cover = false;
+  step->bands_hash = 0;
+}
+
+static upng_error decode_step(upng_t* upng, script_result* result) {
+  band_frame* bands = &result->bands;
+  uint32_t frame = upng_get_frame_position(upng);
+  start_bands(bands, upng);
+  upng_error error = upng_decode_image(upng);
+  add_step(result, error, frame, error == UPNG_EOK ?
+      test_hash(upng_get_buffer(upng), upng_get_size(upng)) : 0);
+  if (error == UPNG_EOK) {
+    step_result* step = &result->steps[result->count - 1];
+    step->decoded = true;
+    step->bands_cover = bands->contiguous && bands->next_row == bands->height;
+    step->bands_hash = test_hash(bands->rows, (size_t)bands->row_bytes * bands->height);
+  }
+  return error;
+}
+
+// decodes frames until one fails, UPNG_EDONE after the last
+static void decode_rest(upng_t* upng, script_result* result) {
+  while (decode_step(upng, result) == UPNG_EOK) {
+  }
+}
+
+static void seek_step(upng_t* upng, uint32_t frame, script_result* result) {
+  add_step(result, upng_seek_frame(upng, frame), frame, 0);
+}
+
+// runs the script on png in mode, false when the build can not decode that way
+static bool run_script(uint8_t* png, uint32_t size, decode_mode mode, upng_verify verify,
+    script_result* result) {
+  upng_t* upng = upng_new_from_bytes(png, size);
+  upng_error error = UPNG_EOK;
+
+  result->count = 0;
+  upng_set_verify(upng, verify);
+  if (mode == DECODE_POOL_2) {
+    error = upng_set_decode_threads(upng, 2);
+  } else if (mode == DECODE_POOL_4) {
+    error = upng_set_decode_threads(upng, 4);
+  } else if (mode == DECODE_PIPELINE) {
+    error = upng_set_decode_pipeline(upng, true);
+  }
+  if (error == UPNG_EUNSUPPORTED) {
+    upng_free(upng);
+    return false;
+  }
+
+  upng_set_rows_callback(upng, rows_callback, &result->bands);
+  error = upng_load(upng);
+  add_step(result, error, 0, 0);
+  if (error == UPNG_EOK) {
+    uint32_t frames = upng_get_frame_count(upng);
+    decode_step(upng, result);
+    seek_step(upng, frames / 2, result);
+    decode_rest(upng, result);
+    seek_step(upng, 0, result);
+    if (decode_step(upng, result) == UPNG_EOK && decode_step(upng, result) == UPNG_EOK) {
+      seek_step(upng, 1, result);
+    }
+    decode_rest(upng, result);
+  }
+  upng_free(upng);
+  return true;
+}
+
+// every frame that decoded came in bands of the rows callback that hold it
+static void check_bands(const char* name, const char* damage, decode_mode mode,
+    upng_verify verify, const script_result* result) {
+  for (uint32_t i = 0; i < result->count; i++) {
+    const step_result* step = &result->steps[i];
+    if (step->decoded && !TEST_CHECK(step->bands_cover && step->bands_hash == step->hash,
+        "%s%s %s, verify level %d: the rows callback %s frame %u", name, damage,
+        mode_names[mode], verify, step->bands_cover ? "gave other rows than" : "did not cover",
+        step->frame)) {
+      return;
+    }
+  }
+}
+
+static void compare_scripts(const char* name, const char* damage, decode_mode mode,
+    upng_verify verify, const script_result* expected, const script_result* result) {
+  if (!TEST_CHECK(result->count == expected->count,
+      "%s%s %s, verify level %d: %u steps, sequential %u", name, damage, mode_names[mode],
+      verify, result->count, expected->count)) {
+    return;
+  }
+  for (uint32_t i = 0; i < result->count; i++) {
+    const step_result* a = &expected->steps[i];
+    const step_result* b = &result->steps[i];
+    if (!TEST_CHECK(a->error == b->error && a->frame == b->frame && a->hash == b->hash,
+        "%s%s %s, verify level %d: step %u at frame %u gives error %d, sequential error %d%s",
+        name, damage, mode_names[mode], verify, i, b->frame, b->error, a->error,
+        a->hash != b->hash ? " and other pixels" : "")) {
+      return;
+    }
+  }
+}
+
+static void test_copy(const char* name, const char* damage, uint8_t* png, uint32_t size,
+    script_result* expected, script_result* result) {
+  for (int v = 0; v < 2; v++) {
+    upng_verify verify = v == 0 ? UPNG_VERIFY_NONE : UPNG_VERIFY_ALL;
+    run_script(png, size, DECODE_SEQUENTIAL, verify, expected);
+    check_bands(name, damage, DECODE_SEQUENTIAL, verify, expected);
+    for (int mode = DECODE_SEQUENTIAL + 1; mode < NUM_DECODE_MODES; mode++) {
+      if (run_script(png, size, (decode_mode)mode, verify, result)) {
+        check_bands(name, damage, (decode_mode)mode, verify, result);
+        compare_scripts(name, damage, (decode_mode)mode, verify, expected, result);
+      }
+    }
+  }
+}
+
+void test_modes(const char* path, uint8_t* png, uint32_t size) {
+  const char* name = test_name(path);
+  script_result expected = { 0 }, result = { 0 };
+
+  test_copy(name, "", png, size, &expected, &result);
+
+  // each damaged copy gets a buffer of its exact size, so that reads past it are seen
+  for (uint32_t copy = 0; copy < TEST_DAMAGED_COPIES; copy++) {
+    uint8_t* damaged = (uint8_t*)malloc(size);
+    uint32_t damaged_size = test_damage(png, size, copy, damaged);
+    uint8_t* exact = (uint8_t*)malloc(damaged_size > 0 ? damaged_size : 1);
+    memcpy(exact, damaged, damaged_size);
+    char damage[32];
+    snprintf(damage, sizeof(damage), " damaged copy %u", copy);
+    test_copy(name, damage, exact, damaged_size, &expected, &result);
+    free(exact);
+    free(damaged);
+  }
+
+  free(result.bands.rows);
+  free(result.steps);
+  free(expected.bands.rows);
+  free(expected.steps);
+}
@@ -0,0 +1,182 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <upng_internal.h>
+
+#include "test_util.h"
+#include "upng_tests.h"
+
+// Each frame upng_set_output_pixels has upng_decode_image write has to be what
+// upng_convert_row_reference makes of upng_get_buffer, row by row at the pitch, in
+// every decode mode, output format and with alpha premultiplied or not. The pitch is
+// wider than a row so that its padding shows, and nothing outside the frame's rows may
+// be written. Pixels too small for the first frame by one byte, or a pitch one byte
+// short of its rows, fail with UPNG_EPARAM before anything is written
+
+// bytes between the end of a row and the next, and after the last row
+#define PITCH_PADDING 13
+#define GUARD_BYTES 64
+#define GUARD 0xA5
+
+typedef enum decode_mode {
+  DECODE_SEQUENTIAL,
+  DECODE_POOL,
+  DECODE_PIPELINE,
+  NUM_DECODE_MODES
+} decode_mode;
+
+static const char* const mode_names[NUM_DECODE_MODES] = { "sequential", "pool", "pipeline" };
+
+static const char* const target_names[] = {
+  "ARGB8888", "ABGR8888", "RGB565", "RGB888", "RGBA8888", "INDEX8"
+};
+
+// a decoder for png in mode, NULL when the build can not decode that way or it does
+// not load
+static upng_t* load(uint8_t* png, uint32_t size, decode_mode mode) {
+  upng_t* upng = upng_new_from_bytes(png, size);
+  upng_error error = UPNG_EOK;
+
+  if (mode == DECODE_POOL) {
+    error = upng_set_decode_threads(upng, 3);
+  } else if (mode == DECODE_PIPELINE) {
+    error = upng_set_decode_pipeline(upng, true);
+  }
+  if (error != UPNG_EOK || upng_load(upng) != UPNG_EOK) {
+    upng_free(upng);
+    return NULL;
+  }
+  return upng;
+}
+
+// the size of the frame upng decodes next
+static void frame_size(const upng_t* upng, uint32_t* width, uint32_t* height) {
+  apng_fctl fctl;
+  *width = upng_get_width(upng);
+  *height = upng_get_height(upng);
+  if (upng_get_frame_fctl(upng, upng_get_frame_position(upng), &fctl)) {
+    *width = fctl.width;
+    *height = fctl.height;
+  }
+}
+
+// true if size bytes of data are all GUARD
+static bool untouched(const uint8_t* data, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    if (data[i] != GUARD) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// the decoded frame in pixels against the reference conversion of upng_get_buffer
+static bool check_frame(const upng_t* upng, const upng_pixel_converter* converter,
+    uint32_t width, uint32_t height, const uint8_t* pixels, uint32_t pitch,
+    size_t pixels_size, uint8_t* expected) {
+  uint32_t row_bytes = width * upng_pixel_format_bytes(converter->target);
+  uint32_t line_bytes = (width * upng_get_bpp(upng) + 7) / 8;
+
+  for (uint32_t y = 0; y < height; y++) {
+    const uint8_t* row = pixels + (size_t)y * pitch;
+    upng_convert_row_reference(converter, expected, upng_get_buffer(upng) + (size_t)y * line_bytes,
+        width);
+    if (memcmp(row, expected, row_bytes) != 0 || !untouched(row + row_bytes, pitch - row_bytes)) {
+      return false;
+    }
+  }
+  return untouched(pixels + (size_t)height * pitch, pixels_size - (size_t)height * pitch);
+}
+
+static void test_target(const char* name, uint8_t* png, uint32_t size, decode_mode mode,
+    upng_pixel_format target, bool premultiplied) {
+  upng_t* upng = load(png, size, mode);
+  if (upng == NULL) {
+    return;
+  }
+
+  upng_pixel_converter converter;
+  bool convertible = upng_pixel_converter_init(&converter, upng, target, premultiplied);
+  uint32_t pixel_bytes = upng_pixel_format_bytes(target);
+  uint32_t pitch = upng_get_width(upng) * pixel_bytes + PITCH_PADDING;
+  size_t pixels_size = (size_t)pitch * upng_get_height(upng) + GUARD_BYTES;
+  uint8_t* pixels = (uint8_t*)malloc(pixels_size);
+  uint8_t* expected = (uint8_t*)malloc((size_t)upng_get_width(upng) * pixel_bytes + 1);
+
+  upng_set_output_pixels(upng, pixels, pitch, (uint32_t)pixels_size, target, premultiplied);
+  for (uint32_t frame = 0; frame < upng_get_frame_count(upng); frame++) {
+    uint32_t width, height;
+    frame_size(upng, &width, &height);
+    memset(pixels, GUARD, pixels_size);
+    upng_error error = upng_decode_image(upng);
+    if (!convertible) {
+      TEST_CHECK(error == UPNG_EUNFORMAT && untouched(pixels, pixels_size),
+          "%s %s: to %s gives error %d or wrote pixels", name, mode_names[mode],
+          target_names[target], error);
+      break;
+    }
+    if (!TEST_CHECK(error == UPNG_EOK, "%s %s frame %u: to %s%s gives error %d", name,
+        mode_names[mode], frame, target_names[target], premultiplied ? " premultiplied" : "",
+        error) ||
+        !TEST_CHECK(check_frame(upng, &converter, width, height, pixels, pitch, pixels_size,
+        expected), "%s %s frame %u: %s%s pixels differ from the reference conversion", name,
+        mode_names[mode], frame, target_names[target], premultiplied ? " premultiplied" : "")) {
+      break;
+    }
+  }
+
+  free(expected);
+  free(pixels);
+  upng_free(upng);
+}
+
+// pixels that are one byte too small, or a pitch one byte short, for the first frame
+static void test_too_small(const char* name, uint8_t* png, uint32_t size, decode_mode mode) {
+  upng_t* upng = load(png, size, mode);
+  if (upng == NULL) {
+    return;
+  }
+  uint32_t width, height;
+  frame_size(upng, &width, &height);
+  upng_free(upng);
+  if (width == 0 || height == 0) {
+    return;
+  }
+
+  uint32_t row_bytes = width * upng_pixel_format_bytes(UPNG_PIXEL_RGBA8888);
+  size_t fit = (size_t)row_bytes * height;
+  uint8_t* pixels = (uint8_t*)malloc(fit + GUARD_BYTES);
+  const struct {
+    const char* what;
+    uint32_t pitch;
+    uint32_t size;
+  } cases[] = {
+    { "one byte too small", row_bytes, (uint32_t)fit - 1 },
+    { "a pitch one byte short", row_bytes - 1, (uint32_t)fit + GUARD_BYTES },
+  };
+
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    upng = load(png, size, mode);
+    memset(pixels, GUARD, fit + GUARD_BYTES);
+    TEST_CHECK(upng_set_output_pixels(upng, pixels, cases[i].pitch, cases[i].size,
+        UPNG_PIXEL_RGBA8888, false) == UPNG_EOK, "%s %s: pixels refused", name, mode_names[mode]);
+    upng_error error = upng_decode_image(upng);
+    TEST_CHECK(error == UPNG_EPARAM && untouched(pixels, fit + GUARD_BYTES),
+        "%s %s: pixels %s give error %d or were written", name, mode_names[mode], cases[i].what,
+        error);
+    upng_free(upng);
+  }
+  free(pixels);
+}
+
+void test_output(const char* path, uint8_t* png, uint32_t size) {
+  const char* name = test_name(path);
+
+  for (int mode = 0; mode < NUM_DECODE_MODES; mode++) {
+    for (int target = UPNG_PIXEL_ARGB8888; target <= UPNG_PIXEL_INDEX8; target++) {
+      test_target(name, png, size, (decode_mode)mode, (upng_pixel_format)target, false);
+      test_target(name, png, size, (decode_mode)mode, (upng_pixel_format)target, true);
+    }
+    test_too_small(name, png, size, (decode_mode)mode);
+  }
+}
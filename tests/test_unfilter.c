@@ -0,0 +1,87 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <upng_internal.h>
+
+#include "test_util.h"
+#include "upng_tests.h"
+
+// Every table of unfilter kernels the CPU can run has to reconstruct the same bytes
+// as the plain C loops, for every bytewidth and filter type and rows from one pixel to
+// past the widest vector loop and its tail. Rows and the previous row are random; the
+// filtered row and the previous one are allocated at their exact length, so that a
+// sanitizer sees reads past them, and nothing may be written past the reconstructed row
+
+#define MAX_PIXELS 100
+// bytes after the row that have to stay untouched
+#define GUARD_BYTES 64
+#define GUARD 0xA5
+
+static const uint32_t bytewidths[] = { 1, 2, 3, 4, 6, 8 };
+#define NUM_BYTEWIDTHS (sizeof(bytewidths) / sizeof(bytewidths[0]))
+
+static const char* const filter_names[] = { "Sub", "Up", "Average", "Paeth" };
+
+static uint32_t random_state = 20100808;
+
+static uint8_t random_byte(void) {
+  random_state = random_state * 1103515245 + 12345;
+  return (uint8_t)(random_state >> 16);
+}
+
+static void check_kernel(const char* table, upng_unfilter_fn kernel,
+    upng_unfilter_fn reference, uint32_t bpp, int filter) {
+  size_t recon_size = (size_t)MAX_PIXELS * bpp + GUARD_BYTES;
+  uint8_t* expected = (uint8_t*)malloc(recon_size);
+  uint8_t* recon = (uint8_t*)malloc(recon_size);
+
+  for (uint32_t pixels = 1; pixels <= MAX_PIXELS; pixels++) {
+    uint32_t length = pixels * bpp;
+    uint8_t* scanline = (uint8_t*)malloc(length);
+    uint8_t* precon = (uint8_t*)malloc(length);
+    for (uint32_t i = 0; i < length; i++) {
+      scanline[i] = random_byte();
+      precon[i] = random_byte();
+    }
+
+    memset(expected, GUARD, recon_size);
+    memset(recon, GUARD, recon_size);
+    reference(expected, scanline, precon, length);
+    kernel(recon, scanline, precon, length);
+    bool same = TEST_CHECK(memcmp(expected, recon, recon_size) == 0,
+        "%s %s of %u pixels of %u bytes differs from the scalar loop", table,
+        filter_names[filter], pixels, bpp);
+
+    free(precon);
+    free(scanline);
+    if (!same) {
+      break;
+    }
+  }
+
+  free(recon);
+  free(expected);
+}
+
+void test_unfilter(void) {
+  const upng_unfilter_kernels* reference = upng_get_unfilter_kernels_scalar();
+  const upng_unfilter_kernels* tables[UPNG_MAX_UNFILTER_TABLES];
+  const char* names[UPNG_MAX_UNFILTER_TABLES];
+  uint32_t count = upng_list_unfilter_kernels(tables, names);
+
+  // the table the decoder uses is one of them
+  bool listed = false;
+  for (uint32_t t = 0; t < count; t++) {
+    listed = listed || tables[t] == upng_get_unfilter_kernels();
+  }
+  TEST_CHECK(listed, "the unfilter kernels in use are not listed");
+
+  for (uint32_t t = 0; t < count; t++) {
+    for (size_t b = 0; b < NUM_BYTEWIDTHS; b++) {
+      uint32_t bpp = bytewidths[b];
+      for (int filter = 0; filter < 4; filter++) {
+        check_kernel(names[t], (*tables[t])[bpp][filter], (*reference)[bpp][filter], bpp, filter);
+      }
+    }
+  }
+}
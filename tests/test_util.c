@@ -0,0 +1,190 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "test_util.h"
+
+static uint32_t failures = 0;
+
+uint8_t* test_read_file(const char* path, uint32_t* size) {
+  FILE* file = fopen(path, "rb");
+  if (file == NULL) {
+    return NULL;
+  }
+
+  fseek(file, 0, SEEK_END);
+  long length = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  // one byte more, so that an empty file is not a NULL buffer
+  uint8_t* data = length >= 0 ? (uint8_t*)malloc((size_t)length + 1) : NULL;
+  if (data != NULL && fread(data, 1, (size_t)length, file) != (size_t)length) {
+    free(data);
+    data = NULL;
+  }
+  fclose(file);
+
+  *size = data != NULL ? (uint32_t)length : 0;
+  return data;
+}
+
+const char* test_name(const char* path) {
+  const char* name = path;
+  for (const char* c = path; *c != '\0'; c++) {
+    if (*c == '/' || *c == '\\') {
+      name = c + 1;
+    }
+  }
+  return name;
+}
+
+bool test_check(bool ok, const char* file, int line, const char* format, ...) {
+  if (!ok) {
+    va_list args;
+    failures++;
+    printf("%s:%d: ", test_name(file), line);
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+    printf("\n");
+  }
+  return ok;
+}
+
+uint32_t test_failures(void) {
+  return failures;
+}
+
+upng_error test_decode_all(upng_t* upng, uint32_t* frames) {
+  upng_error error;
+  *frames = 0;
+  while ((error = upng_decode_image(upng)) == UPNG_EOK) {
+    (*frames)++;
+  }
+  return error;
+}
+
+uint64_t test_hash(const uint8_t* data, size_t size) {
+  uint64_t hash = 14695981039346656037ull;
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ data[i]) * 1099511628211ull;
+  }
+  return hash;
+}
+
+#define TRUNCATED_COPIES 7
+#define FLIPPED_DATA_COPIES 8
+
+// offset of byte index of the IDAT and fdAT chunk contents, 0 past the end of them;
+// data_size gets the number of those bytes
+static uint32_t image_data_offset(const uint8_t* png, uint32_t size, uint32_t index,
+    uint32_t* data_size) {
+  uint32_t pos = 8, offset = 0;
+
+  *data_size = 0;
+  while (pos + 12 <= size) {
+    uint32_t length = (uint32_t)png[pos] << 24 | png[pos + 1] << 16 | png[pos + 2] << 8 | png[pos + 3];
+    const uint8_t* type = png + pos + 4;
+    if (length > size - pos - 12) {
+      break;
+    }
+    if (memcmp(type, "IDAT", 4) == 0 || (memcmp(type, "fdAT", 4) == 0 && length > 4)) {
+      // the sequence number of fdAT is not image data
+      uint32_t skip = type[0] == 'f' ? 4 : 0;
+      if (index >= *data_size && index - *data_size < length - skip) {
+        offset = pos + 8 + skip + (index - *data_size);
+      }
+      *data_size += length - skip;
+    }
+    pos += length + 12;
+  }
+  return offset;
+}
+
+uint32_t test_damage(const uint8_t* png, uint32_t size, uint32_t copy, uint8_t* out) {
+  memcpy(out, png, size);
+
+  if (copy < TRUNCATED_COPIES) {
+    return (uint32_t)((uint64_t)size * (copy + 1) / (TRUNCATED_COPIES + 1));
+  }
+  copy -= TRUNCATED_COPIES;
+
+  if (copy < FLIPPED_DATA_COPIES) {
+    uint32_t data_size;
+    image_data_offset(png, size, 0, &data_size);
+    if (data_size > 0) {
+      uint32_t index = (uint32_t)((uint64_t)data_size * (copy * 2 + 1) / (FLIPPED_DATA_COPIES * 2));
+      out[image_data_offset(png, size, index, &data_size)] ^= (uint8_t)(1 << copy);
+      return size;
+    }
+  }
+
+  // a fixed pseudo random place and value for every copy
+  uint32_t place = (copy + 1) * 2654435761u;
+  if (size > 8) {
+    out[8 + place % (size - 8)] ^= (uint8_t)((place >> 24) | 1);
+  }
+  return size;
+}
+
+uint32_t test_image_data_size(const uint8_t* png, uint32_t size) {
+  uint32_t data_size;
+  image_data_offset(png, size, 0, &data_size);
+  return data_size;
+}
+
+bool test_flip_data_bit(const uint8_t* png, uint32_t size, uint32_t index, uint32_t bit,
+    uint8_t* out) {
+  uint32_t data_size;
+  uint32_t offset = image_data_offset(png, size, index, &data_size);
+  if (index >= data_size) {
+    return false;
+  }
+  memcpy(out, png, size);
+  out[offset] ^= (uint8_t)(1 << bit);
+  return true;
+}
+
+bool test_random_stream(const uint8_t* png, uint32_t size, uint32_t seed, uint8_t* out) {
+  uint32_t data_size;
+  uint32_t first = image_data_offset(png, size, 2, &data_size);
+  if (data_size < 3) {
+    return false;
+  }
+
+  // every byte of the chunks from the first block on, CRCs and all, then the chunk
+  // headers back as they were
+  uint32_t state = seed * 2654435761u + 1;
+  memcpy(out, png, size);
+  for (uint32_t pos = first; pos < size; pos++) {
+    state = state * 1103515245 + 12345;
+    out[pos] = (uint8_t)(state >> 16);
+  }
+  uint32_t pos = 8;
+  while (pos + 12 <= size) {
+    uint32_t length = (uint32_t)png[pos] << 24 | png[pos + 1] << 16 | png[pos + 2] << 8 | png[pos + 3];
+    if (length > size - pos - 12) {
+      break;
+    }
+    bool data = memcmp(png + pos + 4, "IDAT", 4) == 0 || memcmp(png + pos + 4, "fdAT", 4) == 0;
+    uint32_t end = pos + 12 + length;
+    uint32_t keep_end = data ? pos + 8 + (png[pos + 4] == 'f' ? 4 : 0) : end;
+    for (uint32_t i = pos; i < keep_end; i++) {
+      if (i >= first) {
+        out[i] = png[i];
+      }
+    }
+    pos = end;
+  }
+
+  // the block type is in bits 1 and 2 of the first byte after the zlib header
+  out[first] = (uint8_t)((out[first] & ~6) | (seed % 2 == 0 ? 2 : 4));
+  return true;
+}
+
+double test_seconds(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec * 1e-9;
+}
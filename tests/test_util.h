@@ -0,0 +1,56 @@
+#if !defined(UPNG_TEST_UTIL_H)
+#define UPNG_TEST_UTIL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <upng.h>
+
+// Helpers shared by the upng tests and benchmarks
+
+// reads a whole file into memory from malloc, NULL if it can not be read
+uint8_t* test_read_file(const char* path, uint32_t* size);
+
+// the file name of path, for messages
+const char* test_name(const char* path);
+
+// counts a failed check and prints the message for it, returns ok
+bool test_check(bool ok, const char* file, int line, const char* format, ...);
+#define TEST_CHECK(ok, ...) test_check((ok), __FILE__, __LINE__, __VA_ARGS__)
+
+// number of failed checks so far
+uint32_t test_failures(void);
+
+// decodes frames of upng until it returns an error, UPNG_EDONE after the last frame
+upng_error test_decode_all(upng_t* upng, uint32_t* frames);
+
+// 64-bit FNV-1a hash of data
+uint64_t test_hash(const uint8_t* data, size_t size);
+
+// number of damaged copies test_damage makes of a file
+#define TEST_DAMAGED_COPIES 20
+
+// writes damaged copy number copy of png to out, which has room for size bytes, and
+// returns its size. The first copies are cut short, the next have a bit flipped in
+// their image data and the last a byte changed anywhere past the signature
+uint32_t test_damage(const uint8_t* png, uint32_t size, uint32_t copy, uint8_t* out);
+
+// bytes of image data in png, the contents of its IDAT and fdAT chunks
+uint32_t test_image_data_size(const uint8_t* png, uint32_t size);
+
+// writes png to out, which has room for size bytes, with bit flipped in byte index of
+// its image data. False, and nothing written, if the image data is not that long
+bool test_flip_data_bit(const uint8_t* png, uint32_t size, uint32_t index, uint32_t bit,
+    uint8_t* out);
+
+// writes png to out, which has room for size bytes, with its image data past the zlib
+// header of the first frame replaced by pseudo random bytes drawn from seed. The first
+// block is one with fixed codes for even seeds and with dynamic ones for odd seeds.
+// False, and nothing written, if the image data is too short
+bool test_random_stream(const uint8_t* png, uint32_t size, uint32_t seed, uint8_t* out);
+
+// a monotonic clock in seconds
+double test_seconds(void);
+
+#endif
@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(UPNG_INFLATE_ZLIB)
+#include <zlib.h>
+#endif
+
+#include <upng_internal.h>
+
+#include "test_util.h"
+
+// Throughput of upng, built once for every inflate backend so that they can be
+// compared on the same machine
+// usage: upng_bench decode file.png...
+//   decodes every frame of each file over and over, after a single upng_load
+// usage: upng_bench convert file.png...
+//   converts a row to every pixel format with the kernel picked for this CPU and
+//   with the plain C reference, once for each image format among the files
+
+// runs of a measurement add up to at least this long
+#define BENCH_SECONDS 0.25
+#define CONVERT_SECONDS 0.05
+
+// pixels of the rows converted, which stay in the L1 cache
+#define CONVERT_WIDTH 2048
+
+static const char* const format_names[] = {
+  "bad", "indexed1", "indexed2", "indexed4", "indexed8", "rgb8", "rgb16", "rgba8",
+  "rgba16", "grey1", "grey2", "grey4", "grey8", "grey_alpha1", "grey_alpha2",
+  "grey_alpha4", "grey_alpha8"
+};
+
+static const char* const target_names[] = {
+  "ARGB8888", "ABGR8888", "RGB565", "RGB888", "RGBA8888", "INDEX8"
+};
+
+static const char* backend_name(void) {
+#if defined(UPNG_INFLATE_ZLIB)
+  return "zlib";
+#elif defined(UPNG_INFLATE_FAST)
+  return "fast";
+#else
+  return "builtin";
+#endif
+}
+
+static int bench_decode(int count, char* paths[]) {
+  uint64_t total_bytes = 0;
+  double total_seconds = 0;
+
+  printf("inflate backend: %s", backend_name());
+#if defined(UPNG_INFLATE_ZLIB)
+  printf(" (zlib %s)", zlibVersion());
+#endif
+  printf("\n%-28s %10s %10s\n", "file", "ms/decode", "MB/s");
+
+  for (int i = 0; i < count; i++) {
+    uint32_t size, frames;
+    uint8_t* png = test_read_file(paths[i], &size);
+    upng_t* upng = png != NULL ? upng_new_from_bytes(png, size) : NULL;
+
+    if (upng == NULL || upng_load(upng) != UPNG_EOK) {
+      printf("%-28s skipped, it does not load\n", test_name(paths[i]));
+      upng_free(upng);
+      free(png);
+      continue;
+    }
+
+    // bytes of decoded image data in all the frames of one pass
+    uint64_t bytes = 0;
+    while (upng_decode_image(upng) == UPNG_EOK) {
+      bytes += upng_get_size(upng);
+    }
+
+    uint32_t runs = 0;
+    double start = test_seconds(), seconds;
+    do {
+      upng_rewind(upng);
+      test_decode_all(upng, &frames);
+      runs++;
+      seconds = test_seconds() - start;
+    } while (seconds < BENCH_SECONDS);
+
+    printf("%-28s %10.3f %10.1f\n", test_name(paths[i]), seconds * 1e3 / runs,
+        bytes * runs / seconds / 1e6);
+    total_bytes += bytes * runs;
+    total_seconds += seconds;
+    upng_free(upng);
+    free(png);
+  }
+
+  if (total_seconds > 0) {
+    printf("%-28s %10s %10.1f\n", "all", "", total_bytes / total_seconds / 1e6);
+  }
+  return EXIT_SUCCESS;
+}
+
+// millions of pixels a second convert gets through
+static double convert_speed(const upng_pixel_converter* converter, upng_convert_fn convert,
+    uint8_t* dst, const uint8_t* src) {
+  uint32_t runs = 0;
+  double start = test_seconds(), seconds;
+  do {
+    convert(converter, dst, src, CONVERT_WIDTH);
+    runs++;
+    seconds = test_seconds() - start;
+  } while (seconds < CONVERT_SECONDS);
+  return (double)CONVERT_WIDTH * runs / seconds / 1e6;
+}
+
+static int bench_convert(int count, char* paths[]) {
+  // the colour key makes the RGB and grey kernels take another path
+  bool benched[sizeof(format_names) / sizeof(format_names[0])][2] = { { false } };
+  uint8_t* src = (uint8_t*)malloc(CONVERT_WIDTH * UPNG_MAX_BYTEWIDTH);
+  uint8_t* dst = (uint8_t*)malloc(CONVERT_WIDTH * 4);
+
+  for (uint32_t i = 0; i < CONVERT_WIDTH * UPNG_MAX_BYTEWIDTH; i++) {
+    src[i] = (uint8_t)(i * 2654435761u >> 24);
+  }
+  printf("%-16s %-9s %12s %12s %8s\n", "format", "target", "kernel Mpx/s", "scalar Mpx/s",
+      "speedup");
+
+  for (int i = 0; i < count; i++) {
+    uint32_t size;
+    uint8_t* png = test_read_file(paths[i], &size);
+    upng_t* upng = png != NULL ? upng_new_from_bytes(png, size) : NULL;
+
+    upng_pixel_converter converter;
+    // RGBA8888 works for every format the decoder has, and tells if there is a key
+    if (upng == NULL || upng_load(upng) != UPNG_EOK ||
+        !upng_pixel_converter_init(&converter, upng, UPNG_PIXEL_RGBA8888, false) ||
+        benched[upng_get_format(upng)][converter.has_key]) {
+      upng_free(upng);
+      free(png);
+      continue;
+    }
+
+    upng_format format = upng_get_format(upng);
+    bool keyed = converter.has_key;
+    benched[format][keyed] = true;
+    for (int target = UPNG_PIXEL_ARGB8888; target <= UPNG_PIXEL_INDEX8; target++) {
+      if (!upng_pixel_converter_init(&converter, upng, (upng_pixel_format)target, false)) {
+        continue;
+      }
+      double kernel = convert_speed(&converter, converter.convert, dst, src);
+      double scalar = convert_speed(&converter, upng_convert_row_reference, dst, src);
+      printf("%-12s%-4s %-9s %12.0f %12.0f %7.1fx\n", format_names[format], keyed ? "+key" : "",
+          target_names[target], kernel, scalar, kernel / scalar);
+    }
+    upng_free(upng);
+    free(png);
+  }
+
+  free(dst);
+  free(src);
+  return EXIT_SUCCESS;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc > 2 && strcmp(argv[1], "decode") == 0) {
+    return bench_decode(argc - 2, argv + 2);
+  }
+  if (argc > 2 && strcmp(argv[1], "convert") == 0) {
+    return bench_convert(argc - 2, argv + 2);
+  }
+
+  printf("usage: %s decode file.png...\n       %s convert file.png...\n", argv[0], argv[0]);
+  return EXIT_FAILURE;
+}
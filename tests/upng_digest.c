@@ -0,0 +1,90 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test_util.h"
+
+// Prints what decoding each file and damaged copies of it gives: the error of
+// upng_load, then the error and a hash of every frame up to the first error. Built
+// once for every inflate backend; the inflate_backends tests check that they all
+// print the same. Besides the copies of test_damage, copies with a bit of the image
+// data flipped and copies with random deflate blocks go through every backend's checks
+// on the deflate streams, decoded without verifying checksums that would catch them
+// first
+// usage: upng_digest file.png...
+
+static const upng_verify verify_levels[] = { UPNG_VERIFY_NONE, UPNG_VERIFY_ALL };
+
+// flips in the first bytes of the image data, where the code lengths of the first
+// block are, and spread over all of it
+#define HEADER_FLIPS 64
+#define SPREAD_FLIPS 192
+// copies with random blocks in place of the image data
+#define RANDOM_STREAMS 64
+
+static void digest(const char* name, int copy, upng_verify verify, uint8_t* png, uint32_t size) {
+  upng_t* upng = upng_new_from_bytes(png, size);
+  upng_error error;
+
+  upng_set_verify(upng, verify);
+  error = upng_load(upng);
+  printf("%s %d %d: load %d", name, copy, verify, error);
+
+  if (error == UPNG_EOK) {
+    printf(", %u frames", upng_get_frame_count(upng));
+    while ((error = upng_decode_image(upng)) == UPNG_EOK) {
+      printf(" %016llx", (unsigned long long)test_hash(upng_get_buffer(upng), upng_get_size(upng)));
+    }
+    printf(", error %d", error);
+  }
+  printf("\n");
+  upng_free(upng);
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    printf("usage: %s file.png...\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  for (int i = 1; i < argc; i++) {
+    uint32_t size;
+    uint8_t* png = test_read_file(argv[i], &size);
+    if (png == NULL) {
+      printf("%s: can not be read\n", argv[i]);
+      return EXIT_FAILURE;
+    }
+
+    uint8_t* damaged = (uint8_t*)malloc(size + 1);
+    for (size_t v = 0; v < sizeof(verify_levels) / sizeof(verify_levels[0]); v++) {
+      digest(test_name(argv[i]), -1, verify_levels[v], png, size);
+      for (uint32_t copy = 0; copy < TEST_DAMAGED_COPIES; copy++) {
+        uint32_t damaged_size = test_damage(png, size, copy, damaged);
+        // in memory of its own size, so that a sanitizer sees reads past a cut short file
+        uint8_t* exact = (uint8_t*)malloc(damaged_size + (damaged_size == 0));
+        memcpy(exact, damaged, damaged_size);
+        digest(test_name(argv[i]), (int)copy, verify_levels[v], exact, damaged_size);
+        free(exact);
+      }
+    }
+
+    uint32_t data_size = test_image_data_size(png, size);
+    for (uint32_t flip = 0; flip < HEADER_FLIPS + SPREAD_FLIPS; flip++) {
+      uint32_t index = flip < HEADER_FLIPS ? flip :
+          (uint32_t)((uint64_t)data_size * (flip - HEADER_FLIPS) / SPREAD_FLIPS);
+      if (test_flip_data_bit(png, size, index, flip * 3 % 8, damaged)) {
+        digest(test_name(argv[i]), (int)(TEST_DAMAGED_COPIES + flip), UPNG_VERIFY_NONE,
+            damaged, size);
+      }
+    }
+    for (uint32_t seed = 0; seed < RANDOM_STREAMS; seed++) {
+      if (test_random_stream(png, size, seed, damaged)) {
+        digest(test_name(argv[i]), (int)(TEST_DAMAGED_COPIES + HEADER_FLIPS + SPREAD_FLIPS + seed),
+            UPNG_VERIFY_NONE, damaged, size);
+      }
+    }
+    free(damaged);
+    free(png);
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,62 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test_util.h"
+#include "upng_tests.h"
+
+// Runs a test suite on sample images
+// usage: upng_test suite file.png...
+
+typedef struct test_suite {
+  const char* name;
+  test_suite_fn run;
+  test_once_fn run_once;
+} test_suite;
+
+static const test_suite suites[] = {
+  { "allocations", test_allocations, NULL },
+  { "blend", NULL, test_blend },
+  { "checksums", test_checksums, NULL },
+  { "compositor", test_compositor, NULL },
+  { "convert", test_convert, NULL },
+  { "inflate_parts", test_inflate_parts, NULL },
+  { "modes", test_modes, NULL },
+  { "output", test_output, NULL },
+  { "unfilter", NULL, test_unfilter },
+};
+
+#define NUM_SUITES (sizeof(suites) / sizeof(suites[0]))
+
+int main(int argc, char* argv[]) {
+  const test_suite* suite = NULL;
+
+  for (size_t i = 0; argc > 1 && i < NUM_SUITES; i++) {
+    if (strcmp(argv[1], suites[i].name) == 0) {
+      suite = &suites[i];
+    }
+  }
+  if (suite == NULL) {
+    printf("usage: %s suite file.png...\nsuites:", argv[0]);
+    for (size_t i = 0; i < NUM_SUITES; i++) {
+      printf(" %s", suites[i].name);
+    }
+    printf("\n");
+    return EXIT_FAILURE;
+  }
+
+  if (suite->run_once != NULL) {
+    suite->run_once();
+  }
+  for (int i = 2; suite->run != NULL && i < argc; i++) {
+    uint32_t size;
+    uint8_t* png = test_read_file(argv[i], &size);
+    if (TEST_CHECK(png != NULL, "%s: can not be read", argv[i])) {
+      suite->run(argv[i], png, size);
+    }
+    free(png);
+  }
+
+  printf("%s: %d images, %u failures\n", suite->name, argc - 2, test_failures());
+  return test_failures() == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
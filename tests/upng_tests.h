@@ -0,0 +1,42 @@
+#if !defined(UPNG_TESTS_H)
+#define UPNG_TESTS_H
+
+#include <stdint.h>
+
+// The suites of upng_test, one file each. A suite is run once for every sample
+// image and reports what it finds wrong with TEST_CHECK; suites of kernels that
+// make up their own input are run once, before any images
+
+typedef void (*test_suite_fn)(const char* path, uint8_t* png, uint32_t size);
+typedef void (*test_once_fn)(void);
+
+// the checksum functions are right and every verify level checks what it says
+void test_checksums(const char* path, uint8_t* png, uint32_t size);
+
+// upng_get_allocation_count does not change after upng_load
+void test_allocations(const char* path, uint8_t* png, uint32_t size);
+
+// apng_compositor gives the canvases of the APNG spec, without allocating
+void test_compositor(const char* path, uint8_t* png, uint32_t size);
+
+// every blend kernel the CPU can run leaves the canvas the plain C blend does
+void test_blend(void);
+
+// the pixel conversion kernels write what the plain C reference does
+void test_convert(const char* path, uint8_t* png, uint32_t size);
+
+// upng_set_output_pixels writes what the reference conversion makes of each frame, at
+// the pitch and in every decode mode, and nothing when they do not fit
+void test_output(const char* path, uint8_t* png, uint32_t size);
+
+// a stream inflated in parts on several threads gives the frames and errors of one thread
+void test_inflate_parts(const char* path, uint8_t* png, uint32_t size);
+
+// the decode pool and pipeline give the frames and errors of the sequential decoder,
+// also after seeks, and the rows callback gets every frame in order
+void test_modes(const char* path, uint8_t* png, uint32_t size);
+
+// every unfilter kernel the CPU can run reconstructs what the plain C loops do
+void test_unfilter(void);
+
+#endif
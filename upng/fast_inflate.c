@@ -0,0 +1,748 @@
+/*
+fast_inflate -- a single-file raw deflate (RFC 1951) decoder, see fast_inflate.h
+*/
+
+#include <string.h>
+
+#include "fast_inflate.h"
+
+/* table entry layout:
+ *   bits 0-7    bits to drop from bitbuf: the code length plus the extra bits of a length
+ *               or distance, the root bits for a subtable pointer
+ *   bits 8-11   code length, where the extra bits start; index bits of a subtable
+ *   bit 13      end of block
+ *   bit 14      subtable pointer
+ *   bit 15      exceptional: an end of block, a subtable pointer or no code at all
+ *   bits 16-30  literal, base length, base distance, code length symbol or subtable offset
+ *   bit 31      literal */
+#define ENTRY_LITERAL 0x80000000u
+#define ENTRY_EXCEPTIONAL 0x8000u
+#define ENTRY_SUBTABLE 0x4000u
+#define ENTRY_END_OF_BLOCK 0x2000u
+/* no code maps to these bits, or the symbol is one deflate never uses */
+#define ENTRY_INVALID ENTRY_EXCEPTIONAL
+
+#define ENTRY_DROP(e) ((e) & 0xFF)
+#define ENTRY_CODE_LENGTH(e) (((e) >> 8) & 0xF)
+#define ENTRY_VALUE(e) (((e) >> 16) & 0x7FFF)
+
+#define LITLEN_MASK ((1u << FAST_INFLATE_LITLEN_ROOT_BITS) - 1)
+#define DISTANCE_MASK ((1u << FAST_INFLATE_DISTANCE_ROOT_BITS) - 1)
+#define CODE_LENGTH_MASK ((1u << FAST_INFLATE_CODE_LENGTH_ROOT_BITS) - 1)
+
+#define NUM_LITLEN_SYMBOLS 288
+#define NUM_DISTANCE_SYMBOLS 32
+#define NUM_CODE_LENGTH_SYMBOLS 19
+#define MAX_CODE_LENGTH 15
+#define MAX_MATCH_LENGTH 258
+
+/* bits guaranteed to be in bitbuf after a refill. Enough for a length code with its
+ * extra bits and a distance code with its extra bits: 15 + 5 + 15 + 13 */
+#define REFILL_BITS 56
+
+/* a match copy writes whole 16 byte words, up to this many bytes past the match */
+#define MATCH_COPY_SLACK 32
+
+/* the main loop runs while a refill is a single word load and the longest match
+ * plus its copy slack fits in the output */
+#define FAST_INPUT_BYTES 8
+#define FAST_OUTPUT_BYTES (MAX_MATCH_LENGTH + MATCH_COPY_SLACK)
+
+/* the base lengths of length codes 257-285, and their extra bits */
+static const uint16_t LENGTH_BASE[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59,
+	67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t LENGTH_EXTRA[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5,
+	5, 5, 5, 0
+};
+
+/* the base distances of distance codes 0-29, and their extra bits */
+static const uint16_t DISTANCE_BASE[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513,
+	769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t DISTANCE_EXTRA[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10,
+	11, 11, 12, 12, 13, 13
+};
+
+/* the order the code lengths of the code length code are stored in */
+static const uint8_t CODE_LENGTH_ORDER[NUM_CODE_LENGTH_SYMBOLS] = {
+	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+typedef enum alphabet {
+	ALPHABET_LITLEN,
+	ALPHABET_DISTANCE,
+	ALPHABET_CODE_LENGTH
+} alphabet;
+
+static inline uint64_t load_le64(const uint8_t* p) {
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap64(v);
+#endif
+	return v;
+}
+
+/* copies 16 bytes that may overlap the destination, as one load and one store */
+static inline void copy16(uint8_t* dst, const uint8_t* src) {
+	uint8_t word[16];
+	memcpy(word, src, sizeof(word));
+	memcpy(dst, word, sizeof(word));
+}
+
+/* ---- tables ---- */
+
+/* the entry of symbol less its code length: value and flags, and the extra bits in
+ * bits 0-7, to which the code length is added */
+static uint32_t symbol_entry(alphabet alphabet, uint32_t symbol) {
+	if (alphabet == ALPHABET_LITLEN) {
+		if (symbol < 256) {
+			return ENTRY_LITERAL | symbol << 16;
+		} else if (symbol == 256) {
+			return ENTRY_EXCEPTIONAL | ENTRY_END_OF_BLOCK;
+		} else if (symbol <= 285) {
+			return (uint32_t)LENGTH_BASE[symbol - 257] << 16 | LENGTH_EXTRA[symbol - 257];
+		}
+		return ENTRY_INVALID;
+	} else if (alphabet == ALPHABET_DISTANCE) {
+		if (symbol < 30) {
+			return (uint32_t)DISTANCE_BASE[symbol] << 16 | DISTANCE_EXTRA[symbol];
+		}
+		return ENTRY_INVALID;
+	}
+	return symbol << 16;
+}
+
+static uint32_t reverse_bits(uint32_t code, uint32_t length) {
+	uint32_t reversed = 0;
+	while (length-- > 0) {
+		reversed = reversed << 1 | (code & 1);
+		code >>= 1;
+	}
+	return reversed;
+}
+
+/* builds the table of size entries decoding the code given by the code lengths of
+ * num_symbols symbols, false if they do not form a valid code. A code without any
+ * symbols is valid, every lookup in it is not; the only incomplete code allowed is a
+ * single code of one bit */
+static bool build_table(uint32_t* table, uint32_t size, uint32_t rootbits,
+    const uint8_t* lengths, uint32_t num_symbols, alphabet alphabet) {
+	uint16_t count[MAX_CODE_LENGTH + 1];
+	uint16_t offsets[MAX_CODE_LENGTH + 2];
+	uint16_t sorted[NUM_LITLEN_SYMBOLS];	/* symbols by code length, then by value */
+	uint32_t rootsize = 1u << rootbits;
+	uint32_t num_codes, maxlen = 0, len, i;
+	int32_t left = 1;
+
+	memset(count, 0, sizeof(count));
+	for (i = 0; i < num_symbols; i++) {
+		count[lengths[i]]++;
+		if (lengths[i] > maxlen) {
+			maxlen = lengths[i];
+		}
+	}
+	count[0] = 0;
+
+	for (len = 1; len <= MAX_CODE_LENGTH; len++) {
+		left = (left << 1) - count[len];
+		if (left < 0) {
+			return false;
+		}
+	}
+	if (left > 0 && maxlen > 1) {
+		return false;
+	}
+	if (left > 0) {
+		/* empty, or a single code of one bit: what no code maps to stays invalid */
+		for (i = 0; i < rootsize; i++) {
+			table[i] = ENTRY_INVALID;
+		}
+	}
+
+	offsets[1] = 0;
+	for (len = 1; len <= MAX_CODE_LENGTH; len++) {
+		offsets[len + 1] = offsets[len] + count[len];
+	}
+	num_codes = offsets[MAX_CODE_LENGTH + 1];
+	for (i = 0; i < num_symbols; i++) {
+		if (lengths[i] != 0) {
+			sorted[offsets[lengths[i]]++] = (uint16_t)i;
+		}
+	}
+
+	/* canonical codes go up one by one, shifted left where the code length grows.
+	 * Codes longer than rootbits that share their first rootbits bits come one after
+	 * the other and get a subtable, sized for the codes still to come like zlib does */
+	{
+		uint32_t code = 0, prevlen = 0, next_subtable = rootsize;
+		uint32_t subtable_root = rootsize, subtable = 0, subbits = 0;
+
+		for (i = 0; i < num_codes; i++) {
+			uint32_t symbol = sorted[i];
+			uint32_t entry = symbol_entry(alphabet, symbol);
+			uint32_t reversed, index;
+
+			len = lengths[symbol];
+			code <<= len - prevlen;
+			prevlen = len;
+			reversed = reverse_bits(code, len);
+
+			if (len <= rootbits) {
+				entry += len << 8 | len;
+				for (index = reversed; index < rootsize; index += 1u << len) {
+					table[index] = entry;
+				}
+			} else {
+				uint32_t root = reversed & (rootsize - 1);
+				uint32_t sublen = len - rootbits;
+
+				if (root != subtable_root) {
+					int32_t room;
+
+					subbits = sublen;
+					room = 1 << subbits;
+					while (subbits + rootbits < maxlen) {
+						room -= count[subbits + rootbits];
+						if (room <= 0) {
+							break;
+						}
+						subbits++;
+						room <<= 1;
+					}
+					if (next_subtable + (1u << subbits) > size) {
+						return false;
+					}
+
+					subtable_root = root;
+					subtable = next_subtable;
+					next_subtable += 1u << subbits;
+					table[root] = ENTRY_EXCEPTIONAL | ENTRY_SUBTABLE | subtable << 16 |
+              subbits << 8 | rootbits;
+				}
+
+				entry += sublen << 8 | sublen;
+				for (index = reversed >> rootbits; index < (1u << subbits); index += 1u << sublen) {
+					table[subtable + index] = entry;
+				}
+			}
+
+			count[len]--;
+			code++;
+		}
+	}
+	return true;
+}
+
+/* the codes of block type 1 */
+static void load_fixed_tables(fast_inflate_tables* tables) {
+	uint8_t* lengths = tables->lengths;
+	uint32_t i;
+
+	for (i = 0; i < 144; i++) {
+		lengths[i] = 8;
+	}
+	for (; i < 256; i++) {
+		lengths[i] = 9;
+	}
+	for (; i < 280; i++) {
+		lengths[i] = 7;
+	}
+	for (; i < NUM_LITLEN_SYMBOLS; i++) {
+		lengths[i] = 8;
+	}
+	for (i = 0; i < NUM_DISTANCE_SYMBOLS; i++) {
+		lengths[NUM_LITLEN_SYMBOLS + i] = 5;
+	}
+
+	build_table(tables->litlen, FAST_INFLATE_LITLEN_TABLE_SIZE, FAST_INFLATE_LITLEN_ROOT_BITS,
+      lengths, NUM_LITLEN_SYMBOLS, ALPHABET_LITLEN);
+	build_table(tables->distance, FAST_INFLATE_DISTANCE_TABLE_SIZE,
+      FAST_INFLATE_DISTANCE_ROOT_BITS, lengths + NUM_LITLEN_SYMBOLS, NUM_DISTANCE_SYMBOLS,
+      ALPHABET_DISTANCE);
+	tables->fixed_loaded = true;
+}
+
+/* ---- input ---- */
+
+/* steps to the next non-empty span, false at the end of the input */
+static bool next_span(fast_inflate_stream* s) {
+	while (s->next == s->end) {
+		if (s->next_span == NULL || !s->next_span(s->user, &s->next, &s->end)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* tops bitbuf up to at least REFILL_BITS bits a byte at a time, stepping from span to
+ * span; past the end of the input zero bytes are counted in overrun */
+static void refill_careful(fast_inflate_stream* s) {
+	while (s->bitcount < REFILL_BITS) {
+		if (s->next < s->end || next_span(s)) {
+			s->bitbuf |= (uint64_t)(*s->next++) << s->bitcount;
+		} else {
+			s->overrun++;
+		}
+		s->bitcount += 8;
+	}
+}
+
+/* tops bitbuf up to at least REFILL_BITS bits. The bits above bitcount after a word
+ * load are the bytes that follow, the next refill ors the same values in again */
+static inline void refill(fast_inflate_stream* s) {
+	if (s->end - s->next >= FAST_INPUT_BYTES) {
+		s->bitbuf |= load_le64(s->next) << s->bitcount;
+		s->next += (63 - s->bitcount) >> 3;
+		s->bitcount |= REFILL_BITS;
+	} else {
+		refill_careful(s);
+	}
+}
+
+static inline void drop_bits(fast_inflate_stream* s, uint32_t n) {
+	s->bitbuf >>= n;
+	s->bitcount -= n;
+}
+
+/* reads n bits, at most 32 */
+static inline uint32_t read_bits(fast_inflate_stream* s, uint32_t n) {
+	uint32_t value;
+	if (s->bitcount < n) {
+		refill(s);
+	}
+	value = (uint32_t)(s->bitbuf & ((1ull << n) - 1));
+	drop_bits(s, n);
+	return value;
+}
+
+/* true if bits past the end of the input have been used */
+static inline bool overrun(const fast_inflate_stream* s) {
+	return s->overrun * 8 > s->bitcount;
+}
+
+/* the entry decoding the next bits of bitbuf, following a subtable pointer */
+static inline uint32_t lookup(const uint32_t* table, uint32_t mask, uint64_t bitbuf) {
+	uint32_t entry = table[bitbuf & mask];
+	if ((entry & ENTRY_SUBTABLE) != 0) {
+		entry = table[ENTRY_VALUE(entry) +
+        ((bitbuf >> ENTRY_DROP(entry)) & ((1u << ENTRY_CODE_LENGTH(entry)) - 1))];
+	}
+	return entry;
+}
+
+/* the value of a length or distance entry, dropping its code and extra bits */
+static inline uint32_t take_value(fast_inflate_stream* s, uint32_t entry, uint32_t rootbits,
+    bool subtable) {
+	uint32_t drop = ENTRY_DROP(entry) + (subtable ? rootbits : 0);
+	uint32_t codelen = ENTRY_CODE_LENGTH(entry) + (subtable ? rootbits : 0);
+	uint32_t extra = (uint32_t)((s->bitbuf & ((1ull << drop) - 1)) >> codelen);
+	drop_bits(s, drop);
+	return ENTRY_VALUE(entry) + extra;
+}
+
+/* ---- blocks ---- */
+
+/* reads the code lengths of a dynamic block and builds its tables */
+static fast_inflate_result read_dynamic_tables(fast_inflate_tables* tables,
+    fast_inflate_stream* s) {
+	uint8_t code_length_lengths[NUM_CODE_LENGTH_SYMBOLS];
+	uint8_t* lengths = tables->lengths;
+	uint32_t hlit, hdist, hclen, i;
+
+	tables->fixed_loaded = false;
+	memset(lengths, 0, NUM_LITLEN_SYMBOLS + NUM_DISTANCE_SYMBOLS);
+
+	hlit = read_bits(s, 5) + 257;
+	hdist = read_bits(s, 5) + 1;
+	hclen = read_bits(s, 4) + 4;
+	for (i = 0; i < NUM_CODE_LENGTH_SYMBOLS; i++) {
+		code_length_lengths[CODE_LENGTH_ORDER[i]] = i < hclen ? (uint8_t)read_bits(s, 3) : 0;
+	}
+	if (overrun(s) || !build_table(tables->code_length, FAST_INFLATE_CODE_LENGTH_TABLE_SIZE,
+        FAST_INFLATE_CODE_LENGTH_ROOT_BITS, code_length_lengths, NUM_CODE_LENGTH_SYMBOLS,
+        ALPHABET_CODE_LENGTH)) {
+		return FAST_INFLATE_BAD_DATA;
+	}
+
+	/* the literal/length lengths run on into the distance lengths. The code length
+	 * code is at most 7 bits, so one refill covers a symbol and its repeat bits */
+	i = 0;
+	while (i < hlit + hdist) {
+		uint32_t entry, symbol, value = 0, repeat;
+
+		refill(s);
+		entry = tables->code_length[s->bitbuf & CODE_LENGTH_MASK];
+		if ((entry & ENTRY_EXCEPTIONAL) != 0) {
+			return FAST_INFLATE_BAD_DATA;
+		}
+		drop_bits(s, ENTRY_DROP(entry));
+		if (overrun(s)) {
+			return FAST_INFLATE_BAD_DATA;
+		}
+
+		symbol = ENTRY_VALUE(entry);
+		if (symbol <= 15) {
+			lengths[i < hlit ? i : NUM_LITLEN_SYMBOLS + i - hlit] = (uint8_t)symbol;
+			i++;
+			continue;
+		}
+
+		if (symbol == 16) {
+			/* repeats the previous length 3-6 times */
+			if (i == 0) {
+				return FAST_INFLATE_BAD_DATA;
+			}
+			value = lengths[i - 1 < hlit ? i - 1 : NUM_LITLEN_SYMBOLS + i - 1 - hlit];
+			repeat = 3 + read_bits(s, 2);
+		} else if (symbol == 17) {
+			/* 3-10 zeros */
+			repeat = 3 + read_bits(s, 3);
+		} else {
+			/* 11-138 zeros */
+			repeat = 11 + read_bits(s, 7);
+		}
+		if (overrun(s) || repeat > hlit + hdist - i) {
+			return FAST_INFLATE_BAD_DATA;
+		}
+		while (repeat-- > 0) {
+			lengths[i < hlit ? i : NUM_LITLEN_SYMBOLS + i - hlit] = (uint8_t)value;
+			i++;
+		}
+	}
+
+	/* a block without an end code could never end */
+	if (lengths[256] == 0) {
+		return FAST_INFLATE_BAD_DATA;
+	}
+
+	if (!build_table(tables->litlen, FAST_INFLATE_LITLEN_TABLE_SIZE,
+        FAST_INFLATE_LITLEN_ROOT_BITS, lengths, NUM_LITLEN_SYMBOLS, ALPHABET_LITLEN) ||
+      !build_table(tables->distance, FAST_INFLATE_DISTANCE_TABLE_SIZE,
+        FAST_INFLATE_DISTANCE_ROOT_BITS, lengths + NUM_LITLEN_SYMBOLS, NUM_DISTANCE_SYMBOLS,
+        ALPHABET_DISTANCE)) {
+		return FAST_INFLATE_BAD_DATA;
+	}
+	return FAST_INFLATE_OK;
+}
+
+/* tells the caller about the output up to out_pos once it reaches the mark */
+static inline fast_inflate_result report_progress(fast_inflate_stream* s) {
+	if (s->out_pos >= s->progress_mark) {
+		s->progress_mark = s->progress(s->user, s->out_pos);
+		if (s->progress_mark == 0) {
+			return FAST_INFLATE_STOPPED;
+		}
+	}
+	return FAST_INFLATE_OK;
+}
+
+static fast_inflate_result inflate_stored(fast_inflate_stream* s) {
+	uint32_t len, nlen;
+	uint8_t* out = s->out + s->out_pos;
+
+	drop_bits(s, s->bitcount & 7);
+	len = read_bits(s, 16);
+	nlen = read_bits(s, 16);
+	if (overrun(s) || len + nlen != 65535 || len > s->out_size - s->out_pos) {
+		return FAST_INFLATE_BAD_DATA;
+	}
+	s->out_pos += len;
+
+	/* the first bytes may already be in bitbuf */
+	while (len > 0 && s->bitcount >= 8) {
+		*out++ = (uint8_t)s->bitbuf;
+		drop_bits(s, 8);
+		len--;
+	}
+	if (overrun(s)) {
+		return FAST_INFLATE_BAD_DATA;
+	}
+	if (s->bitcount == 0) {
+		/* the lookahead in bitbuf is of bytes copied below */
+		s->bitbuf = 0;
+	}
+
+	while (len > 0) {
+		size_t n;
+		if (!next_span(s)) {
+			return FAST_INFLATE_BAD_DATA;
+		}
+		n = (size_t)(s->end - s->next);
+		n = n < len ? n : len;
+		memcpy(out, s->next, n);
+		s->next += n;
+		out += n;
+		len -= (uint32_t)n;
+	}
+	return report_progress(s);
+}
+
+/* decodes one symbol with every check on the input and output, for the ends of the
+ * spans and of the output */
+static fast_inflate_result inflate_symbol_careful(fast_inflate_tables* tables,
+    fast_inflate_stream* s, bool* end_of_block) {
+	uint32_t entry, length, distance;
+	bool subtable;
+
+	refill_careful(s);
+	entry = tables->litlen[s->bitbuf & LITLEN_MASK];
+	subtable = (entry & ENTRY_SUBTABLE) != 0;
+	entry = lookup(tables->litlen, LITLEN_MASK, s->bitbuf);
+	if ((entry & (ENTRY_LITERAL | ENTRY_EXCEPTIONAL)) == ENTRY_EXCEPTIONAL &&
+      (entry & ENTRY_END_OF_BLOCK) == 0) {
+		return FAST_INFLATE_BAD_DATA;
+	}
+
+	if ((entry & ENTRY_LITERAL) != 0 || (entry & ENTRY_END_OF_BLOCK) != 0) {
+		drop_bits(s, ENTRY_DROP(entry) + (subtable ? FAST_INFLATE_LITLEN_ROOT_BITS : 0));
+		if (overrun(s)) {
+			return FAST_INFLATE_BAD_DATA;
+		}
+		if ((entry & ENTRY_END_OF_BLOCK) != 0) {
+			*end_of_block = true;
+			return FAST_INFLATE_OK;
+		}
+		if (s->out_pos >= s->out_size) {
+			return FAST_INFLATE_BAD_DATA;
+		}
+		s->out[s->out_pos++] = (uint8_t)ENTRY_VALUE(entry);
+		return report_progress(s);
+	}
+
+	length = take_value(s, entry, FAST_INFLATE_LITLEN_ROOT_BITS, subtable);
+
+	entry = tables->distance[s->bitbuf & DISTANCE_MASK];
+	subtable = (entry & ENTRY_SUBTABLE) != 0;
+	entry = lookup(tables->distance, DISTANCE_MASK, s->bitbuf);
+	if ((entry & ENTRY_EXCEPTIONAL) != 0) {
+		return FAST_INFLATE_BAD_DATA;
+	}
+	distance = take_value(s, entry, FAST_INFLATE_DISTANCE_ROOT_BITS, subtable);
+
+	if (overrun(s) || distance > s->out_pos || length > s->out_size - s->out_pos) {
+		return FAST_INFLATE_BAD_DATA;
+	}
+
+	/* byte by byte: each byte may be one this copy just wrote */
+	{
+		uint8_t* dst = s->out + s->out_pos;
+		const uint8_t* src = dst - distance;
+		uint32_t i;
+		for (i = 0; i < length; i++) {
+			dst[i] = src[i];
+		}
+	}
+	s->out_pos += length;
+	return report_progress(s);
+}
+
+/* decodes the symbols of a block with the tables loaded for it, up to its end code */
+static fast_inflate_result inflate_huffman(fast_inflate_tables* tables,
+    fast_inflate_stream* s) {
+	const uint32_t* litlen = tables->litlen;
+	const uint32_t* distance_table = tables->distance;
+	fast_inflate_result result = FAST_INFLATE_OK;
+	bool end_of_block = false;
+
+	while (!end_of_block && result == FAST_INFLATE_OK) {
+		/* work on local copies of the stream state, the compiler has to assume stores
+		 * to the output could change them otherwise */
+		const uint8_t* in = s->next;
+		const uint8_t* in_end = s->end;
+		uint64_t bitbuf = s->bitbuf;
+		uint32_t bitcount = s->bitcount;
+		uint8_t* out_begin = s->out;
+		uint8_t* out = s->out + s->out_pos;
+		uint8_t* out_fast_end = s->out_size >= FAST_OUTPUT_BYTES ?
+        s->out + s->out_size - FAST_OUTPUT_BYTES : s->out;
+		size_t mark = s->progress_mark;
+
+		/* fast loop: the refill is a word load and the longest match plus the copy slack
+		 * fits in the output, so symbols need no input or output bounds checks */
+		while (in_end - in >= FAST_INPUT_BYTES && out < out_fast_end) {
+			uint32_t entry, length, distance, drop;
+			uint64_t saved;
+			uint8_t* dst;
+			const uint8_t* src;
+			uint8_t* end;
+			uint32_t period;
+
+			bitbuf |= load_le64(in) << bitcount;
+			in += (63 - bitcount) >> 3;
+			bitcount |= REFILL_BITS;
+
+			entry = litlen[bitbuf & LITLEN_MASK];
+			if ((entry & ENTRY_LITERAL) != 0) {
+				/* a refill holds three literal codes of at most 15 bits */
+				bitbuf >>= ENTRY_DROP(entry);
+				bitcount -= ENTRY_DROP(entry);
+				*out++ = (uint8_t)(entry >> 16);
+				entry = litlen[bitbuf & LITLEN_MASK];
+				if ((entry & ENTRY_LITERAL) != 0) {
+					bitbuf >>= ENTRY_DROP(entry);
+					bitcount -= ENTRY_DROP(entry);
+					*out++ = (uint8_t)(entry >> 16);
+					entry = litlen[bitbuf & LITLEN_MASK];
+					if ((entry & ENTRY_LITERAL) != 0) {
+						bitbuf >>= ENTRY_DROP(entry);
+						bitcount -= ENTRY_DROP(entry);
+						*out++ = (uint8_t)(entry >> 16);
+					}
+				}
+				if ((size_t)(out - out_begin) >= mark) {
+					break;
+				}
+				continue;
+			}
+
+			if ((entry & ENTRY_EXCEPTIONAL) != 0) {
+				if ((entry & ENTRY_SUBTABLE) != 0) {
+					bitbuf >>= FAST_INFLATE_LITLEN_ROOT_BITS;
+					bitcount -= FAST_INFLATE_LITLEN_ROOT_BITS;
+					entry = litlen[ENTRY_VALUE(entry) +
+              (bitbuf & ((1u << ENTRY_CODE_LENGTH(entry)) - 1))];
+					if ((entry & ENTRY_LITERAL) != 0) {
+						bitbuf >>= ENTRY_DROP(entry);
+						bitcount -= ENTRY_DROP(entry);
+						*out++ = (uint8_t)(entry >> 16);
+						if ((size_t)(out - out_begin) >= mark) {
+							break;
+						}
+						continue;
+					}
+				}
+				if ((entry & ENTRY_END_OF_BLOCK) != 0) {
+					bitbuf >>= ENTRY_DROP(entry);
+					bitcount -= ENTRY_DROP(entry);
+					end_of_block = true;
+					break;
+				}
+				if ((entry & ENTRY_EXCEPTIONAL) != 0) {
+					result = FAST_INFLATE_BAD_DATA;
+					break;
+				}
+			}
+
+			/* a length: the base plus the extra bits after the code */
+			saved = bitbuf;
+			drop = ENTRY_DROP(entry);
+			bitbuf >>= drop;
+			bitcount -= drop;
+			length = ENTRY_VALUE(entry) +
+          (uint32_t)((saved & ((1ull << drop) - 1)) >> ENTRY_CODE_LENGTH(entry));
+
+			entry = distance_table[bitbuf & DISTANCE_MASK];
+			if ((entry & ENTRY_EXCEPTIONAL) != 0) {
+				if ((entry & ENTRY_SUBTABLE) != 0) {
+					bitbuf >>= FAST_INFLATE_DISTANCE_ROOT_BITS;
+					bitcount -= FAST_INFLATE_DISTANCE_ROOT_BITS;
+					entry = distance_table[ENTRY_VALUE(entry) +
+              (bitbuf & ((1u << ENTRY_CODE_LENGTH(entry)) - 1))];
+				}
+				if ((entry & ENTRY_EXCEPTIONAL) != 0) {
+					result = FAST_INFLATE_BAD_DATA;
+					break;
+				}
+			}
+			saved = bitbuf;
+			drop = ENTRY_DROP(entry);
+			bitbuf >>= drop;
+			bitcount -= drop;
+			distance = ENTRY_VALUE(entry) +
+          (uint32_t)((saved & ((1ull << drop) - 1)) >> ENTRY_CODE_LENGTH(entry));
+
+			if (distance > (size_t)(out - out_begin)) {
+				result = FAST_INFLATE_BAD_DATA;
+				break;
+			}
+
+			/* 16 byte words. While the distance is short of a word, a word is copied from
+			 * the start of the match and the repeated part doubles; then whole words are
+			 * copied from a multiple of the distance back, which they do not overlap */
+			dst = out;
+			src = out - distance;
+			end = out + length;
+			period = distance;
+			while (period < 16) {
+				copy16(dst, src);
+				dst += period;
+				period *= 2;
+			}
+			while (dst < end) {
+				copy16(dst, dst - period);
+				dst += 16;
+			}
+			out = end;
+
+			if ((size_t)(out - out_begin) >= mark) {
+				break;
+			}
+		}
+
+		s->next = in;
+		s->end = in_end;
+		s->bitbuf = bitbuf;
+		s->bitcount = bitcount;
+		s->out_pos = (size_t)(out - out_begin);
+
+		if (result != FAST_INFLATE_OK || end_of_block) {
+			break;
+		}
+
+		/* the fast loop stopped at the progress mark, or near the end of the span or
+		 * of the output */
+		result = report_progress(s);
+		if (result == FAST_INFLATE_OK && (s->end - s->next < FAST_INPUT_BYTES ||
+        s->out + s->out_pos >= out_fast_end)) {
+			result = inflate_symbol_careful(tables, s, &end_of_block);
+		}
+	}
+	return result;
+}
+
+fast_inflate_result fast_inflate(fast_inflate_tables* tables, fast_inflate_stream* s) {
+	fast_inflate_result result = FAST_INFLATE_OK;
+	bool final = false;
+
+	if (s->progress == NULL) {
+		s->progress_mark = SIZE_MAX;
+	}
+
+	while (!final && result == FAST_INFLATE_OK) {
+		uint32_t type;
+
+		final = read_bits(s, 1) != 0;
+		type = read_bits(s, 2);
+		if (overrun(s)) {
+			return FAST_INFLATE_BAD_DATA;
+		}
+
+		if (type == 0) {
+			result = inflate_stored(s);
+		} else if (type == 1) {
+			if (!tables->fixed_loaded) {
+				load_fixed_tables(tables);
+			}
+			result = inflate_huffman(tables, s);
+		} else if (type == 2) {
+			result = read_dynamic_tables(tables, s);
+			if (result == FAST_INFLATE_OK) {
+				result = inflate_huffman(tables, s);
+			}
+		} else {
+			result = FAST_INFLATE_BAD_DATA;
+		}
+	}
+
+	/* what is left for the caller is the bits read ahead, nothing above them */
+	if (s->bitcount < 64) {
+		s->bitbuf &= (1ull << s->bitcount) - 1;
+	}
+	return result;
+}
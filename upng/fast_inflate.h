@@ -0,0 +1,90 @@
+/*
+fast_inflate -- a single-file raw deflate (RFC 1951) decoder
+
+Decodes a whole stream into one output buffer that also serves as the window, in
+the manner of libdeflate: a 64-bit bit buffer refilled with unaligned word loads,
+literal/length and distance tables whose entries carry the number of bits to drop
+and the base and extra bits of lengths and distances, so a match is decoded with
+one refill, a main loop that decodes up to three literals per refill and copies
+matches a word at a time without bounds checks while the input and output have
+room, and a careful loop for the rest.
+
+The input may arrive in spans that are not contiguous, e.g. the data of a run of
+PNG IDAT chunks, and the caller is told as the output grows past a mark of its
+choosing. Decoding allocates nothing; the tables live in memory the caller
+provides. Malformed streams are rejected where upng's builtin inflate rejects
+them: codes that are oversubscribed, or incomplete other than a single code of one
+bit, code length repeats out of place, reserved symbols and block types, distances
+past the start of the output and output past its end.
+
+Needs only the C standard library, plus a C99 compiler.
+*/
+
+#ifndef FAST_INFLATE_H
+#define FAST_INFLATE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* bits indexing the root tables, longer codes continue in subtables */
+#define FAST_INFLATE_LITLEN_ROOT_BITS 11
+#define FAST_INFLATE_DISTANCE_ROOT_BITS 8
+#define FAST_INFLATE_CODE_LENGTH_ROOT_BITS 7
+
+/* table sizes: the root table plus the worst case of subtables. A complete code
+ * needs at least (n + 1) codes to fill a subtable of 2^n entries */
+#define FAST_INFLATE_LITLEN_TABLE_SIZE ((1 << FAST_INFLATE_LITLEN_ROOT_BITS) + \
+    (288 / (15 - FAST_INFLATE_LITLEN_ROOT_BITS + 1)) * (1 << (15 - FAST_INFLATE_LITLEN_ROOT_BITS)))
+#define FAST_INFLATE_DISTANCE_TABLE_SIZE ((1 << FAST_INFLATE_DISTANCE_ROOT_BITS) + \
+    (32 / (15 - FAST_INFLATE_DISTANCE_ROOT_BITS + 1)) * (1 << (15 - FAST_INFLATE_DISTANCE_ROOT_BITS)))
+#define FAST_INFLATE_CODE_LENGTH_TABLE_SIZE (1 << FAST_INFLATE_CODE_LENGTH_ROOT_BITS)
+
+/* decode tables, about 13KB. Keep them from one stream to the next: the fixed
+ * codes are only built again after a dynamic block took their place */
+typedef struct fast_inflate_tables {
+	uint32_t litlen[FAST_INFLATE_LITLEN_TABLE_SIZE];
+	uint32_t distance[FAST_INFLATE_DISTANCE_TABLE_SIZE];
+	uint32_t code_length[FAST_INFLATE_CODE_LENGTH_TABLE_SIZE];
+	uint8_t lengths[288 + 32];	/* code lengths of the current dynamic block */
+	bool fixed_loaded;	/* litlen and distance hold the fixed codes */
+} fast_inflate_tables;
+
+/* makes the next span of input current in *next and *end, false at the end of the input */
+typedef bool (*fast_inflate_next_span_fn)(void* user, const uint8_t** next, const uint8_t** end);
+
+/* told that the output has grown to pos, at or past the mark. Returns the next mark,
+ * SIZE_MAX for none, or 0 to stop decoding */
+typedef size_t (*fast_inflate_progress_fn)(void* user, size_t pos);
+
+typedef enum fast_inflate_result {
+	FAST_INFLATE_OK = 0,	/* the final block was decoded */
+	FAST_INFLATE_BAD_DATA = 1,	/* the stream is malformed, cut short or does not fit the output */
+	FAST_INFLATE_STOPPED = 2	/* the progress callback returned 0 */
+} fast_inflate_result;
+
+/* a stream being decoded. The bit buffer is part of the state: the caller may start
+ * with bits already read off the input, and after the final block the bits read
+ * ahead of next are left in bitbuf, the bits above bitcount cleared */
+typedef struct fast_inflate_stream {
+	const uint8_t* next;	/* next input byte */
+	const uint8_t* end;	/* end of the current span */
+	uint64_t bitbuf;	/* the next bit of the stream is the lsb */
+	uint32_t bitcount;	/* valid bits in bitbuf, below 64 */
+	uint32_t overrun;	/* zero bytes put in bitbuf past the end of the input */
+	fast_inflate_next_span_fn next_span;	/* NULL if the current span is all the input */
+
+	uint8_t* out;	/* the output, from its first byte */
+	size_t out_size;
+	size_t out_pos;	/* bytes written so far */
+	fast_inflate_progress_fn progress;	/* NULL to decode without being told */
+	size_t progress_mark;	/* output size progress is called at, SIZE_MAX for none */
+
+	void* user;	/* handed to next_span and progress */
+} fast_inflate_stream;
+
+/* decodes the raw deflate blocks from the stream's position up to and including the
+ * final one, appending to out from out_pos */
+fast_inflate_result fast_inflate(fast_inflate_tables* tables, fast_inflate_stream* stream);
+
+#endif /*FAST_INFLATE_H*/
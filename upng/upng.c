@@ -32,13 +32,21 @@ freely, subject to the following restrictions:
 #include <stdbool.h>
 
 #include "upng.h"
+#include "upng_internal.h"
 
-//smaller decompressor
-//saves about 900 bytes, but still crashing watch
-//#include "tinfl.h"
-//#define TINFL 1
+#if defined(UPNG_THREADS)
+#include <pthread.h>
+#endif
+
+#if defined(UPNG_INFLATE_ZLIB)
+#include <zlib.h>
+#elif defined(UPNG_INFLATE_FAST)
+#include "fast_inflate.h"
+#else
+#define UPNG_INFLATE_BUILTIN
+#endif
 
-#define MAKE_BYTE(b) ((b) & 0xFF)
+#define MAKE_BYTE(b) ((uint32_t)(b) & 0xFF)
 #define MAKE_DWORD(a,b,c,d) \
   ((MAKE_BYTE(a) << 24) | (MAKE_BYTE(b) << 16) | (MAKE_BYTE(c) << 8) | MAKE_BYTE(d))
 
@@ -58,6 +66,10 @@ freely, subject to the following restrictions:
 
 #define FIRST_LENGTH_CODE_INDEX 257
 #define LAST_LENGTH_CODE_INDEX 285
+/* longest back-reference a length code can encode */
+#define MAX_MATCH_LENGTH 258
+/* bytes the word-at-a-time match copy may write past the end of a match */
+#define MATCH_COPY_SLACK 32
 
 /*256 literals, the end code, some length codes, and 2 unused codes */
 #define NUM_DEFLATE_CODE_SYMBOLS 288	
@@ -69,14 +81,32 @@ freely, subject to the following restrictions:
 /* largest number of symbols used by any tree type */
 #define MAX_SYMBOLS 288 
 
-#define DEFLATE_CODE_BITLEN 15
-#define DISTANCE_BITLEN 15
-#define CODE_LENGTH_BITLEN 7
-#define MAX_BIT_LENGTH 15 // bug? 15 /* largest bitlen used by any tree type */
-
-#define DEFLATE_CODE_BUFFER_SIZE (NUM_DEFLATE_CODE_SYMBOLS * 2)
-#define DISTANCE_BUFFER_SIZE (NUM_DISTANCE_SYMBOLS * 2)
-#define CODE_LENGTH_BUFFER_SIZE (NUM_DISTANCE_SYMBOLS * 2)
+#define MAX_BIT_LENGTH 15 /* largest bitlen used by any tree type */
+
+/* number of bits used to index the root decode table of each alphabet;
+ * longer codes continue in a subtable */
+#define DEFLATE_CODE_ROOT_BITS 10
+#define DISTANCE_ROOT_BITS 8
+#define CODE_LENGTH_ROOT_BITS 7
+
+/* decode table sizes: the root table plus the worst case of subtables. 
+ * A complete code needs at least (n + 1) codes to fill a subtable of 2^n entries */
+#define DEFLATE_CODE_TABLE_SIZE ((1 << DEFLATE_CODE_ROOT_BITS) + \
+    (NUM_DEFLATE_CODE_SYMBOLS / (MAX_BIT_LENGTH - DEFLATE_CODE_ROOT_BITS + 1)) * \
+    (1 << (MAX_BIT_LENGTH - DEFLATE_CODE_ROOT_BITS)))
+#define DISTANCE_TABLE_SIZE ((1 << DISTANCE_ROOT_BITS) + \
+    (NUM_DISTANCE_SYMBOLS / (MAX_BIT_LENGTH - DISTANCE_ROOT_BITS + 1)) * \
+    (1 << (MAX_BIT_LENGTH - DISTANCE_ROOT_BITS)))
+#define CODE_LENGTH_TABLE_SIZE (1 << CODE_LENGTH_ROOT_BITS)
+
+/* number of dynamic block table sets kept for reuse, each about 14KB. 
+ * Encoders often repeat the same codes across blocks and APNG frames */
+#if !defined(UPNG_HUFFMAN_CACHE_SLOTS)
+#define UPNG_HUFFMAN_CACHE_SLOTS 4
+#endif
+#if UPNG_HUFFMAN_CACHE_SLOTS < 1
+#error "UPNG_HUFFMAN_CACHE_SLOTS must be at least 1"
+#endif
 
 #define SET_ERROR(upng,code) do {(upng)->error = (code); (upng)->error_line = __LINE__;} while (0)
 
@@ -86,6 +116,12 @@ freely, subject to the following restrictions:
 
 #define upng_chunk_type_critical(chunk_type) (((chunk_type) & 0x20000000) == 0)
 
+/* the CRC covers the chunk type and data, the length field is not included */
+static bool upng_chunk_crc_matches(const uint8_t* chunk) {
+	uint32_t length = upng_chunk_data_length(chunk);
+	return upng_crc32(0, chunk + 4, length + 4) == MAKE_DWORD_PTR(chunk + 8 + length);
+}
+
 typedef enum upng_state {
 	UPNG_ERROR		= -1,
 	UPNG_DECODED	= 0,
@@ -108,6 +144,41 @@ typedef struct upng_source {
 	char					owning;
 } upng_source;
 
+/* working memory for decoding, one allocation made by upng_load and sized
+ * for the full IHDR image, which every APNG frame has to fit in. Buffers the
+ * caller supplied are left out of the allocation */
+typedef struct upng_scratch {
+	uint8_t*	base;
+	size_t	capacity;	/* bytes at base, kept by upng_reset for the next image */
+	struct huffman_cache_slot*	huffman_cache;	/* decode tables of recent dynamic blocks */
+	uint32_t	huffman_cache_next;	/* slot the next new set of tables replaces */
+	uint16_t*	code_lengths;	/* literal/length then distance code lengths of a dynamic block */
+#if defined(UPNG_INFLATE_FAST)
+	struct fast_inflate_tables*	fast_inflate;	/* decode tables of the fast_inflate backend */
+#endif
+	uint8_t*	inflated;	/* filtered scanlines, each with its filtertype byte */
+	uint32_t	inflated_size;
+	uint8_t*	image;	/* unfiltered scanlines, NULL if the caller supplies them */
+	uint32_t	image_size;
+#if defined(UPNG_THREADS)
+	struct inflate_part*	inflate_parts;	/* parts of a stream inflated at the same time */
+	uint32_t	num_inflate_parts;
+	uint16_t*	inflate_symbols;	/* output of every part but the first */
+	size_t	inflate_symbols_size;
+#endif
+} upng_scratch;
+
+/* where a frame's image data lies, found once by upng_load. The data is the run of
+ * consecutive IDAT or fdAT chunks starting at data_offset; each chunk in it is one span
+ * of the zlib stream, walked by the bit reader */
+typedef struct upng_frame {
+	apng_fctl	fctl;
+	bool		has_fctl;	/* false for a default image that is not part of the animation */
+	uint32_t	data_type;	/* CHUNK_IDAT or CHUNK_FDAT */
+	uint32_t	data_offset;	/* source offset of the first chunk of the run */
+	uint32_t	data_end;	/* source offset just past the last chunk of the run */
+} upng_frame;
+
 struct upng_t {
 	uint32_t		width;
 	uint32_t		height;
@@ -116,38 +187,141 @@ struct upng_t {
   int32_t y_offset;
 
   rgb *palette;
-  uint8_t palette_entries;
+  uint32_t palette_entries;
 
   uint8_t *alpha_palette;
-  uint8_t alpha_palette_entries;
+  uint32_t alpha_palette_entries;
 
 	upng_color		color_type;
 	uint32_t		color_depth;
 	upng_format		format;
 
-  uint8_t* cursor; //data cursor for parsing linearly
 	uint8_t*	buffer;
 	uint32_t	size;
 
+  // every image in the file, in order
+  upng_frame* frames;
+  uint32_t num_frames;
+  uint32_t frames_capacity;
+  uint32_t next_frame; // frame the next upng_decode_image call decodes
+
   // APNG information for image at current frame
   bool is_apng;
-  apng_fctl* apng_frame_control;
+  bool has_frame_control;
+  apng_fctl apng_frame_control;
   uint32_t apng_num_frames;
   uint32_t apng_duration_ms;
 
 	upng_error		error;
 	uint32_t		error_line;
+	upng_verify		verify;
 
 	upng_state		state;
 	upng_source		source;
+
+	upng_allocator	allocator;
+	upng_scratch	scratch;
+	uint32_t		allocation_count;
+#if defined(UPNG_INFLATE_ZLIB)
+	z_stream		zstream;
+	bool			zstream_ready;
+#endif
+
+	uint8_t*		work_buffer;	/* caller memory for the inflated scanlines */
+	uint32_t		work_buffer_size;
+	uint8_t*		output_buffer;	/* caller memory for the decoded image */
+	uint32_t		output_buffer_size;
+	uint8_t*		output_pixels;	/* caller memory every frame is also converted to */
+	uint32_t		output_pitch;
+	uint32_t		output_pixels_size;
+	upng_pixel_format	output_format;
+	bool			output_premultiplied;
+	upng_pixel_converter	output_converter;	/* set up for the image by upng_decode_image */
+	bool			output_converter_ready;	/* output_converter is for this image and format */
+
+	uint32_t		decode_threads;	/* worker threads upng_load starts, 0 or 1 for none */
+	bool			decode_pipeline;	/* inflate and unfilter on threads of their own */
+	uint32_t		inflate_threads;	/* threads a large stream is inflated on, 0 or 1 for one */
+#if defined(UPNG_THREADS)
+	struct upng_decode_pool*	decode_pool;
+	struct upng_row_pipeline*	row_pipeline;
+#endif
+
+	upng_rows_callback	rows_callback;	/* called with the scanlines as they are unfiltered */
+	void*			rows_callback_user;
 };
 
-#ifndef TINFL
-typedef struct huffman_tree {
-	uint16_t* tree2d;
-	uint16_t maxbitlen;	/*maximum number of bits a single code can get */
+/*unfilters the inflated scanlines as soon as each one is complete*/
+typedef struct scanline_unfilter {
+	uint8_t* image;	/* unfiltered scanlines, linebytes each */
+	const uint8_t* filtered;	/* inflate output: a filtertype byte plus linebytes per scanline */
+	uint32_t linebytes;
+	uint32_t bytewidth;
+	uint32_t height;
+	uint32_t row;	/* next scanline to unfilter */
+	uint32_t row_end;	/* inflate output position that completes it, UINT32_MAX after the last */
+	const upng_unfilter_fn* kernels;	/* filter types 1-4 for this bytewidth, by filter type - 1 */
+	bool verify_adler;	/* keep the Adler-32 of the inflated data */
+	uint32_t adler;	/* Adler-32 of the scanlines unfiltered so far */
+	const upng_pixel_converter* converter;	/* unfiltered scanlines go on to pixels, or NULL */
+	uint8_t* pixels;
+	uint32_t pitch;
+	uint32_t width;
+#if defined(UPNG_THREADS)
+	struct upng_row_pipeline* pipeline;	/* unfilters on its own thread, NULL to unfilter here */
+#endif
+} scanline_unfilter;
+
+static void unfilter_ready_scanlines(upng_t* upng, scanline_unfilter* rows, uint32_t pos);
+
+#if defined(UPNG_THREADS)
+static void upng_decode_pool_init(upng_t* upng);
+static void upng_decode_pool_free(upng_t* upng);
+static void upng_row_pipeline_init(upng_t* upng);
+static void upng_row_pipeline_free(upng_t* upng);
+static void upng_row_pipeline_begin(struct upng_row_pipeline* pipeline, scanline_unfilter* rows);
+static void upng_row_pipeline_inflated(struct upng_row_pipeline* pipeline, uint32_t pos);
+static void upng_row_pipeline_end(upng_t* upng, scanline_unfilter* rows);
+#endif
+
+#if defined(UPNG_INFLATE_BUILTIN)
+/* huffman decode table entry layout:
+ *   bits 0-7   number of input bits consumed by the entry (the full code length)
+ *   bits 8-11  entry kind, one of HUFFMAN_ENTRY_*
+ *   bits 12-15 index bits of the subtable, or extra bits of a length or distance
+ *   bits 16-31 symbol, literal pair (first | second << 8), subtable offset, 
+ *              or base length or distance */
+#define HUFFMAN_ENTRY_INVALID 0 /* no code maps to these bits, or a symbol deflate never uses */
+#define HUFFMAN_ENTRY_SYMBOL 1 /* a literal, or any code length code */
+#define HUFFMAN_ENTRY_LITERAL_PAIR 2 /* two literals decoded with a single lookup */
+#define HUFFMAN_ENTRY_SUBTABLE 3
+#define HUFFMAN_ENTRY_END_OF_BLOCK 4
+#define HUFFMAN_ENTRY_MATCH 5 /* length code 257-285 as its base length */
+#define HUFFMAN_ENTRY_DISTANCE 6 /* distance code 0-29 as its base distance */
+
+#define HUFFMAN_ENTRY(kind,length,value) \
+  ((uint32_t)(length) | ((uint32_t)(kind) << 8) | ((uint32_t)(value) << 16))
+#define HUFFMAN_ENTRY_LENGTH(e) ((e) & 0xFF)
+#define HUFFMAN_ENTRY_KIND(e) (((e) >> 8) & 0xF)
+#define HUFFMAN_ENTRY_SUBBITS(e) (((e) >> 12) & 0xF)
+#define HUFFMAN_ENTRY_EXTRA_BITS(e) (((e) >> 12) & 0xF)
+
+/* alphabets a table decodes, setting what its symbols turn into */
+typedef enum huffman_alphabet {
+	HUFFMAN_ALPHABET_CODE_LENGTH,
+	HUFFMAN_ALPHABET_DEFLATE_CODE,
+	HUFFMAN_ALPHABET_DISTANCE
+} huffman_alphabet;
+#define HUFFMAN_ENTRY_VALUE(e) ((e) >> 16)
+
+typedef struct huffman_table {
+	const uint32_t* entries;	/* root table of 1 << rootbits entries, followed by the subtables */
+	uint32_t* buffer;	/* where the entries are built, NULL for the static fixed tables */
+	uint16_t size;	/* number of entries available in the entries buffer */
+	uint16_t rootbits;	/* number of bits used to index the root table */
 	uint16_t numcodes;	/*number of symbols in the alphabet = number of codes */
-} huffman_tree;
+	huffman_alphabet alphabet;
+} huffman_table;
 
 /*the base lengths represented by codes 257-285 */
 static const uint16_t LENGTH_BASE[29] = {	
@@ -179,232 +353,574 @@ static const uint16_t DISTANCE_EXTRA[30] = {
 static const uint16_t CLCL[NUM_CODE_LENGTH_CODES]	= { 
   16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
 
-static const uint16_t FIXED_DEFLATE_CODE_TREE[NUM_DEFLATE_CODE_SYMBOLS * 2] = {
-	289, 370, 290, 307, 546, 291, 561, 292, 293, 300, 294, 297, 295, 296, 0, 1,
-	2, 3, 298, 299, 4, 5, 6, 7, 301, 304, 302, 303, 8, 9, 10, 11, 305, 306, 12,
-	13, 14, 15, 308, 339, 309, 324, 310, 317, 311, 314, 312, 313, 16, 17, 18,
-	19, 315, 316, 20, 21, 22, 23, 318, 321, 319, 320, 24, 25, 26, 27, 322, 323,
-	28, 29, 30, 31, 325, 332, 326, 329, 327, 328, 32, 33, 34, 35, 330, 331, 36,
-	37, 38, 39, 333, 336, 334, 335, 40, 41, 42, 43, 337, 338, 44, 45, 46, 47,
-	340, 355, 341, 348, 342, 345, 343, 344, 48, 49, 50, 51, 346, 347, 52, 53,
-	54, 55, 349, 352, 350, 351, 56, 57, 58, 59, 353, 354, 60, 61, 62, 63, 356,
-	363, 357, 360, 358, 359, 64, 65, 66, 67, 361, 362, 68, 69, 70, 71, 364,
-	367, 365, 366, 72, 73, 74, 75, 368, 369, 76, 77, 78, 79, 371, 434, 372,
-	403, 373, 388, 374, 381, 375, 378, 376, 377, 80, 81, 82, 83, 379, 380, 84,
-	85, 86, 87, 382, 385, 383, 384, 88, 89, 90, 91, 386, 387, 92, 93, 94, 95,
-	389, 396, 390, 393, 391, 392, 96, 97, 98, 99, 394, 395, 100, 101, 102, 103,
-	397, 400, 398, 399, 104, 105, 106, 107, 401, 402, 108, 109, 110, 111, 404,
-	419, 405, 412, 406, 409, 407, 408, 112, 113, 114, 115, 410, 411, 116, 117,
-	118, 119, 413, 416, 414, 415, 120, 121, 122, 123, 417, 418, 124, 125, 126,
-	127, 420, 427, 421, 424, 422, 423, 128, 129, 130, 131, 425, 426, 132, 133,
-	134, 135, 428, 431, 429, 430, 136, 137, 138, 139, 432, 433, 140, 141, 142,
-	143, 435, 483, 436, 452, 568, 437, 438, 445, 439, 442, 440, 441, 144, 145,
-	146, 147, 443, 444, 148, 149, 150, 151, 446, 449, 447, 448, 152, 153, 154,
-	155, 450, 451, 156, 157, 158, 159, 453, 468, 454, 461, 455, 458, 456, 457,
-	160, 161, 162, 163, 459, 460, 164, 165, 166, 167, 462, 465, 463, 464, 168,
-	169, 170, 171, 466, 467, 172, 173, 174, 175, 469, 476, 470, 473, 471, 472,
-	176, 177, 178, 179, 474, 475, 180, 181, 182, 183, 477, 480, 478, 479, 184,
-	185, 186, 187, 481, 482, 188, 189, 190, 191, 484, 515, 485, 500, 486, 493,
-	487, 490, 488, 489, 192, 193, 194, 195, 491, 492, 196, 197, 198, 199, 494,
-	497, 495, 496, 200, 201, 202, 203, 498, 499, 204, 205, 206, 207, 501, 508,
-	502, 505, 503, 504, 208, 209, 210, 211, 506, 507, 212, 213, 214, 215, 509,
-	512, 510, 511, 216, 217, 218, 219, 513, 514, 220, 221, 222, 223, 516, 531,
-	517, 524, 518, 521, 519, 520, 224, 225, 226, 227, 522, 523, 228, 229, 230,
-	231, 525, 528, 526, 527, 232, 233, 234, 235, 529, 530, 236, 237, 238, 239,
-	532, 539, 533, 536, 534, 535, 240, 241, 242, 243, 537, 538, 244, 245, 246,
-	247, 540, 543, 541, 542, 248, 249, 250, 251, 544, 545, 252, 253, 254, 255,
-	547, 554, 548, 551, 549, 550, 256, 257, 258, 259, 552, 553, 260, 261, 262,
-	263, 555, 558, 556, 557, 264, 265, 266, 267, 559, 560, 268, 269, 270, 271,
-	562, 565, 563, 564, 272, 273, 274, 275, 566, 567, 276, 277, 278, 279, 569,
-	572, 570, 571, 280, 281, 282, 283, 573, 574, 284, 285, 286, 287, 0, 0
-};
+#endif /*defined(UPNG_INFLATE_BUILTIN)*/
+
+/*reads the zlib stream lsb first. bitbuf holds up to 64 bits of lookahead and is refilled with
+ * whole unaligned 64-bit loads while at least 8 input bytes remain; the last bytes are fed one 
+ * at a time, followed by zero bytes which are counted so running past the end can be detected.
+ * The stream is either a single buffer or the data of a run of consecutive IDAT/fdAT chunks,
+ * which is read in place, chunk by chunk. When the chunk CRCs are verified a chunk is read in 
+ * spans of at most BIT_READER_CRC_SPAN bytes, each added to the chunk's CRC as the reader 
+ * steps past it while the bytes are still in cache; the CRC is compared on leaving the chunk*/
+typedef struct bit_reader {
+	const uint8_t* next;	/* next input byte to load into bitbuf */
+	const uint8_t* end;	/* end of the current input span */
+	uint64_t bitbuf;	/* the next bit of the stream is the lsb */
+	uint32_t bitcount;	/* number of valid bits in bitbuf */
+	uint32_t overrun;	/* number of zero bytes loaded past the end of the input */
+	uint32_t span_end;	/* stream offset of end, i.e. the size of every span entered so far */
+	const uint8_t* chunk;	/* chunk holding the current span, NULL for a single buffer */
+	const uint8_t* chunk_end;	/* end of the data of that chunk, where its CRC is */
+	const uint8_t* chunks_end;	/* end of the run of chunks */
+	uint32_t chunk_skip;	/* bytes before the stream data in each chunk */
+	bool verify_crc;	/* check the CRC of each chunk the reader goes through */
+	bool crc_mismatch;	/* a chunk failed the check, the stream ends after it */
+	uint32_t crc;	/* CRC of the chunk up to crc_next */
+	const uint8_t* crc_next;	/* first byte of the chunk not in crc, NULL when the reader did 
+	                         	 * not start at the beginning of the chunk and can not check it */
+} bit_reader;
+
+/* bits guaranteed to be available in bitbuf after a refill */
+#define BIT_READER_REFILL_BITS 56
+
+/* largest span of a chunk whose CRC is verified, small enough to still be in the L1 cache 
+ * when the reader steps past it */
+#define BIT_READER_CRC_SPAN 16384
+
+static void bit_reader_init(bit_reader* br, const uint8_t* in, uint32_t insize) {
+	br->next = in;
+	br->end = in + insize;
+	br->bitbuf = 0;
+	br->bitcount = 0;
+	br->overrun = 0;
+	br->span_end = insize;
+	br->chunk = NULL;
+	br->chunk_end = NULL;
+	br->chunks_end = NULL;
+	br->chunk_skip = 0;
+	br->verify_crc = false;
+	br->crc_mismatch = false;
+	br->crc = 0;
+	br->crc_next = NULL;
+}
 
-static const uint16_t FIXED_DISTANCE_TREE[NUM_DISTANCE_SYMBOLS * 2] = {
-	33, 48, 34, 41, 35, 38, 36, 37, 0, 1, 2, 3, 39, 40, 4, 5, 6, 7, 42, 45, 43,
-	44, 8, 9, 10, 11, 46, 47, 12, 13, 14, 15, 49, 56, 50, 53, 51, 52, 16, 17,
-	18, 19, 54, 55, 20, 21, 22, 23, 57, 60, 58, 59, 24, 25, 26, 27, 61, 62, 28,
-	29, 30, 31, 0, 0
-};
+/*makes the span of the chunk that starts at next the current one*/
+static void bit_reader_set_span(bit_reader* br) {
+	br->end = br->chunk_end;
+	if (br->verify_crc && br->chunk_end - br->next > BIT_READER_CRC_SPAN) {
+		br->end = br->next + BIT_READER_CRC_SPAN;
+	}
+	br->span_end += (uint32_t)(br->end - br->next);
+}
+
+/*starts reading the data of br->chunk; its CRC begins with the chunk type and the bytes 
+ * skipped before the stream data*/
+static void bit_reader_enter_chunk(bit_reader* br) {
+	br->next = br->chunk + br->chunk_skip;
+	br->chunk_end = upng_chunk_data(br->chunk) + upng_chunk_data_length(br->chunk);
+	br->crc_next = NULL;
+	if (br->verify_crc) {
+		br->crc = upng_crc32(0, br->chunk + 4, br->chunk_skip - 4);
+		br->crc_next = br->next;
+	}
+	bit_reader_set_span(br);
+}
+
+/*adds the chunk bytes from crc_next up to end to the CRC*/
+static inline void bit_reader_update_crc(bit_reader* br) {
+	if (br->crc_next != NULL) {
+		br->crc = upng_crc32(br->crc, br->crc_next, (size_t)(br->end - br->crc_next));
+		br->crc_next = br->end;
+	}
+}
+
+/*finishes the CRC of the current chunk, whose spans have all been read, and compares it.
+ * A chunk that fails ends the stream, returning false*/
+static bool bit_reader_leave_chunk(bit_reader* br) {
+	if (br->verify_crc && br->crc_next != NULL) {
+		bit_reader_update_crc(br);
+		if (br->crc != MAKE_DWORD_PTR(br->chunk_end)) {
+			br->crc_mismatch = true;
+			br->chunk = NULL;
+			br->next = br->end;
+			return false;
+		}
+	}
+	return true;
+}
+
+/*steps to the next span of the chunk or to the next non-empty chunk of the run, returns 
+ * false at the end of the stream*/
+static bool bit_reader_next_span(bit_reader* br) {
+	while (br->chunk != NULL) {
+		if (br->end < br->chunk_end) {
+			if (br->verify_crc) {
+				bit_reader_update_crc(br);
+			}
+			br->next = br->end;
+			bit_reader_set_span(br);
+			return true;
+		}
+		if (!bit_reader_leave_chunk(br)) {
+			break;
+		}
+
+		br->chunk = br->chunk_end + 4;
+		if (br->chunk >= br->chunks_end) {
+			br->chunk = NULL;
+			break;
+		}
+
+		bit_reader_enter_chunk(br);
+		if (br->next < br->end) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/*reads the stream held in the chunks from first up to chunks_end, all of the same type and 
+ * already validated to lie within the source. skip is the chunk header size, plus the sequence 
+ * number for fdAT chunks. With verify_crc each chunk's CRC is checked as the reader goes 
+ * through it*/
+static void bit_reader_init_chunks(bit_reader* br, const uint8_t* first, 
+    const uint8_t* chunks_end, uint32_t skip, bool verify_crc) {
+	bit_reader_init(br, first, 0);
+	br->chunk = first;
+	br->chunks_end = chunks_end;
+	br->chunk_skip = skip;
+	br->verify_crc = verify_crc;
+	bit_reader_enter_chunk(br);
+	if (br->next == br->end) {
+		bit_reader_next_span(br);
+	}
+}
+
+static inline uint64_t load_le64(const uint8_t* p) {
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap64(v);
 #endif
+	return v;
+}
 
-static uint8_t read_bit(uint32_t *bitpointer, const uint8_t *bitstream) {
-	uint8_t result = 
-    (uint8_t)((bitstream[(*bitpointer) >> 3] >> ((*bitpointer) & 0x7)) & 1);
-	(*bitpointer)++;
-	return result;
+/*true while a refill is a single word load, so the input needs no per-symbol checks*/
+static inline bool bit_reader_fast(const bit_reader* br) {
+	return br->end - br->next >= 8;
+}
+
+/*tops bitbuf up to at least BIT_READER_REFILL_BITS bits*/
+static inline void bit_reader_refill(bit_reader* br) {
+	if (bit_reader_fast(br)) {
+		/* bits above the new bitcount are the following input bytes,
+		 * the next refill ors the same values in at the same place */
+		br->bitbuf |= load_le64(br->next) << br->bitcount;
+		br->next += (63 - br->bitcount) >> 3;
+		br->bitcount |= BIT_READER_REFILL_BITS;
+	} else {
+		while (br->bitcount < BIT_READER_REFILL_BITS) {
+			if (br->next < br->end || bit_reader_next_span(br)) {
+				br->bitbuf |= (uint64_t)(*br->next++) << br->bitcount;
+			} else {
+				br->overrun++;
+			}
+			br->bitcount += 8;
+		}
+	}
+}
+
+static inline void bit_reader_consume(bit_reader* br, uint32_t nbits) {
+	br->bitbuf >>= nbits;
+	br->bitcount -= nbits;
 }
 
-#ifndef TINFL
-static uint32_t read_bits(uint32_t *bitpointer, 
-    const uint8_t *bitstream, uint32_t nbits) {
-	uint32_t result = 0, i;
-	for (i = 0; i < nbits; i++)
-		result |= ((uint32_t)read_bit(bitpointer, bitstream)) << i;
+/*reads nbits (at most 32) from bitbuf, which must have been refilled for them*/
+static inline uint32_t bit_reader_pop(bit_reader* br, uint32_t nbits) {
+	uint32_t result = (uint32_t)(br->bitbuf & ((1ull << nbits) - 1));
+	bit_reader_consume(br, nbits);
 	return result;
 }
 
-/* the buffer must be numcodes*2 in size! */
-static void huffman_tree_init(huffman_tree* tree, uint16_t* buffer, 
-    uint16_t numcodes, uint16_t maxbitlen) {
-	tree->tree2d = buffer;
+static inline uint32_t read_bits(bit_reader* br, uint32_t nbits) {
+	if (br->bitcount < nbits) {
+		bit_reader_refill(br);
+	}
+	return bit_reader_pop(br, nbits);
+}
+
+/*true if bits past the end of the input have been consumed*/
+static inline bool bit_reader_overrun(const bit_reader* br) {
+	return br->overrun * 8 > br->bitcount;
+}
 
-	tree->numcodes = numcodes;
-	tree->maxbitlen = maxbitlen;
+/*number of stream bits consumed so far*/
+static inline uint64_t bit_reader_position(const bit_reader* br) {
+	return ((uint64_t)br->span_end - (uint64_t)(br->end - br->next) + br->overrun) * 8 - br->bitcount;
 }
 
-/*given the code lengths (as stored in the PNG file), generate the tree as defined by Deflate.
- * maxbitlen is the maximum bits that a code in the tree can have. return value is error.*/
-static void huffman_tree_create_lengths(upng_t* upng, huffman_tree* tree, const uint16_t *bitlen) {
-	uint16_t* tree1d = malloc(sizeof(uint16_t) * MAX_SYMBOLS);
-  uint16_t blcount[MAX_BIT_LENGTH];
-  uint16_t nextcode[MAX_BIT_LENGTH];
-  if (!tree1d) {
-		SET_ERROR(upng, UPNG_ENOMEM);
-		return;
-  }
+/*drops the bits up to the next byte boundary*/
+static void bit_reader_align(bit_reader* br) {
+	bit_reader_consume(br, br->bitcount & 0x7);
+}
+
+/*copies len bytes from a byte aligned stream, first out of bitbuf then straight from the input.
+ * returns false if the input is too short*/
+static bool bit_reader_copy(bit_reader* br, uint8_t* out, uint32_t len) {
+	while (len > 0 && br->bitcount >= 8) {
+		*out++ = (uint8_t)bit_reader_pop(br, 8);
+		len--;
+	}
+
+	if (bit_reader_overrun(br)) {
+		return false;
+	}
+
+	if (br->bitcount == 0) {
+		/* bitbuf may still hold lookahead of bytes that are skipped now */
+		br->bitbuf = 0;
+	}
+
+	while (len > 0) {
+		uint32_t n = (uint32_t)(br->end - br->next);
+		if (n == 0) {
+			if (!bit_reader_next_span(br)) {
+				return false;
+			}
+			continue;
+		}
 
-	uint16_t bits, n, i;
-	uint16_t nodefilled = 0;	/*up to which node it is filled */
-	uint16_t treepos = 0;	/*position in the tree (1 of the numcodes columns) */
+		n = n < len ? n : len;
+		memcpy(out, br->next, n);
+		br->next += n;
+		out += n;
+		len -= n;
+	}
+	return true;
+}
+
+#if defined(UPNG_INFLATE_BUILTIN)
+static void huffman_table_init(huffman_table* table, uint32_t* buffer, uint16_t size,
+    uint16_t numcodes, uint16_t rootbits, huffman_alphabet alphabet) {
+	table->entries = buffer;
+	table->buffer = buffer;
+	table->size = size;
+	table->numcodes = numcodes;
+	table->rootbits = rootbits;
+	table->alphabet = alphabet;
+}
+
+/*the entry decoding symbol, less its code length. Lengths and distances carry their base
+ * and number of extra bits, so decoding them needs no further lookups*/
+static uint32_t huffman_symbol_entry(huffman_alphabet alphabet, uint16_t symbol) {
+	if (alphabet == HUFFMAN_ALPHABET_DEFLATE_CODE) {
+		if (symbol < 256) {
+			return HUFFMAN_ENTRY(HUFFMAN_ENTRY_SYMBOL, 0, symbol);
+		} else if (symbol == 256) {
+			return HUFFMAN_ENTRY(HUFFMAN_ENTRY_END_OF_BLOCK, 0, 0);
+		} else if (symbol <= LAST_LENGTH_CODE_INDEX) {
+			return HUFFMAN_ENTRY(HUFFMAN_ENTRY_MATCH, 0, LENGTH_BASE[symbol - FIRST_LENGTH_CODE_INDEX])
+          | ((uint32_t)LENGTH_EXTRA[symbol - FIRST_LENGTH_CODE_INDEX] << 12);
+		}
+		/* unused length codes 286 and 287 */
+		return HUFFMAN_ENTRY(HUFFMAN_ENTRY_INVALID, 0, 0);
+	} else if (alphabet == HUFFMAN_ALPHABET_DISTANCE) {
+		if (symbol <= 29) {
+			return HUFFMAN_ENTRY(HUFFMAN_ENTRY_DISTANCE, 0, DISTANCE_BASE[symbol])
+          | ((uint32_t)DISTANCE_EXTRA[symbol] << 12);
+		}
+		/* distance codes 30-31 are never used */
+		return HUFFMAN_ENTRY(HUFFMAN_ENTRY_INVALID, 0, 0);
+	}
+	return HUFFMAN_ENTRY(HUFFMAN_ENTRY_SYMBOL, 0, symbol);
+}
+
+static uint16_t reverse_bits(uint16_t code, uint16_t nbits) {
+	uint16_t result = 0, i;
+	for (i = 0; i < nbits; i++) {
+		result = (result << 1) | ((code >> i) & 1);
+	}
+	return result;
+}
 
-	/* initialize local vectors */
-	memset(blcount, 0, sizeof(uint16_t) * MAX_BIT_LENGTH);
-	memset(nextcode, 0, sizeof(uint16_t) * MAX_BIT_LENGTH);
+/*given the code lengths (as stored in the PNG file), generate the decode table as defined 
+ * by Deflate. The root table is indexed by the next rootbits bits of the stream (lsb first),
+ * codes longer than that continue in a subtable per root slot. return value is error.*/
+static void huffman_table_create_lengths(upng_t* upng, huffman_table* table, 
+    const uint16_t *bitlen) {
+	uint16_t blcount[MAX_BIT_LENGTH + 1];
+	uint16_t offsets[MAX_BIT_LENGTH + 2];
+	uint16_t sorted[MAX_SYMBOLS];	/*symbols ordered by code length, then by value */
+	uint16_t codes[MAX_SYMBOLS];	/*canonical code of each entry in sorted */
+	uint32_t rootsize = 1u << table->rootbits;
+	uint32_t next_subtable = rootsize;	/*first free entry after the root table */
+	uint16_t bits, n, i, maxlen = 0, code = 0;
+	int32_t left = 1;
+
+	memset(blcount, 0, sizeof(blcount));
+	memset(table->buffer, 0, sizeof(uint32_t) * rootsize);
 
 	/*step 1: count number of instances of each code length */
-	for (bits = 0; bits < tree->numcodes; bits++) {
-		blcount[bitlen[bits]]++;
+	for (n = 0; n < table->numcodes; n++) {
+		blcount[bitlen[n]]++;
+		if (bitlen[n] > maxlen) {
+			maxlen = bitlen[n];
+		}
 	}
 
-	/*step 2: generate the nextcode values */
-	for (bits = 1; bits <= tree->maxbitlen; bits++) {
-		nextcode[bits] = (nextcode[bits - 1] + blcount[bits - 1]) << 1;
+	/* an empty code is allowed (e.g. a block without distance codes), 
+	 * any lookup in it is an error */
+	if (maxlen == 0) {
+		return;
 	}
 
-	/*step 3: generate all the codes */
-	for (n = 0; n < tree->numcodes; n++) {
-		if (bitlen[n] != 0) {
-			tree1d[n] = nextcode[bitlen[n]]++;
+	/*step 2: reject oversubscribed and incomplete codes. The only incomplete code
+	 * deflate allows is a single code of one bit */
+	for (bits = 1; bits <= MAX_BIT_LENGTH; bits++) {
+		left = (left << 1) - blcount[bits];
+		if (left < 0) {
+			SET_ERROR(upng, UPNG_EMALFORMED);
+			return;
 		}
 	}
+	if (left > 0 && maxlen != 1) {
+		SET_ERROR(upng, UPNG_EMALFORMED);
+		return;
+	}
 
-	/*convert tree1d[] to tree2d[][]. In the 2D array, a value of 32767 means uninited, 
-   * a value >= numcodes is an address to another bit, a value < numcodes is a code. 
-   * The 2 rows are the 2 possible bit values (0 or 1), there are as many columns as codes - 1
-	 * a good huffmann tree has N * 2 - 1 nodes, of which N - 1 are internal nodes. 
-   * Here, the internal nodes are stored (what their 0 and 1 option point to).
-   * There is only memory for such good tree currently, if there are more nodes
-   * (due to too long length codes), error 55 will happen */
-	for (n = 0; n < tree->numcodes * 2; n++) {
-		tree->tree2d[n] = 32767;	/*32767 here means the tree2d isn't filled there yet */
+	/*step 3: sort the symbols by code length and generate their canonical codes */
+	offsets[1] = 0;
+	for (bits = 1; bits <= MAX_BIT_LENGTH; bits++) {
+		offsets[bits + 1] = offsets[bits] + blcount[bits];
+	}
+	for (n = 0; n < table->numcodes; n++) {
+		if (bitlen[n] != 0) {
+			sorted[offsets[bitlen[n]]++] = n;
+		}
+	}
+	n = 0;
+	for (bits = 1; bits <= maxlen; bits++) {
+		for (i = 0; i < blcount[bits]; i++) {
+			codes[n++] = code++;
+		}
+		code <<= 1;
 	}
 
-	for (n = 0; n < tree->numcodes; n++) {	/*the codes */
-		for (i = 0; i < bitlen[n]; i++) {	/*the bits for this code */
-			uint8_t bit = (uint8_t)((tree1d[n] >> (bitlen[n] - i - 1)) & 1);
-			/* check if oversubscribed */
-			if (treepos > tree->numcodes - 2) {
-				SET_ERROR(upng, UPNG_EMALFORMED);
-				return;
+	/*step 4: fill in the tables. Codes sharing the same root bits are adjacent in
+	 * canonical order, so each group gets one subtable sized for its longest code */
+	for (i = 0; i < n; i++) {
+		uint16_t symbol = sorted[i];
+		uint16_t len = bitlen[symbol];
+		uint32_t reversed = reverse_bits(codes[i], len);
+		uint32_t entry = huffman_symbol_entry(table->alphabet, symbol) | len;
+		uint32_t index;
+
+		if (len <= table->rootbits) {
+			for (index = reversed; index < rootsize; index += 1u << len) {
+				table->buffer[index] = entry;
 			}
+		} else {
+			uint32_t root = reversed & (rootsize - 1);
+			uint32_t subtable = table->buffer[root];
+			uint32_t subsize;
+
+			if (HUFFMAN_ENTRY_KIND(subtable) != HUFFMAN_ENTRY_SUBTABLE) {
+				/*first code of this group, the last code in the group is the longest */
+				uint16_t prefix = codes[i] >> (len - table->rootbits);
+				uint16_t last = i, subbits;
+				while (last + 1 < n && (codes[last + 1] >> 
+                (bitlen[sorted[last + 1]] - table->rootbits)) == prefix) {
+					last++;
+				}
+				subbits = bitlen[sorted[last]] - table->rootbits;
 
-			if (tree->tree2d[2 * treepos + bit] == 32767) {	/*not yet filled in */
-				if (i + 1 == bitlen[n]) {	/*last bit */
-					tree->tree2d[2 * treepos + bit] = n;	/*put the current code in it */
-					treepos = 0;
-				} else {	
-          /*put address of the next step in here, 
-           * first that address has to be found of course (it's just nodefilled + 1)... */
-					nodefilled++;
-          /*addresses encoded with numcodes added to it */
-					tree->tree2d[2 * treepos + bit] = nodefilled + tree->numcodes;	
-					treepos = nodefilled;
+				if (next_subtable + (1u << subbits) > table->size) {
+					SET_ERROR(upng, UPNG_EMALFORMED);
+					return;
 				}
-			} else {
-				treepos = tree->tree2d[2 * treepos + bit] - tree->numcodes;
+
+				subtable = HUFFMAN_ENTRY(HUFFMAN_ENTRY_SUBTABLE, table->rootbits, next_subtable) 
+            | ((uint32_t)subbits << 12);
+				table->buffer[root] = subtable;
+				memset(&table->buffer[next_subtable], 0, sizeof(uint32_t) << subbits);
+				next_subtable += 1u << subbits;
 			}
-		}
-	}
 
-	for (n = 0; n < tree->numcodes * 2; n++) {
-		if (tree->tree2d[n] == 32767) {
-			tree->tree2d[n] = 0;	/*remove possible remaining 32767's */
+			subsize = 1u << HUFFMAN_ENTRY_SUBBITS(subtable);
+			for (index = reversed >> table->rootbits; index < subsize; 
+          index += 1u << (len - table->rootbits)) {
+				table->buffer[HUFFMAN_ENTRY_VALUE(subtable) + index] = entry;
+			}
 		}
 	}
-	free(tree1d);
 }
 
-static uint16_t huffman_decode_symbol(upng_t *upng, const uint8_t *in, 
-    uint32_t *bp, const huffman_tree* codetree, uint32_t inlength) {
-	uint16_t treepos = 0, ct;
-	uint8_t bit;
-	for (;;) {
-		/* error: end of input memory reached without endcode */
-		if (((*bp) & 0x07) == 0 && ((*bp) >> 3) > inlength) {
-			SET_ERROR(upng, UPNG_EMALFORMED);
-			return 0;
-		}
+/*merge root entries holding a short literal code with the literal that follows it,
+ * when both codes fit in the root bits, so they are decoded with a single lookup */
+static void huffman_table_pair_literals(huffman_table* table) {
+	uint32_t rootsize = 1u << table->rootbits;
+	uint32_t index = rootsize;
 
-		bit = read_bit(bp, in);
+	/*walk downwards: the follow-up entry (index >> len) is never above index, 
+	 * so it is still a plain symbol entry when we look at it */
+	while (index-- > 0) {
+		uint32_t first = table->buffer[index];
+		uint32_t second, len;
 
-		ct = codetree->tree2d[(treepos << 1) | bit];
-		if (ct < codetree->numcodes) {
-			return ct;
+		if (HUFFMAN_ENTRY_KIND(first) != HUFFMAN_ENTRY_SYMBOL || HUFFMAN_ENTRY_VALUE(first) > 255) {
+			continue;
 		}
 
-		treepos = ct - codetree->numcodes;
-		if (treepos >= codetree->numcodes) {
-			SET_ERROR(upng, UPNG_EMALFORMED);
-			return 0;
+		len = HUFFMAN_ENTRY_LENGTH(first);
+		second = table->buffer[index >> len];
+		if (HUFFMAN_ENTRY_KIND(second) != HUFFMAN_ENTRY_SYMBOL || HUFFMAN_ENTRY_VALUE(second) > 255 
+        || len + HUFFMAN_ENTRY_LENGTH(second) > table->rootbits) {
+			continue;
 		}
+
+		table->buffer[index] = HUFFMAN_ENTRY(HUFFMAN_ENTRY_LITERAL_PAIR, 
+        len + HUFFMAN_ENTRY_LENGTH(second), 
+        HUFFMAN_ENTRY_VALUE(first) | (HUFFMAN_ENTRY_VALUE(second) << 8));
 	}
 }
 
-/* get the tree of a deflated block with dynamic tree, 
- * the tree itself is also Huffman compressed with a known tree*/
-static void get_tree_inflate_dynamic(upng_t* upng, huffman_tree* codetree, huffman_tree* codetreeD,
-    huffman_tree* codelengthcodetree, const uint8_t *in, uint32_t *bp, 
-    uint32_t inlength) {
-	uint16_t codelengthcode[NUM_CODE_LENGTH_CODES];
-	uint16_t* bitlen = (uint16_t*)malloc(sizeof(uint16_t) * NUM_DEFLATE_CODE_SYMBOLS);
+/* block type 1 uses fixed codes, decoded with tables generated ahead of time into
+ * upng_fixed_tables.h. The longest fixed codes are 9 and 5 bits, so each table is
+ * just a root table and fixed blocks start decoding without building anything */
+#define FIXED_DEFLATE_CODE_ROOT_BITS 9
+#define FIXED_DISTANCE_ROOT_BITS 5
+
+#include "upng_fixed_tables.h"
+
+static const huffman_table FIXED_DEFLATE_CODE_TREE = {
+	FIXED_DEFLATE_CODE_TABLE, NULL, 1 << FIXED_DEFLATE_CODE_ROOT_BITS, 
+	FIXED_DEFLATE_CODE_ROOT_BITS, NUM_DEFLATE_CODE_SYMBOLS, HUFFMAN_ALPHABET_DEFLATE_CODE
+};
+
+static const huffman_table FIXED_DISTANCE_TREE = {
+	FIXED_DISTANCE_TABLE, NULL, 1 << FIXED_DISTANCE_ROOT_BITS, 
+	FIXED_DISTANCE_ROOT_BITS, NUM_DISTANCE_SYMBOLS, HUFFMAN_ALPHABET_DISTANCE
+};
+
+#if defined(UPNG_MAKE_FIXED_TABLES)
+static void print_fixed_table(FILE* out, const char* name, const huffman_table* table) {
+	uint32_t i, size = 1u << table->rootbits;
+
+	fprintf(out, "static const uint32_t %s[%u] = {", name, size);
+	for (i = 0; i < size; i++) {
+		fprintf(out, "%s0x%08x%s", i % 8 == 0 ? "\n\t" : " ", table->entries[i], 
+        i + 1 < size ? "," : "\n");
+	}
+	fprintf(out, "};\n");
+}
+
+/* writes upng_fixed_tables.h with the fixed code tables built the way dynamic ones are. 
+ * The make_fixed_tables test program does, run it after changing the table entry layout */
+void upng_make_fixed_tables(FILE* out) {
+	uint32_t buffer[1 << FIXED_DEFLATE_CODE_ROOT_BITS];
+	uint32_t bufferD[1 << FIXED_DISTANCE_ROOT_BITS];
+	uint16_t bitlen[NUM_DEFLATE_CODE_SYMBOLS];
 	uint16_t bitlenD[NUM_DISTANCE_SYMBOLS];
-  
-  if (!bitlen) {
-		SET_ERROR(upng, UPNG_ENOMEM);
-		return;
-  }
+	huffman_table codetree, codetreeD;
+	upng_t upng;
+	uint16_t n;
 
-  uint16_t n, hlit, hdist, hclen, i;
+	memset(&upng, 0, sizeof(upng));
+	for (n = 0; n < NUM_DEFLATE_CODE_SYMBOLS; n++) {
+		bitlen[n] = (n <= 143 || n >= 280) ? 8 : (n <= 255 ? 9 : 7);
+	}
+	for (n = 0; n < NUM_DISTANCE_SYMBOLS; n++) {
+		bitlenD[n] = 5;
+	}
+
+	huffman_table_init(&codetree, buffer, 1 << FIXED_DEFLATE_CODE_ROOT_BITS, 
+      NUM_DEFLATE_CODE_SYMBOLS, FIXED_DEFLATE_CODE_ROOT_BITS, HUFFMAN_ALPHABET_DEFLATE_CODE);
+	huffman_table_init(&codetreeD, bufferD, 1 << FIXED_DISTANCE_ROOT_BITS, 
+      NUM_DISTANCE_SYMBOLS, FIXED_DISTANCE_ROOT_BITS, HUFFMAN_ALPHABET_DISTANCE);
+	huffman_table_create_lengths(&upng, &codetree, bitlen);
+	huffman_table_pair_literals(&codetree);
+	huffman_table_create_lengths(&upng, &codetreeD, bitlenD);
+
+	fprintf(out, "/* fixed Huffman decode tables of deflate block type 1, see the huffman\n"
+      " * decode table entry layout in upng.c. Generated by upng_make_fixed_tables, do not edit */\n\n");
+	print_fixed_table(out, "FIXED_DEFLATE_CODE_TABLE", &codetree);
+	fprintf(out, "\n");
+	print_fixed_table(out, "FIXED_DISTANCE_TABLE", &codetreeD);
+}
+#endif
+
+/*decodes the next code of the stream and returns its table entry, either a symbol 
+ * or a literal pair. bitbuf must hold at least MAX_BIT_LENGTH bits*/
+static inline uint32_t huffman_decode_entry(upng_t *upng, bit_reader* br, 
+    const huffman_table* table) {
+	uint32_t bits = (uint32_t)br->bitbuf;
+	uint32_t entry = table->entries[bits & ((1u << table->rootbits) - 1)];
+
+	if (HUFFMAN_ENTRY_KIND(entry) == HUFFMAN_ENTRY_SUBTABLE) {
+		entry = table->entries[HUFFMAN_ENTRY_VALUE(entry) + 
+        ((bits >> table->rootbits) & ((1u << HUFFMAN_ENTRY_SUBBITS(entry)) - 1))];
+	}
 
-	/* make sure that length values that aren't filled in will be 0, or a wrong tree will be generated
-	 * C-code note: use no "return" between ctor and dtor of an uivector! */
-	if ((*bp) >> 3 >= inlength - 2) {
+	/* error: no code matches these bits */
+	if (HUFFMAN_ENTRY_KIND(entry) == HUFFMAN_ENTRY_INVALID) {
 		SET_ERROR(upng, UPNG_EMALFORMED);
-		return;
+		return 0;
+	}
+
+	bit_reader_consume(br, HUFFMAN_ENTRY_LENGTH(entry));
+	return entry;
+}
+
+/*decodes the next code of the stream as a single symbol, checking for the end of the input*/
+static uint16_t huffman_decode_symbol(upng_t *upng, bit_reader* br, const huffman_table* table) {
+	uint32_t entry;
+
+	bit_reader_refill(br);
+	entry = huffman_decode_entry(upng, br, table);
+
+	/* error: end of input memory reached without endcode */
+	if (bit_reader_overrun(br)) {
+		SET_ERROR(upng, UPNG_EMALFORMED);
+		return 0;
 	}
 
+	return HUFFMAN_ENTRY_VALUE(entry);
+}
+
+/* get the code lengths of a deflated block with dynamic tree into scratch.code_lengths,
+ * the lengths themselves are also Huffman compressed with a known tree*/
+static void get_tree_inflate_dynamic(upng_t* upng, huffman_table* codelengthcodetree, 
+    bit_reader* br) {
+	uint16_t codelengthcode[NUM_CODE_LENGTH_CODES];
+	uint16_t* bitlen = upng->scratch.code_lengths;
+	uint16_t* bitlenD = bitlen + NUM_DEFLATE_CODE_SYMBOLS;
+  uint16_t n, hlit, hdist, hclen, i;
+
 	/* clear bitlen arrays */
-	memset(bitlen, 0, sizeof(uint16_t) * NUM_DEFLATE_CODE_SYMBOLS);
-	memset(bitlenD, 0, sizeof(uint16_t) * NUM_DISTANCE_SYMBOLS);
+	memset(bitlen, 0, sizeof(uint16_t) * (NUM_DEFLATE_CODE_SYMBOLS + NUM_DISTANCE_SYMBOLS));
 
-	/*the bit pointer is or will go past the memory */
   /*number of literal/length codes + 257. 
    * Unlike the spec, the value 257 is added to it here already */
-	hlit = read_bits(bp, in, 5) + 257;	
+	hlit = read_bits(br, 5) + 257;	
   /*number of distance codes. Unlike the spec, the value 1 is added to it here already */
-	hdist = read_bits(bp, in, 5) + 1;	
+	hdist = read_bits(br, 5) + 1;	
   /*number of code length codes. Unlike the spec, the value 4 is added to it here already */
-	hclen = read_bits(bp, in, 4) + 4;	
+	hclen = read_bits(br, 4) + 4;	
 
 	for (i = 0; i < NUM_CODE_LENGTH_CODES; i++) {
 		if (i < hclen) {
-			codelengthcode[CLCL[i]] = read_bits(bp, in, 3);
+			codelengthcode[CLCL[i]] = read_bits(br, 3);
 		} else {
 			codelengthcode[CLCL[i]] = 0;	/*if not, it must stay 0 */
 		}
 	}
 
-	huffman_tree_create_lengths(upng, codelengthcodetree, codelengthcode);
+	/*the bit pointer went past the memory */
+	if (bit_reader_overrun(br)) {
+		SET_ERROR(upng, UPNG_EMALFORMED);
+	} else {
+		huffman_table_create_lengths(upng, codelengthcodetree, codelengthcode);
+	}
 
 
 	/* bail now if we encountered an error earlier */
@@ -418,7 +934,7 @@ static void get_tree_inflate_dynamic(upng_t* upng, huffman_tree* codetree, huffm
   /*i is the current symbol we're reading in the part that contains 
    * the code lengths of lit/len codes and dist codes */
 	while (i < hlit + hdist) {	
-		uint16_t code = huffman_decode_symbol(upng, in, bp, codelengthcodetree, inlength);
+		uint16_t code = huffman_decode_symbol(upng, br, codelengthcodetree);
 		if (upng->error != UPNG_EOK) {
 			break;
 		}
@@ -434,12 +950,19 @@ static void get_tree_inflate_dynamic(upng_t* upng, huffman_tree* codetree, huffm
 			uint16_t replength = 3;	/*read in the 2 bits that indicate repeat length (3-6) */
 			uint16_t value;	/*set value to the previous code */
 
-			if ((*bp) >> 3 >= inlength) {
+			/*error, there is no previous code to repeat */
+			if (i == 0) {
 				SET_ERROR(upng, UPNG_EMALFORMED);
 				break;
 			}
+
+			replength += read_bits(br, 2);
+
 			/*error, bit pointer jumps past memory */
-			replength += read_bits(bp, in, 2);
+			if (bit_reader_overrun(br)) {
+				SET_ERROR(upng, UPNG_EMALFORMED);
+				break;
+			}
 
 			if ((i - 1) < hlit) {
 				value = bitlen[i - 1];
@@ -464,14 +987,14 @@ static void get_tree_inflate_dynamic(upng_t* upng, huffman_tree* codetree, huffm
 			}
 		} else if (code == 17) {	/*repeat "0" 3-10 times */
 			uint16_t replength = 3;	/*read in the bits that indicate repeat length */
-			if ((*bp) >> 3 >= inlength) {
+			replength += read_bits(br, 3);
+
+			/*error, bit pointer jumps past memory */
+			if (bit_reader_overrun(br)) {
 				SET_ERROR(upng, UPNG_EMALFORMED);
 				break;
 			}
 
-			/*error, bit pointer jumps past memory */
-			replength += read_bits(bp, in, 3);
-
 			/*repeat this value in the next lengths */
 			for (n = 0; n < replength; n++) {
 				/* error: i is larger than the amount of codes */
@@ -489,14 +1012,14 @@ static void get_tree_inflate_dynamic(upng_t* upng, huffman_tree* codetree, huffm
 			}
 		} else if (code == 18) {	/*repeat "0" 11-138 times */
 			uint16_t replength = 11;	/*read in the bits that indicate repeat length */
-			/* error, bit pointer jumps past memory */
-			if ((*bp) >> 3 >= inlength) {
+			replength += read_bits(br, 7);
+
+			/*error, bit pointer jumps past memory */
+			if (bit_reader_overrun(br)) {
 				SET_ERROR(upng, UPNG_EMALFORMED);
 				break;
 			}
 
-			replength += read_bits(bp, in, 7);
-
 			/*repeat this value in the next lengths */
 			for (n = 0; n < replength; n++) {
 				/* i is larger than the amount of codes */
@@ -522,230 +1045,884 @@ static void get_tree_inflate_dynamic(upng_t* upng, huffman_tree* codetree, huffm
 	}
 
 	/*the length of the end code 256 must be larger than 0 */
-	/*now we've finally got hlit and hdist, so generate the code trees, and the function is done */
-	if (upng->error == UPNG_EOK) {
-		huffman_tree_create_lengths(upng, codetree, bitlen);
+}
+
+/* decode tables built for one set of dynamic block code lengths */
+typedef struct huffman_cache_slot {
+	huffman_table codetree;
+	huffman_table codetreeD;
+	bool valid;	/* the tables were built without error */
+	uint32_t hash;	/* CRC-32 of lengths */
+	uint16_t lengths[NUM_DEFLATE_CODE_SYMBOLS + NUM_DISTANCE_SYMBOLS];
+	uint32_t entries[DEFLATE_CODE_TABLE_SIZE + DISTANCE_TABLE_SIZE];
+} huffman_cache_slot;
+
+static void huffman_cache_init(upng_t* upng) {
+	uint32_t i;
+
+	for (i = 0; i < UPNG_HUFFMAN_CACHE_SLOTS; i++) {
+		upng->scratch.huffman_cache[i].valid = false;
+	}
+	upng->scratch.huffman_cache_next = 0;
+}
+
+/*returns the slot holding the decode tables for the code lengths in scratch.code_lengths,
+ * building them over the oldest slot unless an earlier block used the same lengths. 
+ * NULL if the lengths do not form valid codes*/
+static const huffman_cache_slot* huffman_cache_get(upng_t* upng) {
+	const uint16_t* bitlen = upng->scratch.code_lengths;
+	uint32_t hash = upng_crc32(0, (const uint8_t*)bitlen, 
+      sizeof(uint16_t) * (NUM_DEFLATE_CODE_SYMBOLS + NUM_DISTANCE_SYMBOLS));
+	huffman_cache_slot* slot;
+	uint32_t i;
+
+	for (i = 0; i < UPNG_HUFFMAN_CACHE_SLOTS; i++) {
+		slot = &upng->scratch.huffman_cache[i];
+		if (slot->valid && slot->hash == hash && 
+        memcmp(slot->lengths, bitlen, sizeof(slot->lengths)) == 0) {
+			return slot;
+		}
 	}
+
+	slot = &upng->scratch.huffman_cache[upng->scratch.huffman_cache_next];
+	upng->scratch.huffman_cache_next = (upng->scratch.huffman_cache_next + 1) % UPNG_HUFFMAN_CACHE_SLOTS;
+
+	huffman_table_init(&slot->codetree, slot->entries, DEFLATE_CODE_TABLE_SIZE, 
+      NUM_DEFLATE_CODE_SYMBOLS, DEFLATE_CODE_ROOT_BITS, HUFFMAN_ALPHABET_DEFLATE_CODE);
+	huffman_table_init(&slot->codetreeD, slot->entries + DEFLATE_CODE_TABLE_SIZE, 
+      DISTANCE_TABLE_SIZE, NUM_DISTANCE_SYMBOLS, DISTANCE_ROOT_BITS, HUFFMAN_ALPHABET_DISTANCE);
+
+	huffman_table_create_lengths(upng, &slot->codetree, bitlen);
 	if (upng->error == UPNG_EOK) {
-		huffman_tree_create_lengths(upng, codetreeD, bitlenD);
+		huffman_table_pair_literals(&slot->codetree);
+		huffman_table_create_lengths(upng, &slot->codetreeD, bitlen + NUM_DEFLATE_CODE_SYMBOLS);
 	}
-	free(bitlen);
-}
 
-/*inflate a block with dynamic of fixed Huffman tree*/
-static void inflate_huffman(upng_t* upng, uint8_t* out, uint32_t outsize, 
-    const uint8_t *in, uint32_t *bp, uint32_t *pos, uint32_t inlength, 
-    uint16_t btype) {
-  //Converted to malloc, was overflowing 2k stack on Pebble
-	uint16_t* codetree_buffer = (uint16_t*)malloc(sizeof(uint16_t) * DEFLATE_CODE_BUFFER_SIZE);
-	uint16_t codetreeD_buffer[DISTANCE_BUFFER_SIZE];
-  if (codetree_buffer == NULL) {
-		SET_ERROR(upng, UPNG_ENOMEM);
-		return;
-  }
-	uint16_t done = 0;
+	slot->valid = upng->error == UPNG_EOK;
+	if (!slot->valid) {
+		return NULL;
+	}
+
+	slot->hash = hash;
+	memcpy(slot->lengths, bitlen, sizeof(slot->lengths));
+	return slot;
+}
 
-	huffman_tree codetree;
-	huffman_tree codetreeD;
+/*reads the code lengths of a dynamic block and returns its decode tables, 
+ * NULL on error. The tables are kept off the stack (was overflowing 2k stack 
+ * on Pebble) and reused while later blocks bring the same code lengths*/
+static const huffman_cache_slot* inflate_dynamic_tables(upng_t* upng, bit_reader* br) {
+	uint32_t codelengthcodetree_buffer[CODE_LENGTH_TABLE_SIZE];
+	huffman_table codelengthcodetree;
 
+	huffman_table_init(&codelengthcodetree, codelengthcodetree_buffer, CODE_LENGTH_TABLE_SIZE, 
+      NUM_CODE_LENGTH_CODES, CODE_LENGTH_ROOT_BITS, HUFFMAN_ALPHABET_CODE_LENGTH);
 
-	if (btype == 1) {
-		/* fixed trees */
-		huffman_tree_init(&codetree, 
-                      (uint16_t*)FIXED_DEFLATE_CODE_TREE, NUM_DEFLATE_CODE_SYMBOLS, 
-                      DEFLATE_CODE_BITLEN);
-		huffman_tree_init(&codetreeD, 
-                      (uint16_t*)FIXED_DISTANCE_TREE, NUM_DISTANCE_SYMBOLS, 
-                      DISTANCE_BITLEN);
-	} else if (btype == 2) {
-		/* dynamic trees */
-		uint16_t codelengthcodetree_buffer[CODE_LENGTH_BUFFER_SIZE];
-		huffman_tree codelengthcodetree;
+	get_tree_inflate_dynamic(upng, &codelengthcodetree, br);
+	if (upng->error != UPNG_EOK) {
+		return NULL;
+	}
+	return huffman_cache_get(upng);
+}
 
+/* bytes in the longest store of whole pattern periods that fits in 8 bytes,
+ * by distance */
+static const uint8_t MATCH_PATTERN_STEP[8] = { 0, 8, 8, 6, 8, 5, 6, 7 };
+
+/* copies a back-reference in 8, 16 or 32 byte chunks. The last chunk runs
+ * up to MATCH_COPY_SLACK - 1 bytes past the match; those bytes are garbage
+ * until later output overwrites them, so the caller guarantees the room */
+static inline void copy_match_fast(uint8_t* dst, uint32_t distance, uint32_t length) {
+	const uint8_t* src = dst - distance;
+	uint8_t* end = dst + length;
+
+	if (distance >= 32) {
+		do {
+			memcpy(dst, src, 32);
+			dst += 32;
+			src += 32;
+		} while (dst < end);
+	} else if (distance >= 16) {
+		do {
+			memcpy(dst, src, 16);
+			dst += 16;
+			src += 16;
+		} while (dst < end);
+	} else if (distance >= 8) {
+		do {
+			memcpy(dst, src, 8);
+			dst += 8;
+			src += 8;
+		} while (dst < end);
+	} else {
+		/* a chunk would read bytes it has not written yet: replicate the
+		 * period into a pattern and store that, advancing by whole periods. The
+		 * compiler can not tell that distance is at least 1, zeroing the pattern
+		 * keeps it from warning about the replication reading unset bytes */
+		uint8_t pattern[16] = { 0 };
+		uint32_t step = MATCH_PATTERN_STEP[distance];
+		uint32_t i;
+
+		for (i = 0; i < distance; i++)
+			pattern[i] = src[i];
+		for (; i < 8; i++)
+			pattern[i] = pattern[i - distance];
+
+		if (step == 8) {
+			/* distance 1, 2, 4 and 8 repeat in 16 bytes too: runs of one colour */
+			memcpy(pattern + 8, pattern, 8);
+			do {
+				memcpy(dst, pattern, 16);
+				dst += 16;
+			} while (dst < end);
+		} else {
+			do {
+				memcpy(dst, pattern, 8);
+				dst += step;
+			} while (dst < end);
+		}
+	}
+}
 
-		huffman_tree_init(&codetree, codetree_buffer, NUM_DEFLATE_CODE_SYMBOLS, DEFLATE_CODE_BITLEN);
+/* copies a back-reference without writing past its end */
+static inline void copy_match(uint8_t* dst, uint32_t distance, uint32_t length) {
+	const uint8_t* src = dst - distance;
+	uint32_t i;
 
-		
-    huffman_tree_init(&codetreeD, codetreeD_buffer, NUM_DISTANCE_SYMBOLS, DISTANCE_BITLEN);
-		huffman_tree_init(&codelengthcodetree, codelengthcodetree_buffer, NUM_CODE_LENGTH_CODES, 
-                      CODE_LENGTH_BITLEN);
-    
-    get_tree_inflate_dynamic(upng, &codetree, &codetreeD, &codelengthcodetree, in, bp, inlength);
+	if (distance >= length) {
+		memcpy(dst, src, length);
+	} else {
+		/* overlapping: each byte may be one this copy just wrote */
+		for (i = 0; i < length; i++)
+			dst[i] = src[i];
 	}
+}
+
+/*inflate a block with dynamic of fixed Huffman tree*/
+static void inflate_huffman(upng_t* upng, uint8_t* out, uint32_t outsize, 
+    bit_reader* br, uint32_t *pos, scanline_unfilter* rows, uint16_t btype) {
+	uint16_t done = 0;
 
+	const huffman_table* codetree = &FIXED_DEFLATE_CODE_TREE;
+	const huffman_table* codetreeD = &FIXED_DISTANCE_TREE;
 
-	while (done == 0) {
-		uint16_t code = huffman_decode_symbol(upng, in, bp, &codetree, inlength);
-		if (upng->error != UPNG_EOK) {
+	if (btype == 2) {
+		const huffman_cache_slot* slot = inflate_dynamic_tables(upng, br);
+		if (slot == NULL) {
 			return;
 		}
 
-		if (code == 256) {
-			/* end code */
-			done = 1;
-		} else if (code <= 255) {
-			/* literal symbol */
-			if ((*pos) >= outsize) {
+		codetree = &slot->codetree;
+		codetreeD = &slot->codetreeD;
+	}
+
+	/* work on local copies of the stream state and output position, 
+	 * the compiler has to assume stores to out could change them otherwise */
+	bit_reader in = *br;
+	uint32_t outpos = *pos;
+	uint32_t row_end = rows->row_end;
+
+	while (done == 0 && upng->error == UPNG_EOK) {
+		/*fast path: the refill is a word load and the longest match plus the copy slack 
+		 * fits in the output, so the symbol needs no input or output bounds checks */
+		bool fast = bit_reader_fast(&in) && 
+        outsize - outpos >= MAX_MATCH_LENGTH + MATCH_COPY_SLACK;
+		uint32_t entry, kind, value;
+
+		/* one refill covers a length code, its extra bits, a distance code and its extra bits */
+		bit_reader_refill(&in);
+		entry = huffman_decode_entry(upng, &in, codetree);
+		kind = HUFFMAN_ENTRY_KIND(entry);
+		value = HUFFMAN_ENTRY_VALUE(entry);
+		if (upng->error != UPNG_EOK) {
+			break;
+		}
+
+		/* error: end of input memory reached without endcode */
+		if (!fast && bit_reader_overrun(&in)) {
+			SET_ERROR(upng, UPNG_EMALFORMED);
+			break;
+		}
+
+		if (kind == HUFFMAN_ENTRY_LITERAL_PAIR) {
+			/* two literal symbols */
+			if (!fast && outpos + 2 > outsize) {
 				SET_ERROR(upng, UPNG_EMALFORMED);
-				return;
+				break;
 			}
 
-			/* store output */
-			out[(*pos)++] = (uint8_t)(code);
-		} else if (code >= FIRST_LENGTH_CODE_INDEX && code <= LAST_LENGTH_CODE_INDEX) {	/*length code */
-			/* part 1: get length base */
-			uint32_t length = LENGTH_BASE[code - FIRST_LENGTH_CODE_INDEX];
-			uint16_t codeD, distance, numextrabitsD;
-			uint32_t start, forward, backward, numextrabits;
-
-			/* part 2: get extra bits and add the value of that to length */
-			numextrabits = LENGTH_EXTRA[code - FIRST_LENGTH_CODE_INDEX];
-
-			/* error, bit pointer will jump past memory */
-			if (((*bp) >> 3) >= inlength) {
+			out[outpos++] = (uint8_t)(value);
+			out[outpos++] = (uint8_t)(value >> 8);
+		} else if (kind == HUFFMAN_ENTRY_SYMBOL) {
+			/* literal symbol */
+			if (!fast && outpos >= outsize) {
 				SET_ERROR(upng, UPNG_EMALFORMED);
-				return;
+				break;
 			}
-			length += read_bits(bp, in, numextrabits);
 
-			/*part 3: get distance code */
-			codeD = huffman_decode_symbol(upng, in, bp, &codetreeD, inlength);
+			/* store output */
+			out[outpos++] = (uint8_t)(value);
+		} else if (kind == HUFFMAN_ENTRY_MATCH) {
+			/* length code: the entry holds the base length and the number of extra bits */
+			uint32_t length = value + bit_reader_pop(&in, HUFFMAN_ENTRY_EXTRA_BITS(entry));
+			uint32_t distance;
+
+			/* distance code, likewise as base distance and extra bits */
+			entry = huffman_decode_entry(upng, &in, codetreeD);
 			if (upng->error != UPNG_EOK) {
-				return;
+				break;
 			}
+			distance = HUFFMAN_ENTRY_VALUE(entry) + 
+          bit_reader_pop(&in, HUFFMAN_ENTRY_EXTRA_BITS(entry));
 
-			/* invalid distance code (30-31 are never used) */
-			if (codeD > 29) {
+			/* error, bit pointer jumped past memory */
+			if (!fast && bit_reader_overrun(&in)) {
 				SET_ERROR(upng, UPNG_EMALFORMED);
-				return;
+				break;
 			}
 
-			distance = DISTANCE_BASE[codeD];
-
-			/*part 4: get extra bits from distance */
-			numextrabitsD = DISTANCE_EXTRA[codeD];
-
-			/* error, bit pointer will jump past memory */
-			if (((*bp) >> 3) >= inlength) {
+			/* fill in all the out[n] values based on the length and dist */
+			/* error, distance points before the start of the output */
+			if (distance > outpos || (!fast && outpos + length > outsize)) {
 				SET_ERROR(upng, UPNG_EMALFORMED);
-				return;
+				break;
 			}
 
-			distance += read_bits(bp, in, numextrabitsD);
-
-			/*part 5: fill in all the out[n] values based on the length and dist */
-			start = (*pos);
-			backward = start - distance;
-
-			if ((*pos) + length > outsize) {
-				SET_ERROR(upng, UPNG_EMALFORMED);
-				return;
+			if (fast) {
+				copy_match_fast(out + outpos, distance, length);
+			} else {
+				copy_match(out + outpos, distance, length);
 			}
+			outpos += length;
+		} else {
+			/* end code */
+			done = 1;
+		}
 
-			for (forward = 0; forward < length; forward++) {
-				out[(*pos)++] = out[backward];
-				backward++;
-
-				if (backward >= start) {
-					backward = start - distance;
-				}
-			}
+		if (outpos >= row_end) {
+			unfilter_ready_scanlines(upng, rows, outpos);
+			row_end = rows->row_end;
 		}
 	}
 
-  free(codetree_buffer);
-  return;
+	*br = in;
+	*pos = outpos;
 }
-#endif //ifdef TINFL
 
 static void inflate_uncompressed(upng_t* upng, uint8_t* out, uint32_t outsize, 
-    const uint8_t *in, uint32_t *bp, uint32_t *pos, uint32_t inlength) {
-	uint32_t p;
-	uint16_t len, nlen, n;
+    bit_reader* br, uint32_t *pos, scanline_unfilter* rows) {
+	uint16_t len, nlen;
 
 	/* go to first boundary of byte */
-	while (((*bp) & 0x7) != 0) {
-		(*bp)++;
-	}
-	p = (*bp) / 8;		/*byte position */
+	bit_reader_align(br);
 
 	/* read len (2 bytes) and nlen (2 bytes) */
-	if (p >= inlength - 4) {
+	len = read_bits(br, 16);
+	nlen = read_bits(br, 16);
+
+	if (bit_reader_overrun(br)) {
 		SET_ERROR(upng, UPNG_EMALFORMED);
 		return;
 	}
 
-	len = in[p] + 256 * in[p + 1];
-	p += 2;
-	nlen = in[p] + 256 * in[p + 1];
-	p += 2;
-
 	/* check if 16-bit nlen is really the one's complement of len */
 	if (len + nlen != 65535) {
 		SET_ERROR(upng, UPNG_EMALFORMED);
 		return;
 	}
 
-	if ((*pos) + len >= outsize) {
+	if ((*pos) + len > outsize) {
 		SET_ERROR(upng, UPNG_EMALFORMED);
 		return;
 	}
 
 	/* read the literal data: len bytes are now stored in the out buffer */
-	if (p + len > inlength) {
+	if (!bit_reader_copy(br, &out[*pos], len)) {
 		SET_ERROR(upng, UPNG_EMALFORMED);
 		return;
 	}
 
-	for (n = 0; n < len; n++) {
-		out[(*pos)++] = in[p++];
-	}
-
-	(*bp) = p * 8;
+	(*pos) += len;
+	unfilter_ready_scanlines(upng, rows, *pos);
 }
 
-/*inflate the deflated data (cfr. deflate spec); return value is the error*/
-static upng_error uz_inflate_data(upng_t* upng, uint8_t* out, uint32_t outsize, 
-    const uint8_t *in, uint32_t insize, uint32_t inpos) {
-  /*bit pointer in the "in" data, current byte is bp >> 3, 
-   * current bit is bp & 0x7 (from lsb to msb of the byte) */
-	uint32_t bp = 0;	
-	uint32_t pos = 0;	/*byte position in the out buffer */
+/* inflate backends. uz_inflate_data decodes the raw deflate blocks at the reader's byte
+ * aligned position into out, hands the scanlines to rows as they complete and leaves the
+ * reader after the last block; uz_inflate around it deals with the zlib header and trailer.
+ * The builtin decoder below is the default, UPNG_INFLATE_ZLIB swaps in zlib's inflate and
+ * UPNG_INFLATE_FAST the single-file decoder in fast_inflate.c */
 
+/*decodes blocks until the final one, or until the next block would start at or after the 
+ * stream bit position stop; final tells which*/
+static void inflate_blocks(upng_t* upng, uint8_t* out, uint32_t outsize, bit_reader* br,
+    uint32_t* pos, scanline_unfilter* rows, uint64_t stop, bool* final) {
 	uint16_t done = 0;
 
-	while (done == 0) {
+	while (done == 0 && bit_reader_position(br) < stop) {
 		uint16_t btype;
 
-		/* ensure next bit doesn't point past the end of the buffer */
-		if ((bp >> 3) >= insize) {
+		/* read block control bits */
+		done = read_bits(br, 1);
+		btype = read_bits(br, 2);
+
+		/* ensure the block header didn't point past the end of the buffer */
+		if (bit_reader_overrun(br)) {
 			SET_ERROR(upng, UPNG_EMALFORMED);
-			return upng->error;
+			return;
 		}
 
-		/* read block control bits */
-		done = read_bit(&bp, &in[inpos]);
-		btype = read_bit(&bp, &in[inpos]) | (read_bit(&bp, &in[inpos]) << 1);
-
 		/* process control type appropriateyly */
 		if (btype == 3) {
 			SET_ERROR(upng, UPNG_EMALFORMED);
-			return upng->error;
+			return;
 		} else if (btype == 0) {
-			inflate_uncompressed(upng, out, outsize, &in[inpos], &bp, &pos, insize);	/*no compression */
+			inflate_uncompressed(upng, out, outsize, br, pos, rows);	/*no compression */
 		} else {
-#ifndef TINFL			
       /*compression, btype 01 or 10 */
-      inflate_huffman(upng, out, outsize, &in[inpos], &bp, &pos, insize, btype);	
-#else
-      tinfl_decompressor inflator;
-      tinfl_init(&inflator);
-      tinfl_decompress(&inflator, &in[inpos], (size_t*)&insize, out, out, (uint8_t*)&outsize, 0);
-			inflate_uncompressed(upng, out, outsize, &in[inpos], &bp, &pos, insize);	/*no compression */
-#endif
+      inflate_huffman(upng, out, outsize, br, pos, rows, btype);	
 		}
 
 		/* stop if an error has occured */
+		if (upng->error != UPNG_EOK) {
+			return;
+		}
+	}
+
+	*final = done != 0;
+}
+
+#if defined(UPNG_THREADS)
+/* a single large stream is inflated in parts on several threads. The compressed data is
+ * cut into equal pieces; a part's thread looks for the first dynamic block header after 
+ * its cut and decodes from there, without the output before it. Bytes copied from before 
+ * the part are kept as references into the 32K window that precedes it. The thread that 
+ * called the decode inflates the first part straight into the output meanwhile, then 
+ * takes the parts in order: a part that starts where the previous one ended is correct, 
+ * its references are patched from the output and it is copied in. The rest of a part 
+ * whose guess was wrong, or that ran out of room, is inflated again right there */
+
+/* the smallest piece of compressed data worth a thread of its own */
+#if !defined(UPNG_INFLATE_PART_MIN_BYTES)
+#define UPNG_INFLATE_PART_MIN_BYTES (256 * 1024)
+#endif
+
+/* how far past its cut a part looks for a block start before giving up */
+#define INFLATE_PART_SEARCH_BYTES (64 * 1024)
+
+/* symbols above the part's share of the inflated size, so a part of denser data still fits */
+#define INFLATE_PART_SLACK 65536
+
+#define WINDOW_SIZE 32768
+
+/* a symbol of the part's output: a literal byte below 256, otherwise the byte 
+ * WINDOW_SIZE + 256 - symbol bytes before the part starts */
+#define INFLATE_WINDOW_SYMBOL(back) ((uint16_t)(WINDOW_SIZE + 256 - (back)))
+
+typedef struct inflate_part {
+	upng_t decoder;	/* error and dynamic block tables of the part's thread, nothing else */
+	huffman_cache_slot huffman_cache[UPNG_HUFFMAN_CACHE_SLOTS];
+	uint16_t code_lengths[NUM_DEFLATE_CODE_SYMBOLS + NUM_DISTANCE_SYMBOLS];
+	uint16_t* symbols;	/* the part's output */
+	uint32_t capacity;
+	pthread_t thread;
+	bool started;
+	bit_reader in;	/* at the cut */
+	uint64_t stop;	/* the part's blocks start before this bit position, the next part's cut */
+	bool found;	/* a block start was found, the fields below are the part's result */
+	uint64_t start;	/* bit position of the first block */
+	bit_reader end;	/* just after the last block decoded in full */
+	uint32_t count;	/* symbols of the blocks decoded in full */
+	bool final;	/* the last of them is the final block */
+	uint8_t lookup[256 + WINDOW_SIZE];	/* byte of each symbol once the window is known */
+} inflate_part;
+
+/*decodes a block into the part's symbols from *count on*/
+static void inflate_part_block(inflate_part* part, bit_reader* br, uint32_t* count, uint16_t btype) {
+	upng_t* decoder = &part->decoder;
+	uint16_t* out = part->symbols;
+	uint32_t outsize = part->capacity;
+	uint32_t outpos = *count;
+	uint16_t done = 0;
+
+	const huffman_table* codetree = &FIXED_DEFLATE_CODE_TREE;
+	const huffman_table* codetreeD = &FIXED_DISTANCE_TREE;
+
+	if (btype == 0) {
+		uint16_t len, nlen;
+
+		bit_reader_align(br);
+		len = read_bits(br, 16);
+		nlen = read_bits(br, 16);
+		if (bit_reader_overrun(br) || len + nlen != 65535) {
+			SET_ERROR(decoder, UPNG_EMALFORMED);
+			return;
+		}
+		if (outpos + len > outsize) {
+			SET_ERROR(decoder, UPNG_ENOMEM);
+			return;
+		}
+
+		while (len-- > 0) {
+			out[outpos++] = (uint16_t)read_bits(br, 8);
+		}
+		if (bit_reader_overrun(br)) {
+			SET_ERROR(decoder, UPNG_EMALFORMED);
+			return;
+		}
+
+		*count = outpos;
+		return;
+	}
+
+	if (btype == 2) {
+		const huffman_cache_slot* slot = inflate_dynamic_tables(decoder, br);
+		if (slot == NULL) {
+			return;
+		}
+
+		codetree = &slot->codetree;
+		codetreeD = &slot->codetreeD;
+	}
+
+	while (done == 0 && decoder->error == UPNG_EOK) {
+		/* as in inflate_huffman, no bounds checks while a whole match surely fits */
+		bool fast = bit_reader_fast(br) && outsize - outpos >= MAX_MATCH_LENGTH;
+		uint32_t entry, kind, value;
+
+		bit_reader_refill(br);
+		entry = huffman_decode_entry(decoder, br, codetree);
+		kind = HUFFMAN_ENTRY_KIND(entry);
+		value = HUFFMAN_ENTRY_VALUE(entry);
+		if (decoder->error != UPNG_EOK) {
+			break;
+		}
+		if (!fast && bit_reader_overrun(br)) {
+			SET_ERROR(decoder, UPNG_EMALFORMED);
+			break;
+		}
+
+		if (kind == HUFFMAN_ENTRY_LITERAL_PAIR) {
+			if (!fast && outpos + 2 > outsize) {
+				SET_ERROR(decoder, UPNG_ENOMEM);
+				break;
+			}
+			out[outpos++] = (uint16_t)(value & 0xFF);
+			out[outpos++] = (uint16_t)(value >> 8);
+		} else if (kind == HUFFMAN_ENTRY_SYMBOL) {
+			if (!fast && outpos >= outsize) {
+				SET_ERROR(decoder, UPNG_ENOMEM);
+				break;
+			}
+			out[outpos++] = (uint16_t)value;
+		} else if (kind == HUFFMAN_ENTRY_MATCH) {
+			uint32_t length = value + bit_reader_pop(br, HUFFMAN_ENTRY_EXTRA_BITS(entry));
+			uint32_t distance, i;
+
+			entry = huffman_decode_entry(decoder, br, codetreeD);
+			if (decoder->error != UPNG_EOK) {
+				break;
+			}
+			distance = HUFFMAN_ENTRY_VALUE(entry) + 
+          bit_reader_pop(br, HUFFMAN_ENTRY_EXTRA_BITS(entry));
+			if ((!fast && bit_reader_overrun(br)) || distance > outpos + WINDOW_SIZE) {
+				SET_ERROR(decoder, UPNG_EMALFORMED);
+				break;
+			}
+			if (!fast && outpos + length > outsize) {
+				SET_ERROR(decoder, UPNG_ENOMEM);
+				break;
+			}
+
+			if (distance <= outpos && distance >= length) {
+				memcpy(out + outpos, out + outpos - distance, sizeof(uint16_t) * length);
+				outpos += length;
+				continue;
+			}
+
+			/* the part of the match before the part's output becomes window references,
+			 * the rest copies symbols, references included */
+			for (i = 0; i < length && distance > outpos; i++, outpos++) {
+				out[outpos] = INFLATE_WINDOW_SYMBOL(distance - outpos);
+			}
+			for (; i < length; i++, outpos++) {
+				out[outpos] = out[outpos - distance];
+			}
+		} else {
+			done = 1;
+		}
+	}
+
+	*count = outpos;
+}
+
+/*decodes the part from a block start guessed at the reader's position, for as long as its
+ * blocks start before the next part's cut. Returns false if no block can start there*/
+static bool inflate_part_guess(inflate_part* part, bit_reader* in) {
+	upng_t* decoder = &part->decoder;
+	uint64_t start = bit_reader_position(in);
+	uint32_t count = 0;
+	uint16_t done = 0;
+	bool first = true;
+
+	while (done == 0 && bit_reader_position(in) < part->stop) {
+		bit_reader block = *in;
+		uint16_t btype;
+
+		decoder->error = UPNG_EOK;
+		done = read_bits(&block, 1);
+		btype = read_bits(&block, 2);
+
+		/* only dynamic block headers are distinctive enough to guess */
+		if (first && (done != 0 || btype != 2)) {
+			return false;
+		}
+
+		if (btype == 3 || bit_reader_overrun(&block)) {
+			SET_ERROR(decoder, UPNG_EMALFORMED);
+		} else {
+			inflate_part_block(part, &block, &count, btype);
+		}
+
+		/* a bad first block is a wrong guess, a bad later one ends the part; 
+		 * the sequential decode will find out what is wrong with it */
+		if (decoder->error != UPNG_EOK) {
+			if (first) {
+				return false;
+			}
+			done = 0;
+			break;
+		}
+
+		*in = block;
+		part->count = count;
+		first = false;
+	}
+
+	part->found = true;
+	part->start = start;
+	part->end = *in;
+	part->final = done != 0;
+	return true;
+}
+
+static void* inflate_part_worker(void* arg) {
+	inflate_part* part = (inflate_part*)arg;
+	bit_reader byte = part->in;
+	uint64_t limit = bit_reader_position(&byte) + 8 * INFLATE_PART_SEARCH_BYTES;
+
+	if (limit > part->stop) {
+		limit = part->stop;
+	}
+
+	/* try every bit position after the cut */
+	while (!part->found && bit_reader_position(&byte) < limit && !bit_reader_overrun(&byte)) {
+		for (uint32_t bit = 0; bit < 8; bit++) {
+			bit_reader in = byte;
+			if (bit > 0) {
+				read_bits(&in, bit);
+			}
+			if (inflate_part_guess(part, &in)) {
+				break;
+			}
+
+			/* the first block alone is larger than the part's room */
+			if (part->decoder.error == UPNG_ENOMEM) {
+				return NULL;
+			}
+		}
+		read_bits(&byte, 8);
+	}
+	return NULL;
+}
+
+/*stream offset just past the last byte of the stream*/
+static uint64_t bit_reader_stream_size(const bit_reader* br) {
+	uint64_t size = br->span_end;
+	const uint8_t* chunk = br->chunk;
+
+	if (chunk != NULL) {
+		size += (uint64_t)(br->chunk_end - br->end);
+	}
+	while (chunk != NULL) {
+		chunk += upng_chunk_data_length(chunk) + 12;
+		if (chunk >= br->chunks_end) {
+			break;
+		}
+		if (upng_chunk_data_length(chunk) + 8 > br->chunk_skip) {
+			size += upng_chunk_data_length(chunk) + 8 - br->chunk_skip;
+		}
+	}
+	return size;
+}
+
+/*moves a reader without lookahead forward to the stream offset, false past the end. 
+ * The chunks on the way are left to whoever reads them, and so is the one it lands in: 
+ * the reader did not see its start. The chunks after it are checked as usual*/
+static bool bit_reader_skip_to(bit_reader* br, uint64_t offset) {
+	bool verify_crc = br->verify_crc;
+	bool entered = true;
+
+	br->verify_crc = false;
+	while (br->span_end <= offset && entered) {
+		entered = bit_reader_next_span(br);
+	}
+	br->verify_crc = verify_crc;
+	br->crc_next = NULL;
+	if (!entered) {
+		return false;
+	}
+
+	br->next = br->end - (uint32_t)(br->span_end - offset);
+	return true;
+}
+
+/*continues br at the position of from, a reader that went through the same chunks up to a 
+ * later point. Every chunk still gets checked: br's CRC carries over if from is in the 
+ * chunk br is in and has not gone past the span br's CRC ends at, otherwise br checks 
+ * the rest of its chunk right away; from checked the chunks after it*/
+static void bit_reader_take(bit_reader* br, const bit_reader* from) {
+	const uint8_t* chunk = br->chunk;
+	const uint8_t* crc_next = br->crc_next;
+	uint32_t crc = br->crc;
+	bool mismatch = br->crc_mismatch;
+
+	*br = *from;
+	br->crc_mismatch |= mismatch;
+	if (!br->verify_crc || chunk == NULL || crc_next == NULL) {
+		return;
+	}
+
+	if (br->chunk == chunk && crc_next <= br->end) {
+		br->crc = crc;
+		br->crc_next = crc_next;
+		return;
+	}
+
+	crc = upng_crc32(crc, crc_next, (size_t)(upng_chunk_data(chunk) + 
+      upng_chunk_data_length(chunk) - crc_next));
+	if (crc != MAKE_DWORD_PTR(upng_chunk_data(chunk) + upng_chunk_data_length(chunk))) {
+		br->crc_mismatch = true;
+	}
+	if (br->chunk == chunk) {
+		br->crc_next = NULL;
+	}
+}
+
+/*number of parts the stream after the zlib header is inflated in*/
+static uint32_t inflate_parallel_parts(const upng_t* upng, const bit_reader* br) {
+	uint64_t size = bit_reader_stream_size(br) - bit_reader_position(br) / 8;
+	uint64_t parts = size / UPNG_INFLATE_PART_MIN_BYTES;
+
+	if (parts > upng->scratch.num_inflate_parts) {
+		parts = upng->scratch.num_inflate_parts;
+	}
+	return parts > 1 ? (uint32_t)parts : 1;
+}
+
+/*maps the part's symbols to bytes at the end of the output, through a table of the 
+ * literals followed by the window before the part*/
+static void inflate_part_resolve(upng_t* upng, uint8_t* out, uint32_t outsize, 
+    uint32_t* pos, inflate_part* part) {
+	const uint16_t* symbols = part->symbols;
+	uint8_t* lookup = part->lookup;
+	uint8_t* dst = out + *pos;
+	uint32_t window = *pos < WINDOW_SIZE ? *pos : WINDOW_SIZE;
+	uint32_t i;
+
+	if (part->count > outsize - *pos) {
+		SET_ERROR(upng, UPNG_EMALFORMED);
+		return;
+	}
+
+	/* error, a distance points before the start of the output */
+	if (window < WINDOW_SIZE) {
+		for (i = 0; i < part->count; i++) {
+			if (symbols[i] >= 256 && symbols[i] < 256 + WINDOW_SIZE - window) {
+				SET_ERROR(upng, UPNG_EMALFORMED);
+				return;
+			}
+		}
+	}
+
+	memcpy(lookup + 256 + WINDOW_SIZE - window, dst - window, window);
+	for (i = 0; i < part->count; i++) {
+		dst[i] = lookup[symbols[i]];
+	}
+	*pos += part->count;
+}
+
+static void inflate_parallel(upng_t* upng, uint8_t* out, uint32_t outsize, bit_reader* br,
+    scanline_unfilter* rows, uint32_t num_parts) {
+	inflate_part* parts = upng->scratch.inflate_parts;
+	uint64_t first = bit_reader_position(br) / 8;
+	uint64_t size = bit_reader_stream_size(br) - first;
+	uint64_t share = upng->scratch.inflate_symbols_size / (num_parts - 1);
+	uint32_t pos = 0;
+	bool final = false;
+
+	if (share > UINT32_MAX) {
+		share = UINT32_MAX;
+	}
+
+	for (uint32_t i = 1; i < num_parts; i++) {
+		inflate_part* part = &parts[i];
+		uint64_t cut = first + size * i / num_parts;
+
+		part->decoder.error = UPNG_EOK;
+		part->symbols = upng->scratch.inflate_symbols + share * (i - 1);
+		part->capacity = (uint32_t)share;
+		part->stop = i + 1 < num_parts ? (first + size * (i + 1) / num_parts) * 8 : UINT64_MAX;
+		part->found = false;
+		part->count = 0;
+		part->in = *br;
+		part->in.bitbuf = 0;
+		part->in.bitcount = 0;
+		part->started = bit_reader_skip_to(&part->in, cut) && 
+        pthread_create(&part->thread, NULL, inflate_part_worker, part) == 0;
+	}
+
+	/* the first part is known to start right here */
+	inflate_blocks(upng, out, outsize, br, &pos, rows, (first + size / num_parts) * 8, &final);
+
+	for (uint32_t i = 1; i < num_parts; i++) {
+		inflate_part* part = &parts[i];
+
+		if (part->started) {
+			pthread_join(part->thread, NULL);
+		}
+		if (upng->error != UPNG_EOK || final) {
+			continue;
+		}
+
+		if (part->found && part->start == bit_reader_position(br)) {
+			inflate_part_resolve(upng, out, outsize, &pos, part);
+			if (upng->error == UPNG_EOK) {
+				bit_reader_take(br, &part->end);
+				final = part->final;
+				unfilter_ready_scanlines(upng, rows, pos);
+			}
+		}
+		if (upng->error == UPNG_EOK && !final) {
+			inflate_blocks(upng, out, outsize, br, &pos, rows, part->stop, &final);
+		}
+	}
+}
+
+/* the part memory in the scratch arena */
+static uint64_t inflate_parts_size(uint32_t num_parts) {
+	return sizeof(inflate_part) * (uint64_t)num_parts;
+}
+
+/*clears each part's decoder and points it to the part's tables*/
+static void inflate_parts_init(upng_t* upng) {
+	for (uint32_t i = 0; i < upng->scratch.num_inflate_parts; i++) {
+		inflate_part* part = &upng->scratch.inflate_parts[i];
+		memset(&part->decoder, 0, sizeof(upng_t));
+		part->decoder.scratch.huffman_cache = part->huffman_cache;
+		part->decoder.scratch.code_lengths = part->code_lengths;
+		huffman_cache_init(&part->decoder);
+		part->started = false;
+		for (uint32_t j = 0; j < 256; j++) {
+			part->lookup[j] = (uint8_t)j;
+		}
+	}
+}
+#endif
+
+/*inflate the deflated data (cfr. deflate spec); return value is the error*/
+static upng_error uz_inflate_data(upng_t* upng, uint8_t* out, uint32_t outsize, bit_reader* br,
+    scanline_unfilter* rows) {
+	uint32_t pos = 0;	/*byte position in the out buffer */
+	bool final = false;
+
+#if defined(UPNG_THREADS)
+	uint32_t num_parts = inflate_parallel_parts(upng, br);
+	if (num_parts > 1) {
+		inflate_parallel(upng, out, outsize, br, rows, num_parts);
+		return upng->error;
+	}
+#endif
+
+	inflate_blocks(upng, out, outsize, br, &pos, rows, UINT64_MAX, &final);
+	return upng->error;
+}
+#elif defined(UPNG_INFLATE_ZLIB)
+static void* upng_alloc(upng_t* upng, size_t size);
+static void upng_dealloc(upng_t* upng, void* ptr);
+
+static voidpf upng_zlib_alloc(voidpf opaque, uInt items, uInt size) {
+	return upng_alloc((upng_t*)opaque, (size_t)items * size);
+}
+
+static void upng_zlib_free(voidpf opaque, voidpf ptr) {
+	upng_dealloc((upng_t*)opaque, ptr);
+}
+
+/* sets up the raw inflate stream reused by every frame. zlib allocates its window on
+ * the first call that leaves output behind; a one byte dictionary makes that happen
+ * here, so decoding frames stays free of allocations like the builtin decoder */
+static void upng_zlib_init(upng_t* upng) {
+	z_stream* strm = &upng->zstream;
+	const Bytef dictionary = 0;
+
+	if (upng->zstream_ready) {
+		return;
+	}
+
+	memset(strm, 0, sizeof(z_stream));
+	strm->zalloc = upng_zlib_alloc;
+	strm->zfree = upng_zlib_free;
+	strm->opaque = upng;
+	if (inflateInit2(strm, -MAX_WBITS) != Z_OK) {
+		SET_ERROR(upng, UPNG_ENOMEM);
+		return;
+	}
+	upng->zstream_ready = true;
+
+	if (inflateSetDictionary(strm, &dictionary, 1) != Z_OK) {
+		SET_ERROR(upng, UPNG_ENOMEM);
+	}
+}
+
+/*inflates the deflated data with zlib, handing it the reader's spans in place one at a
+ * time; return value is the error*/
+static upng_error uz_inflate_data(upng_t* upng, uint8_t* out, uint32_t outsize, bit_reader* br,
+    scanline_unfilter* rows) {
+	z_stream* strm = &upng->zstream;
+	int ret = Z_OK;
+
+	if (inflateReset(strm) != Z_OK) {
+		SET_ERROR(upng, UPNG_ENOMEM);
+		return upng->error;
+	}
+
+	strm->next_out = out;
+	strm->avail_out = outsize;
+
+	while (ret != Z_STREAM_END) {
+		/* the data ends before the last block */
+		if (br->next == br->end && !bit_reader_next_span(br)) {
+			SET_ERROR(upng, UPNG_EMALFORMED);
+			return upng->error;
+		}
+
+		strm->next_in = (Bytef*)br->next;
+		strm->avail_in = (uInt)(br->end - br->next);
+		ret = inflate(strm, Z_NO_FLUSH);
+		br->next = strm->next_in;
+
+		if (ret == Z_MEM_ERROR) {
+			SET_ERROR(upng, UPNG_ENOMEM);
+			return upng->error;
+		}
+
+		/* Z_BUF_ERROR: out is full and the stream goes on */
+		if (ret != Z_OK && ret != Z_STREAM_END) {
+			SET_ERROR(upng, UPNG_EMALFORMED);
+			return upng->error;
+		}
+
+		unfilter_ready_scanlines(upng, rows, outsize - strm->avail_out);
 		if (upng->error != UPNG_EOK) {
 			return upng->error;
 		}
@@ -753,38 +1930,132 @@ static upng_error uz_inflate_data(upng_t* upng, uint8_t* out, uint32_t outsize,
 
 	return upng->error;
 }
+#else
+/* what fast_inflate's callbacks work on */
+typedef struct upng_fast_inflate_user {
+	upng_t* upng;
+	bit_reader* br;
+	scanline_unfilter* rows;
+} upng_fast_inflate_user;
+
+/*steps the reader to its next span once fast_inflate has read the current one*/
+static bool upng_fast_inflate_next_span(void* user, const uint8_t** next, const uint8_t** end) {
+	bit_reader* br = ((upng_fast_inflate_user*)user)->br;
+
+	br->next = *next;
+	if (!bit_reader_next_span(br)) {
+		return false;
+	}
+	*next = br->next;
+	*end = br->end;
+	return true;
+}
+
+/*unfilters the scanlines the output up to pos completes; the next mark is where the 
+ * following one ends, 0 stops the decoder after an error*/
+static size_t upng_fast_inflate_progress(void* user, size_t pos) {
+	upng_fast_inflate_user* inflate_user = (upng_fast_inflate_user*)user;
+
+	unfilter_ready_scanlines(inflate_user->upng, inflate_user->rows, (uint32_t)pos);
+	if (inflate_user->upng->error != UPNG_EOK) {
+		return 0;
+	}
+	return inflate_user->rows->row_end;
+}
+
+/*inflates the deflated data with fast_inflate, which reads the reader's spans in place 
+ * and takes over its bit buffer, then hands back what it read ahead; return value is 
+ * the error*/
+static upng_error uz_inflate_data(upng_t* upng, uint8_t* out, uint32_t outsize, bit_reader* br,
+    scanline_unfilter* rows) {
+	upng_fast_inflate_user user;
+	fast_inflate_stream stream;
+	fast_inflate_result result;
+
+	user.upng = upng;
+	user.br = br;
+	user.rows = rows;
+
+	stream.next = br->next;
+	stream.end = br->end;
+	stream.bitbuf = br->bitcount > 0 ? br->bitbuf & ((1ull << br->bitcount) - 1) : 0;
+	stream.bitcount = br->bitcount;
+	stream.overrun = br->overrun;
+	stream.next_span = upng_fast_inflate_next_span;
+	stream.out = out;
+	stream.out_size = outsize;
+	stream.out_pos = 0;
+	stream.progress = upng_fast_inflate_progress;
+	stream.progress_mark = rows->row_end;
+	stream.user = &user;
+
+	result = fast_inflate(upng->scratch.fast_inflate, &stream);
+
+	br->next = stream.next;
+	br->bitbuf = stream.bitbuf;
+	br->bitcount = stream.bitcount;
+	br->overrun = stream.overrun;
+
+	/* a stopped decoder left the error of the scanlines */
+	if (result == FAST_INFLATE_BAD_DATA) {
+		SET_ERROR(upng, UPNG_EMALFORMED);
+	}
+	return upng->error;
+}
+#endif /*defined(UPNG_INFLATE_BUILTIN)*/
 
-static upng_error uz_inflate(upng_t* upng, uint8_t *out, uint32_t outsize, 
-    const uint8_t *in, uint32_t insize) {
-	/* we require two bytes for the zlib data header */
-	if (insize < 2) {
+static upng_error uz_inflate(upng_t* upng, uint8_t *out, uint32_t outsize, bit_reader* br,
+    scanline_unfilter* rows) {
+	uint8_t header[2];
+	uint32_t cmf, flg;
+
+	/* read the two bytes of the zlib data header, straight off the reader so the
+	 * backend starts at the first block */
+	if (!bit_reader_copy(br, header, 2)) {
 		SET_ERROR(upng, UPNG_EMALFORMED);
 		return upng->error;
 	}
+	cmf = header[0];
+	flg = header[1];
 
-	/* 256 * in[0] + in[1] must be a multiple of 31, 
+	/* 256 * cmf + flg must be a multiple of 31, 
    * the FCHECK value is supposed to be made that way */
-	if ((in[0] * 256 + in[1]) % 31 != 0) {
+	if ((cmf * 256 + flg) % 31 != 0) {
 		SET_ERROR(upng, UPNG_EMALFORMED);
 		return upng->error;
 	}
 
 	/*error: only compression method 8: inflate with sliding window of 32k 
    * is supported by the PNG spec */
-	if ((in[0] & 15) != 8 || ((in[0] >> 4) & 15) > 7) {
+	if ((cmf & 15) != 8 || ((cmf >> 4) & 15) > 7) {
 		SET_ERROR(upng, UPNG_EMALFORMED);
 		return upng->error;
 	}
 
 	/* the specification of PNG says about the zlib stream: 
    * "The additional flags shall not specify a preset dictionary." */
-	if (((in[1] >> 5) & 1) != 0) {
+	if (((flg >> 5) & 1) != 0) {
 		SET_ERROR(upng, UPNG_EMALFORMED);
 		return upng->error;
 	}
 
-	/* create output buffer */
-	uz_inflate_data(upng, out, outsize, in, insize, 2);
+	uz_inflate_data(upng, out, outsize, br, rows);
+#if defined(UPNG_THREADS)
+	upng_row_pipeline_end(upng, rows);
+#endif
+
+	/* the Adler-32 of the inflated data follows the last block, most significant byte 
+	 * first. A stream short of scanlines is malformed whatever its checksum says */
+	if (upng->error == UPNG_EOK && rows->verify_adler && rows->row == rows->height) {
+		uint8_t trailer[4];
+
+		bit_reader_align(br);
+		if (!bit_reader_copy(br, trailer, 4)) {
+			SET_ERROR(upng, UPNG_EMALFORMED);
+		} else if (MAKE_DWORD_PTR(trailer) != rows->adler) {
+			SET_ERROR(upng, UPNG_ECHECKSUM);
+		}
+	}
 
 	return upng->error;
 }
@@ -804,7 +2075,7 @@ static int32_t paeth_predictor(int32_t a, int32_t b, int32_t c) {
 		return c;
 }
 
-static void unfilter_scanline(upng_t* upng, uint8_t *recon, const uint8_t *scanline, 
+static bool unfilter_scanline(uint8_t *recon, const uint8_t *scanline, 
     const uint8_t *precon, uint32_t bytewidth, uint8_t filterType, 
     uint32_t length) {
 	/*
@@ -815,6 +2086,7 @@ static void unfilter_scanline(upng_t* upng, uint8_t *recon, const uint8_t *scanl
 	   the incoming scanlines do NOT include the filtertype byte, 
      that one is given in the parameter filterType instead
 	   recon and scanline MAY be the same memory address! precon must be disjoint.
+	   returns false for an unknown filterType
 	 */
 
 	uint32_t i;
@@ -865,99 +2137,111 @@ static void unfilter_scanline(upng_t* upng, uint8_t *recon, const uint8_t *scanl
 		}
 		break;
 	default:
-		SET_ERROR(upng, UPNG_EMALFORMED);
-		break;
+		return false;
 	}
+	return true;
 }
 
-static void unfilter(upng_t* upng, uint8_t *out, const uint8_t *in, 
-    uint32_t w, uint32_t h, uint32_t bpp) {
+static void scanline_unfilter_init(upng_t* upng, scanline_unfilter* rows, uint8_t* image, 
+    const uint8_t* filtered, uint32_t w, uint32_t h, uint32_t bpp) {
 	/*
 	   For PNG filter method 0
-	   this function unfilters a single image 
-     (e.g. without interlacing this is called once, with Adam7 it's called 7 times)
-	   out must have enough bytes allocated already, 
-     in must have the scanlines + 1 filtertype byte per scanline
+	   unfilters a single image (e.g. without interlacing this is one pass, with Adam7 there are 7)
+	   scanline by scanline while it is being inflated.
+	   filtered receives the inflated scanlines, each with its filtertype byte in front,
+	   image must have room for the unfiltered scanlines
 	   w and h are image dimensions or dimensions of reduced image, bpp is bpp per pixel
-	   in and out are allowed to be the same memory address!
 	 */
+	if (bpp == 0) {
+		SET_ERROR(upng, UPNG_EMALFORMED);
+		return;
+	}
 
-	uint32_t y;
-	uint8_t *prevline = 0;
-
+	rows->image = image;
+	rows->filtered = filtered;
   /*bytewidth is used for filtering, is 1 when bpp < 8, number of bytes per pixel otherwise */
-	uint32_t bytewidth = (bpp + 7) / 8;	
-	uint32_t linebytes = (w * bpp + 7) / 8;
-
-	for (y = 0; y < h; y++) {
-		uint32_t outindex = linebytes * y;
-		uint32_t inindex = (1 + linebytes) * y;	/*the extra filterbyte added to each row */
-		uint8_t filterType = in[inindex];
+	rows->bytewidth = (bpp + 7) / 8;
+	rows->linebytes = (w * bpp + 7) / 8;
+	rows->height = h;
+	rows->row = 0;
+	rows->row_end = h > 0 ? rows->linebytes + 1 : UINT32_MAX;	/*the extra filterbyte added to each row */
+	rows->kernels = rows->bytewidth <= UPNG_MAX_BYTEWIDTH ? 
+      (*upng_get_unfilter_kernels())[rows->bytewidth] : NULL;
+	rows->verify_adler = upng->verify != UPNG_VERIFY_NONE;
+	rows->adler = 1;
+	rows->converter = upng->output_pixels != NULL ? &upng->output_converter : NULL;
+	rows->pixels = upng->output_pixels;
+	rows->pitch = upng->output_pitch;
+	rows->width = w;
+#if defined(UPNG_THREADS)
+	rows->pipeline = NULL;
+#endif
+}
 
-		unfilter_scanline(upng, &out[outindex], &in[inindex + 1], prevline, bytewidth, filterType, 
-                      linebytes);
-		if (upng->error != UPNG_EOK) {
-			return;
+/*unfilters the scanlines the inflate output up to pos completes, 
+ * while the previous unfiltered scanline is still in cache. False on a bad filter type*/
+static bool unfilter_scanlines(scanline_unfilter* rows, uint32_t pos) {
+	uint32_t first_row = rows->row;
+	bool valid = true;
+
+	while (pos >= rows->row_end) {
+		const uint8_t* scanline = rows->filtered + rows->row_end - rows->linebytes;
+		uint8_t* recon = rows->image + rows->row * rows->linebytes;
+		uint8_t filterType = scanline[-1];
+
+		/* the kernels need a previous scanline for everything but Sub; the
+		 * first one, type 0 and invalid types take the generic path */
+		if (rows->kernels != NULL && filterType >= 1 && filterType <= 4 && 
+        (rows->row > 0 || filterType == 1) && rows->kernels[filterType - 1] != NULL) {
+			rows->kernels[filterType - 1](recon, scanline, 
+          rows->row > 0 ? recon - rows->linebytes : NULL, rows->linebytes);
+		} else if (!unfilter_scanline(recon, scanline, rows->row > 0 ? recon - rows->linebytes : NULL, 
+          rows->bytewidth, filterType, rows->linebytes)) {
+			valid = false;
+			break;
+		}
+		if (rows->converter != NULL) {
+			upng_convert_row(rows->converter, rows->pixels + (size_t)rows->row * rows->pitch, 
+          recon, rows->width);
 		}
 
-		prevline = &out[outindex];
+		rows->row++;
+		rows->row_end = rows->row < rows->height ? 
+        rows->row_end + rows->linebytes + 1 : UINT32_MAX;
 	}
-}
 
-static void remove_padding_bits(uint8_t *out, const uint8_t *in, 
-    uint32_t olinebits, uint32_t ilinebits, uint32_t h) {
-	/*
-	   After filtering there are still padding bpp if scanlines have non multiple of 8 bit amounts.
-     They need to be removed (except at last scanline of (Adam7-reduced) image)
-     before working with pure image buffers for the Adam7 code,
-     the color convert code and the output to the user.
-	   in and out are allowed to be the same buffer, in may also be higher but still overlapping; 
-     in must have >= ilinebits*h bpp, out must have >= olinebits*h bpp, 
-     olinebits must be <= ilinebits
-	   also used to move bpp after earlier such operations happened, 
-     e.g. in a sequence of reduced images from Adam7
-	   only useful if (ilinebits - olinebits) is a value in the range 1..7
-	 */
-	uint32_t y;
-	uint32_t diff = ilinebits - olinebits;
-	uint32_t obp = 0, ibp = 0;	/*bit pointers */
-	for (y = 0; y < h; y++) {
-		uint32_t x;
-		for (x = 0; x < olinebits; x++) {
-			uint8_t bit = (uint8_t)((in[(ibp) >> 3] >> (7 - ((ibp) & 0x7))) & 1);
-			ibp++;
+	/* checksum the completed scanlines while they are still in cache */
+	if (rows->verify_adler && rows->row > first_row) {
+		uint32_t stride = rows->linebytes + 1;
+		rows->adler = upng_adler32(rows->adler, rows->filtered + first_row * stride, 
+        (rows->row - first_row) * stride);
+	}
+	return valid;
+}
+
+static void unfilter_ready_scanlines(upng_t* upng, scanline_unfilter* rows, uint32_t pos) {
+	uint32_t first_row = rows->row;
 
-			if (bit == 0)
-				out[(obp) >> 3] &= (uint8_t)(~(1 << (7 - ((obp) & 0x7))));
-			else
-				out[(obp) >> 3] |= (1 << (7 - ((obp) & 0x7)));
-			++obp;
+#if defined(UPNG_THREADS)
+	/* the unfilter stage takes the scanlines, only their count is kept here */
+	if (rows->pipeline != NULL) {
+		while (pos >= rows->row_end) {
+			rows->row++;
+			rows->row_end = rows->row < rows->height ? 
+          rows->row_end + rows->linebytes + 1 : UINT32_MAX;
 		}
-		ibp += diff;
+		upng_row_pipeline_inflated(rows->pipeline, pos);
+		return;
 	}
-}
+#endif
 
-/*out must be buffer big enough to contain full image, 
- * and in must contain the full decompressed data from the IDAT chunks*/
-static void post_process_scanlines(upng_t* upng, uint8_t *out, uint8_t *in, 
-    uint32_t bpp, uint32_t w, uint32_t h) {
-	if (bpp == 0) {
+	if (!unfilter_scanlines(rows, pos)) {
 		SET_ERROR(upng, UPNG_EMALFORMED);
 		return;
 	}
 
-	if (bpp < 8 && w * bpp != ((w * bpp + 7) / 8) * 8) {
-		unfilter(upng, in, in, w, h, bpp);
-		if (upng->error != UPNG_EOK) {
-			return;
-		}
-		//remove_padding_bits(out, in, w * bpp, ((w * bpp + 7) / 8) * 8, h);
-    //fix for non-byte-aligned images
-    uint32_t aligned_width = ((w * bpp + 7) / 8) * 8;
-		remove_padding_bits(in, in, aligned_width, aligned_width, h);
-	} else {
-    /*we can immediatly filter into the out buffer, no other steps needed */
-		unfilter(upng, in, in, w, h, bpp);	
+	if (upng->rows_callback != NULL && rows->row > first_row) {
+		upng->rows_callback(upng->rows_callback_user, upng, first_row, rows->row - first_row);
 	}
 }
 
@@ -1035,6 +2319,169 @@ static void upng_free_source(upng_t* upng) {
 	upng->source.owning = 0;
 }
 
+/* true if the verify policy asks for the CRC of chunk_type to be checked */
+static bool upng_chunk_verified(const upng_t* upng, uint32_t chunk_type) {
+	switch (upng->verify) {
+	case UPNG_VERIFY_ALL:
+		return true;
+	case UPNG_VERIFY_CRITICAL:
+		/* the APNG chunks are ancillary, but frames can not be decoded without them */
+		return upng_chunk_type_critical(chunk_type) || chunk_type == CHUNK_ACTL 
+        || chunk_type == CHUNK_FCTL || chunk_type == CHUNK_FDAT;
+	default:
+		return false;
+	}
+}
+
+static void* upng_default_alloc(void* user, size_t size) {
+	(void)user;
+	return malloc(size);
+}
+
+static void upng_default_free(void* user, void* ptr) {
+	(void)user;
+	free(ptr);
+}
+
+/* every heap allocation made on behalf of a decoder goes through here, 
+ * so that upng_get_allocation_count can report them */
+static void* upng_alloc(upng_t* upng, size_t size) {
+	void* ptr = upng->allocator.alloc(upng->allocator.user, size);
+	if (ptr != NULL) {
+		upng->allocation_count++;
+	}
+	return ptr;
+}
+
+static void upng_dealloc(upng_t* upng, void* ptr) {
+	if (ptr != NULL) {
+		upng->allocator.free(upng->allocator.user, ptr);
+	}
+}
+
+/* bytes per scanline of the full image */
+static uint64_t upng_image_linebytes(const upng_t* upng) {
+	return ((uint64_t)upng->width * upng_get_bpp(upng) + 7) / 8;
+}
+
+/* allocates the scratch arena: decode tables, then the inflated and the 
+ * unfiltered scanlines of an image the size given in IHDR unless the caller
+ * supplied memory for them. An arena left by upng_reset is reused if the
+ * image fits */
+static void upng_scratch_init(upng_t* upng) {
+	upng_scratch* scratch = &upng->scratch;
+	uint64_t image_size = upng_image_linebytes(upng) * upng->height;
+	uint64_t inflated_size = image_size + upng->height; //pad byte
+#if defined(UPNG_INFLATE_ZLIB)
+	/* zlib keeps its decode tables in its own state */
+	uint64_t tables_size = 0;
+	uint64_t lengths_size = 0;
+#elif defined(UPNG_INFLATE_FAST)
+	uint64_t tables_size = sizeof(fast_inflate_tables);
+	uint64_t lengths_size = 0;
+#else
+	uint64_t tables_size = sizeof(huffman_cache_slot) * UPNG_HUFFMAN_CACHE_SLOTS;
+	uint64_t lengths_size = sizeof(uint16_t) * (NUM_DEFLATE_CODE_SYMBOLS + NUM_DISTANCE_SYMBOLS);
+#endif
+#if defined(UPNG_THREADS) && defined(UPNG_INFLATE_BUILTIN)
+	/* a part per inflate thread, each after the first with its share of the symbols */
+	uint32_t num_parts = upng->inflate_threads > 1 ? upng->inflate_threads : 0;
+	uint64_t parts_size = inflate_parts_size(num_parts);
+	uint64_t symbols_count = num_parts > 1 ? 
+      inflated_size + inflated_size / 4 + (uint64_t)INFLATE_PART_SLACK * num_parts : 0;
+#else
+	uint64_t parts_size = 0;
+	uint64_t symbols_count = 0;
+#endif
+	uint64_t arena_inflated_size = upng->work_buffer != NULL ? 0 : inflated_size;
+	uint64_t arena_image_size = upng->output_buffer != NULL ? 0 : image_size;
+	uint64_t total;
+
+	if (inflated_size > UINT32_MAX) {
+		SET_ERROR(upng, UPNG_ENOMEM);
+		return;
+	}
+
+	/* caller memory has to hold the largest frame */
+	if (upng->work_buffer != NULL && upng->work_buffer_size < inflated_size) {
+		SET_ERROR(upng, UPNG_EPARAM);
+		return;
+	}
+
+	total = parts_size + tables_size + lengths_size + sizeof(uint16_t) * symbols_count + 
+      arena_inflated_size + arena_image_size;
+	if (total > SIZE_MAX) {
+		SET_ERROR(upng, UPNG_ENOMEM);
+		return;
+	}
+
+	if (scratch->base == NULL || scratch->capacity < total) {
+		upng_dealloc(upng, scratch->base);
+		scratch->capacity = 0;
+		scratch->base = (uint8_t*)upng_alloc(upng, (size_t)total);
+		if (scratch->base == NULL) {
+			SET_ERROR(upng, UPNG_ENOMEM);
+			return;
+		}
+		scratch->capacity = (size_t)total;
+	}
+
+	/* the parts come first, they hold pointers */
+	uint8_t* tables = scratch->base + parts_size;
+	uint8_t* inflated = tables + tables_size + lengths_size + sizeof(uint16_t) * symbols_count;
+
+	scratch->huffman_cache = (struct huffman_cache_slot*)tables;
+	scratch->code_lengths = (uint16_t*)(tables + tables_size);
+	scratch->inflated = upng->work_buffer != NULL ? upng->work_buffer : inflated;
+	scratch->inflated_size = (uint32_t)inflated_size;
+	scratch->image = upng->output_buffer != NULL ? NULL : inflated + arena_inflated_size;
+	scratch->image_size = (uint32_t)arena_image_size;
+#if defined(UPNG_THREADS)
+	scratch->inflate_parts = (struct inflate_part*)scratch->base;
+	scratch->num_inflate_parts = parts_size > 0 ? upng->inflate_threads : 0;
+	scratch->inflate_symbols = (uint16_t*)(tables + tables_size + lengths_size);
+	scratch->inflate_symbols_size = (size_t)symbols_count;
+#endif
+
+#if defined(UPNG_INFLATE_ZLIB)
+	upng_zlib_init(upng);
+#elif defined(UPNG_INFLATE_FAST)
+	scratch->fast_inflate = (struct fast_inflate_tables*)tables;
+	scratch->fast_inflate->fixed_loaded = false;
+#else
+	huffman_cache_init(upng);
+#if defined(UPNG_THREADS)
+	inflate_parts_init(upng);
+#endif
+#endif
+}
+
+/* reads an fcTL chunk into fctl, the frame has to lie inside the image */
+static void upng_parse_fctl(upng_t* upng, apng_fctl* fctl, const uint8_t* data, 
+    uint32_t data_length) {
+	if (data_length < 26) {
+		SET_ERROR(upng, UPNG_EMALFORMED);
+		return;
+	}
+
+	fctl->sequence_number = MAKE_DWORD_PTR(data);
+	fctl->width = MAKE_DWORD_PTR(data + 4);
+	fctl->height = MAKE_DWORD_PTR(data + 8);
+	fctl->x_offset = MAKE_DWORD_PTR(data + 12);
+	fctl->y_offset = MAKE_DWORD_PTR(data + 16);
+	fctl->delay_num = MAKE_DSHORT_PTR(data + 20);
+	fctl->delay_den = MAKE_DSHORT_PTR(data + 22);
+	fctl->dispose_op = data[24];
+	fctl->blend_op = data[25];
+
+	if (fctl->width == 0 || fctl->height == 0 
+      || fctl->width > upng->width || fctl->x_offset > upng->width - fctl->width 
+      || fctl->height > upng->height || fctl->y_offset > upng->height - fctl->height) {
+		SET_ERROR(upng, UPNG_EMALFORMED);
+		return;
+	}
+}
+
 /*read the information from the header and store it in the upng_Info. return value is error*/
 upng_error upng_header(upng_t* upng) {
 	/* if we have an error state, bail now */
@@ -1070,167 +2517,857 @@ upng_error upng_header(upng_t* upng) {
 		return upng->error;
 	}
 
+	/* the IHDR chunk, its CRC included, takes up bytes 8-32 */
+	if (upng_chunk_verified(upng, CHUNK_IHDR)) {
+		if (upng->source.size < 33 || upng_chunk_data_length(upng->source.buffer + 8) != 13) {
+			SET_ERROR(upng, UPNG_EMALFORMED);
+			return upng->error;
+		}
+		if (!upng_chunk_crc_matches(upng->source.buffer + 8)) {
+			SET_ERROR(upng, UPNG_ECHECKSUM);
+			return upng->error;
+		}
+	}
+
 	/* read the values given in the header */
 	upng->width = MAKE_DWORD_PTR(upng->source.buffer + 16);
 	upng->height = MAKE_DWORD_PTR(upng->source.buffer + 20);
 	upng->color_depth = upng->source.buffer[24];
 	upng->color_type = (upng_color)upng->source.buffer[25];
 
-	/* determine our color format */
-	upng->format = determine_format(upng);
-	if (upng->format == UPNG_BADFORMAT) {
-		SET_ERROR(upng, UPNG_EUNFORMAT);
-		return upng->error;
+	/* determine our color format */
+	upng->format = determine_format(upng);
+	if (upng->format == UPNG_BADFORMAT) {
+		SET_ERROR(upng, UPNG_EUNFORMAT);
+		return upng->error;
+	}
+
+	/* check that the compression method (byte 27) is 0 (only allowed value in spec) */
+	if (upng->source.buffer[26] != 0) {
+		SET_ERROR(upng, UPNG_EMALFORMED);
+		return upng->error;
+	}
+
+	/* check that the compression method (byte 27) is 0 (only allowed value in spec) */
+	if (upng->source.buffer[27] != 0) {
+		SET_ERROR(upng, UPNG_EMALFORMED);
+		return upng->error;
+	}
+
+	/* check that the compression method (byte 27) is 0 
+   * (spec allows 1, but uPNG does not support it) */
+	if (upng->source.buffer[28] != 0) {
+		SET_ERROR(upng, UPNG_EUNINTERLACED);
+		return upng->error;
+	}
+
+	upng->state = UPNG_HEADER;
+	return upng->error;
+}
+
+
+/* appends a frame to the frame table, NULL when out of memory. The table starts out 
+ * with room for the frames acTL announces and the default image, and is doubled when a
+ * file has more; no file can have more frames than it has room for data chunks */
+static upng_frame* upng_add_frame(upng_t* upng) {
+	if (upng->num_frames == upng->frames_capacity) {
+		uint64_t capacity = (uint64_t)upng->frames_capacity * 2;
+		uint64_t most = upng->source.size / 12 + 1;
+		upng_frame* frames;
+
+		if (capacity < (uint64_t)upng->apng_num_frames + 1) {
+			capacity = (uint64_t)upng->apng_num_frames + 1;
+		}
+		if (capacity < 4) {
+			capacity = 4;
+		}
+		if (capacity > most) {
+			capacity = most;
+		}
+
+		frames = (upng_frame*)upng_alloc(upng, sizeof(upng_frame) * (size_t)capacity);
+		if (frames == NULL) {
+			return NULL;
+		}
+		if (upng->num_frames > 0) {
+			memcpy(frames, upng->frames, sizeof(upng_frame) * upng->num_frames);
+		}
+		upng_dealloc(upng, upng->frames);
+		upng->frames = frames;
+		upng->frames_capacity = (uint32_t)capacity;
+	}
+	return &upng->frames[upng->num_frames++];
+}
+
+upng_error upng_load(upng_t* upng) {
+	const uint8_t* chunk;
+	const uint8_t* end = upng->source.buffer + upng->source.size;
+	uint32_t previous_type = 0;
+	upng_frame* frame = NULL;
+	bool seen_data = false;
+	bool has_fctl = false;
+	apng_fctl fctl;
+
+  /* if we have an error state, bail now */
+	if (upng->error != UPNG_EOK) {
+		return upng->error;
+	}
+
+	/* parse the main header, if necessary */
+  if (upng->state != UPNG_HEADER) {
+	  upng_header(upng);
+	  if ((upng->error != UPNG_EOK) || (upng->state != UPNG_HEADER)) {
+		  return upng->error;
+	  }
+  }
+  
+  /* first byte of the first chunk after the header */
+	chunk = upng->source.buffer + 33;
+	memset(&fctl, 0, sizeof(fctl));
+	upng->num_frames = 0;
+	upng->next_frame = 0;
+	upng->output_converter_ready = false;
+
+	/* scan through all of the chunks once, reading the global data, indexing the frames,
+	 * and also verify general well-formed-ness so decoding frames needs no rescanning */
+	while (chunk < end) {
+    uint32_t chunk_type;
+		uint32_t data_length;
+		const uint8_t *data;
+
+		/* make sure chunk header is not larger than the total compressed, before 
+		 * reading the length and type from it */
+		if (end - chunk < 12) {
+			SET_ERROR(upng, UPNG_EMALFORMED);
+			return upng->error;
+		}
+
+		chunk_type = upng_chunk_type(chunk);
+		data_length = upng_chunk_data_length(chunk);
+		data = upng_chunk_data(chunk);
+
+		/* sanity check data_length */
+		if (data_length > INT_MAX) {
+			SET_ERROR(upng, UPNG_EMALFORMED);
+			return upng->error;
+		}
+
+		/* make sure chunk header+paylaod is not larger than the total compressed */
+		if ((uint64_t)data_length + 12 > (uint64_t)(end - chunk)) {
+			SET_ERROR(upng, UPNG_EMALFORMED);
+			return upng->error;
+		}
+
+		/* IDAT and fdAT chunks are checked while they are inflated */
+		if (chunk_type != CHUNK_IDAT && chunk_type != CHUNK_FDAT 
+        && upng_chunk_verified(upng, chunk_type) && !upng_chunk_crc_matches(chunk)) {
+			SET_ERROR(upng, UPNG_ECHECKSUM);
+			return upng->error;
+		}
+
+		/* parse chunks; the global ones only count before the image data */
+    switch (chunk_type) {
+      case CHUNK_OFFS:
+        if (!seen_data && data_length >= 8) {
+          upng->x_offset = MAKE_DWORD_PTR(data);
+          upng->y_offset = MAKE_DWORD_PTR(data + 4);
+        }
+        break;
+      case CHUNK_PLTE:
+        if (seen_data) {
+          SET_ERROR(upng, UPNG_EUNSUPPORTED);
+          return upng->error;
+        }
+        upng->palette_entries = data_length / 3; //3 bytes per color entry
+        if(upng->palette) {
+          upng_dealloc(upng, upng->palette);
+          upng->palette = NULL;
+        }
+        upng->palette = upng_alloc(upng, data_length);
+        if (upng->palette == NULL) {
+          SET_ERROR(upng, UPNG_ENOMEM);
+          return upng->error;
+        }
+        memcpy(upng->palette, data, data_length);
+        break;
+      case CHUNK_TRNS:
+        if (seen_data) {
+          break;
+        }
+        upng->alpha_palette_entries = data_length; //1 byte per color entry
+        if(upng->alpha_palette) {
+          upng_dealloc(upng, upng->alpha_palette);
+          upng->alpha_palette = NULL;
+        }
+        upng->alpha_palette = upng_alloc(upng, data_length);
+        if (upng->alpha_palette == NULL) {
+          SET_ERROR(upng, UPNG_ENOMEM);
+          return upng->error;
+        }
+        memcpy(upng->alpha_palette, data, data_length);
+        break;
+      case CHUNK_FCTL:
+        upng_parse_fctl(upng, &fctl, data, data_length);
+        if (upng->error != UPNG_EOK) {
+          return upng->error;
+        }
+        has_fctl = true;
+        break; 
+      case CHUNK_ACTL:
+        if (!seen_data) {
+          upng->is_apng = true;
+          upng->apng_num_frames = MAKE_DWORD_PTR(data);
+          // We ignore apng num_plays
+        }
+        break;
+      case CHUNK_FDAT:
+        /* first 4 bytes in fdAT is sequence number, skipped while inflating */
+        if (data_length < 4) {
+          SET_ERROR(upng, UPNG_EMALFORMED);
+          return upng->error;
+        }
+        /* fall through */
+      case CHUNK_IDAT:
+        /* a frame's image data continues up to the first chunk of another type, 
+         * the last fcTL before it describes the frame */
+        if (chunk_type != previous_type) {
+          frame = upng_add_frame(upng);
+          if (frame == NULL) {
+            SET_ERROR(upng, UPNG_ENOMEM);
+            return upng->error;
+          }
+          frame->fctl = fctl;
+          frame->has_fctl = has_fctl;
+          frame->data_type = chunk_type;
+          frame->data_offset = (uint32_t)(chunk - upng->source.buffer);
+          has_fctl = false;
+        }
+        frame->data_end = (uint32_t)(chunk - upng->source.buffer) + data_length + 12;
+        seen_data = true;
+        break;
+      case CHUNK_IEND:
+        end = chunk;
+        continue;
+      default:
+        if (upng_chunk_type_critical(chunk_type)) {
+          SET_ERROR(upng, UPNG_EUNSUPPORTED);
+          return upng->error;
+        }
+        break;
+    }
+    previous_type = chunk_type;
+    chunk += data_length + 12; //forward to next chunk
+  }
+
+  /* no image data before the end of the file */
+  if (upng->num_frames == 0) {
+    SET_ERROR(upng, UPNG_EMALFORMED);
+    upng->state = UPNG_ERROR;
+    return upng->error;
+  }
+
+  /* the frame control of the first frame is available before it is decoded */
+  upng->has_frame_control = upng->frames[0].has_fctl;
+  upng->apng_frame_control = upng->frames[0].fctl;
+
+  /* with worker threads, frames are only decoded in memory of the workers */
+#if defined(UPNG_THREADS)
+  upng_decode_pool_free(upng);
+  upng_row_pipeline_free(upng);
+  if (upng->decode_threads > 1) {
+    upng_decode_pool_init(upng);
+  } else if (upng->decode_pipeline) {
+    upng_scratch_init(upng);
+    if (upng->error == UPNG_EOK) {
+      upng_row_pipeline_init(upng);
+    }
+  } else
+#endif
+  upng_scratch_init(upng);
+  if (upng->error == UPNG_EOK) {
+    upng->state = UPNG_LOADED;
+  }
+  return upng->error;
+}
+
+/* whether a frame of width x height pixels fits the caller's output pixels, if any */
+static bool upng_output_pixels_fit(const upng_t* upng, uint32_t width, uint32_t height) {
+	uint64_t row_bytes = (uint64_t)width * upng_pixel_format_bytes(upng->output_format);
+	if (upng->output_pixels == NULL || height == 0) {
+		return true;
+	}
+	return row_bytes <= upng->output_pitch && 
+      (uint64_t)(height - 1) * upng->output_pitch + row_bytes <= upng->output_pixels_size;
+}
+
+/* inflates and unfilters one frame into the scratch arena or the output buffer */
+static void upng_decode_frame(upng_t* upng, uint32_t frame_index) {
+	const upng_frame* frame = &upng->frames[frame_index];
+	const uint8_t* data_chunk; /* first chunk of the frame's IDAT/fdAT run */
+	uint8_t* inflated = NULL;
+	uint32_t inflated_size = 0;
+	bit_reader br;
+	scanline_unfilter rows;
+
+  data_chunk = upng->source.buffer + frame->data_offset;
+  upng->has_frame_control = frame->has_fctl;
+  if (frame->has_fctl) {
+    upng->apng_frame_control = frame->fctl;
+  }
+
+  uint32_t width = upng->width;
+  uint32_t height = upng->height;
+  if (upng->has_frame_control) {
+    width = upng->apng_frame_control.width;
+    height = upng->apng_frame_control.height;
+  }
+
+	/* inflated (but still filtered) data goes to the scratch arena, which 
+	 * upng_parse_fctl made sure is large enough for any frame */
+  uint32_t width_aligned_bytes = (width * upng_get_bpp(upng) + 7) / 8;
+	inflated_size = (width_aligned_bytes * height) + height; //pad byte
+	inflated = upng->scratch.inflated;
+
+	if (inflated_size > upng->scratch.inflated_size) {
+		SET_ERROR(upng, UPNG_EMALFORMED);
+		return;
+	}
+
+	/* the image is unfiltered into its own buffer while inflating, 
+	 * back-references still need the filtered data */
+	upng->size = width_aligned_bytes * height;
+	if (upng->output_buffer != NULL) {
+		if (upng->size > upng->output_buffer_size) {
+			SET_ERROR(upng, UPNG_EPARAM);
+			return;
+		}
+		upng->buffer = upng->output_buffer;
+	} else if (upng->scratch.image != NULL) {
+		upng->buffer = upng->scratch.image;
+	} else {
+		/* the output buffer was taken away after upng_load left it out of the arena */
+		SET_ERROR(upng, UPNG_EPARAM);
+		return;
+	}
+	if (!upng_output_pixels_fit(upng, width, height)) {
+		SET_ERROR(upng, UPNG_EPARAM);
+		return;
+	}
+
+	/* decompress image data straight out of the chunks, unfiltering scanlines as they complete */
+	if (upng->error == UPNG_EOK) {
+		scanline_unfilter_init(upng, &rows, upng->buffer, inflated, width, height, 
+        upng_get_bpp(upng));
+	}
+	if (upng->error == UPNG_EOK) {
+		bit_reader_init_chunks(&br, data_chunk, upng->source.buffer + frame->data_end, 
+        frame->data_type == CHUNK_FDAT ? 12 : 8, upng_chunk_verified(upng, frame->data_type));
+#if defined(UPNG_THREADS)
+		if (upng->row_pipeline != NULL) {
+			upng_row_pipeline_begin(upng->row_pipeline, &rows);
+		}
+#endif
+		uz_inflate(upng, inflated, inflated_size, &br, &rows);
+#if defined(UPNG_THREADS)
+		upng_row_pipeline_end(upng, &rows);
+#endif
+
+		/* the rest of the run was never read, check it too. After an error as well, so 
+		 * that a corrupt chunk is reported as such wherever inflate came to fail on it */
+		if (upng->error == UPNG_EOK || br.verify_crc) {
+			while (bit_reader_next_span(&br)) {
+			}
+		}
+
+		/* a corrupt chunk cut the stream short, which is what inflate complained about */
+		if (br.crc_mismatch) {
+			SET_ERROR(upng, UPNG_ECHECKSUM);
+		}
+	}
+
+	/* error: the image data ended before the last scanline */
+	if (upng->error == UPNG_EOK && rows.row < height) {
+		SET_ERROR(upng, UPNG_EMALFORMED);
+	}
+}
+
+
+#if defined(UPNG_THREADS)
+/* frames ahead of the one upng_decode_image returns are inflated and unfiltered
+ * on worker threads. Every slot is a decoder of its own that shares the source,
+ * frame index and palette of the parent, so a frame decodes the same on any of
+ * them; only compositing depends on the frames before */
+typedef enum upng_slot_state {
+	UPNG_SLOT_FREE,
+	UPNG_SLOT_QUEUED,	/* waiting for a worker */
+	UPNG_SLOT_BUSY,	/* a worker is decoding it */
+	UPNG_SLOT_DONE
+} upng_slot_state;
+
+typedef struct upng_decode_slot {
+	upng_t	decoder;
+	uint32_t	frame;
+	upng_slot_state	state;
+} upng_decode_slot;
+
+typedef struct upng_decode_pool {
+	pthread_mutex_t	lock;
+	pthread_cond_t	work;	/* a slot was queued, or the pool shuts down */
+	pthread_cond_t	done;	/* a slot finished decoding */
+	pthread_t*	threads;
+	uint32_t	num_threads;
+	upng_decode_slot*	slots;
+	uint32_t	num_slots;
+	uint32_t	issue_frame;	/* frame the next free slot is queued for */
+	upng_decode_slot*	delivered;	/* slot upng_get_buffer points into, until the next frame */
+	bool	quit;
+} upng_decode_pool;
+
+/* decode slots per worker thread, one decoding and one waiting to be delivered */
+#define UPNG_DECODE_SLOTS_PER_THREAD 2
+
+static void* upng_decode_worker(void* arg) {
+	upng_decode_pool* pool = (upng_decode_pool*)arg;
+	pthread_mutex_lock(&pool->lock);
+	while (!pool->quit) {
+		/* the earliest queued frame is the one delivered first */
+		upng_decode_slot* slot = NULL;
+		for (uint32_t i = 0; i < pool->num_slots; i++) {
+			upng_decode_slot* candidate = &pool->slots[i];
+			if (candidate->state == UPNG_SLOT_QUEUED && (slot == NULL || candidate->frame < slot->frame)) {
+				slot = candidate;
+			}
+		}
+		if (slot == NULL) {
+			pthread_cond_wait(&pool->work, &pool->lock);
+			continue;
+		}
+
+		slot->state = UPNG_SLOT_BUSY;
+		pthread_mutex_unlock(&pool->lock);
+
+		slot->decoder.error = UPNG_EOK;
+		slot->decoder.error_line = 0;
+		upng_decode_frame(&slot->decoder, slot->frame);
+
+		pthread_mutex_lock(&pool->lock);
+		slot->state = UPNG_SLOT_DONE;
+		pthread_cond_broadcast(&pool->done);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+static void upng_decode_pool_free(upng_t* upng) {
+	upng_decode_pool* pool = upng->decode_pool;
+	if (pool == NULL) {
+		return;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->quit = true;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+	for (uint32_t i = 0; i < pool->num_threads; i++) {
+		pthread_join(pool->threads[i], NULL);
+	}
+
+	for (uint32_t i = 0; i < pool->num_slots; i++) {
+		upng_t* decoder = &pool->slots[i].decoder;
+		upng_dealloc(upng, decoder->scratch.base);
+#if defined(UPNG_INFLATE_ZLIB)
+		if (decoder->zstream_ready) {
+			inflateEnd(&decoder->zstream);
+		}
+#endif
+	}
+
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->work);
+	pthread_mutex_destroy(&pool->lock);
+	upng_dealloc(upng, pool);
+	upng->decode_pool = NULL;
+}
+
+/* allocates the slots and starts the workers, once the frames are indexed */
+static void upng_decode_pool_init(upng_t* upng) {
+	uint32_t num_threads = upng->decode_threads;
+	uint32_t num_slots = num_threads * UPNG_DECODE_SLOTS_PER_THREAD;
+	upng_decode_pool* pool;
+
+	pool = (upng_decode_pool*)upng_alloc(upng, sizeof(upng_decode_pool) 
+      + sizeof(upng_decode_slot) * num_slots + sizeof(pthread_t) * num_threads);
+	if (pool == NULL) {
+		SET_ERROR(upng, UPNG_ENOMEM);
+		return;
+	}
+
+	pool->slots = (upng_decode_slot*)(pool + 1);
+	memset(pool->slots, 0, sizeof(upng_decode_slot) * num_slots);
+	pool->num_slots = num_slots;
+	pool->threads = (pthread_t*)(pool->slots + num_slots);
+	pool->num_threads = 0;
+	pool->issue_frame = 0;
+	pool->delivered = NULL;
+	pool->quit = false;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work, NULL);
+	pthread_cond_init(&pool->done, NULL);
+	upng->decode_pool = pool;
+
+	/* the decoders borrow everything upng_load read and get scratch memory of their own */
+	for (uint32_t i = 0; i < num_slots; i++) {
+		upng_t* decoder = &pool->slots[i].decoder;
+		*decoder = *upng;
+		decoder->source.owning = 0;
+		decoder->work_buffer = NULL;
+		decoder->work_buffer_size = 0;
+		decoder->output_buffer = NULL;
+		decoder->output_buffer_size = 0;
+		decoder->output_pixels = NULL;
+		decoder->allocation_count = 0;
+		decoder->decode_threads = 0;
+		decoder->decode_pool = NULL;
+		decoder->decode_pipeline = false;
+		decoder->inflate_threads = 0;
+		decoder->row_pipeline = NULL;
+		decoder->rows_callback = NULL;
+		memset(&decoder->scratch, 0, sizeof(upng_scratch));
+#if defined(UPNG_INFLATE_ZLIB)
+		decoder->zstream_ready = false;
+#endif
+		pool->slots[i].state = UPNG_SLOT_FREE;
+		pool->slots[i].frame = 0;
+
+		upng_scratch_init(decoder);
+		upng->allocation_count += decoder->allocation_count;
+		if (decoder->error != UPNG_EOK) {
+			SET_ERROR(upng, decoder->error);
+			return;
+		}
+	}
+
+	for (uint32_t i = 0; i < num_threads; i++) {
+		if (pthread_create(&pool->threads[i], NULL, upng_decode_worker, pool) != 0) {
+			SET_ERROR(upng, UPNG_ENOMEM);
+			return;
+		}
+		pool->num_threads++;
+	}
+}
+
+/* hands out the result of next_frame and queues the frames after it on the slots */
+static void upng_decode_pool_next(upng_t* upng) {
+	upng_decode_pool* pool = upng->decode_pool;
+	uint32_t frame = upng->next_frame;
+	upng_decode_slot* slot = NULL;
+
+	pthread_mutex_lock(&pool->lock);
+	if (pool->delivered != NULL) {
+		pool->delivered->state = UPNG_SLOT_FREE;
+		pool->delivered = NULL;
+	}
+
+	for (uint32_t i = 0; i < pool->num_slots; i++) {
+		if (pool->slots[i].state != UPNG_SLOT_FREE && pool->slots[i].frame == frame) {
+			slot = &pool->slots[i];
+		}
+	}
+
+	/* after a seek, the frames queued from the old position are dropped; the ones 
+	 * being decoded are freed once they are done */
+	if (slot == NULL) {
+		pool->issue_frame = frame;
+	} else if (frame >= pool->issue_frame) {
+		pool->issue_frame = frame + 1; /* left over from before an earlier seek */
+	}
+	for (uint32_t i = 0; i < pool->num_slots; i++) {
+		upng_decode_slot* candidate = &pool->slots[i];
+		if ((candidate->state == UPNG_SLOT_QUEUED || candidate->state == UPNG_SLOT_DONE) 
+        && (candidate->frame < frame || candidate->frame >= pool->issue_frame)) {
+			candidate->state = UPNG_SLOT_FREE;
+		}
+	}
+
+	/* every free slot gets one of the frames that come next */
+	for (uint32_t i = 0; i < pool->num_slots && pool->issue_frame < upng->num_frames; i++) {
+		upng_decode_slot* candidate = &pool->slots[i];
+		if (candidate->state == UPNG_SLOT_FREE) {
+			candidate->frame = pool->issue_frame++;
+			candidate->state = UPNG_SLOT_QUEUED;
+			if (slot == NULL) {
+				slot = candidate;
+			}
+		}
+	}
+	pthread_cond_broadcast(&pool->work);
+
+	/* every slot was busy with a frame from before the seek, the first one done
+	 * decodes the frame instead */
+	while (slot == NULL) {
+		pthread_cond_wait(&pool->done, &pool->lock);
+		for (uint32_t i = 0; i < pool->num_slots && slot == NULL; i++) {
+			upng_decode_slot* candidate = &pool->slots[i];
+			if (candidate->state == UPNG_SLOT_DONE) {
+				if (candidate->frame != frame) {
+					candidate->frame = frame;
+					candidate->state = UPNG_SLOT_QUEUED;
+					pthread_cond_broadcast(&pool->work);
+				}
+				pool->issue_frame = frame + 1;
+				slot = candidate;
+			}
+		}
+	}
+
+	while (slot->state != UPNG_SLOT_DONE) {
+		pthread_cond_wait(&pool->done, &pool->lock);
+	}
+	pool->delivered = slot;
+	pthread_mutex_unlock(&pool->lock);
+
+	/* the frame is returned as if this decoder had decoded it */
+	upng_t* decoder = &slot->decoder;
+	upng->has_frame_control = decoder->has_frame_control;
+	upng->apng_frame_control = decoder->apng_frame_control;
+	if (decoder->error != UPNG_EOK) {
+		upng->error = decoder->error;
+		upng->error_line = decoder->error_line;
+		return;
+	}
+
+	upng->size = decoder->size;
+	if (upng->output_buffer != NULL) {
+		if (upng->size > upng->output_buffer_size) {
+			SET_ERROR(upng, UPNG_EPARAM);
+			return;
+		}
+		memcpy(upng->output_buffer, decoder->buffer, upng->size);
+		upng->buffer = upng->output_buffer;
+	} else {
+		upng->buffer = decoder->buffer;
+	}
+
+	/* the shared pixels can only be written once the caller is done with the frame 
+	 * before, so here instead of on the worker */
+	if (upng->output_pixels != NULL) {
+		uint32_t width = upng->has_frame_control ? upng->apng_frame_control.width : upng->width;
+		uint32_t height = upng->has_frame_control ? upng->apng_frame_control.height : upng->height;
+		uint32_t linebytes = (width * upng_get_bpp(upng) + 7) / 8;
+		if (!upng_output_pixels_fit(upng, width, height)) {
+			SET_ERROR(upng, UPNG_EPARAM);
+			return;
+		}
+		for (uint32_t y = 0; y < height; y++) {
+			upng_convert_row(&upng->output_converter, upng->output_pixels + (size_t)y * upng->output_pitch, 
+          upng->buffer + (size_t)y * linebytes, width);
+		}
+	}
+
+	/* the frame is complete before the caller sees any of it */
+	if (upng->rows_callback != NULL) {
+		upng->rows_callback(upng->rows_callback_user, upng, 0, 
+        upng->has_frame_control ? upng->apng_frame_control.height : upng->height);
+	}
+}
+
+/* a frame inflated on one thread and unfiltered on another, while the thread that 
+ * called upng_decode_image hands the finished scanlines to the rows callback. The 
+ * stages pass inflate output positions and scanline counts, the data stays in place */
+typedef struct upng_row_pipeline {
+	pthread_mutex_t	lock;
+	pthread_cond_t	wake;	/* a frame to inflate, more inflated scanlines, or shutdown */
+	pthread_cond_t	progress;	/* more unfiltered scanlines, or the frame is done */
+	pthread_t	threads[2];
+	uint32_t	num_threads;
+	upng_t*	upng;
+	uint32_t	frame;	/* frame the inflate stage decodes */
+	bool	queued;	/* frame is waiting for the inflate stage */
+	bool	decoding;	/* until upng_decode_frame returns for it */
+	scanline_unfilter	rows;	/* the unfilter stage's own view of the frame */
+	bool	unfiltering;	/* rows has scanlines the inflate stage may still complete */
+	uint32_t	inflated_pos;	/* inflate output written so far */
+	bool	inflate_done;	/* inflated_pos is final */
+	bool	unfilter_failed;	/* a scanline had an unknown filter type */
+	uint32_t	unfiltered;	/* scanlines of the frame unfiltered so far */
+	bool	quit;
+} upng_row_pipeline;
+
+static void* upng_row_pipeline_inflate_stage(void* arg) {
+	upng_row_pipeline* pipeline = (upng_row_pipeline*)arg;
+	pthread_mutex_lock(&pipeline->lock);
+	while (!pipeline->quit) {
+		if (!pipeline->queued) {
+			pthread_cond_wait(&pipeline->wake, &pipeline->lock);
+			continue;
+		}
+
+		pipeline->queued = false;
+		pthread_mutex_unlock(&pipeline->lock);
+		upng_decode_frame(pipeline->upng, pipeline->frame);
+		pthread_mutex_lock(&pipeline->lock);
+		pipeline->decoding = false;
+		pthread_cond_broadcast(&pipeline->progress);
+	}
+	pthread_mutex_unlock(&pipeline->lock);
+	return NULL;
+}
+
+static void* upng_row_pipeline_unfilter_stage(void* arg) {
+	upng_row_pipeline* pipeline = (upng_row_pipeline*)arg;
+	pthread_mutex_lock(&pipeline->lock);
+	while (!pipeline->quit) {
+		if (!pipeline->unfiltering 
+        || (pipeline->inflated_pos < pipeline->rows.row_end && !pipeline->inflate_done)) {
+			pthread_cond_wait(&pipeline->wake, &pipeline->lock);
+			continue;
+		}
+
+		uint32_t pos = pipeline->inflated_pos;
+		bool last = pipeline->inflate_done;
+		pthread_mutex_unlock(&pipeline->lock);
+		bool valid = unfilter_scanlines(&pipeline->rows, pos);
+		pthread_mutex_lock(&pipeline->lock);
+
+		pipeline->unfiltered = pipeline->rows.row;
+		if (!valid) {
+			pipeline->unfilter_failed = true;
+		}
+		if (!valid || last || pipeline->rows.row == pipeline->rows.height) {
+			pipeline->unfiltering = false;
+		}
+		pthread_cond_broadcast(&pipeline->progress);
+	}
+	pthread_mutex_unlock(&pipeline->lock);
+	return NULL;
+}
+
+/* hands the scanlines of the frame being inflated to the unfilter stage */
+static void upng_row_pipeline_begin(upng_row_pipeline* pipeline, scanline_unfilter* rows) {
+	pthread_mutex_lock(&pipeline->lock);
+	pipeline->rows = *rows;
+	pipeline->rows.pipeline = NULL;
+	pipeline->inflated_pos = 0;
+	pipeline->inflate_done = false;
+	pipeline->unfilter_failed = false;
+	pipeline->unfiltered = 0;
+	pipeline->unfiltering = rows->height > 0;
+	pthread_mutex_unlock(&pipeline->lock);
+	rows->pipeline = pipeline;
+}
+
+static void upng_row_pipeline_inflated(upng_row_pipeline* pipeline, uint32_t pos) {
+	pthread_mutex_lock(&pipeline->lock);
+	pipeline->inflated_pos = pos;
+	pthread_cond_broadcast(&pipeline->wake);
+	pthread_mutex_unlock(&pipeline->lock);
+}
+
+/* waits for the unfilter stage to catch up with the end of the inflate output, then 
+ * rows has its checksum. Nothing to do for a frame that is not pipelined, or twice */
+static void upng_row_pipeline_end(upng_t* upng, scanline_unfilter* rows) {
+	upng_row_pipeline* pipeline = rows->pipeline;
+	bool failed;
+	if (pipeline == NULL) {
+		return;
 	}
 
-	/* check that the compression method (byte 27) is 0 (only allowed value in spec) */
-	if (upng->source.buffer[26] != 0) {
-		SET_ERROR(upng, UPNG_EMALFORMED);
-		return upng->error;
+	pthread_mutex_lock(&pipeline->lock);
+	pipeline->inflate_done = true;
+	pthread_cond_broadcast(&pipeline->wake);
+	while (pipeline->unfiltering) {
+		pthread_cond_wait(&pipeline->progress, &pipeline->lock);
 	}
+	rows->adler = pipeline->rows.adler;
+	failed = pipeline->unfilter_failed;
+	pthread_mutex_unlock(&pipeline->lock);
 
-	/* check that the compression method (byte 27) is 0 (only allowed value in spec) */
-	if (upng->source.buffer[27] != 0) {
+	rows->pipeline = NULL;
+	if (failed && upng->error == UPNG_EOK) {
 		SET_ERROR(upng, UPNG_EMALFORMED);
-		return upng->error;
 	}
+}
 
-	/* check that the compression method (byte 27) is 0 
-   * (spec allows 1, but uPNG does not support it) */
-	if (upng->source.buffer[28] != 0) {
-		SET_ERROR(upng, UPNG_EUNINTERLACED);
-		return upng->error;
-	}
+/* decodes next_frame on the stage threads and runs the rows callback on this one */
+static void upng_row_pipeline_decode(upng_t* upng) {
+	upng_row_pipeline* pipeline = upng->row_pipeline;
+	uint32_t delivered = 0;
+
+	pthread_mutex_lock(&pipeline->lock);
+	pipeline->frame = upng->next_frame;
+	pipeline->queued = true;
+	pipeline->decoding = true;
+	pipeline->unfiltered = 0;
+	pthread_cond_broadcast(&pipeline->wake);
+	while (1) {
+		while (pipeline->decoding && pipeline->unfiltered == delivered) {
+			pthread_cond_wait(&pipeline->progress, &pipeline->lock);
+		}
+		uint32_t unfiltered = pipeline->unfiltered;
+		bool done = !pipeline->decoding;
+		pthread_mutex_unlock(&pipeline->lock);
 
-	upng->state = UPNG_HEADER;
-	return upng->error;
+		if (upng->rows_callback != NULL && unfiltered > delivered) {
+			upng->rows_callback(upng->rows_callback_user, upng, delivered, unfiltered - delivered);
+		}
+		delivered = unfiltered;
+		if (done) {
+			return;
+		}
+		pthread_mutex_lock(&pipeline->lock);
+	}
 }
 
+static void upng_row_pipeline_free(upng_t* upng) {
+	upng_row_pipeline* pipeline = upng->row_pipeline;
+	if (pipeline == NULL) {
+		return;
+	}
 
-upng_error upng_load(upng_t* upng) {
-  /* if we have an error state, bail now */
-	if (upng->error != UPNG_EOK) {
-		return upng->error;
+	pthread_mutex_lock(&pipeline->lock);
+	pipeline->quit = true;
+	pthread_cond_broadcast(&pipeline->wake);
+	pthread_mutex_unlock(&pipeline->lock);
+	for (uint32_t i = 0; i < pipeline->num_threads; i++) {
+		pthread_join(pipeline->threads[i], NULL);
 	}
 
-	/* parse the main header, if necessary */
-  if (upng->state != UPNG_HEADER) {
-	  upng_header(upng);
-	  if ((upng->error != UPNG_EOK) || (upng->state != UPNG_HEADER)) {
-		  return upng->error;
-	  }
-  }
-  
-  /* first byte of the first chunk after the header */
-	upng->cursor = upng->source.buffer + 33;
+	pthread_cond_destroy(&pipeline->progress);
+	pthread_cond_destroy(&pipeline->wake);
+	pthread_mutex_destroy(&pipeline->lock);
+	upng_dealloc(upng, pipeline);
+	upng->row_pipeline = NULL;
+}
 
-	/* scan through the chunks, finding the size of all IDAT chunks, and also
-	 * verify general well-formed-ness */
-	while (upng->cursor < upng->source.buffer + upng->source.size) {
-    uint32_t chunk_type = upng_chunk_type(upng->cursor);
-		uint32_t data_length = upng_chunk_data_length(upng->cursor);
-		const uint8_t *data = upng_chunk_data(upng->cursor);
+static void upng_row_pipeline_init(upng_t* upng) {
+	void* (*stages[2])(void*) = { upng_row_pipeline_inflate_stage, upng_row_pipeline_unfilter_stage };
+	upng_row_pipeline* pipeline;
 
-		/* sanity check data_length */
-		if (data_length > INT_MAX) {
-      upng->cursor += data_length + 12; //forward cursor to next chunk
-			SET_ERROR(upng, UPNG_EMALFORMED);
-			return upng->error;
-		}
+	pipeline = (upng_row_pipeline*)upng_alloc(upng, sizeof(upng_row_pipeline));
+	if (pipeline == NULL) {
+		SET_ERROR(upng, UPNG_ENOMEM);
+		return;
+	}
 
-		/* make sure chunk header is not larger than the total compressed */
-		if ((uint32_t)(upng->cursor - upng->source.buffer + 12) > upng->source.size) {
-      upng->cursor += data_length + 12; //forward cursor to next chunk
-			SET_ERROR(upng, UPNG_EMALFORMED);
-			return upng->error;
-		}
+	memset(pipeline, 0, sizeof(upng_row_pipeline));
+	pipeline->upng = upng;
+	pthread_mutex_init(&pipeline->lock, NULL);
+	pthread_cond_init(&pipeline->wake, NULL);
+	pthread_cond_init(&pipeline->progress, NULL);
+	upng->row_pipeline = pipeline;
 
-		/* make sure chunk header+paylaod is not larger than the total compressed */
-		if ((uint32_t)(upng->cursor - upng->source.buffer + data_length + 12) > upng->source.size) {
-      upng->cursor += data_length + 12; //forward cursor to next chunk
-			SET_ERROR(upng, UPNG_EMALFORMED);
-			return upng->error;
+	for (uint32_t i = 0; i < 2; i++) {
+		if (pthread_create(&pipeline->threads[i], NULL, stages[i], pipeline) != 0) {
+			SET_ERROR(upng, UPNG_ENOMEM);
+			return;
 		}
-
-
-		/* parse chunks */
-    switch (chunk_type) {
-      case CHUNK_OFFS:
-        upng->x_offset = MAKE_DWORD_PTR(data);
-        upng->y_offset = MAKE_DWORD_PTR(data + 4);
-        break;
-      case CHUNK_PLTE:
-        upng->palette_entries = data_length / 3; //3 bytes per color entry
-        if(upng->palette) {
-          free(upng->palette);
-          upng->palette = NULL;
-        }
-        upng->palette = malloc(data_length);
-        memcpy(upng->palette, data, data_length);
-        break;
-      case CHUNK_TRNS:
-        upng->alpha_palette_entries = data_length; //1 byte per color entry
-        if(upng->alpha_palette) {
-          free(upng->alpha_palette);
-          upng->alpha_palette = NULL;
-        }
-        upng->alpha_palette = malloc(data_length);
-        memcpy(upng->alpha_palette, data, data_length);
-        break;
-      case CHUNK_FCTL:
-        if(upng->apng_frame_control) {
-          free(upng->apng_frame_control);
-        }
-        upng->apng_frame_control = malloc(data_length);
-        upng->apng_frame_control->sequence_number = MAKE_DWORD_PTR(data);
-        upng->apng_frame_control->width = MAKE_DWORD_PTR(data + 4);
-        upng->apng_frame_control->height = MAKE_DWORD_PTR(data + 8);
-        upng->apng_frame_control->x_offset = MAKE_DWORD_PTR(data + 12);
-        upng->apng_frame_control->y_offset = MAKE_DWORD_PTR(data + 16);
-        upng->apng_frame_control->delay_num = MAKE_DSHORT_PTR(data + 20);
-        upng->apng_frame_control->delay_den = MAKE_DSHORT_PTR(data + 22);
-        upng->apng_frame_control->dispose_op = *(data + 23);
-        upng->apng_frame_control->blend_op = *(data + 24);
-        break; 
-      case CHUNK_ACTL:
-        upng->is_apng = true;
-        upng->apng_num_frames = MAKE_DWORD_PTR(data);
-        // We ignore apng num_plays
-        break;
-      case CHUNK_IDAT:
-        // Stop at these chunks and leave for another stage
-        upng->state = UPNG_LOADED;
-        return upng->error;
-        break;
-      case CHUNK_IEND:
-        SET_ERROR(upng, UPNG_EMALFORMED);
-        upng->state = UPNG_ERROR;
-        return upng->error;
-        break;
-      default:
-        if (upng_chunk_type_critical(chunk_type)) {
-          SET_ERROR(upng, UPNG_EUNSUPPORTED);
-          upng->cursor += data_length + 12; //forward cursor to next chunk
-          return upng->error;
-        }
-        break;
-    }
-    upng->cursor += data_length + 12; //forward cursor to next chunk
-  }
-
-  SET_ERROR(upng, UPNG_EMALFORMED);
-	upng->state = UPNG_ERROR;
-	return upng->error;
+		pipeline->num_threads++;
+	}
 }
+#endif
 
 /*read a PNG, the result will be in the same color type as the PNG (hence "generic")*/
 upng_error upng_decode_image(upng_t* upng) {
-	uint8_t* compressed = NULL;
-	uint8_t* inflated = NULL;
-	uint32_t compressed_size = 0;
-	uint32_t inflated_size = 0;
-  bool cursor_at_next_frame = false;
-
 	/* if we have an error state, bail now */
 	if (upng->error != UPNG_EOK) {
 		return upng->error;
@@ -1245,127 +3382,38 @@ upng_error upng_decode_image(upng_t* upng) {
   }
 
 
-	/* release old result, if any */
-	if (upng->buffer != 0) {
-		free(upng->buffer);
-		upng->buffer = 0;
-		upng->size = 0;
-	}
-
-
-  /* scan through the chunks, finding the size of all IDAT chunks, and also
-	 * verify general well-formed-ness */
-	while ((upng->cursor < upng->source.buffer + upng->source.size) && !cursor_at_next_frame) {
-    uint32_t chunk_type = upng_chunk_type(upng->cursor);
-		uint32_t data_length = upng_chunk_data_length(upng->cursor);
-		const uint8_t *data = upng_chunk_data(upng->cursor);
-
-		/* sanity check data_length */
-		if (data_length > INT_MAX) {
-      upng->cursor += data_length + 12; //forward cursor to next chunk
-			SET_ERROR(upng, UPNG_EMALFORMED);
-			return upng->error;
-		}
+	/* release old result, if any; the next one reuses its memory */
+	upng->buffer = NULL;
+	upng->size = 0;
 
-		/* make sure chunk header is not larger than the total compressed */
-		if ((uint32_t)(upng->cursor - upng->source.buffer + 12) > upng->source.size) {
-      upng->cursor += data_length + 12; //forward cursor to next chunk
-			SET_ERROR(upng, UPNG_EMALFORMED);
-			return upng->error;
-		}
+  /* past the last frame; upng_seek_frame can start over */
+  if (upng->next_frame >= upng->num_frames) {
+    SET_ERROR(upng, UPNG_EDONE);
+    return upng->error;
+  }
 
-		/* make sure chunk header+payload is not larger than the total compressed */
-		if ((uint32_t)(upng->cursor - upng->source.buffer + data_length + 12) > upng->source.size) {
-      upng->cursor += data_length + 12; //forward cursor to next chunk
-			SET_ERROR(upng, UPNG_EMALFORMED);
+	/* the palette is known now; it only changes with upng_load, the format with 
+	 * upng_set_output_pixels */
+	if (upng->output_pixels != NULL && !upng->output_converter_ready) {
+		if (!upng_pixel_converter_init(&upng->output_converter, upng, upng->output_format, 
+        upng->output_premultiplied)) {
+			SET_ERROR(upng, UPNG_EUNFORMAT);
 			return upng->error;
 		}
-
-
-		/* parse chunks */
-    switch (chunk_type) {
-      case CHUNK_FCTL:
-        if(upng->apng_frame_control) {
-          free(upng->apng_frame_control);
-        }
-        upng->apng_frame_control = malloc(data_length);
-        upng->apng_frame_control->sequence_number = MAKE_DWORD_PTR(data);
-        upng->apng_frame_control->width = MAKE_DWORD_PTR(data + 4);
-        upng->apng_frame_control->height = MAKE_DWORD_PTR(data + 8);
-        upng->apng_frame_control->x_offset = MAKE_DWORD_PTR(data + 12);
-        upng->apng_frame_control->y_offset = MAKE_DWORD_PTR(data + 16);
-        upng->apng_frame_control->delay_num = *(uint16_t*)(data + 20);
-        upng->apng_frame_control->delay_den = *(uint16_t*)(data + 22);
-        upng->apng_frame_control->dispose_op = *(data + 23);
-        upng->apng_frame_control->blend_op = *(data + 24);
-        break; 
-      case CHUNK_FDAT:
-        /* first 4 bytes in fdAT is sequence number, so skip 4 bytes */
-        // TODO : fix for multiple consecutive fdAT chunks
-        compressed = (uint8_t*)(data + 4);
-        compressed_size = (data_length - 4);
-        cursor_at_next_frame = true; //stop processing chunks at the IDAT/fdAT chunks
-        break;
-      case CHUNK_IDAT:
-        // TODO : fix for multiple consecutive IDAT chunks
-        compressed = (uint8_t*)(data);
-        compressed_size = data_length;
-        cursor_at_next_frame = true; //stop processing chunks at the IDAT/fdAT chunks
-        break;
-      case CHUNK_IEND:
-        SET_ERROR(upng, UPNG_EDONE);
-        upng->state = UPNG_ERROR; //force future calls to fail
-        return upng->error;
-        break;
-      default:
-        if (upng_chunk_type_critical(chunk_type)) {
-          SET_ERROR(upng, UPNG_EUNSUPPORTED);
-          upng->cursor += data_length + 12; //forward cursor to next chunk
-          return upng->error;
-        }
-        break;
-    }
-    upng->cursor += data_length + 12; //forward cursor to next chunk
-  }
-
-
-  uint32_t width = upng->width;
-  uint32_t height = upng->height;
-  if (upng->apng_frame_control) {
-    width = upng->apng_frame_control->width;
-    height = upng->apng_frame_control->height;
-  }
-
-	/* allocate space to store inflated (but still filtered) data */
-  int32_t width_aligned_bytes = (width * upng_get_bpp(upng) + 7) / 8;
-	inflated_size = (width_aligned_bytes * height) + height; //pad byte
-
-#ifdef CCM
-  //Hard-codec CCM usage, avoid compositor buffer (ie. +32k to be safe)
-	inflated = (void*)0x1000a0d8;//(uint8_t*)malloc(inflated_size);
-	//inflated = (void*)0x10008000;//(uint8_t*)malloc(inflated_size);
-#else
-  inflated = (uint8_t*)malloc(inflated_size);
-#endif
-
-	if (inflated == NULL) {
-		SET_ERROR(upng, UPNG_ENOMEM);
-		return upng->error;
-	}
-
-	/* decompress image data */
-	if (uz_inflate(upng, inflated, inflated_size, compressed, compressed_size) != UPNG_EOK) {
-		free(compressed);
-		return upng->error;
+		upng->output_converter_ready = true;
 	}
 
-	/* unfilter scanlines */
-	post_process_scanlines(upng, inflated, inflated, upng_get_bpp(upng), width, height);
-  upng->buffer = inflated;
-	upng->size = inflated_size;
+#if defined(UPNG_THREADS)
+  if (upng->decode_pool != NULL) {
+    upng_decode_pool_next(upng);
+  } else if (upng->row_pipeline != NULL) {
+    upng_row_pipeline_decode(upng);
+  } else
+#endif
+  upng_decode_frame(upng, upng->next_frame);
+  upng->next_frame++;
 
 	if (upng->error != UPNG_EOK) {
-		free(upng->buffer);
 		upng->buffer = NULL;
 		upng->size = 0;
 	} else {
@@ -1375,15 +3423,12 @@ upng_error upng_decode_image(upng_t* upng) {
 	return upng->error;
 }
 
-static upng_t* upng_new(void) {
-	upng_t* upng;
-
-	upng = (upng_t*)malloc(sizeof(upng_t));
-	if (upng == NULL) {
-		return NULL;
-	}
-
-  upng->cursor = NULL;
+/* everything upng_load and decoding find out about an image, back to nothing */
+static void upng_reset_image(upng_t* upng) {
+  upng->frames = NULL;
+  upng->num_frames = 0;
+  upng->frames_capacity = 0;
+  upng->next_frame = 0;
 	upng->buffer = NULL;
 	upng->size = 0;
 
@@ -1402,7 +3447,9 @@ static upng_t* upng_new(void) {
 	upng->color_depth = 8;
 	upng->format = UPNG_RGBA8;
 
-  upng->apng_frame_control = NULL;
+  upng->is_apng = false;
+  upng->has_frame_control = false;
+  memset(&upng->apng_frame_control, 0, sizeof(apng_fctl));
   upng->apng_duration_ms = 0;
   upng->apng_num_frames = 0;
 
@@ -1410,11 +3457,54 @@ static upng_t* upng_new(void) {
 
 	upng->error = UPNG_EOK;
 	upng->error_line = 0;
+}
+
+static upng_t* upng_new(void) {
+	upng_t* upng;
+
+	upng = (upng_t*)malloc(sizeof(upng_t));
+	if (upng == NULL) {
+		return NULL;
+	}
+
+	upng_reset_image(upng);
+	upng->verify = UPNG_VERIFY_NONE;
 
 	upng->source.buffer = NULL;
 	upng->source.size = 0;
 	upng->source.owning = 0;
 
+	upng->allocator.alloc = upng_default_alloc;
+	upng->allocator.free = upng_default_free;
+	upng->allocator.user = NULL;
+	memset(&upng->scratch, 0, sizeof(upng_scratch));
+	upng->allocation_count = 0;
+#if defined(UPNG_INFLATE_ZLIB)
+	upng->zstream_ready = false;
+#endif
+
+	upng->work_buffer = NULL;
+	upng->work_buffer_size = 0;
+	upng->output_buffer = NULL;
+	upng->output_buffer_size = 0;
+	upng->output_pixels = NULL;
+	upng->output_pitch = 0;
+	upng->output_pixels_size = 0;
+	upng->output_format = UPNG_PIXEL_ARGB8888;
+	upng->output_premultiplied = false;
+	upng->output_converter_ready = false;
+
+	upng->decode_threads = 0;
+	upng->decode_pipeline = false;
+	upng->inflate_threads = 0;
+#if defined(UPNG_THREADS)
+	upng->decode_pool = NULL;
+	upng->row_pipeline = NULL;
+#endif
+
+	upng->rows_callback = NULL;
+	upng->rows_callback_user = NULL;
+
 	return upng;
 }
 
@@ -1431,18 +3521,45 @@ upng_t* upng_new_from_bytes(uint8_t* buffer, uint32_t size) {
 	return upng;
 }
 
+upng_error upng_reset(upng_t* upng, uint8_t* buffer, uint32_t size) {
+#if defined(UPNG_THREADS)
+	/* upng_load starts them again for the new image */
+	upng_decode_pool_free(upng);
+	upng_row_pipeline_free(upng);
+#endif
+
+  upng_dealloc(upng, upng->frames);
+  upng_dealloc(upng, upng->palette);
+  upng_dealloc(upng, upng->alpha_palette);
+	upng_free_source(upng);
+
+	upng_reset_image(upng);
+	upng->source.buffer = buffer;
+	upng->source.size = size;
+	return UPNG_EOK;
+}
+
 void upng_free(upng_t* upng) {
-#ifndef CCM   // Hack to use CCM, disable free
-	/* deallocate image buffer */
-	if (upng->buffer != NULL) {
-		free(upng->buffer);
+#if defined(UPNG_THREADS)
+	/* stops the workers before anything they borrow goes away */
+	upng_decode_pool_free(upng);
+	upng_row_pipeline_free(upng);
+#endif
+
+	/* deallocate scratch arena, which holds the image buffer */
+	upng_dealloc(upng, upng->scratch.base);
+
+#if defined(UPNG_INFLATE_ZLIB)
+	if (upng->zstream_ready) {
+		inflateEnd(&upng->zstream);
 	}
 #endif
 
-  /* deallocate palette buffer, if necessary */
-  if (upng->palette) {
-    free(upng->palette);
-  }
+  upng_dealloc(upng, upng->frames);
+
+  /* deallocate palette buffers, if necessary */
+  upng_dealloc(upng, upng->palette);
+  upng_dealloc(upng, upng->alpha_palette);
 
 	/* deallocate source buffer, if necessary */
 	upng_free_source(upng);
@@ -1526,6 +3643,131 @@ uint32_t upng_get_size(const upng_t* upng) {
 	return upng->size;
 }
 
+upng_error upng_set_verify(upng_t* upng, upng_verify verify) {
+	if (verify != UPNG_VERIFY_NONE && verify != UPNG_VERIFY_CRITICAL && verify != UPNG_VERIFY_ALL) {
+		return UPNG_EPARAM;
+	}
+
+	upng->verify = verify;
+	return UPNG_EOK;
+}
+
+upng_error upng_set_decode_threads(upng_t* upng, uint32_t threads) {
+	/* the workers are started by upng_load */
+	if (upng->state == UPNG_LOADED || upng->state == UPNG_DECODED) {
+		return UPNG_EPARAM;
+	}
+#if !defined(UPNG_THREADS)
+	if (threads > 1) {
+		return UPNG_EUNSUPPORTED;
+	}
+#endif
+
+	upng->decode_threads = threads;
+	return UPNG_EOK;
+}
+
+upng_error upng_set_decode_pipeline(upng_t* upng, bool pipeline) {
+	/* the stage threads are started by upng_load */
+	if (upng->state == UPNG_LOADED || upng->state == UPNG_DECODED) {
+		return UPNG_EPARAM;
+	}
+#if !defined(UPNG_THREADS)
+	if (pipeline) {
+		return UPNG_EUNSUPPORTED;
+	}
+#endif
+
+	upng->decode_pipeline = pipeline;
+	return UPNG_EOK;
+}
+
+upng_error upng_set_inflate_threads(upng_t* upng, uint32_t threads) {
+	/* the part memory is allocated by upng_load */
+	if (upng->state == UPNG_LOADED || upng->state == UPNG_DECODED) {
+		return UPNG_EPARAM;
+	}
+#if !defined(UPNG_THREADS) || !defined(UPNG_INFLATE_BUILTIN)
+	if (threads > 1) {
+		return UPNG_EUNSUPPORTED;
+	}
+#endif
+
+	upng->inflate_threads = threads;
+	return UPNG_EOK;
+}
+
+upng_error upng_set_rows_callback(upng_t* upng, upng_rows_callback callback, void* user) {
+	upng->rows_callback = callback;
+	upng->rows_callback_user = user;
+	return UPNG_EOK;
+}
+
+uint32_t upng_get_allocation_count(const upng_t* upng) {
+	return upng->allocation_count;
+}
+
+upng_error upng_set_allocator(upng_t* upng, const upng_allocator* allocator) {
+	/* memory allocated so far has to go back to the allocator it came from */
+	if (upng->allocation_count != 0 
+      || (allocator != NULL && (allocator->alloc == NULL || allocator->free == NULL))) {
+		return UPNG_EPARAM;
+	}
+
+	if (allocator != NULL) {
+		upng->allocator = *allocator;
+	} else {
+		upng->allocator.alloc = upng_default_alloc;
+		upng->allocator.free = upng_default_free;
+		upng->allocator.user = NULL;
+	}
+	return UPNG_EOK;
+}
+
+uint32_t upng_get_work_buffer_size(const upng_t* upng) {
+	uint64_t size = (upng_image_linebytes(upng) + 1) * upng->height;
+	return size > UINT32_MAX ? 0 : (uint32_t)size;
+}
+
+uint32_t upng_get_output_buffer_size(const upng_t* upng) {
+	uint64_t size = upng_image_linebytes(upng) * upng->height;
+	return size > UINT32_MAX ? 0 : (uint32_t)size;
+}
+
+upng_error upng_set_work_buffer(upng_t* upng, uint8_t* buffer, uint32_t size) {
+	/* the scratch arena is laid out by upng_load */
+	if (upng->scratch.base != NULL) {
+		return UPNG_EPARAM;
+	}
+
+	upng->work_buffer = buffer;
+	upng->work_buffer_size = buffer != NULL ? size : 0;
+	return UPNG_EOK;
+}
+
+upng_error upng_set_output_buffer(upng_t* upng, uint8_t* buffer, uint32_t size) {
+	upng->output_buffer = buffer;
+	upng->output_buffer_size = buffer != NULL ? size : 0;
+	return UPNG_EOK;
+}
+
+upng_error upng_set_output_pixels(upng_t* upng, void* pixels, uint32_t pitch, uint32_t size, 
+    upng_pixel_format format, bool premultiplied) {
+	if (pixels != NULL && upng_pixel_format_bytes(format) == 0) {
+		return UPNG_EPARAM;
+	}
+
+	upng->output_pixels = (uint8_t*)pixels;
+	upng->output_pitch = pixels != NULL ? pitch : 0;
+	upng->output_pixels_size = pixels != NULL ? size : 0;
+	if (format != upng->output_format || premultiplied != upng->output_premultiplied) {
+		upng->output_converter_ready = false;
+	}
+	upng->output_format = format;
+	upng->output_premultiplied = premultiplied;
+	return UPNG_EOK;
+}
+
 //returns if the png is an apng after the upng_load() function
 bool upng_is_apng(const upng_t* upng) {
   return upng->is_apng;
@@ -1536,11 +3778,53 @@ uint32_t upng_apng_num_frames(const upng_t* upng) {
   return upng->apng_num_frames;
 }
 
+uint32_t upng_get_frame_count(const upng_t* upng) {
+  return upng->num_frames;
+}
+
+uint32_t upng_get_frame_position(const upng_t* upng) {
+  return upng->next_frame;
+}
+
+upng_error upng_seek_frame(upng_t* upng, uint32_t frame) {
+  /* running out of frames is the only error a seek recovers from */
+  if (upng->error == UPNG_EDONE) {
+    upng->error = UPNG_EOK;
+    upng->error_line = 0;
+  }
+  if (upng->error != UPNG_EOK) {
+    return upng->error;
+  }
+
+  if (upng->state != UPNG_LOADED && upng->state != UPNG_DECODED) {
+    return UPNG_EPARAM;
+  }
+  if (frame >= upng->num_frames) {
+    return UPNG_EPARAM;
+  }
+
+  upng->next_frame = frame;
+  return UPNG_EOK;
+}
+
+upng_error upng_rewind(upng_t* upng) {
+  return upng_seek_frame(upng, 0);
+}
+
+bool upng_get_frame_fctl(const upng_t* upng, uint32_t frame, apng_fctl *apng_frame_control) {
+  if (frame >= upng->num_frames || !upng->frames[frame].has_fctl 
+      || apng_frame_control == NULL) {
+    return false;
+  }
+  *apng_frame_control = upng->frames[frame].fctl;
+  return true;
+}
+
 //Pass in a apng_fctl to get the next frames frame control information
 bool upng_get_apng_fctl(const upng_t* upng, apng_fctl *apng_frame_control) {
   bool retval = false;
   if (upng->is_apng && apng_frame_control != NULL) {
-    *apng_frame_control = *upng->apng_frame_control;
+    *apng_frame_control = upng->apng_frame_control;
     retval = true;
   }
   return retval;
@@ -27,6 +27,7 @@ freely, subject to the following restrictions:
 #if !defined(UPNG_H)
 #define UPNG_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -40,9 +41,16 @@ typedef enum upng_error {
  UPNG_EUNINTERLACED = 6, /* image int32_terlacing is not supported */
  UPNG_EUNFORMAT  = 7, /* image color format is not supported */
  UPNG_EPARAM   = 8, /* invalid parameter to method call */
- UPNG_EDONE   = 9 /* completed decoding all information to end of file (IEND) */
+ UPNG_EDONE   = 9, /* completed decoding all information to end of file (IEND) */
+ UPNG_ECHECKSUM  = 10 /* a chunk CRC or the zlib Adler-32 does not match the data */
 } upng_error;
 
+typedef enum upng_verify {
+ UPNG_VERIFY_NONE  = 0, /* trust the input, no checksums are computed (default) */
+ UPNG_VERIFY_CRITICAL = 1, /* CRCs of critical and APNG chunks, Adler-32 of the image data */
+ UPNG_VERIFY_ALL  = 2 /* CRCs of every chunk, Adler-32 of the image data */
+} upng_verify;
+
 typedef enum upng_format {
  UPNG_BADFORMAT,
  UPNG_INDEXED1,
@@ -72,10 +80,105 @@ typedef struct __attribute__((__packed__)) rgb {
 } rgb;
 
 
+typedef struct upng_allocator {
+  void* (*alloc)(void* user, size_t size);
+  void (*free)(void* user, void* ptr);
+  void* user; //passed to both callbacks
+} upng_allocator;
+
 upng_t*  upng_new_from_bytes(uint8_t* source_buffer, uint32_t source_size);
 
 void  upng_free(upng_t* upng);
 
+//starts over with the image in buffer, as if upng had just been created for it. The
+//allocator, checksum and thread settings and caller buffers stay, and so does the
+//scratch memory when the new image fits in it, so decoding many images of similar
+//size allocates little more than their palettes and frame indexes
+upng_error upng_reset(upng_t* upng, uint8_t* buffer, uint32_t size);
+
+//installs the callbacks used for every allocation the decoder makes (the upng_t itself
+//comes from malloc). Only possible before anything is allocated, i.e. before upng_load.
+//NULL restores malloc/free
+upng_error upng_set_allocator(upng_t* upng, const upng_allocator* allocator);
+
+//reads just the IHDR chunk, so that the buffer sizes below are known before upng_load
+upng_error upng_header(upng_t* upng);
+
+//bytes needed for the inflated scanlines and for the decoded image of the largest frame
+uint32_t upng_get_work_buffer_size(const upng_t* upng);
+uint32_t upng_get_output_buffer_size(const upng_t* upng);
+
+//supplies the memory the inflated scanlines go to (e.g. CCM on embedded targets)
+//instead of allocating it. Must be called before upng_load, the buffer has to
+//hold upng_get_work_buffer_size bytes and stay valid until upng_free
+upng_error upng_set_work_buffer(upng_t* upng, uint8_t* buffer, uint32_t size);
+
+//decodes images straight into caller memory, upng_get_buffer then points there.
+//When set before upng_load the decoder allocates no image buffer of its own; it can
+//be switched between frames. A frame larger than size fails with UPNG_EPARAM
+upng_error upng_set_output_buffer(upng_t* upng, uint8_t* buffer, uint32_t size);
+
+//pixel layouts upng_set_output_pixels converts to. ARGB8888 and ABGR8888 are words in
+//native byte order with alpha in the top byte, as SDL names them; RGB565 is a native
+//16-bit word, RGB888 three bytes R, G, B and RGBA8888 four bytes R, G, B, A whatever the
+//byte order. The formats without alpha drop it. INDEX8 is not a colour: one byte per
+//pixel with the palette index or grey sample of a palette or grey image of up to 8
+//bits, unscaled, so 1, 2 and 4-bit images come out one sample a byte
+typedef enum upng_pixel_format {
+  UPNG_PIXEL_ARGB8888,
+  UPNG_PIXEL_ABGR8888,
+  UPNG_PIXEL_RGB565,
+  UPNG_PIXEL_RGB888,
+  UPNG_PIXEL_RGBA8888,
+  UPNG_PIXEL_INDEX8
+} upng_pixel_format;
+
+//has upng_decode_image also write each frame to pixels, pitch bytes a row, in format:
+//every scanline is converted as soon as it is unfiltered, while it is still in cache.
+//With premultiplied the colours are multiplied by alpha, which for the formats without
+//alpha is the frame over black. A frame is written from pixels on, an APNG frame is not
+//moved to its offset; one that does not fit in size bytes or in pitch fails with
+//UPNG_EPARAM, a format the image has no conversion to with UPNG_EUNFORMAT and
+//premultiplied is ignored for INDEX8. upng_get_buffer still has the frame as decoded.
+//NULL pixels turns it off
+upng_error upng_set_output_pixels(upng_t* upng, void* pixels, uint32_t pitch, uint32_t size, 
+    upng_pixel_format format, bool premultiplied);
+
+//chooses which checksums are verified from now on; they are computed while the chunks
+//are scanned by upng_load and inflated, a mismatch fails with UPNG_ECHECKSUM
+upng_error upng_set_verify(upng_t* upng, upng_verify verify);
+
+//decodes the frames after the one upng_decode_image returns on worker threads, which
+//still hands them out one at a time and in order. Every thread decodes into two frame
+//buffers of its own, upng_get_buffer stays valid until the next upng_decode_image call.
+//Must be called before upng_load, 0 or 1 decodes on the calling thread. Needs a build
+//with UPNG_THREADS, otherwise more threads fail with UPNG_EUNSUPPORTED
+upng_error upng_set_decode_threads(upng_t* upng, uint32_t threads);
+
+//inflates and unfilters every frame on two threads of their own, one scanline behind
+//the other, so that the rows callback gets the top of a large frame while the rest is
+//still being inflated. Meant for single images and first frames; upng_set_decode_threads
+//takes precedence. Must be called before upng_load. Needs a build with UPNG_THREADS,
+//otherwise it fails with UPNG_EUNSUPPORTED
+upng_error upng_set_decode_pipeline(upng_t* upng, bool pipeline);
+
+//inflates the zlib stream of a large frame in up to threads parts at the same time,
+//each part's thread guessing where a deflate block starts in it. Wrong guesses are
+//inflated again on the calling thread, so the result is always the same; streams
+//under 512K compressed stay on one thread. Meant for giant single images, it costs
+//about 2.5 times the size of upng_get_work_buffer_size in extra memory. Must be
+//called before upng_load, 0 or 1 inflates on one thread. Needs a build with
+//UPNG_THREADS and the builtin inflate, otherwise more threads fail with UPNG_EUNSUPPORTED
+upng_error upng_set_inflate_threads(upng_t* upng, uint32_t threads);
+
+//called by upng_decode_image on the thread that called it, each time more scanlines of
+//the frame are final: num_rows rows from first_row of upng_get_buffer. The frame's fcTL
+//is already set, so the band can be converted or blended while the rest is decoded.
+//Besides those two, only the image properties may be read from it
+typedef void (*upng_rows_callback)(void* user, const upng_t* upng, uint32_t first_row, 
+    uint32_t num_rows);
+upng_error upng_set_rows_callback(upng_t* upng, upng_rows_callback callback, void* user);
+
 upng_error upng_load(upng_t* upng);
 upng_error upng_decode_image(upng_t* upng);
 
@@ -101,6 +204,10 @@ int32_t upng_get_alpha_palette(const upng_t *upng, uint8_t **alpha_palette);
 
 const uint8_t* upng_get_buffer(const upng_t* upng);
 
+//returns the number of heap allocations the decoder has made, not counting the upng_t itself.
+//All of them happen in upng_load, decoding frames afterwards does not allocate
+uint32_t upng_get_allocation_count(const upng_t* upng);
+
 typedef enum apng_dispose_ops {
   APNG_DISPOSE_OP_NONE = 0,
   APNG_DISPOSE_OP_BACKGROUND,
@@ -138,4 +245,79 @@ uint32_t upng_apng_num_plays(const upng_t* upng);
 //Pass in a apng_fctl to get the next frames frame control information
 bool upng_get_apng_fctl(const upng_t* upng, apng_fctl *apng_frame_control);
 
+//number of images upng_load found, each run of IDAT or fdAT chunks is one. Frame 0 is 
+//the default image, which has no frame control when it is not part of the animation
+uint32_t upng_get_frame_count(const upng_t* upng);
+
+//the frame the next upng_decode_image call decodes
+uint32_t upng_get_frame_position(const upng_t* upng);
+
+//makes upng_decode_image continue at frame without rescanning the file, also after 
+//it returned UPNG_EDONE. Frames depend on the ones before them when composited, 
+//the decoder itself keeps no state between them
+upng_error upng_seek_frame(upng_t* upng, uint32_t frame);
+upng_error upng_rewind(upng_t* upng);
+
+//frame control of any frame, false if it has none
+bool upng_get_frame_fctl(const upng_t* upng, uint32_t frame, apng_fctl *apng_frame_control);
+
+//composites the frames of an animation the way the APNG spec describes, onto a canvas
+//of the image size with 4 bytes per pixel: R, G, B and A, not premultiplied. The canvas,
+//the area APNG_DISPOSE_OP_PREVIOUS restores and a row for blending are allocated by
+//apng_compositor_new, so compositing itself allocates nothing
+typedef struct apng_compositor apng_compositor;
+
+//a compositor for the image upng_load read, NULL if out of memory or for an image format
+//it can not convert
+apng_compositor* apng_compositor_new(const upng_t* upng);
+void apng_compositor_free(apng_compositor* compositor);
+
+//disposes of the frame on the canvas, then decodes the next frame of upng and blends it
+//onto the canvas band by band while it is decoded; upng's rows callback is taken for the
+//call. The frames have to be decoded in order from the first, or from a restored
+//snapshot. After an error the canvas holds part of the frame
+upng_error apng_compositor_decode_frame(apng_compositor* compositor, upng_t* upng);
+
+//the canvas, width * 4 bytes per row, valid until apng_compositor_free. It is only
+//changed by apng_compositor_decode_frame and apng_compositor_restore
+const uint8_t* apng_compositor_get_canvas(const apng_compositor* compositor);
+
+//frame on the canvas, UINT32_MAX before the first
+uint32_t apng_compositor_get_frame(const apng_compositor* compositor);
+
+//copies the canvas and everything the next frame needs from it into caller memory of
+//apng_compositor_snapshot_size bytes, so that compositing can go back there after a seek
+size_t apng_compositor_snapshot_size(const apng_compositor* compositor);
+void apng_compositor_save(const apng_compositor* compositor, void* snapshot);
+void apng_compositor_restore(apng_compositor* compositor, const void* snapshot);
+
+typedef struct upng_batch_input {
+  const char* path; //file the image is read from when buffer is NULL
+  uint8_t* buffer;
+  uint32_t size;
+} upng_batch_input;
+
+typedef struct upng_batch_stats {
+  uint32_t images; //inputs whose first frame was decoded
+  uint32_t failed;
+  uint32_t threads;
+  uint32_t steals; //times a thread took over part of the inputs of another
+  uint64_t input_bytes; //PNG data read
+  uint64_t output_bytes; //decoded first frames
+  double seconds; //wall clock time of the whole batch
+} upng_batch_stats;
+
+//called for every input on the thread that decoded it, with the first frame decoded or the
+//error that stopped it. upng may decode the other frames, but it and the input data are
+//only valid during the call; upng is NULL if the input could not be read
+typedef void (*upng_batch_callback)(void* user, uint32_t index, upng_t* upng, upng_error error);
+
+//decodes count inputs on threads threads, 0 for one per core, the calling thread being one
+//of them. Every thread starts on an equal share of the list, and when it is through takes
+//half of what is left of another's. Each reuses a single upng_t for all its images, see
+//upng_reset. Without UPNG_THREADS the batch is decoded on the calling thread alone. 
+//stats may be NULL
+upng_error upng_decode_batch(const upng_batch_input* inputs, uint32_t count, uint32_t threads,
+    upng_batch_callback callback, void* user, upng_batch_stats* stats);
+
 #endif /*defined(UPNG_H)*/
@@ -0,0 +1,307 @@
+/*
+uPNG -- derived from LodePNG version 20100808
+
+Copyright (c) 2005-2010 Lode Vandevenne
+Copyright (c) 2010 Sean Middleditch
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+		1. The origin of this software must not be misrepresented; you must not
+		claim that you wrote the original software. If you use this software
+		in a product, an acknowledgment in the product documentation would be
+		appreciated but is not required.
+
+		2. Altered source versions must be plainly marked as such, and must not be
+		misrepresented as being the original software.
+
+		3. This notice may not be removed or altered from any source
+		distribution.
+*/
+
+/* batch decoding of many images. Every thread keeps one decoder that upng_reset 
+ * moves from image to image, so its scratch memory is only reallocated for an 
+ * image larger than all before. The inputs are split into one range per thread;
+ * a thread that is done with its range takes over the upper half of what is left
+ * of another one's */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#if defined(UPNG_THREADS)
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#include "upng.h"
+
+struct upng_batch;
+
+typedef struct batch_worker {
+#if defined(UPNG_THREADS)
+	pthread_t	thread;
+	pthread_mutex_t	lock;	/* guards next and end, which other threads steal from */
+#endif
+	uint32_t	next;	/* range of inputs not started yet */
+	uint32_t	end;
+	struct upng_batch*	batch;
+	upng_t*	upng;	/* created for the first input, reset for every other one */
+	uint8_t*	file;	/* contents of the last input read from a file */
+	uint32_t	file_capacity;
+	upng_batch_stats	stats;
+} batch_worker;
+
+typedef struct upng_batch {
+	const upng_batch_input*	inputs;
+	upng_batch_callback	callback;
+	void*	user;
+	batch_worker*	workers;
+	uint32_t	num_workers;
+} upng_batch;
+
+static double batch_seconds(void) {
+#if defined(UPNG_THREADS)
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+#else
+	/* the batch runs on this thread alone */
+	return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+static void batch_lock(batch_worker* worker) {
+#if defined(UPNG_THREADS)
+	pthread_mutex_lock(&worker->lock);
+#else
+	(void)worker;
+#endif
+}
+
+static void batch_unlock(batch_worker* worker) {
+#if defined(UPNG_THREADS)
+	pthread_mutex_unlock(&worker->lock);
+#else
+	(void)worker;
+#endif
+}
+
+/* next input of the worker's own range */
+static bool batch_take(batch_worker* worker, uint32_t* index) {
+	bool taken = false;
+	batch_lock(worker);
+	if (worker->next < worker->end) {
+		*index = worker->next++;
+		taken = true;
+	}
+	batch_unlock(worker);
+	return taken;
+}
+
+/* moves the upper half of the first range with inputs left, looking at the 
+ * workers after this one, to this worker */
+static bool batch_steal(batch_worker* worker) {
+	upng_batch* batch = worker->batch;
+	uint32_t self = (uint32_t)(worker - batch->workers);
+
+	for (uint32_t i = 1; i < batch->num_workers; i++) {
+		batch_worker* victim = &batch->workers[(self + i) % batch->num_workers];
+		uint32_t first = 0, end = 0;
+
+		batch_lock(victim);
+		if (victim->next < victim->end) {
+			end = victim->end;
+			first = end - (end - victim->next + 1) / 2;
+			victim->end = first;
+		}
+		batch_unlock(victim);
+
+		if (first < end) {
+			batch_lock(worker);
+			worker->next = first;
+			worker->end = end;
+			batch_unlock(worker);
+			worker->stats.steals++;
+			return true;
+		}
+	}
+	return false;
+}
+
+static upng_error batch_read_file(batch_worker* worker, const char* path, uint32_t* size) {
+	FILE* file = fopen(path, "rb");
+	long length;
+
+	if (file == NULL) {
+		return UPNG_ENOTFOUND;
+	}
+
+	if (fseek(file, 0, SEEK_END) != 0 || (length = ftell(file)) < 0 || length > UINT32_MAX 
+      || fseek(file, 0, SEEK_SET) != 0) {
+		fclose(file);
+		return UPNG_ENOTFOUND;
+	}
+
+	/* the buffer only grows, like the decoder's scratch memory */
+	if ((uint32_t)length > worker->file_capacity) {
+		uint8_t* grown = (uint8_t*)realloc(worker->file, (size_t)length);
+		if (grown == NULL) {
+			fclose(file);
+			return UPNG_ENOMEM;
+		}
+		worker->file = grown;
+		worker->file_capacity = (uint32_t)length;
+	}
+
+	*size = (uint32_t)fread(worker->file, 1, (size_t)length, file);
+	fclose(file);
+	return *size == (uint32_t)length ? UPNG_EOK : UPNG_ENOTFOUND;
+}
+
+static void batch_decode(batch_worker* worker, uint32_t index) {
+	upng_batch* batch = worker->batch;
+	const upng_batch_input* input = &batch->inputs[index];
+	uint8_t* data = input->buffer;
+	uint32_t size = input->size;
+	upng_error error = UPNG_EOK;
+	upng_t* upng = NULL;
+
+	if (data == NULL) {
+		error = batch_read_file(worker, input->path, &size);
+		data = worker->file;
+	}
+
+	if (error == UPNG_EOK) {
+		if (worker->upng == NULL) {
+			worker->upng = upng_new_from_bytes(data, size);
+			error = worker->upng == NULL ? UPNG_ENOMEM : UPNG_EOK;
+		} else {
+			error = upng_reset(worker->upng, data, size);
+		}
+	}
+
+	if (error == UPNG_EOK) {
+		upng = worker->upng;
+		error = upng_decode_image(upng);
+	}
+
+	worker->stats.input_bytes += size;
+	if (error == UPNG_EOK) {
+		worker->stats.images++;
+		worker->stats.output_bytes += upng_get_size(upng);
+	} else {
+		worker->stats.failed++;
+	}
+
+	if (batch->callback != NULL) {
+		batch->callback(batch->user, index, upng, error);
+	}
+}
+
+static void* batch_work(void* arg) {
+	batch_worker* worker = (batch_worker*)arg;
+	uint32_t index;
+
+	do {
+		while (batch_take(worker, &index)) {
+			batch_decode(worker, index);
+		}
+	} while (batch_steal(worker));
+	return NULL;
+}
+
+upng_error upng_decode_batch(const upng_batch_input* inputs, uint32_t count, uint32_t threads,
+    upng_batch_callback callback, void* user, upng_batch_stats* stats) {
+	upng_batch batch;
+	uint32_t started = 1;
+	double start = batch_seconds();
+
+	if (inputs == NULL && count > 0) {
+		return UPNG_EPARAM;
+	}
+
+#if defined(UPNG_THREADS)
+	if (threads == 0) {
+		long cores = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = cores > 0 ? (uint32_t)cores : 1;
+	}
+#else
+	threads = 1;
+#endif
+	if (threads > count) {
+		threads = count > 0 ? count : 1;
+	}
+
+	batch.inputs = inputs;
+	batch.callback = callback;
+	batch.user = user;
+	batch.num_workers = threads;
+	batch.workers = (batch_worker*)calloc(threads, sizeof(batch_worker));
+	if (batch.workers == NULL) {
+		return UPNG_ENOMEM;
+	}
+
+	for (uint32_t i = 0; i < threads; i++) {
+		batch_worker* worker = &batch.workers[i];
+		worker->batch = &batch;
+		worker->next = (uint32_t)((uint64_t)count * i / threads);
+		worker->end = (uint32_t)((uint64_t)count * (i + 1) / threads);
+#if defined(UPNG_THREADS)
+		pthread_mutex_init(&worker->lock, NULL);
+#endif
+	}
+
+	/* the calling thread is the first worker */
+#if defined(UPNG_THREADS)
+	for (; started < threads; started++) {
+		if (pthread_create(&batch.workers[started].thread, NULL, batch_work, 
+        &batch.workers[started]) != 0) {
+			break;
+		}
+	}
+#endif
+	batch_work(&batch.workers[0]);
+
+#if defined(UPNG_THREADS)
+	for (uint32_t i = 1; i < started; i++) {
+		pthread_join(batch.workers[i].thread, NULL);
+	}
+#endif
+
+	if (stats != NULL) {
+		memset(stats, 0, sizeof(upng_batch_stats));
+		stats->threads = started;
+	}
+	for (uint32_t i = 0; i < threads; i++) {
+		batch_worker* worker = &batch.workers[i];
+#if defined(UPNG_THREADS)
+		pthread_mutex_destroy(&worker->lock);
+#endif
+		if (stats != NULL) {
+			stats->images += worker->stats.images;
+			stats->failed += worker->stats.failed;
+			stats->steals += worker->stats.steals;
+			stats->input_bytes += worker->stats.input_bytes;
+			stats->output_bytes += worker->stats.output_bytes;
+		}
+		if (worker->upng != NULL) {
+			upng_free(worker->upng);
+		}
+		free(worker->file);
+	}
+	free(batch.workers);
+
+	if (stats != NULL) {
+		stats->seconds = batch_seconds() - start;
+	}
+	return UPNG_EOK;
+}
@@ -0,0 +1,485 @@
+/*
+uPNG -- derived from LodePNG version 20100808
+
+Copyright (c) 2005-2010 Lode Vandevenne
+Copyright (c) 2010 Sean Middleditch
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+		1. The origin of this software must not be misrepresented; you must not
+		claim that you wrote the original software. If you use this software
+		in a product, an acknowledgment in the product documentation would be
+		appreciated but is not required.
+
+		2. Altered source versions must be plainly marked as such, and must not be
+		misrepresented as being the original software.
+
+		3. This notice may not be removed or altered from any source
+		distribution.
+*/
+
+/* compositing of APNG frames onto a canvas the size of the image, as the APNG
+ * spec's output buffer. Frames are converted to RGBA and blended band by band
+ * from the rows callback while they are decoded. Everything is allocated once 
+ * by apng_compositor_new: the canvas, the area APNG_DISPOSE_OP_PREVIOUS puts
+ * back and a row of converted pixels */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "upng_internal.h"
+
+/* the area of the canvas the last frame covers and what happens to it
+ * before the next one is composited */
+typedef struct compositor_dispose {
+	uint32_t	op;	/* apng_dispose_ops */
+	uint32_t	x_offset;
+	uint32_t	y_offset;
+	uint32_t	width;
+	uint32_t	height;
+} compositor_dispose;
+
+/* what the alpha of a frame's pixels can be, from the format and tRNS */
+typedef enum compositor_alpha {
+	COMPOSITOR_ALPHA_OPAQUE,	/* 255 only, OVER is SOURCE */
+	COMPOSITOR_ALPHA_BINARY,	/* 0 or 255, OVER copies the opaque pixels */
+	COMPOSITOR_ALPHA_BLEND	/* anything */
+} compositor_alpha;
+
+/* what a snapshot holds before the canvas and the saved area */
+typedef struct compositor_snapshot {
+	compositor_dispose	dispose;
+	uint32_t	frame;
+} compositor_snapshot;
+
+struct apng_compositor {
+	uint32_t	width;
+	uint32_t	height;
+	upng_format	format;
+	uint8_t*	canvas;	/* width * height pixels, RGBA */
+	uint8_t*	saved;	/* the area of APNG_DISPOSE_OP_PREVIOUS, dispose.width pixels a row */
+	uint8_t*	row;	/* one frame row converted to RGBA, for blending */
+	upng_pixel_converter	converter;	/* frame rows to RGBA */
+	compositor_alpha	alpha;
+	upng_blend_fn	blend;	/* APNG_BLEND_OP_OVER kernel for the CPU */
+	compositor_dispose	dispose;
+	apng_fctl	fctl;	/* frame being composited */
+	uint32_t	frame;	/* frame on the canvas, UINT32_MAX for none */
+};
+
+/* what the alpha of the converted pixels can be: the table of palette and grey 
+ * images has every value a sample can take */
+static compositor_alpha compositor_alpha_class(const apng_compositor* compositor, 
+    const upng_t* upng) {
+	const upng_pixel_converter* converter = &compositor->converter;
+	bool opaque = true, binary = true;
+
+	switch (compositor->format) {
+	case UPNG_RGBA8:
+	case UPNG_RGBA16:
+	case UPNG_LUMINANCE_ALPHA8:
+		return COMPOSITOR_ALPHA_BLEND;
+	case UPNG_RGB8:
+	case UPNG_RGB16:
+		return converter->has_key ? COMPOSITOR_ALPHA_BINARY : COMPOSITOR_ALPHA_OPAQUE;
+	default:
+		break;
+	}
+
+	for (uint32_t i = 0; i < 1u << upng_get_bitdepth(upng); i++) {
+		uint8_t pixel[4];
+		memcpy(pixel, &converter->table[i], 4);
+		opaque = opaque && pixel[3] == 0xFF;
+		binary = binary && (pixel[3] == 0xFF || pixel[3] == 0);
+	}
+	return opaque ? COMPOSITOR_ALPHA_OPAQUE : 
+      binary ? COMPOSITOR_ALPHA_BINARY : COMPOSITOR_ALPHA_BLEND;
+}
+
+/* APNG_BLEND_OP_OVER of straight alpha RGBA pixels: the source is composited 
+ * over the canvas, which may be transparent itself. Over an opaque canvas this
+ * is the same as the rounded divide by 255 of the vector kernels below, so 
+ * which one handles a pixel makes no difference to the result */
+static void compositor_blend_over_scalar(uint8_t* dst, const uint8_t* src, uint32_t width) {
+	for (uint32_t x = 0; x < width; x++, dst += 4, src += 4) {
+		uint32_t sa = src[3];
+		uint32_t dw, oa;
+
+		if (sa == 0) {
+			continue;
+		}
+		if (sa == 0xFF || dst[3] == 0) {
+			memcpy(dst, src, 4);
+			continue;
+		}
+
+		/* the weight of the canvas and the resulting alpha, both times 255 */
+		dw = dst[3] * (255 - sa);
+		oa = sa * 255 + dw;
+		for (uint32_t c = 0; c < 3; c++) {
+			dst[c] = (uint8_t)((src[c] * sa * 255 + dst[c] * dw + oa / 2) / oa);
+		}
+		dst[3] = (uint8_t)((oa + 127) / 255);
+	}
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define COMPOSITOR_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+#if defined(COMPOSITOR_X86_SIMD)
+
+/* The vector kernels take 4 (SSE2) or 8 (AVX2) pixels at a time. An all 
+ * transparent source leaves the canvas alone, an all opaque source, or one 
+ * without transparent pixels over an all transparent canvas, is copied, and 
+ * over an all opaque canvas the colour is sc * sa + dc * (255 - sa) divided by 255 in 16-bit 
+ * lanes, with the alpha staying 255. Any other group is left to the scalar 
+ * blend, which divides by the resulting alpha. */
+
+/* x / 255 rounded, for x up to 255 * 255 */
+#define COMPOSITOR_DIV255(isa, x) \
+	_mm##isa##_srli_epi16(_mm##isa##_add_epi16(_mm##isa##_add_epi16(x, half), \
+	    _mm##isa##_srli_epi16(_mm##isa##_add_epi16(x, half), 8)), 8)
+
+/* two pixels widened to 16 bits, blended over two opaque canvas pixels */
+#define COMPOSITOR_BLEND_HALF(isa, s, d) \
+	do { \
+		s = COMPOSITOR_DIV255(isa, _mm##isa##_add_epi16(_mm##isa##_mullo_epi16(s, sa), \
+		    _mm##isa##_mullo_epi16(d, _mm##isa##_sub_epi16(full, sa)))); \
+	} while (0)
+
+static void compositor_blend_over_sse2(uint8_t* dst, const uint8_t* src, uint32_t width) {
+	const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i full = _mm_set1_epi16(0xFF);
+	const __m128i half = _mm_set1_epi16(0x80);
+	uint32_t x = 0;
+
+	for (; x + 4 <= width; x += 4) {
+		__m128i s = _mm_loadu_si128((const __m128i*)(src + x * 4));
+		__m128i d = _mm_loadu_si128((__m128i*)(dst + x * 4));
+		int opaque = _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(s, alpha), alpha));
+		int clear = _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(s, alpha), zero));
+		int below_opaque = _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(d, alpha), alpha));
+		int below_clear = _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(d, alpha), zero));
+		__m128i lo, hi, dlo, dhi, sa;
+
+		if (clear == 0xFFFF) {
+			continue;
+		}
+		if (opaque == 0xFFFF || (below_clear == 0xFFFF && clear == 0)) {
+			_mm_storeu_si128((__m128i*)(dst + x * 4), s);
+			continue;
+		}
+		if (below_opaque != 0xFFFF) {
+			compositor_blend_over_scalar(dst + x * 4, src + x * 4, 4);
+			continue;
+		}
+
+		lo = _mm_unpacklo_epi8(s, zero);
+		hi = _mm_unpackhi_epi8(s, zero);
+		dlo = _mm_unpacklo_epi8(d, zero);
+		dhi = _mm_unpackhi_epi8(d, zero);
+		sa = _mm_shufflehi_epi16(_mm_shufflelo_epi16(lo, 0xFF), 0xFF);
+		COMPOSITOR_BLEND_HALF(, lo, dlo);
+		sa = _mm_shufflehi_epi16(_mm_shufflelo_epi16(hi, 0xFF), 0xFF);
+		COMPOSITOR_BLEND_HALF(, hi, dhi);
+		_mm_storeu_si128((__m128i*)(dst + x * 4), _mm_or_si128(_mm_packus_epi16(lo, hi), alpha));
+	}
+	compositor_blend_over_scalar(dst + x * 4, src + x * 4, width - x);
+}
+
+static __attribute__((target("avx2"))) void compositor_blend_over_avx2(uint8_t* dst, 
+    const uint8_t* src, uint32_t width) {
+	const __m256i alpha = _mm256_set1_epi32((int)0xFF000000);
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i full = _mm256_set1_epi16(0xFF);
+	const __m256i half = _mm256_set1_epi16(0x80);
+	/* copies the alpha word of each pixel to its other three words */
+	const __m256i spread = _mm256_setr_epi8(6, 7, 6, 7, 6, 7, 6, 7, 14, 15, 14, 15, 14, 15, 14, 15, 
+	    6, 7, 6, 7, 6, 7, 6, 7, 14, 15, 14, 15, 14, 15, 14, 15);
+	uint32_t x = 0;
+
+	for (; x + 8 <= width; x += 8) {
+		__m256i s = _mm256_loadu_si256((const __m256i*)(src + x * 4));
+		__m256i d = _mm256_loadu_si256((__m256i*)(dst + x * 4));
+		int opaque = _mm256_movemask_epi8(_mm256_cmpeq_epi32(_mm256_and_si256(s, alpha), alpha));
+		int clear = _mm256_movemask_epi8(_mm256_cmpeq_epi32(_mm256_and_si256(s, alpha), zero));
+		int below_opaque = _mm256_movemask_epi8(_mm256_cmpeq_epi32(_mm256_and_si256(d, alpha), alpha));
+		int below_clear = _mm256_movemask_epi8(_mm256_cmpeq_epi32(_mm256_and_si256(d, alpha), zero));
+		__m256i lo, hi, dlo, dhi, sa;
+
+		if (clear == -1) {
+			continue;
+		}
+		if (opaque == -1 || (below_clear == -1 && clear == 0)) {
+			_mm256_storeu_si256((__m256i*)(dst + x * 4), s);
+			continue;
+		}
+		if (below_opaque != -1) {
+			compositor_blend_over_scalar(dst + x * 4, src + x * 4, 8);
+			continue;
+		}
+
+		/* unpack and pack work within 128-bit lanes, so the pixel order survives */
+		lo = _mm256_unpacklo_epi8(s, zero);
+		hi = _mm256_unpackhi_epi8(s, zero);
+		dlo = _mm256_unpacklo_epi8(d, zero);
+		dhi = _mm256_unpackhi_epi8(d, zero);
+		sa = _mm256_shuffle_epi8(lo, spread);
+		COMPOSITOR_BLEND_HALF(256, lo, dlo);
+		sa = _mm256_shuffle_epi8(hi, spread);
+		COMPOSITOR_BLEND_HALF(256, hi, dhi);
+		_mm256_storeu_si256((__m256i*)(dst + x * 4), _mm256_or_si256(_mm256_packus_epi16(lo, hi), alpha));
+	}
+	compositor_blend_over_sse2(dst + x * 4, src + x * 4, width - x);
+}
+
+static upng_blend_fn compositor_select_blend(void) {
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return compositor_blend_over_avx2;
+	return compositor_blend_over_sse2;
+}
+
+uint32_t upng_list_blend_kernels(upng_blend_fn kernels[UPNG_MAX_BLEND_KERNELS],
+    const char* names[UPNG_MAX_BLEND_KERNELS]) {
+	uint32_t count = 0;
+	__builtin_cpu_init();
+	kernels[count] = compositor_blend_over_sse2;
+	names[count++] = "SSE2";
+	if (__builtin_cpu_supports("avx2")) {
+		kernels[count] = compositor_blend_over_avx2;
+		names[count++] = "AVX2";
+	}
+	return count;
+}
+
+#else
+
+static upng_blend_fn compositor_select_blend(void) {
+	return compositor_blend_over_scalar;
+}
+
+uint32_t upng_list_blend_kernels(upng_blend_fn kernels[UPNG_MAX_BLEND_KERNELS],
+    const char* names[UPNG_MAX_BLEND_KERNELS]) {
+	kernels[0] = compositor_blend_over_scalar;
+	names[0] = "scalar";
+	return 1;
+}
+
+#endif /*defined(COMPOSITOR_X86_SIMD)*/
+
+void upng_blend_over_reference(uint8_t* dst, const uint8_t* src, uint32_t width) {
+	compositor_blend_over_scalar(dst, src, width);
+}
+
+/* copies the opaque pixels of a source whose alpha is only ever 0 or 255, 
+ * a run at a time */
+static void compositor_copy_opaque(uint8_t* dst, const uint8_t* src, uint32_t width) {
+	uint32_t x = 0;
+
+	while (x < width) {
+		uint32_t run = x;
+		while (run < width && src[run * 4 + 3] != 0) {
+			run++;
+		}
+		memcpy(dst + x * 4, src + x * 4, (size_t)(run - x) * 4);
+		while (run < width && src[run * 4 + 3] == 0) {
+			run++;
+		}
+		x = run;
+	}
+}
+
+static void compositor_rows(void* user, const upng_t* decoder, uint32_t first_row, 
+    uint32_t num_rows) {
+	apng_compositor* compositor = (apng_compositor*)user;
+	const apng_fctl* fctl = &compositor->fctl;
+	const uint8_t* buffer = upng_get_buffer(decoder);
+	uint32_t stride = (fctl->width * upng_get_bpp(decoder) + 7) / 8;
+
+	for (uint32_t y = first_row; y < first_row + num_rows; y++) {
+		uint8_t* dst = compositor->canvas + 
+        ((size_t)(fctl->y_offset + y) * compositor->width + fctl->x_offset) * 4;
+
+		if (fctl->blend_op == APNG_BLEND_OP_OVER && compositor->alpha != COMPOSITOR_ALPHA_OPAQUE) {
+			upng_convert_row(&compositor->converter, compositor->row, 
+          buffer + (size_t)y * stride, fctl->width);
+			if (compositor->alpha == COMPOSITOR_ALPHA_BINARY) {
+				compositor_copy_opaque(dst, compositor->row, fctl->width);
+			} else {
+				compositor->blend(dst, compositor->row, fctl->width);
+			}
+		} else {
+			upng_convert_row(&compositor->converter, dst, buffer + (size_t)y * stride, fctl->width);
+		}
+	}
+}
+
+/* copies an area between the canvas and a buffer of its own size */
+static void compositor_copy_area(apng_compositor* compositor, const compositor_dispose* area, 
+    uint8_t* buffer, bool to_canvas) {
+	size_t row_bytes = (size_t)area->width * 4;
+
+	for (uint32_t y = 0; y < area->height; y++) {
+		uint8_t* canvas = compositor->canvas + 
+        ((size_t)(area->y_offset + y) * compositor->width + area->x_offset) * 4;
+		if (to_canvas) {
+			memcpy(canvas, buffer + y * row_bytes, row_bytes);
+		} else {
+			memcpy(buffer + y * row_bytes, canvas, row_bytes);
+		}
+	}
+}
+
+apng_compositor* apng_compositor_new(const upng_t* upng) {
+	uint32_t width = upng_get_width(upng);
+	uint32_t height = upng_get_height(upng);
+	upng_format format = upng_get_format(upng);
+	size_t canvas_bytes = (size_t)width * height * 4;
+	apng_compositor* compositor;
+
+	/* grey with alpha only comes with 8 bits in a PNG */
+	if (format == UPNG_BADFORMAT || (format >= UPNG_LUMINANCE_ALPHA1 && format <= UPNG_LUMINANCE_ALPHA4)) {
+		return NULL;
+	}
+	if (width == 0 || height == 0 || (uint64_t)width * height > SIZE_MAX / 8) {
+		return NULL;
+	}
+
+	compositor = (apng_compositor*)malloc(sizeof(apng_compositor) + canvas_bytes * 2 + (size_t)width * 4);
+	if (compositor == NULL) {
+		return NULL;
+	}
+
+	compositor->width = width;
+	compositor->height = height;
+	compositor->format = format;
+	compositor->canvas = (uint8_t*)(compositor + 1);
+	compositor->saved = compositor->canvas + canvas_bytes;
+	compositor->row = compositor->saved + canvas_bytes;
+	upng_pixel_converter_init(&compositor->converter, upng, UPNG_PIXEL_RGBA8888, false);
+	compositor->alpha = compositor_alpha_class(compositor, upng);
+	compositor->blend = compositor_select_blend();
+	memset(&compositor->dispose, 0, sizeof(compositor->dispose));
+	memset(&compositor->fctl, 0, sizeof(compositor->fctl));
+	compositor->frame = UINT32_MAX;
+
+	/* transparent black until the first frame */
+	memset(compositor->canvas, 0, canvas_bytes);
+	return compositor;
+}
+
+void apng_compositor_free(apng_compositor* compositor) {
+	free(compositor);
+}
+
+upng_error apng_compositor_decode_frame(apng_compositor* compositor, upng_t* upng) {
+	uint32_t frame = upng_get_frame_position(upng);
+	compositor_dispose* dispose = &compositor->dispose;
+	apng_fctl* fctl = &compositor->fctl;
+	apng_fctl default_fctl;
+	bool first;
+	upng_error error;
+
+	if (upng_get_width(upng) != compositor->width || upng_get_height(upng) != compositor->height 
+      || upng_get_format(upng) != compositor->format) {
+		return UPNG_EPARAM;
+	}
+	if (frame >= upng_get_frame_count(upng)) {
+		return upng_decode_image(upng);
+	}
+
+	/* the animation starts over at its first frame, which the default image is 
+	 * unless it has no frame control */
+	first = frame == 0 || (frame == 1 && !upng_get_frame_fctl(upng, 0, &default_fctl));
+	if (!upng_get_frame_fctl(upng, frame, fctl)) {
+		/* a default image outside the animation covers the canvas */
+		memset(fctl, 0, sizeof(*fctl));
+		fctl->width = compositor->width;
+		fctl->height = compositor->height;
+		fctl->blend_op = APNG_BLEND_OP_SOURCE;
+		fctl->dispose_op = APNG_DISPOSE_OP_NONE;
+	}
+
+	if (first) {
+		memset(compositor->canvas, 0, (size_t)compositor->width * compositor->height * 4);
+	} else if (dispose->op == APNG_DISPOSE_OP_PREVIOUS) {
+		compositor_copy_area(compositor, dispose, compositor->saved, true);
+	} else if (dispose->op == APNG_DISPOSE_OP_BACKGROUND) {
+		for (uint32_t y = 0; y < dispose->height; y++) {
+			memset(compositor->canvas + ((size_t)(dispose->y_offset + y) * compositor->width + 
+          dispose->x_offset) * 4, 0, (size_t)dispose->width * 4);
+		}
+	}
+
+	/* the first frame has nothing before it to go back to */
+	dispose->op = fctl->dispose_op;
+	if (first && dispose->op == APNG_DISPOSE_OP_PREVIOUS) {
+		dispose->op = APNG_DISPOSE_OP_BACKGROUND;
+	}
+	dispose->x_offset = fctl->x_offset;
+	dispose->y_offset = fctl->y_offset;
+	dispose->width = fctl->width;
+	dispose->height = fctl->height;
+	if (dispose->op == APNG_DISPOSE_OP_PREVIOUS) {
+		compositor_copy_area(compositor, dispose, compositor->saved, false);
+	}
+
+	upng_set_rows_callback(upng, compositor_rows, compositor);
+	error = upng_decode_image(upng);
+	upng_set_rows_callback(upng, NULL, NULL);
+
+	compositor->frame = error == UPNG_EOK ? frame : UINT32_MAX;
+	return error;
+}
+
+const uint8_t* apng_compositor_get_canvas(const apng_compositor* compositor) {
+	return compositor->canvas;
+}
+
+uint32_t apng_compositor_get_frame(const apng_compositor* compositor) {
+	return compositor->frame;
+}
+
+size_t apng_compositor_snapshot_size(const apng_compositor* compositor) {
+	return sizeof(compositor_snapshot) + (size_t)compositor->width * compositor->height * 4 * 2;
+}
+
+void apng_compositor_save(const apng_compositor* compositor, void* snapshot) {
+	compositor_snapshot* header = (compositor_snapshot*)snapshot;
+	uint8_t* data = (uint8_t*)(header + 1);
+	size_t canvas_bytes = (size_t)compositor->width * compositor->height * 4;
+
+	header->dispose = compositor->dispose;
+	header->frame = compositor->frame;
+	memcpy(data, compositor->canvas, canvas_bytes);
+	if (compositor->dispose.op == APNG_DISPOSE_OP_PREVIOUS) {
+		memcpy(data + canvas_bytes, compositor->saved, 
+        (size_t)compositor->dispose.width * compositor->dispose.height * 4);
+	}
+}
+
+void apng_compositor_restore(apng_compositor* compositor, const void* snapshot) {
+	const compositor_snapshot* header = (const compositor_snapshot*)snapshot;
+	const uint8_t* data = (const uint8_t*)(header + 1);
+	size_t canvas_bytes = (size_t)compositor->width * compositor->height * 4;
+
+	compositor->dispose = header->dispose;
+	compositor->frame = header->frame;
+	memcpy(compositor->canvas, data, canvas_bytes);
+	if (compositor->dispose.op == APNG_DISPOSE_OP_PREVIOUS) {
+		memcpy(compositor->saved, data + canvas_bytes, 
+        (size_t)compositor->dispose.width * compositor->dispose.height * 4);
+	}
+}
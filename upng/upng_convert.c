@@ -0,0 +1,648 @@
+/*
+uPNG -- derived from LodePNG version 20100808
+
+Copyright (c) 2005-2010 Lode Vandevenne
+Copyright (c) 2010 Sean Middleditch
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+		1. The origin of this software must not be misrepresented; you must not
+		claim that you wrote the original software. If you use this software
+		in a product, an acknowledgment in the product documentation would be
+		appreciated but is not required.
+
+		2. Altered source versions must be plainly marked as such, and must not be
+		misrepresented as being the original software.
+
+		3. This notice may not be removed or altered from any source
+		distribution.
+*/
+
+/* conversion of unfiltered scanlines to the pixel formats of upng_set_output_pixels.
+ * Palette and grey images up to 8 bits go through a table of finished pixels, the
+ * other formats are packed pixel by pixel. On x86-64 the table lookups of the 32-bit
+ * formats and every format to RGBA8888 have SSE2/SSSE3/AVX2 kernels, picked at 
+ * runtime; the scalar loops take the rest and the ends of rows */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "upng_internal.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define UPNG_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+/* c * a / 255, rounded */
+static inline uint32_t convert_premultiply(uint32_t c, uint32_t a) {
+	uint32_t t = c * a + 128;
+	return (t + (t >> 8)) >> 8;
+}
+
+static inline uint32_t convert_pack(upng_pixel_format target, bool premultiplied,
+    uint32_t r, uint32_t g, uint32_t b, uint32_t a) {
+	if (premultiplied && a != 0xFF) {
+		r = convert_premultiply(r, a);
+		g = convert_premultiply(g, a);
+		b = convert_premultiply(b, a);
+	}
+
+	switch (target) {
+	case UPNG_PIXEL_ARGB8888:
+		return (a << 24) | (r << 16) | (g << 8) | b;
+	case UPNG_PIXEL_ABGR8888:
+		return (a << 24) | (b << 16) | (g << 8) | r;
+	case UPNG_PIXEL_RGB565:
+		return ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+	case UPNG_PIXEL_RGBA8888: {
+		/* bytes in memory order whatever the byte order of the word */
+		uint8_t bytes[4] = { (uint8_t)r, (uint8_t)g, (uint8_t)b, (uint8_t)a };
+		uint32_t pixel;
+		memcpy(&pixel, bytes, 4);
+		return pixel;
+	}
+	case UPNG_PIXEL_RGB888:
+	default:
+		/* the bytes in memory order, the low three of the word */
+		return r | (g << 8) | (b << 16);
+	}
+}
+
+static inline void convert_store(upng_pixel_format target, uint8_t* dst, uint32_t x,
+    uint32_t pixel) {
+	switch (target) {
+	case UPNG_PIXEL_RGB565: {
+		uint16_t half = (uint16_t)pixel;
+		memcpy(dst + x * 2, &half, 2);
+		break;
+	}
+	case UPNG_PIXEL_RGB888:
+		dst[x * 3 + 0] = (uint8_t)pixel;
+		dst[x * 3 + 1] = (uint8_t)(pixel >> 8);
+		dst[x * 3 + 2] = (uint8_t)(pixel >> 16);
+		break;
+	default:
+		memcpy(dst + x * 4, &pixel, 4);
+		break;
+	}
+}
+
+uint32_t upng_pixel_format_bytes(upng_pixel_format target) {
+	switch (target) {
+	case UPNG_PIXEL_ARGB8888:
+	case UPNG_PIXEL_ABGR8888:
+	case UPNG_PIXEL_RGBA8888:
+		return 4;
+	case UPNG_PIXEL_RGB565:
+		return 2;
+	case UPNG_PIXEL_RGB888:
+		return 3;
+	case UPNG_PIXEL_INDEX8:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/* bits per sample of the formats that go through the table, 0 for the others */
+static uint32_t convert_table_depth(upng_format format) {
+	switch (format) {
+	case UPNG_INDEXED1:
+	case UPNG_LUMINANCE1:
+		return 1;
+	case UPNG_INDEXED2:
+	case UPNG_LUMINANCE2:
+		return 2;
+	case UPNG_INDEXED4:
+	case UPNG_LUMINANCE4:
+		return 4;
+	case UPNG_INDEXED8:
+	case UPNG_LUMINANCE8:
+		return 8;
+	default:
+		return 0;
+	}
+}
+
+/* the samples of a byte of 1, 2 or 4-bit pixels, most significant bits first, 
+ * one byte each */
+#define UNPACK1(b) { (b) >> 7 & 1, (b) >> 6 & 1, (b) >> 5 & 1, (b) >> 4 & 1, \
+	(b) >> 3 & 1, (b) >> 2 & 1, (b) >> 1 & 1, (b) & 1 }
+#define UNPACK2(b) { (b) >> 6 & 3, (b) >> 4 & 3, (b) >> 2 & 3, (b) & 3 }
+#define UNPACK4(b) { (b) >> 4 & 15, (b) & 15 }
+
+#define UNPACK_4(u, b) u(b), u((b) + 1), u((b) + 2), u((b) + 3)
+#define UNPACK_16(u, b) UNPACK_4(u, b), UNPACK_4(u, (b) + 4), UNPACK_4(u, (b) + 8), UNPACK_4(u, (b) + 12)
+#define UNPACK_64(u, b) UNPACK_16(u, b), UNPACK_16(u, (b) + 16), UNPACK_16(u, (b) + 32), UNPACK_16(u, (b) + 48)
+#define UNPACK_256(u) UNPACK_64(u, 0), UNPACK_64(u, 64), UNPACK_64(u, 128), UNPACK_64(u, 192)
+
+static const uint8_t unpack1[256][8] = { UNPACK_256(UNPACK1) };
+static const uint8_t unpack2[256][4] = { UNPACK_256(UNPACK2) };
+static const uint8_t unpack4[256][2] = { UNPACK_256(UNPACK4) };
+
+/* the unpack table of depth, samples_per_byte entries for each byte value */
+static const uint8_t* convert_unpack_table(uint32_t depth) {
+	return depth == 1 ? unpack1[0] : depth == 2 ? unpack2[0] : unpack4[0];
+}
+
+/* writes width pixels of a row of palette or grey samples through the table. 
+ * Sub-byte samples are looked up a source byte at a time */
+static void convert_row_table(const upng_pixel_converter* converter, uint8_t* dst,
+    const uint8_t* src, uint32_t width, uint32_t depth) {
+	upng_pixel_format target = converter->target;
+	const uint32_t* table = converter->table;
+	uint32_t x;
+
+	if (depth == 8) {
+		if (upng_pixel_format_bytes(target) == 4) {
+			uint32_t* out = (uint32_t*)(void*)dst;
+			for (x = 0; x < width; x++) {
+				memcpy(&out[x], &table[src[x]], 4);
+			}
+		} else {
+			for (x = 0; x < width; x++) {
+				convert_store(target, dst, x, table[src[x]]);
+			}
+		}
+		return;
+	}
+
+	uint32_t per_byte = 8 / depth;
+	const uint8_t* unpack = convert_unpack_table(depth);
+	if (upng_pixel_format_bytes(target) == 4) {
+		uint32_t* out = (uint32_t*)(void*)dst;
+		for (x = 0; x + per_byte <= width; x += per_byte, src++) {
+			const uint8_t* samples = unpack + *src * per_byte;
+			for (uint32_t k = 0; k < per_byte; k++) {
+				memcpy(&out[x + k], &table[samples[k]], 4);
+			}
+		}
+	} else {
+		for (x = 0; x + per_byte <= width; x += per_byte, src++) {
+			const uint8_t* samples = unpack + *src * per_byte;
+			for (uint32_t k = 0; k < per_byte; k++) {
+				convert_store(target, dst, x + k, table[samples[k]]);
+			}
+		}
+	}
+	/* the last byte of a row may hold fewer pixels */
+	for (uint32_t k = 0; x < width; x++, k++) {
+		convert_store(target, dst, x, table[unpack[*src * per_byte + k]]);
+	}
+}
+
+/* UPNG_PIXEL_INDEX8: the samples of a palette or grey row, one byte each */
+static void convert_unpack_row(const upng_pixel_converter* converter, uint8_t* dst,
+    const uint8_t* src, uint32_t width) {
+	uint32_t depth = convert_table_depth(converter->format);
+	uint32_t per_byte = 8 / depth;
+	const uint8_t* unpack;
+	uint32_t x;
+
+	if (depth == 8) {
+		memcpy(dst, src, width);
+		return;
+	}
+
+	unpack = convert_unpack_table(depth);
+	for (x = 0; x + per_byte <= width; x += per_byte, src++) {
+		memcpy(dst + x, unpack + *src * per_byte, per_byte);
+	}
+	if (x < width) {
+		memcpy(dst + x, unpack + *src * per_byte, width - x);
+	}
+}
+
+static void convert_row_scalar(const upng_pixel_converter* converter, uint8_t* dst,
+    const uint8_t* src, uint32_t width) {
+	upng_pixel_format target = converter->target;
+	bool premultiplied = converter->premultiplied;
+	const uint16_t* key = converter->key;
+	bool has_key = converter->has_key;
+	uint32_t depth = convert_table_depth(converter->format);
+	uint32_t x;
+
+	if (depth != 0) {
+		convert_row_table(converter, dst, src, width, depth);
+		return;
+	}
+
+	switch (converter->format) {
+	case UPNG_LUMINANCE_ALPHA8:
+		for (x = 0; x < width; x++) {
+			uint32_t grey = src[x * 2];
+			convert_store(target, dst, x, convert_pack(target, premultiplied,
+          grey, grey, grey, src[x * 2 + 1]));
+		}
+		break;
+	case UPNG_RGB8:
+		for (x = 0; x < width; x++) {
+			const uint8_t* p = src + x * 3;
+			uint32_t a = has_key && p[0] == key[0] && p[1] == key[1] && p[2] == key[2] ? 0 : 0xFF;
+			convert_store(target, dst, x, convert_pack(target, premultiplied, p[0], p[1], p[2], a));
+		}
+		break;
+	case UPNG_RGB16:
+		/* 16-bit samples keep their most significant byte */
+		for (x = 0; x < width; x++) {
+			const uint8_t* p = src + x * 6;
+			uint32_t a = has_key && ((p[0] << 8) | p[1]) == key[0] &&
+          ((p[2] << 8) | p[3]) == key[1] && ((p[4] << 8) | p[5]) == key[2] ? 0 : 0xFF;
+			convert_store(target, dst, x, convert_pack(target, premultiplied, p[0], p[2], p[4], a));
+		}
+		break;
+	case UPNG_RGBA8:
+		if (target == UPNG_PIXEL_RGBA8888 && !premultiplied) {
+			memcpy(dst, src, (size_t)width * 4);
+			break;
+		}
+		for (x = 0; x < width; x++) {
+			const uint8_t* p = src + x * 4;
+			convert_store(target, dst, x, convert_pack(target, premultiplied, p[0], p[1], p[2], p[3]));
+		}
+		break;
+	case UPNG_RGBA16:
+		for (x = 0; x < width; x++) {
+			const uint8_t* p = src + x * 8;
+			convert_store(target, dst, x, convert_pack(target, premultiplied, p[0], p[2], p[4], p[6]));
+		}
+		break;
+	default:
+		/* upng_pixel_converter_init turned the other formats down */
+		break;
+	}
+}
+
+#if defined(UPNG_X86_SIMD)
+
+/* Every kernel converts whole blocks of pixels and leaves the rest of the row to 
+ * convert_row_scalar; sub-byte blocks end on a byte, so the rest starts on one. 
+ * Loads never reach past the end of the source row. */
+
+#define CONVERT_TARGET_ssse3 __attribute__((target("ssse3")))
+#define CONVERT_TARGET_avx2 __attribute__((target("avx2")))
+
+/* 16 bytes of per-pixel bytes r, g, b and a interleaved to 64 bytes of pixels */
+static inline void convert_store_planes(uint8_t* dst, __m128i r, __m128i g, __m128i b, __m128i a) {
+	__m128i rg_lo = _mm_unpacklo_epi8(r, g), rg_hi = _mm_unpackhi_epi8(r, g);
+	__m128i ba_lo = _mm_unpacklo_epi8(b, a), ba_hi = _mm_unpackhi_epi8(b, a);
+	_mm_storeu_si128((__m128i*)(dst + 0), _mm_unpacklo_epi16(rg_lo, ba_lo));
+	_mm_storeu_si128((__m128i*)(dst + 16), _mm_unpackhi_epi16(rg_lo, ba_lo));
+	_mm_storeu_si128((__m128i*)(dst + 32), _mm_unpacklo_epi16(rg_hi, ba_hi));
+	_mm_storeu_si128((__m128i*)(dst + 48), _mm_unpackhi_epi16(rg_hi, ba_hi));
+}
+
+/* 16 samples of 1, 2 or 4 bits from the start of src, one byte each */
+static CONVERT_TARGET_ssse3 inline __m128i convert_unpack16_ssse3(const uint8_t* src, 
+    uint32_t depth) {
+	const __m128i low2 = _mm_set1_epi8(3);
+	const __m128i low4 = _mm_set1_epi8(15);
+
+	if (depth == 1) {
+		/* byte 0 or 1 to every lane, then the bit of the lane */
+		const __m128i spread = _mm_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1);
+		const __m128i bits = _mm_setr_epi8((char)0x80, 0x40, 0x20, 0x10, 8, 4, 2, 1, 
+		    (char)0x80, 0x40, 0x20, 0x10, 8, 4, 2, 1);
+		uint16_t two;
+		__m128i in;
+		memcpy(&two, src, 2);
+		in = _mm_shuffle_epi8(_mm_cvtsi32_si128(two), spread);
+		return _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(in, bits), bits), _mm_set1_epi8(1));
+	}
+	if (depth == 2) {
+		uint32_t four;
+		__m128i in, s6, s4, s2;
+		memcpy(&four, src, 4);
+		in = _mm_cvtsi32_si128((int)four);
+		/* the shifts are per 16 bits, the masks drop what crossed over */
+		s6 = _mm_and_si128(_mm_srli_epi16(in, 6), low2);
+		s4 = _mm_and_si128(_mm_srli_epi16(in, 4), low2);
+		s2 = _mm_and_si128(_mm_srli_epi16(in, 2), low2);
+		return _mm_unpacklo_epi16(_mm_unpacklo_epi8(s6, s4), 
+		    _mm_unpacklo_epi8(s2, _mm_and_si128(in, low2)));
+	}
+
+	__m128i in = _mm_loadl_epi64((const __m128i*)src);
+	return _mm_unpacklo_epi8(_mm_and_si128(_mm_srli_epi16(in, 4), low4), _mm_and_si128(in, low4));
+}
+
+/* 1, 2 and 4-bit samples to any 32-bit target: 16 samples are spread to one 
+ * byte each, then looked up in the byte planes of the first 16 table entries 
+ * with pshufb. 16 pixels a block */
+static CONVERT_TARGET_ssse3 void convert_sub_byte_ssse3(const upng_pixel_converter* converter, 
+    uint8_t* dst, const uint8_t* src, uint32_t width) {
+	const __m128i planes[4] = {
+		_mm_loadu_si128((const __m128i*)converter->planes[0]),
+		_mm_loadu_si128((const __m128i*)converter->planes[1]),
+		_mm_loadu_si128((const __m128i*)converter->planes[2]),
+		_mm_loadu_si128((const __m128i*)converter->planes[3]),
+	};
+	uint32_t depth = convert_table_depth(converter->format);
+	uint32_t x = 0;
+
+	for (; x + 16 <= width; x += 16, src += 2 * depth, dst += 64) {
+		__m128i index = convert_unpack16_ssse3(src, depth);
+		convert_store_planes(dst, _mm_shuffle_epi8(planes[0], index), _mm_shuffle_epi8(planes[1], index), 
+		    _mm_shuffle_epi8(planes[2], index), _mm_shuffle_epi8(planes[3], index));
+	}
+	convert_row_scalar(converter, dst, src, width - x);
+}
+
+/* 1, 2 and 4-bit samples to UPNG_PIXEL_INDEX8, 16 a block */
+static CONVERT_TARGET_ssse3 void convert_unpack_ssse3(const upng_pixel_converter* converter, 
+    uint8_t* dst, const uint8_t* src, uint32_t width) {
+	uint32_t depth = convert_table_depth(converter->format);
+	uint32_t x = 0;
+
+	for (; x + 16 <= width; x += 16, src += 2 * depth, dst += 16) {
+		_mm_storeu_si128((__m128i*)dst, convert_unpack16_ssse3(src, depth));
+	}
+	convert_unpack_row(converter, dst, src, width - x);
+}
+
+/* 8-bit palette and grey to any 32-bit target, 8 table entries a gather */
+static CONVERT_TARGET_avx2 void convert_table8_avx2(const upng_pixel_converter* converter, 
+    uint8_t* dst, const uint8_t* src, uint32_t width) {
+	const int* table = (const int*)converter->table;
+	uint32_t x = 0;
+
+	for (; x + 16 <= width; x += 16) {
+		__m128i in = _mm_loadu_si128((const __m128i*)(src + x));
+		__m256i lo = _mm256_i32gather_epi32(table, _mm256_cvtepu8_epi32(in), 4);
+		__m256i hi = _mm256_i32gather_epi32(table, _mm256_cvtepu8_epi32(_mm_srli_si128(in, 8)), 4);
+		_mm256_storeu_si256((__m256i*)(dst + x * 4), lo);
+		_mm256_storeu_si256((__m256i*)(dst + x * 4 + 32), hi);
+	}
+	convert_row_scalar(converter, dst + x * 4, src + x, width - x);
+}
+
+/* grey to RGBA8888, the colour key compared a byte at a time. 16 pixels a block */
+static void convert_grey8_sse2(const upng_pixel_converter* converter, uint8_t* dst, 
+    const uint8_t* src, uint32_t width) {
+	const __m128i key = _mm_set1_epi8((char)converter->key[0]);
+	const __m128i opaque = _mm_set1_epi8((char)0xFF);
+	uint32_t x = 0;
+
+	for (; x + 16 <= width; x += 16) {
+		__m128i grey = _mm_loadu_si128((const __m128i*)(src + x));
+		__m128i alpha = opaque;
+		if (converter->has_key) {
+			alpha = _mm_andnot_si128(_mm_cmpeq_epi8(grey, key), opaque);
+		}
+		convert_store_planes(dst + x * 4, grey, grey, grey, alpha);
+	}
+	convert_row_scalar(converter, dst + x * 4, src + x, width - x);
+}
+
+/* grey and alpha to RGBA8888: each 16-bit grey, alpha pair becomes grey, grey 
+ * followed by the pair itself. 8 pixels a block */
+static void convert_grey_alpha8_sse2(const upng_pixel_converter* converter, uint8_t* dst, 
+    const uint8_t* src, uint32_t width) {
+	const __m128i low = _mm_set1_epi16(0xFF);
+	uint32_t x = 0;
+
+	for (; x + 8 <= width; x += 8) {
+		__m128i in = _mm_loadu_si128((const __m128i*)(src + x * 2));
+		__m128i grey = _mm_and_si128(in, low);
+		grey = _mm_or_si128(grey, _mm_slli_epi16(grey, 8));
+		_mm_storeu_si128((__m128i*)(dst + x * 4), _mm_unpacklo_epi16(grey, in));
+		_mm_storeu_si128((__m128i*)(dst + x * 4 + 16), _mm_unpackhi_epi16(grey, in));
+	}
+	convert_row_scalar(converter, dst + x * 4, src + x * 2, width - x);
+}
+
+/* RGB to RGBA8888 by inserting an alpha byte with pshufb; a pixel equal to the 
+ * colour key gets alpha 0. 4 pixels from 12 of the 16 bytes loaded a block */
+static CONVERT_TARGET_ssse3 void convert_rgb8_ssse3(const upng_pixel_converter* converter, 
+    uint8_t* dst, const uint8_t* src, uint32_t width) {
+	const __m128i insert = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+	const __m128i opaque = _mm_set1_epi32((int)0xFF000000);
+	const __m128i key = _mm_set1_epi32((int)((uint32_t)converter->key[0] | 
+	    ((uint32_t)converter->key[1] << 8) | ((uint32_t)converter->key[2] << 16)));
+	uint32_t x = 0;
+
+	for (; x * 3 + 16 <= width * 3; x += 4) {
+		__m128i rgb = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + x * 3)), insert);
+		__m128i alpha = opaque;
+		if (converter->has_key) {
+			alpha = _mm_andnot_si128(_mm_cmpeq_epi32(rgb, key), opaque);
+		}
+		_mm_storeu_si128((__m128i*)(dst + x * 4), _mm_or_si128(rgb, alpha));
+	}
+	convert_row_scalar(converter, dst + x * 4, src + x * 3, width - x);
+}
+
+/* 16-bit RGB without a colour key to RGBA8888, the most significant bytes picked 
+ * out of two overlapping loads. 4 pixels from 24 bytes a block */
+static CONVERT_TARGET_ssse3 void convert_rgb16_ssse3(const upng_pixel_converter* converter, 
+    uint8_t* dst, const uint8_t* src, uint32_t width) {
+	const __m128i first = _mm_setr_epi8(0, 2, 4, -1, 6, 8, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i second = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, 4, 6, 8, -1, 10, 12, 14, -1);
+	const __m128i opaque = _mm_set1_epi32((int)0xFF000000);
+	uint32_t x = 0;
+
+	for (; x + 4 <= width; x += 4) {
+		__m128i lo = _mm_loadu_si128((const __m128i*)(src + x * 6));
+		__m128i hi = _mm_loadu_si128((const __m128i*)(src + x * 6 + 8));
+		__m128i rgb = _mm_or_si128(_mm_shuffle_epi8(lo, first), _mm_shuffle_epi8(hi, second));
+		_mm_storeu_si128((__m128i*)(dst + x * 4), _mm_or_si128(rgb, opaque));
+	}
+	convert_row_scalar(converter, dst + x * 4, src + x * 6, width - x);
+}
+
+/* 16-bit RGBA to RGBA8888: the most significant byte is the low one of each 
+ * 16-bit lane, two registers pack to one. 4 pixels a block */
+static void convert_rgba16_sse2(const upng_pixel_converter* converter, uint8_t* dst, 
+    const uint8_t* src, uint32_t width) {
+	const __m128i low = _mm_set1_epi16(0xFF);
+	uint32_t x = 0;
+
+	for (; x + 4 <= width; x += 4) {
+		__m128i lo = _mm_and_si128(_mm_loadu_si128((const __m128i*)(src + x * 8)), low);
+		__m128i hi = _mm_and_si128(_mm_loadu_si128((const __m128i*)(src + x * 8 + 16)), low);
+		_mm_storeu_si128((__m128i*)(dst + x * 4), _mm_packus_epi16(lo, hi));
+	}
+	convert_row_scalar(converter, dst + x * 4, src + x * 8, width - x);
+}
+
+#define CONVERT_CPU_KNOWN	1
+#define CONVERT_CPU_SSSE3	2
+#define CONVERT_CPU_AVX2	4
+
+/* the CPU features the kernels use, looked up on first use */
+static uint32_t convert_cpu_features(void) {
+	/* racing first calls find the same bits, so a plain atomic store is enough */
+	static uint32_t features = 0;
+	uint32_t bits = __atomic_load_n(&features, __ATOMIC_ACQUIRE);
+	if (bits == 0) {
+		__builtin_cpu_init();
+		bits = CONVERT_CPU_KNOWN;
+		if (__builtin_cpu_supports("ssse3"))
+			bits |= CONVERT_CPU_SSSE3;
+		if (__builtin_cpu_supports("avx2"))
+			bits |= CONVERT_CPU_AVX2;
+		__atomic_store_n(&features, bits, __ATOMIC_RELEASE);
+	}
+	return bits;
+}
+
+static upng_convert_fn convert_select(const upng_pixel_converter* converter) {
+	uint32_t depth = convert_table_depth(converter->format);
+	bool rgba = converter->target == UPNG_PIXEL_RGBA8888 && !converter->premultiplied;
+	uint32_t features = convert_cpu_features();
+	bool ssse3 = (features & CONVERT_CPU_SSSE3) != 0;
+	bool avx2 = (features & CONVERT_CPU_AVX2) != 0;
+
+	if (converter->target == UPNG_PIXEL_INDEX8) {
+		return depth > 0 && depth < 8 && ssse3 ? convert_unpack_ssse3 : convert_unpack_row;
+	}
+
+	/* the tables hold finished pixels, any 32-bit target and premultiplied alpha work */
+	if (upng_pixel_format_bytes(converter->target) == 4) {
+		if (depth > 0 && depth < 8 && ssse3) {
+			return convert_sub_byte_ssse3;
+		}
+		if (converter->format == UPNG_LUMINANCE8 && rgba) {
+			return convert_grey8_sse2;
+		}
+		if (depth == 8 && avx2) {
+			return convert_table8_avx2;
+		}
+	}
+	if (!rgba) {
+		return convert_row_scalar;
+	}
+
+	switch (converter->format) {
+	case UPNG_LUMINANCE_ALPHA8:
+		return convert_grey_alpha8_sse2;
+	case UPNG_RGB8:
+		return ssse3 ? convert_rgb8_ssse3 : convert_row_scalar;
+	case UPNG_RGB16:
+		return ssse3 && !converter->has_key ? convert_rgb16_ssse3 : convert_row_scalar;
+	case UPNG_RGBA16:
+		return convert_rgba16_sse2;
+	default:
+		return convert_row_scalar;
+	}
+}
+
+#else
+
+static upng_convert_fn convert_select(const upng_pixel_converter* converter) {
+	return converter->target == UPNG_PIXEL_INDEX8 ? convert_unpack_row : convert_row_scalar;
+}
+
+#endif /*defined(UPNG_X86_SIMD)*/
+
+bool upng_pixel_converter_init(upng_pixel_converter* converter, const upng_t* upng,
+    upng_pixel_format target, bool premultiplied) {
+	upng_format format = upng_get_format(upng);
+	rgb* palette = NULL;
+	uint8_t* alpha = NULL;
+	int32_t entries = upng_get_palette(upng, &palette);
+	int32_t alpha_entries = upng_get_alpha_palette(upng, &alpha);
+
+	converter->format = format;
+	converter->target = target;
+	converter->premultiplied = premultiplied;
+	converter->has_key = false;
+	converter->convert = NULL;
+
+	/* the samples themselves, for palette and grey images only */
+	if (target == UPNG_PIXEL_INDEX8) {
+		if (convert_table_depth(format) == 0) {
+			return false;
+		}
+		converter->convert = convert_select(converter);
+		return true;
+	}
+
+	switch (format) {
+	case UPNG_INDEXED1:
+	case UPNG_INDEXED2:
+	case UPNG_INDEXED4:
+	case UPNG_INDEXED8:
+		/* indices past the palette are transparent black */
+		for (int32_t i = 0; i < 256; i++) {
+			converter->table[i] = i < entries ? convert_pack(target, premultiplied,
+          palette[i].r, palette[i].g, palette[i].b, i < alpha_entries ? alpha[i] : 0xFF) :
+          convert_pack(target, premultiplied, 0, 0, 0, 0);
+		}
+		break;
+	case UPNG_LUMINANCE1:
+	case UPNG_LUMINANCE2:
+	case UPNG_LUMINANCE4:
+	case UPNG_LUMINANCE8: {
+		uint32_t max = (1u << upng_get_bitdepth(upng)) - 1;
+		/* the colour key is a 16-bit sample, most significant byte first */
+		uint32_t key = alpha_entries >= 2 ? (uint32_t)((alpha[0] << 8) | alpha[1]) : UINT32_MAX;
+
+		for (uint32_t i = 0; i <= max; i++) {
+			uint32_t grey = i * 255 / max;
+			converter->table[i] = convert_pack(target, premultiplied, grey, grey, grey,
+          i == key ? 0 : 0xFF);
+		}
+		/* the vector grey kernel compares samples itself */
+		converter->has_key = key <= max;
+		converter->key[0] = (uint16_t)(key <= max ? key : 0);
+		break;
+	}
+	case UPNG_RGB8:
+	case UPNG_RGB16:
+		if (alpha_entries >= 6) {
+			converter->has_key = true;
+			for (uint32_t i = 0; i < 3; i++) {
+				converter->key[i] = (uint16_t)((alpha[i * 2] << 8) | alpha[i * 2 + 1]);
+			}
+			/* an 8-bit key out of range matches nothing */
+			if (format == UPNG_RGB8 && (converter->key[0] > 0xFF || converter->key[1] > 0xFF || 
+          converter->key[2] > 0xFF)) {
+				converter->has_key = false;
+			}
+		}
+		break;
+	case UPNG_RGBA8:
+	case UPNG_RGBA16:
+	case UPNG_LUMINANCE_ALPHA8:
+		break;
+	default:
+		return false;
+	}
+
+	/* byte planes of the first 16 pixels of the table, for lookups with pshufb */
+	if (upng_pixel_format_bytes(target) == 4) {
+		for (uint32_t i = 0; i < 16; i++) {
+			uint8_t bytes[4];
+			memcpy(bytes, &converter->table[i], 4);
+			for (uint32_t k = 0; k < 4; k++) {
+				converter->planes[k][i] = bytes[k];
+			}
+		}
+	}
+
+	converter->convert = convert_select(converter);
+	return true;
+}
+
+void upng_convert_row(const upng_pixel_converter* converter, uint8_t* dst,
+    const uint8_t* src, uint32_t width) {
+	converter->convert(converter, dst, src, width);
+}
+
+void upng_convert_row_reference(const upng_pixel_converter* converter, uint8_t* dst,
+    const uint8_t* src, uint32_t width) {
+	if (converter->target == UPNG_PIXEL_INDEX8) {
+		convert_unpack_row(converter, dst, src, width);
+	} else {
+		convert_row_scalar(converter, dst, src, width);
+	}
+}
@@ -0,0 +1,411 @@
+/*
+uPNG -- derived from LodePNG version 20100808
+
+Copyright (c) 2005-2010 Lode Vandevenne
+Copyright (c) 2010 Sean Middleditch
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+		1. The origin of this software must not be misrepresented; you must not
+		claim that you wrote the original software. If you use this software
+		in a product, an acknowledgment in the product documentation would be
+		appreciated but is not required.
+
+		2. Altered source versions must be plainly marked as such, and must not be
+		misrepresented as being the original software.
+
+		3. This notice may not be removed or altered from any source
+		distribution.
+*/
+
+/* unfilter kernels for PNG filter types 1-4 (Sub, Up, Average, Paeth),
+ * specialised per bytewidth, with SSE2/SSSE3/AVX2 versions picked at runtime
+ * on x86-64 */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "upng_internal.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define UPNG_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+/* generic loops; every kernel passes a constant bpp so the compiler can
+ * specialise them */
+
+static inline void unfilter_sub_scalar(uint8_t* recon, const uint8_t* scanline,
+    const uint8_t* precon, uint32_t length, uint32_t bpp) {
+	uint32_t i;
+	(void)precon;
+	for (i = 0; i < bpp; i++)
+		recon[i] = scanline[i];
+	for (i = bpp; i < length; i++)
+		recon[i] = scanline[i] + recon[i - bpp];
+}
+
+static inline void unfilter_up_scalar(uint8_t* recon, const uint8_t* scanline,
+    const uint8_t* precon, uint32_t length, uint32_t bpp) {
+	uint32_t i;
+	(void)bpp;
+	for (i = 0; i < length; i++)
+		recon[i] = scanline[i] + precon[i];
+}
+
+static inline void unfilter_avg_scalar(uint8_t* recon, const uint8_t* scanline,
+    const uint8_t* precon, uint32_t length, uint32_t bpp) {
+	uint32_t i;
+	for (i = 0; i < bpp; i++)
+		recon[i] = scanline[i] + precon[i] / 2;
+	for (i = bpp; i < length; i++)
+		recon[i] = scanline[i] + ((recon[i - bpp] + precon[i]) / 2);
+}
+
+/* same choice as paeth_predictor in upng.c, without branches: p - a, p - b
+ * and p - c reduce to b - c, a - c and their sum */
+static inline uint8_t paeth_select(int32_t a, int32_t b, int32_t c) {
+	int32_t pa = abs(b - c);
+	int32_t pb = abs(a - c);
+	int32_t pc = abs(a + b - 2 * c);
+	int32_t nearest = pb <= pc ? b : c;
+	return (uint8_t)(pa <= pb && pa <= pc ? a : nearest);
+}
+
+static inline void unfilter_paeth_scalar(uint8_t* recon, const uint8_t* scanline,
+    const uint8_t* precon, uint32_t length, uint32_t bpp) {
+	uint32_t i;
+	for (i = 0; i < bpp; i++)
+		recon[i] = scanline[i] + precon[i];
+	for (i = bpp; i < length; i++)
+		recon[i] = scanline[i] + paeth_select(recon[i - bpp], precon[i], precon[i - bpp]);
+}
+
+#define UNFILTER_TARGET_scalar
+#define UNFILTER_TARGET_sse2
+#define UNFILTER_TARGET_ssse3 __attribute__((target("ssse3")))
+#define UNFILTER_TARGET_avx2 __attribute__((target("avx2")))
+
+/* defines unfilter_<filter><bpp>_<isa> as an upng_unfilter_fn */
+#define UNFILTER_KERNEL(filter, bpp, isa) \
+	static UNFILTER_TARGET_##isa void unfilter_##filter##bpp##_##isa(uint8_t* recon, \
+	    const uint8_t* scanline, const uint8_t* precon, uint32_t length) { \
+		unfilter_##filter##_##isa(recon, scanline, precon, length, bpp); \
+	}
+
+#define UNFILTER_KERNELS_MULTIBYTE(filter, isa) \
+	UNFILTER_KERNEL(filter, 2, isa) UNFILTER_KERNEL(filter, 3, isa) \
+	UNFILTER_KERNEL(filter, 4, isa) UNFILTER_KERNEL(filter, 6, isa) \
+	UNFILTER_KERNEL(filter, 8, isa)
+
+#define UNFILTER_KERNELS_PER_BYTEWIDTH(filter, isa) \
+	UNFILTER_KERNEL(filter, 1, isa) UNFILTER_KERNELS_MULTIBYTE(filter, isa)
+
+/* table row for one bytewidth, in filter type order */
+#define UNFILTER_ROW(bpp, sub, up, avg, paeth) \
+	[bpp] = { unfilter_sub##bpp##_##sub, unfilter_up##bpp##_##up, \
+	    unfilter_avg##bpp##_##avg, unfilter_paeth##bpp##_##paeth }
+
+/* the plain loops for every bytewidth, the reference the others are tested
+ * against and the kernels of CPUs without vector units */
+UNFILTER_KERNELS_PER_BYTEWIDTH(sub, scalar)
+UNFILTER_KERNELS_PER_BYTEWIDTH(up, scalar)
+UNFILTER_KERNELS_PER_BYTEWIDTH(avg, scalar)
+UNFILTER_KERNELS_PER_BYTEWIDTH(paeth, scalar)
+
+static const upng_unfilter_kernels unfilter_kernels_scalar = {
+	UNFILTER_ROW(1, scalar, scalar, scalar, scalar),
+	UNFILTER_ROW(2, scalar, scalar, scalar, scalar),
+	UNFILTER_ROW(3, scalar, scalar, scalar, scalar),
+	UNFILTER_ROW(4, scalar, scalar, scalar, scalar),
+	UNFILTER_ROW(6, scalar, scalar, scalar, scalar),
+	UNFILTER_ROW(8, scalar, scalar, scalar, scalar),
+};
+
+const upng_unfilter_kernels* upng_get_unfilter_kernels_scalar(void) {
+	return &unfilter_kernels_scalar;
+}
+
+#if defined(UPNG_X86_SIMD)
+
+/* Average and Paeth depend on the previous pixel, so beyond Up and the Sub
+ * prefix sum the vector kernels work one pixel per iteration, with the pixel
+ * in the low bytes of a register.
+ *
+ * A 3 or 6 byte pixel is moved with a 4 or 8 byte access while that much of
+ * the row is left; the extra bytes written belong to the next pixel and are
+ * overwritten by the next iteration. recon therefore must not overlap
+ * scanline or precon. */
+
+static inline uint32_t pixel_access_width(uint32_t bpp) {
+	return bpp == 3 ? 4 : bpp == 6 ? 8 : bpp;
+}
+
+static inline __m128i load_pixel(const uint8_t* p, uint32_t n) {
+	uint64_t v = 0;
+	memcpy(&v, p, n);
+	return _mm_cvtsi64_si128((int64_t)v);
+}
+
+static inline void store_pixel(uint8_t* p, __m128i x, uint32_t n) {
+	uint64_t v = (uint64_t)_mm_cvtsi128_si64(x);
+	memcpy(p, &v, n);
+}
+
+/* shift left by whole pixels; bytes is a constant so the switch folds away */
+static inline __m128i shift_bytes_left(__m128i x, uint32_t bytes) {
+	switch (bytes) {
+	case 1: return _mm_slli_si128(x, 1);
+	case 2: return _mm_slli_si128(x, 2);
+	case 4: return _mm_slli_si128(x, 4);
+	case 8: return _mm_slli_si128(x, 8);
+	default: return _mm_setzero_si128();
+	}
+}
+
+/* copies the last pixel of x into every pixel */
+static inline __m128i broadcast_last_pixel(__m128i x, uint32_t bpp) {
+	switch (bpp) {
+	case 1: x = _mm_unpackhi_epi8(x, x); /* fall through */
+	case 2: x = _mm_shufflehi_epi16(x, 0xFF); /* fall through */
+	case 4: return _mm_shuffle_epi32(x, 0xFF);
+	default: return _mm_unpackhi_epi64(x, x);
+	}
+}
+
+static inline void unfilter_sub_sse2(uint8_t* recon, const uint8_t* scanline,
+    const uint8_t* precon, uint32_t length, uint32_t bpp) {
+	uint32_t i = 0;
+	(void)precon;
+
+	if (bpp == 3 || bpp == 6) {
+		uint32_t wide = pixel_access_width(bpp);
+		__m128i a = _mm_setzero_si128();
+		for (; i + wide <= length; i += bpp) {
+			a = _mm_add_epi8(a, load_pixel(scanline + i, wide));
+			store_pixel(recon + i, a, wide);
+		}
+		for (; i < length; i += bpp) {
+			a = _mm_add_epi8(a, load_pixel(scanline + i, bpp));
+			store_pixel(recon + i, a, bpp);
+		}
+		return;
+	}
+
+	/* 16 bytes hold a whole number of pixels: prefix sum them in log steps,
+	 * then add the last pixel of the previous block */
+	__m128i carry = _mm_setzero_si128();
+	for (; i + 16 <= length; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i*)(scanline + i));
+		uint32_t step;
+		for (step = bpp; step < 16; step *= 2)
+			x = _mm_add_epi8(x, shift_bytes_left(x, step));
+		x = _mm_add_epi8(x, carry);
+		_mm_storeu_si128((__m128i*)(recon + i), x);
+		carry = broadcast_last_pixel(x, bpp);
+	}
+	for (; i < length; i++)
+		recon[i] = scanline[i] + (i >= bpp ? recon[i - bpp] : 0);
+}
+
+static inline void unfilter_up_sse2(uint8_t* recon, const uint8_t* scanline,
+    const uint8_t* precon, uint32_t length, uint32_t bpp) {
+	uint32_t i;
+	(void)bpp;
+	for (i = 0; i + 16 <= length; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i*)(scanline + i));
+		__m128i b = _mm_loadu_si128((const __m128i*)(precon + i));
+		_mm_storeu_si128((__m128i*)(recon + i), _mm_add_epi8(x, b));
+	}
+	for (; i < length; i++)
+		recon[i] = scanline[i] + precon[i];
+}
+
+static inline UNFILTER_TARGET_avx2 void unfilter_up_avx2(uint8_t* recon,
+    const uint8_t* scanline, const uint8_t* precon, uint32_t length, uint32_t bpp) {
+	uint32_t i;
+	for (i = 0; i + 32 <= length; i += 32) {
+		__m256i x = _mm256_loadu_si256((const __m256i*)(scanline + i));
+		__m256i b = _mm256_loadu_si256((const __m256i*)(precon + i));
+		_mm256_storeu_si256((__m256i*)(recon + i), _mm256_add_epi8(x, b));
+	}
+	unfilter_up_sse2(recon + i, scanline + i, precon + i, length - i, bpp);
+}
+
+/* (a + b) >> 1 per byte; pavgb rounds up, so take back the carried low bit */
+static inline __m128i average_floor(__m128i a, __m128i b) {
+	__m128i rounding = _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1));
+	return _mm_sub_epi8(_mm_avg_epu8(a, b), rounding);
+}
+
+static inline void unfilter_avg_sse2(uint8_t* recon, const uint8_t* scanline,
+    const uint8_t* precon, uint32_t length, uint32_t bpp) {
+	uint32_t wide = pixel_access_width(bpp);
+	__m128i a = _mm_setzero_si128();
+	uint32_t i = 0;
+
+	for (; i + wide <= length; i += bpp) {
+		__m128i b = load_pixel(precon + i, wide);
+		a = _mm_add_epi8(load_pixel(scanline + i, wide), average_floor(a, b));
+		store_pixel(recon + i, a, wide);
+	}
+	for (; i < length; i += bpp) {
+		__m128i b = load_pixel(precon + i, bpp);
+		a = _mm_add_epi8(load_pixel(scanline + i, bpp), average_floor(a, b));
+		store_pixel(recon + i, a, bpp);
+	}
+}
+
+static inline __m128i if_then_else(__m128i mask, __m128i t, __m128i f) {
+	return _mm_or_si128(_mm_and_si128(mask, t), _mm_andnot_si128(mask, f));
+}
+
+static inline __m128i abs_epi16_sse2(__m128i x) {
+	return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+}
+
+static inline UNFILTER_TARGET_ssse3 __m128i abs_epi16_ssse3(__m128i x) {
+	return _mm_abs_epi16(x);
+}
+
+/* Paeth on a, b and c widened to 16 bits, same tie order as the scalar
+ * predictor: a, then b, then c */
+#define UNFILTER_PAETH_VECTOR(isa) \
+	static inline UNFILTER_TARGET_##isa __m128i paeth_pixel_##isa(__m128i a, \
+	    __m128i b, __m128i c) { \
+		__m128i pa_signed = _mm_sub_epi16(b, c); \
+		__m128i pb_signed = _mm_sub_epi16(a, c); \
+		__m128i pa = abs_epi16_##isa(pa_signed); \
+		__m128i pb = abs_epi16_##isa(pb_signed); \
+		__m128i pc = abs_epi16_##isa(_mm_add_epi16(pa_signed, pb_signed)); \
+		__m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb)); \
+		__m128i nearest = if_then_else(_mm_cmpeq_epi16(smallest, pc), c, b); \
+		nearest = if_then_else(_mm_cmpeq_epi16(smallest, pb), b, nearest); \
+		return if_then_else(_mm_cmpeq_epi16(smallest, pa), a, nearest); \
+	} \
+	\
+	static inline UNFILTER_TARGET_##isa void unfilter_paeth_##isa(uint8_t* recon, \
+	    const uint8_t* scanline, const uint8_t* precon, uint32_t length, uint32_t bpp) { \
+		uint32_t wide = pixel_access_width(bpp); \
+		__m128i zero = _mm_setzero_si128(); \
+		__m128i a = zero; \
+		__m128i c = zero; \
+		uint32_t i = 0; \
+		\
+		for (; i + wide <= length; i += bpp) { \
+			__m128i b = _mm_unpacklo_epi8(load_pixel(precon + i, wide), zero); \
+			__m128i nearest = paeth_pixel_##isa(a, b, c); \
+			__m128i x = _mm_add_epi8(load_pixel(scanline + i, wide), \
+			    _mm_packus_epi16(nearest, nearest)); \
+			store_pixel(recon + i, x, wide); \
+			a = _mm_unpacklo_epi8(x, zero); \
+			c = b; \
+		} \
+		for (; i < length; i += bpp) { \
+			__m128i b = _mm_unpacklo_epi8(load_pixel(precon + i, bpp), zero); \
+			__m128i nearest = paeth_pixel_##isa(a, b, c); \
+			__m128i x = _mm_add_epi8(load_pixel(scanline + i, bpp), \
+			    _mm_packus_epi16(nearest, nearest)); \
+			store_pixel(recon + i, x, bpp); \
+			a = _mm_unpacklo_epi8(x, zero); \
+			c = b; \
+		} \
+	}
+
+UNFILTER_PAETH_VECTOR(sse2)
+UNFILTER_PAETH_VECTOR(ssse3)
+
+UNFILTER_KERNELS_PER_BYTEWIDTH(sub, sse2)
+UNFILTER_KERNELS_PER_BYTEWIDTH(up, sse2)
+UNFILTER_KERNELS_MULTIBYTE(avg, sse2)
+UNFILTER_KERNELS_MULTIBYTE(paeth, sse2)
+UNFILTER_KERNELS_MULTIBYTE(paeth, ssse3)
+UNFILTER_KERNELS_PER_BYTEWIDTH(up, avx2)
+
+/* one byte per pixel leaves nothing to vectorise in Average and Paeth, so
+ * those stay scalar */
+static const upng_unfilter_kernels unfilter_kernels_sse2 = {
+	UNFILTER_ROW(1, sse2, sse2, scalar, scalar),
+	UNFILTER_ROW(2, sse2, sse2, sse2, sse2),
+	UNFILTER_ROW(3, sse2, sse2, sse2, sse2),
+	UNFILTER_ROW(4, sse2, sse2, sse2, sse2),
+	UNFILTER_ROW(6, sse2, sse2, sse2, sse2),
+	UNFILTER_ROW(8, sse2, sse2, sse2, sse2),
+};
+
+static const upng_unfilter_kernels unfilter_kernels_ssse3 = {
+	UNFILTER_ROW(1, sse2, sse2, scalar, scalar),
+	UNFILTER_ROW(2, sse2, sse2, sse2, ssse3),
+	UNFILTER_ROW(3, sse2, sse2, sse2, ssse3),
+	UNFILTER_ROW(4, sse2, sse2, sse2, ssse3),
+	UNFILTER_ROW(6, sse2, sse2, sse2, ssse3),
+	UNFILTER_ROW(8, sse2, sse2, sse2, ssse3),
+};
+
+static const upng_unfilter_kernels unfilter_kernels_avx2 = {
+	UNFILTER_ROW(1, sse2, avx2, scalar, scalar),
+	UNFILTER_ROW(2, sse2, avx2, sse2, ssse3),
+	UNFILTER_ROW(3, sse2, avx2, sse2, ssse3),
+	UNFILTER_ROW(4, sse2, avx2, sse2, ssse3),
+	UNFILTER_ROW(6, sse2, avx2, sse2, ssse3),
+	UNFILTER_ROW(8, sse2, avx2, sse2, ssse3),
+};
+
+static const upng_unfilter_kernels* select_unfilter_kernels(void) {
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return &unfilter_kernels_avx2;
+	if (__builtin_cpu_supports("ssse3"))
+		return &unfilter_kernels_ssse3;
+	return &unfilter_kernels_sse2;
+}
+
+const upng_unfilter_kernels* upng_get_unfilter_kernels(void) {
+	/* racing first calls pick the same table, so a plain atomic store is enough */
+	static const upng_unfilter_kernels* selected = NULL;
+	const upng_unfilter_kernels* kernels = __atomic_load_n(&selected, __ATOMIC_ACQUIRE);
+	if (kernels == NULL) {
+		kernels = select_unfilter_kernels();
+		__atomic_store_n(&selected, kernels, __ATOMIC_RELEASE);
+	}
+	return kernels;
+}
+
+uint32_t upng_list_unfilter_kernels(const upng_unfilter_kernels* tables[UPNG_MAX_UNFILTER_TABLES],
+    const char* names[UPNG_MAX_UNFILTER_TABLES]) {
+	uint32_t count = 0;
+	__builtin_cpu_init();
+	tables[count] = &unfilter_kernels_sse2;
+	names[count++] = "SSE2";
+	if (__builtin_cpu_supports("ssse3")) {
+		tables[count] = &unfilter_kernels_ssse3;
+		names[count++] = "SSSE3";
+	}
+	if (__builtin_cpu_supports("avx2")) {
+		tables[count] = &unfilter_kernels_avx2;
+		names[count++] = "AVX2";
+	}
+	return count;
+}
+
+#else
+
+const upng_unfilter_kernels* upng_get_unfilter_kernels(void) {
+	return &unfilter_kernels_scalar;
+}
+
+uint32_t upng_list_unfilter_kernels(const upng_unfilter_kernels* tables[UPNG_MAX_UNFILTER_TABLES],
+    const char* names[UPNG_MAX_UNFILTER_TABLES]) {
+	tables[0] = &unfilter_kernels_scalar;
+	names[0] = "scalar";
+	return 1;
+}
+
+#endif /*defined(UPNG_X86_SIMD)*/
@@ -0,0 +1,122 @@
+/*
+uPNG -- derived from LodePNG version 20100808
+
+Copyright (c) 2005-2010 Lode Vandevenne
+Copyright (c) 2010 Sean Middleditch
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+		1. The origin of this software must not be misrepresented; you must not
+		claim that you wrote the original software. If you use this software
+		in a product, an acknowledgment in the product documentation would be
+		appreciated but is not required.
+
+		2. Altered source versions must be plainly marked as such, and must not be
+		misrepresented as being the original software.
+
+		3. This notice may not be removed or altered from any source
+		distribution.
+*/
+
+/* declarations shared between the uPNG source files; not part of the API */
+
+#if !defined(UPNG_INTERNAL_H)
+#define UPNG_INTERNAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "upng.h"
+
+/* largest number of bytes per complete pixel (16-bit RGBA) */
+#define UPNG_MAX_BYTEWIDTH 8
+
+/* reconstructs one scanline of filter type 1-4. recon and scanline are
+ * length bytes, precon is the previous reconstructed scanline and is only
+ * read by Up, Average and Paeth */
+typedef void (*upng_unfilter_fn)(uint8_t* recon, const uint8_t* scanline,
+    const uint8_t* precon, uint32_t length);
+
+/* unfilter kernels indexed by bytewidth and filter type - 1, picked for the
+ * running CPU on first use. Entries for bytewidths a PNG can not have are
+ * NULL */
+typedef upng_unfilter_fn upng_unfilter_kernels[UPNG_MAX_BYTEWIDTH + 1][4];
+
+const upng_unfilter_kernels* upng_get_unfilter_kernels(void);
+
+/* the plain C kernels of every bytewidth, and the tables of every instruction
+ * set the running CPU has, for the tests to compare. Returns how many tables
+ * were listed */
+#define UPNG_MAX_UNFILTER_TABLES 3
+
+const upng_unfilter_kernels* upng_get_unfilter_kernels_scalar(void);
+uint32_t upng_list_unfilter_kernels(const upng_unfilter_kernels* tables[UPNG_MAX_UNFILTER_TABLES],
+    const char* names[UPNG_MAX_UNFILTER_TABLES]);
+
+/* turns unfiltered scanlines of one image into a pixel format of 
+ * upng_set_output_pixels (upng_convert.c) */
+typedef struct upng_pixel_converter upng_pixel_converter;
+
+typedef void (*upng_convert_fn)(const upng_pixel_converter* converter, uint8_t* dst,
+    const uint8_t* src, uint32_t width);
+
+struct upng_pixel_converter {
+	upng_format	format;	/* of the scanlines */
+	upng_pixel_format	target;
+	bool	premultiplied;
+	bool	has_key;	/* tRNS of a grey or truecolour image */
+	uint16_t	key[3];	/* that colour, as 16-bit samples */
+	uint32_t	table[256];	/* finished pixels by palette index or grey level */
+	uint8_t	planes[4][16];	/* bytes 0-3 of the first 16 table pixels, for 32-bit targets */
+	upng_convert_fn	convert;	/* kernel for the format, target and CPU */
+};
+
+/* bytes of a pixel in target, 0 for an unknown format */
+uint32_t upng_pixel_format_bytes(upng_pixel_format target);
+
+/* sets converter up for the format and palette upng_load read, false for a 
+ * format it can not convert */
+bool upng_pixel_converter_init(upng_pixel_converter* converter, const upng_t* upng,
+    upng_pixel_format target, bool premultiplied);
+
+/* converts width pixels of an unfiltered scanline, dst gets width pixels of target */
+void upng_convert_row(const upng_pixel_converter* converter, uint8_t* dst,
+    const uint8_t* src, uint32_t width);
+
+/* the same in plain C whatever kernel converter picked, which every kernel has to 
+ * match; for the tests and benchmarks */
+void upng_convert_row_reference(const upng_pixel_converter* converter, uint8_t* dst,
+    const uint8_t* src, uint32_t width);
+
+/* APNG_BLEND_OP_OVER of width straight alpha RGBA pixels of src onto the
+ * canvas row dst (upng_compositor.c) */
+typedef void (*upng_blend_fn)(uint8_t* dst, const uint8_t* src, uint32_t width);
+
+/* the plain C blend, which the vector kernels have to match exactly, and the
+ * kernels of every instruction set the running CPU has; for the tests. Returns
+ * how many kernels were listed */
+#define UPNG_MAX_BLEND_KERNELS 2
+
+void upng_blend_over_reference(uint8_t* dst, const uint8_t* src, uint32_t width);
+uint32_t upng_list_blend_kernels(upng_blend_fn kernels[UPNG_MAX_BLEND_KERNELS],
+    const char* names[UPNG_MAX_BLEND_KERNELS]);
+
+/* zlib style running checksums: start from 0 (CRC-32) or 1 (Adler-32) and
+ * pass the previous result to continue over more data */
+uint32_t upng_crc32(uint32_t crc, const uint8_t* data, size_t len);
+uint32_t upng_adler32(uint32_t adler, const uint8_t* data, size_t len);
+
+#if defined(UPNG_MAKE_FIXED_TABLES)
+#include <stdio.h>
+
+/* prints upng_fixed_tables.h */
+void upng_make_fixed_tables(FILE* out);
+#endif
+
+#endif /*defined(UPNG_INTERNAL_H)*/